@@ -8,17 +8,33 @@ enum	E_CONF_TOKEN {
 	CONF_EMPTY_TOKEN = 0,
 	CONF_NOT_FOUND_TOKEN,
 	CONF_ERRORENOUS_TOKEN,
+	CONF_MAIN_WORKER_PROCESSES,
+	CONF_MAIN_WORKER_CPU_AFFINITY,
+	CONF_MAIN_WORKER_INCOMING_CPU,
 	CONF_SERVER_NAME,
 	CONF_SERVER_LISTEN,
 	CONF_SERVER_OPENING,
 	CONF_SERVER_LOCATION,
 	CONF_BLOCK_CGI,
+	CONF_BLOCK_CGI_WORKERS,
+	CONF_BLOCK_CGI_CACHE,
+	CONF_BLOCK_CGI_LIMIT,
+	CONF_BLOCK_CGI_TIMEOUT,
+	CONF_BLOCK_DISK_CACHE,
+	CONF_BLOCK_FASTCGI_PASS,
 	CONF_BLOCK_ROOT,
 	CONF_BLOCK_INDEX,
+	CONF_BLOCK_INTERNAL,
+	CONF_BLOCK_PROXY_PASS,
+	CONF_BLOCK_PROXY_BALANCE,
 	CONF_BLOCK_CLOSING,
 	CONF_BLOCK_AUTOINDEX,
 	CONF_BLOCK_REDIRECT,
 	CONF_BLOCK_ERROR_PAGE,
+	CONF_BLOCK_GZIP,
+	CONF_BLOCK_GZIP_TYPES,
+	CONF_BLOCK_GZIP_MIN_LENGTH,
+	CONF_BLOCK_GZIP_COMP_LEVEL,
 	CONF_BLOCK_BODY_LIMIT,
 	CONF_BLOCK_UPLOAD_PASS,
 	CONF_BLOCK_ALLOWED_METHODS,
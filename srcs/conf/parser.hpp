@@ -11,13 +11,17 @@
 #ifndef CONF_PARSER_HPP_
 #define CONF_PARSER_HPP_
 
+#include <sched.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 
+#include <map>
 #include <string>
 #include <vector>
+#include <utility>
 #include <fstream>
+#include <algorithm>
 #include <sstream>
 #include <iostream>
 
@@ -37,13 +41,30 @@ class Parser {
 
 	typedef std::vector<IServer *> IServerList;
 
+	/*
+		Worker processes of the master/worker mode, none runs a single
+		process. affinity holds the CPUs of worker i at i (the last one for
+		the workers past it), auto_affinity pins worker i to the CPU i.
+	*/
+	struct Processes {
+		size_t					workers;
+		bool					auto_affinity;
+		std::vector<cpu_set_t>	affinity;
+		bool					incoming_cpu;
+	};
+
  private:
 	std::vector<IServer *>	_servers;
+	Processes				_processes;
 	std::string _conf_file_path;
 	std::string	_conf_file;
 
  public:
-	Parser() : _conf_file_path("") {}
+	Parser() : _conf_file_path("") {
+		_processes.workers = 0;
+		_processes.auto_affinity = false;
+		_processes.incoming_cpu = false;
+	}
 	~Parser() { clear(); }
 
 	bool	run(int ac, char **av) {
@@ -57,6 +78,9 @@ class Parser {
 		}
 		if (_servers.size() == 0)
 			return no_server_error();
+		if (_processes.incoming_cpu && !_processes.auto_affinity
+			&& _processes.affinity.empty())
+			return incoming_cpu_unpinned_error();
 		_handle_vhosts();
 		return _handle_interfaces();
 	}
@@ -75,39 +99,47 @@ class Parser {
 		return _servers;
 	}
 
+	const Processes	&get_processes() const {
+		return _processes;
+	}
+
  private:
 	bool		_handle_interfaces() {
+		std::map<int, IServer *>	ports;
+
 		IServerList::const_iterator it = _servers.begin();
 		for (; it != _servers.end(); it++) {
-			IServerList::const_iterator it2 = it + 1;
-			for (; it2 != _servers.end();  it2++) {
-				if ((*it)->get_port() == (*it2)->get_port()) {
-					return interface_rebind_error(
-						(*it)->get_name(), (*it2)->get_name(),
-						(*it)->get_port());
-				}
+			std::map<int, IServer *>::iterator bound =
+				ports.insert(std::make_pair((*it)->get_port(), *it)).first;
+			if (bound->second != *it) {
+				return interface_rebind_error(
+					bound->second->get_name(), (*it)->get_name(),
+					(*it)->get_port());
 			}
 		}
 		return true;
 	}
 
+	/*
+		Servers sharing a host:port are merged into the first one declared,
+		as its vhosts.
+	*/
 	void	_handle_vhosts() {
-		if (_servers.size() == 0)
-			return;
+		std::map<std::pair<std::string, int>, IServer *>	interfaces;
+		IServerList											masters;
 
 		IServerList::iterator it = _servers.begin();
 		for (; it != _servers.end(); it++) {
-			IServerList::iterator it2 = it + 1;
-			for (; it2 != _servers.end(); it2++) {
-				if ((*it)->get_host() == (*it2)->get_host() &&
-					(*it)->get_port() == (*it2)->get_port()) {
-					(*it)->merge(*it2);
-					delete *it2;
-					_servers.erase(it2);
-					--it2;
-				}
-			}
+			const std::pair<std::string, int> key((*it)->get_host(),
+				(*it)->get_port());
+			std::map<std::pair<std::string, int>, IServer *>::iterator master =
+				interfaces.insert(std::make_pair(key, *it)).first;
+			if (master->second == *it)
+				masters.push_back(*it);
+			else
+				master->second->merge(*it);
 		}
+		_servers.swap(masters);
 	}
 
 	void	_default_configuration() {
@@ -198,12 +230,38 @@ class Parser {
 			return CONF_BLOCK_BODY_LIMIT;
 		if (key == "cgi")
 			return CONF_BLOCK_CGI;
+		if (key == "cgi_workers")
+			return CONF_BLOCK_CGI_WORKERS;
+		if (key == "cgi_cache")
+			return CONF_BLOCK_CGI_CACHE;
+		if (key == "cgi_limit")
+			return CONF_BLOCK_CGI_LIMIT;
+		if (key == "cgi_timeout")
+			return CONF_BLOCK_CGI_TIMEOUT;
+		if (key == "disk_cache")
+			return CONF_BLOCK_DISK_CACHE;
 		if (key == "error_page")
 			return CONF_BLOCK_ERROR_PAGE;
+		if (key == "fastcgi_pass")
+			return CONF_BLOCK_FASTCGI_PASS;
+		if (key == "gzip")
+			return CONF_BLOCK_GZIP;
+		if (key == "gzip_comp_level")
+			return CONF_BLOCK_GZIP_COMP_LEVEL;
+		if (key == "gzip_min_length")
+			return CONF_BLOCK_GZIP_MIN_LENGTH;
+		if (key == "gzip_types")
+			return CONF_BLOCK_GZIP_TYPES;
 		if (key == "index")
 			return CONF_BLOCK_INDEX;
+		if (key == "internal")
+			return CONF_BLOCK_INTERNAL;
 		if (key == "location")
 			return CONF_SERVER_LOCATION;
+		if (key == "proxy_pass")
+			return CONF_BLOCK_PROXY_PASS;
+		if (key == "proxy_balance")
+			return CONF_BLOCK_PROXY_BALANCE;
 		if (key == "listen")
 			return CONF_SERVER_LISTEN;
 		if (key == "redirect")
@@ -214,6 +272,12 @@ class Parser {
 			return CONF_SERVER_NAME;
 		if (key == "upload_pass")
 			return CONF_BLOCK_UPLOAD_PASS;
+		if (key == "worker_processes")
+			return CONF_MAIN_WORKER_PROCESSES;
+		if (key == "worker_cpu_affinity")
+			return CONF_MAIN_WORKER_CPU_AFFINITY;
+		if (key == "worker_incoming_cpu")
+			return CONF_MAIN_WORKER_INCOMING_CPU;
 		return CONF_NOT_FOUND_TOKEN;
 	}
 
@@ -226,6 +290,21 @@ class Parser {
 		return s.find_first_not_of("0123456789") == std::string::npos;
 	}
 
+	/*
+		unix:/path/to.sock or host:port
+	*/
+	static bool	_is_upstream_address(const std::string &address) {
+		if (address.compare(0, 5, "unix:") == 0)
+			return address.size() > 5 && address.find(' ') == std::string::npos;
+		const size_t sep = address.rfind(':');
+		if (sep == std::string::npos || sep == 0 || sep + 1 == address.size())
+			return false;
+		const std::string port = address.substr(sep + 1);
+		return _is_digits(port) && atoi(port.c_str()) > 0
+			&& atoi(port.c_str()) < 65536
+			&& address.find(' ') == std::string::npos;
+	}
+
 	static void _extract_value(const std::string &key, std::string *bucket,
 		bool inside_location_block) {
 		bucket->erase(0, key.size());
@@ -237,8 +316,9 @@ class Parser {
 			throw std::runtime_error("invalid delimiter");
 		}
 		bucket->erase(bucket->size() - 1, 1);
+		// Location paths and regexes may hold commas ({m,n})
 		if (bucket->find(';') != std::string::npos
-		|| bucket->find(',') != std::string::npos) {
+		|| (bucket->find(',') != std::string::npos && !inside_location_block)) {
 			illegal_char_error(*bucket);
 			throw std::runtime_error("invalid char");
 		}
@@ -302,6 +382,123 @@ class Parser {
 					current_block->set_cgi(extension, cgi_path);
 					break;
 				}
+				case CONF_BLOCK_CGI_WORKERS: {
+					_extract_value("cgi_workers", &line, false);
+
+					std::vector<std::string> split, args;
+					_split_string(line, ' ', &split);
+					std::vector<std::string>::const_iterator it = split.begin();
+					for (; it != split.end(); it++) {
+						if (it->size() == 0)
+							continue;
+						if (args.size() && !_is_digits(*it))
+							return invalid_value_error(*it, line_nbr);
+						args.push_back(*it);
+					}
+					if (args.size() != 4 || current_block->get_cgi(args[0]) == "")
+						return invalid_value_error(line, line_nbr);
+
+					Models::IBlock::CGIWorkers workers;
+					workers.min = atoi(args[1].c_str());
+					workers.max = atoi(args[2].c_str());
+					workers.requests = atoi(args[3].c_str());
+					if (workers.max == 0 || workers.min > workers.max)
+						return invalid_value_error(line, line_nbr);
+					current_block->set_cgi_workers(args[0], workers);
+					break;
+				}
+				case CONF_BLOCK_CGI_CACHE: {
+					_extract_value("cgi_cache", &line, false);
+
+					std::vector<std::string> split, args;
+					_split_string(line, ' ', &split);
+					std::vector<std::string>::const_iterator it = split.begin();
+					for (; it != split.end(); it++) {
+						if (it->size() == 0)
+							continue;
+						if (!_is_digits(*it))
+							return invalid_value_error(*it, line_nbr);
+						args.push_back(*it);
+					}
+					if (args.size() != 2)
+						return invalid_value_error(line, line_nbr);
+
+					Models::IBlock::CGICache cache;
+					cache.ttl = atoi(args[0].c_str());
+					cache.size = atoi(args[1].c_str());
+					if (cache.ttl == 0 || cache.size == 0)
+						return invalid_value_error(line, line_nbr);
+					current_block->set_cgi_cache(cache);
+					break;
+				}
+				case CONF_BLOCK_CGI_LIMIT: {
+					_extract_value("cgi_limit", &line, false);
+
+					std::vector<std::string> split, args;
+					_split_string(line, ' ', &split);
+					std::vector<std::string>::const_iterator it = split.begin();
+					for (; it != split.end(); it++) {
+						if (it->size() == 0)
+							continue;
+						if (!_is_digits(*it))
+							return invalid_value_error(*it, line_nbr);
+						args.push_back(*it);
+					}
+					if (args.size() != 3)
+						return invalid_value_error(line, line_nbr);
+
+					Models::IBlock::CGILimit limit;
+					limit.processes = atoi(args[0].c_str());
+					limit.queue = atoi(args[1].c_str());
+					limit.timeout = atoi(args[2].c_str());
+					if (limit.processes == 0)
+						return invalid_value_error(line, line_nbr);
+					current_block->set_cgi_limit(limit);
+					break;
+				}
+				case CONF_BLOCK_DISK_CACHE: {
+					_extract_value("disk_cache", &line, false);
+
+					std::vector<std::string> split, args;
+					_split_string(line, ' ', &split);
+					std::vector<std::string>::const_iterator it = split.begin();
+					for (; it != split.end(); it++) {
+						if (it->size() == 0)
+							continue;
+						if (args.size() && !_is_digits(*it))
+							return invalid_value_error(*it, line_nbr);
+						args.push_back(*it);
+					}
+					if (args.size() != 3)
+						return invalid_value_error(line, line_nbr);
+
+					Models::IBlock::CacheDir cache;
+					cache.path = args[0];
+					cache.ttl = atoi(args[1].c_str());
+					cache.size = atol(args[2].c_str());
+					if (cache.ttl == 0 || cache.size == 0)
+						return invalid_value_error(line, line_nbr);
+					current_block->set_disk_cache(cache);
+					break;
+				}
+				case CONF_BLOCK_CGI_TIMEOUT: {
+					_extract_value("cgi_timeout", &line, false);
+					if (line.size() == 0 || !_is_digits(line) || atoi(line.c_str()) == 0)
+						return invalid_value_error(line, line_nbr);
+					current_block->set_cgi_timeout(atoi(line.c_str()));
+					break;
+				}
+				case CONF_BLOCK_FASTCGI_PASS: {
+					_extract_value("fastcgi_pass", &line, false);
+					if (line.find(" ") == std::string::npos)
+						return invalid_value_error(line, line_nbr);
+					std::string extension = line.substr(0, line.find(" "));
+					std::string address = line.substr(line.find(" ") + 1);
+					if (!_is_upstream_address(address))
+						return invalid_value_error(address, line_nbr);
+					current_block->set_fastcgi(extension, address);
+					break;
+				}
 				case CONF_BLOCK_ERROR_PAGE: {
 					_extract_value("error_page", &line, false);
 
@@ -318,6 +515,45 @@ class Parser {
 					current_block->set_error_page(error_code, source);
 					break;
 				}
+				case CONF_BLOCK_GZIP: {
+					_extract_value("gzip", &line, false);
+					if (line != "on" && line != "off")
+						return invalid_value_error(line, line_nbr);
+					current_block->set_gzip(line == "on");
+					break;
+				}
+				case CONF_BLOCK_GZIP_COMP_LEVEL: {
+					_extract_value("gzip_comp_level", &line, false);
+					if (line.size() != 1 || !_is_digits(line) || line == "0")
+						return invalid_value_error(line, line_nbr);
+					current_block->set_gzip_comp_level(atoi(line.c_str()));
+					break;
+				}
+				case CONF_BLOCK_GZIP_MIN_LENGTH: {
+					_extract_value("gzip_min_length", &line, false);
+					if (line.size() == 0 || !_is_digits(line))
+						return invalid_value_error(line, line_nbr);
+					current_block->set_gzip_min_length(atoi(line.c_str()));
+					break;
+				}
+				case CONF_BLOCK_GZIP_TYPES: {
+					_extract_value("gzip_types", &line, false);
+
+					std::vector<std::string> split, types;
+					_split_string(line, ' ', &split);
+					std::vector<std::string>::const_iterator it = split.begin();
+					for (; it != split.end(); it++) {
+						if (it->size() == 0)
+							continue;
+						if (*it != "*" && it->find('/') == std::string::npos)
+							return invalid_value_error(*it, line_nbr);
+						types.push_back(*it);
+					}
+					if (types.size() == 0)
+						return invalid_value_error(line, line_nbr);
+					current_block->set_gzip_types(types);
+					break;
+				}
 				case CONF_BLOCK_INDEX: {
 					_extract_value("index", &line, false);
 
@@ -333,17 +569,70 @@ class Parser {
 					}
 					break;
 				}
+				case CONF_BLOCK_INTERNAL: {
+					_extract_value("internal", &line, false);
+					if (scope != 2)
+						return unexpected_token_line_error("internal", line_nbr);
+					if (line != "on" && line != "off")
+						return invalid_value_error(line, line_nbr);
+					current_block->set_internal(line == "on");
+					break;
+				}
+				case CONF_BLOCK_PROXY_PASS: {
+					_extract_value("proxy_pass", &line, false);
+					if (scope != 2 || current_block->get_proxy_pass().size())
+						return unexpected_token_line_error("proxy_pass", line_nbr);
+
+					std::vector<std::string> split;
+					_split_string(line, ' ', &split);
+					std::vector<std::string>::const_iterator it = split.begin();
+					for (; it != split.end(); it++) {
+						if (it->size() == 0)
+							continue;
+						if (it->compare(0, 5, "unix:") != 0
+							&& it->find(':') == std::string::npos)
+							return invalid_value_error(*it, line_nbr);
+						current_block->add_proxy_pass(*it);
+					}
+					if (current_block->get_proxy_pass().empty())
+						return invalid_value_error(line, line_nbr);
+					break;
+				}
+				case CONF_BLOCK_PROXY_BALANCE: {
+					_extract_value("proxy_balance", &line, false);
+					if (scope != 2)
+						return unexpected_token_line_error("proxy_balance", line_nbr);
+					if (line == "round_robin")
+						current_block->set_proxy_balance(Models::IBlock::BALANCE_ROUND_ROBIN);
+					else if (line == "least_conn")
+						current_block->set_proxy_balance(Models::IBlock::BALANCE_LEAST_CONN);
+					else if (line == "hash")
+						current_block->set_proxy_balance(Models::IBlock::BALANCE_HASH);
+					else
+						return invalid_value_error(line, line_nbr);
+					break;
+				}
 				case CONF_SERVER_LOCATION: {
 					if (scope == 2)
 						return nested_locations_error(line, line_nbr);
 					++scope;
 					_extract_value("location", &line, true);
 
-					if (line.size() < 1 || line[0] != '/')
-						return invalid_value_error(line, line_nbr);
-					if (line[line.size() - 1] == ' ')
+					// location [ = | ^~ | ~ | ~* ] path
+					std::string modifier;
+					if (line.compare(0, 2, "^~") == 0
+						|| line.compare(0, 2, "~*") == 0)
+						modifier = line.substr(0, 2);
+					else if (line.size() > 0 && (line[0] == '=' || line[0] == '~'))
+						modifier = line.substr(0, 1);
+					line.erase(0, modifier.size());
+					_skip_whitespaces(&line);
+					if (line.size() > 0 && line[line.size() - 1] == ' ')
 						line = line.substr(0, line.size() - 1);
-					ILocation *block = _servers.back()->new_location(line);
+					if (line.size() < 1
+						|| (line[0] != '/' && modifier.compare(0, 1, "~") != 0))
+						return invalid_value_error(line, line_nbr);
+					ILocation *block = _servers.back()->new_location(line, modifier);
 					if (!block)
 						return invalid_value_error(line, line_nbr);
 					current_block = block;
@@ -410,7 +699,21 @@ class Parser {
 						return unexpected_token_line_error("server_name", line_nbr);
 					if (line.size() == 0)
 						return invalid_value_error(line, line_nbr);
-					_servers.back()->set_name(line);
+
+					// server_name name [*.name .name name.*] ...
+					std::vector<std::string> names;
+					std::replace(line.begin(), line.end(), '\t', ' ');
+					_split_string(line, ' ', &names);
+					for (size_t i = 0; i < names.size(); ++i) {
+						std::string &name = names[i];
+						for (size_t c = 0; c < name.size(); ++c)
+							name[c] = std::tolower(name[c]);
+						if (name.empty())
+							continue;
+						if (!Models::VHostIndex::valid(name))
+							return invalid_value_error(name, line_nbr);
+						_servers.back()->add_server_name(name);
+					}
 					break;
 				}
 				case CONF_BLOCK_UPLOAD_PASS: {
@@ -421,6 +724,66 @@ class Parser {
 					current_block->set_upload_pass(line);
 					break;
 				}
+				case CONF_MAIN_WORKER_PROCESSES: {
+					_extract_value("worker_processes", &line, false);
+					if (scope != 0)
+						return unexpected_token_line_error("worker_processes", line_nbr);
+					// auto: one worker per online cpu
+					if (line == "auto") {
+						const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+						_processes.workers = cpus > 0 ? cpus : 1;
+					} else if (_is_digits(line) && line.size() < 4
+						&& atoi(line.c_str()) > 0) {
+						_processes.workers = atoi(line.c_str());
+					} else {
+						return invalid_value_error(line, line_nbr);
+					}
+					break;
+				}
+				case CONF_MAIN_WORKER_CPU_AFFINITY: {
+					_extract_value("worker_cpu_affinity", &line, false);
+					if (scope != 0)
+						return unexpected_token_line_error("worker_cpu_affinity",
+							line_nbr);
+					_processes.affinity.clear();
+					_processes.auto_affinity = line == "auto";
+					if (_processes.auto_affinity)
+						break;
+
+					// worker_cpu_affinity mask [mask] ..., cpu 0 rightmost
+					std::vector<std::string> masks;
+					std::replace(line.begin(), line.end(), '\t', ' ');
+					_split_string(line, ' ', &masks);
+					for (size_t i = 0; i < masks.size(); ++i) {
+						const std::string &mask = masks[i];
+						if (mask.empty())
+							continue;
+						if (mask.find_first_not_of("01") != std::string::npos
+							|| mask.find('1') == std::string::npos
+							|| mask.size() > CPU_SETSIZE)
+							return invalid_value_error(mask, line_nbr);
+						cpu_set_t	set;
+						CPU_ZERO(&set);
+						for (size_t cpu = 0; cpu < mask.size(); ++cpu) {
+							if (mask[mask.size() - 1 - cpu] == '1')
+								CPU_SET(cpu, &set);
+						}
+						_processes.affinity.push_back(set);
+					}
+					if (_processes.affinity.empty())
+						return invalid_value_error(line, line_nbr);
+					break;
+				}
+				case CONF_MAIN_WORKER_INCOMING_CPU: {
+					_extract_value("worker_incoming_cpu", &line, false);
+					if (scope != 0)
+						return unexpected_token_line_error("worker_incoming_cpu",
+							line_nbr);
+					if (line != "on" && line != "off")
+						return invalid_value_error(line, line_nbr);
+					_processes.incoming_cpu = line == "on";
+					break;
+				}
 				case CONF_EMPTY_TOKEN:
 					break;
 				case CONF_SERVER_OPENING: {
@@ -0,0 +1,88 @@
+/*
+	Parsed configuration, compiled once and shared read-only by every
+	listener and client.
+
+	The snapshot takes the servers over from the parser, with their
+	locations and vhosts, renders their error pages and builds their CGI
+	environments: nothing is copied per listener. The blocks of the whole
+	configuration are laid out in one flat array for the passes walking all
+	of them (cgi workers, disk caches).
+
+	Listeners and clients acquire() the snapshot they serve and release()
+	it when done: the last release frees it, so a snapshot replaced while
+	requests are in flight stays valid until they complete.
+*/
+
+#ifndef CONF_SNAPSHOT_HPP_
+#define CONF_SNAPSHOT_HPP_
+
+#include <vector>
+
+#include "conf/parser.hpp"
+#include "models/IBlock.hpp"
+#include "models/IServer.hpp"
+
+namespace Webserv {
+namespace Conf {
+class Snapshot {
+ public:
+	typedef Webserv::Models::IBlock		IBlock;
+	typedef Webserv::Models::IServer	IServer;
+
+	typedef std::vector<IServer *>			IServerList;
+	typedef std::vector<const IBlock *>		IBlockList;
+
+ private:
+	IServerList			_servers;
+	IBlockList			_blocks;
+	Parser::Processes	_processes;
+	size_t				_refs;
+
+ public:
+	/*
+		The servers of parser are owned by the snapshot from now on. The
+		caller holds the first reference.
+	*/
+	explicit Snapshot(Parser *parser)
+	:	_processes(parser->get_processes()), _refs(1) {
+		_servers.swap(parser->get_servers());
+		for (size_t i = 0; i < _servers.size(); ++i) {
+			_servers[i]->render_error_pages();
+			_servers[i]->build_cgi_env();
+			_servers[i]->get_blocks(&_blocks);
+		}
+	}
+
+	Snapshot	*acquire() {
+		++_refs;
+		return this;
+	}
+
+	void	release() {
+		if (--_refs == 0)
+			delete this;
+	}
+
+	size_t	refs() const { return _refs; }
+
+	// Master servers, one per interface
+	const IServerList	&get_servers() const { return _servers; }
+
+	// Every block of the configuration: servers, locations, vhosts
+	const IBlockList	&get_blocks() const { return _blocks; }
+
+	const Parser::Processes	&get_processes() const { return _processes; }
+
+ private:
+	~Snapshot() {
+		for (size_t i = 0; i < _servers.size(); ++i)
+			delete _servers[i];
+	}
+
+	Snapshot(const Snapshot &lhs);
+	Snapshot	&operator=(const Snapshot &lhs);
+};
+}  // namespace Conf
+}  // namespace Webserv
+
+#endif  // CONF_SNAPSHOT_HPP_
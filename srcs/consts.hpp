@@ -8,9 +8,45 @@
 #define WEBSERV_REQUEST_BUFFER_SIZE	4096
 #define	WEBSERV_CLIENT_TIMEOUT		60
 #define WEBSERV_METHODS_SUPPORTED	3
+#define WEBSERV_STREAM_CHUNK_SIZE	16384
 
 #define WEBSERV_CGI_TIMEOUT			1
-#define WEBSERV_CGI_TICKS_US		100
+#define WEBSERV_GATEWAY_HEADERS_SIZE	65536
+#define WEBSERV_GATEWAY_BUFFER_SIZE		65536
+#define WEBSERV_CGI_WORKERS_SOCKET		"/tmp/webserv-worker"
+
+#define WEBSERV_FASTCGI_POOL_SIZE		8
+#define WEBSERV_FASTCGI_MPX_REQUESTS	16
+#define WEBSERV_FASTCGI_SPILL_SIZE		1048576
+
+#define WEBSERV_PROXY_TIMEOUT		60
+#define WEBSERV_PROXY_KEEPALIVE		16
+#define WEBSERV_PROXY_FAIL_TIMEOUT	10
+#define WEBSERV_PROXY_HASH_POINTS	160
+
+#define WEBSERV_TUNNEL_TIMEOUT		300
+#define WEBSERV_TUNNEL_BUFFER		65536
+
+#define WEBSERV_ENV_LISTENERS		"WEBSERV_LISTENERS"
+#define WEBSERV_ENV_READY			"WEBSERV_READY"
+#define WEBSERV_WORKER_RESPAWN_DELAY	1
+
+#define WEBSERV_IO_THREADS			4
+#define WEBSERV_IO_QUEUE			1024
+#define WEBSERV_IO_READAHEAD		1048576
+#define WEBSERV_IO_WRITE_BACKLOG	1048576
+#define WEBSERV_IO_RETRY_AFTER		1
+
+#define WEBSERV_REGEX_STATES		8192
+#define WEBSERV_REGEX_REPEAT		100
+
+#define WEBSERV_GZIP_BUFFER_SIZE	16384
+#define WEBSERV_GZIP_MIN_LENGTH		20
+#define WEBSERV_GZIP_COMP_LEVEL		1
+
+#define WEBSERV_AUTOINDEX_CACHE_ENTRIES	64
+#define WEBSERV_AUTOINDEX_CACHE_SIZE	67108864
+#define WEBSERV_AUTOINDEX_CACHE_ENTRY	16777216
 
 #define WEBSERV_SESSION_ID_LENGTH 	32
 #define WEBSERV_SESSION_TIMEOUT		600
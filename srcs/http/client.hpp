@@ -1,12 +1,14 @@
 #ifndef HTTP_CLIENT_HPP_
 #define HTTP_CLIENT_HPP_
 
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/time.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 
 #include <map>
@@ -21,19 +23,25 @@
 #include "http/request.hpp"
 #include "http/response.hpp"
 #include "models/IServer.hpp"
+#include "server/reactor.hpp"
+#include "server/instance.hpp"
 
 namespace Webserv {
 namespace HTTP {
 class Client {
 	typedef Webserv::HTTP::Request		Request;
 	typedef Webserv::Models::IServer	IServer;
+	typedef Webserv::Conf::Snapshot		Snapshot;
 
 	#ifdef WEBSERV_SESSION
 	typedef std::map<std::string, std::string> Cookies;
 	#endif
 
  private:
-	IServer	*_master;
+	Server::Instance	*_listener;
+	const IServer		*_master;
+	Snapshot			*_snapshot;
+	Server::Reactor		*_reactor;
 
 	struct sockaddr_in	_addr;
 	socklen_t 			_addr_len;
@@ -44,26 +52,41 @@ class Client {
 
 	Request		*req;
 	Response	*resp;
+	bool		_writing;
+	bool		_ready;
 
 	#ifdef WEBSERV_SESSION
+	Sessions		*_sessions;
 	std::string		_sid;
 	#endif
 
  public:
-	Client(IServer *master, int ev_fd)
-	:	_master(master),
+	/*
+		listener is held until the client is gone, each request is served
+		from the snapshot the listener served when it started.
+	*/
+	Client(Server::Instance *listener, int ev_fd, Server::Reactor *reactor)
+	:	_listener(listener->acquire()),
+		_master(listener->get_server()),
+		_snapshot(listener->get_snapshot()->acquire()),
+		_reactor(reactor),
 		_addr(), _addr_len(0),
 		_fd(-1) ,
-		req(0), resp(0) {
-		_fd = accept(ev_fd, (struct sockaddr *)&_addr, &_addr_len);
-		if (_fd == -1) {
+		req(0), resp(0), _writing(false), _ready(false) {
+		#ifdef WEBSERV_SESSION
+		_sessions = listener->get_sessions();
+		#endif
+		_fd = accept4(ev_fd, (struct sockaddr *)&_addr, &_addr_len,
+			SOCK_NONBLOCK | SOCK_CLOEXEC);
+		// Another worker polling the listener may have taken the connection
+		if (_fd == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
 			std::cerr << "accept() failed" << std::endl;
 		}
-		if (fcntl(_fd, F_SETFL, O_NONBLOCK) == -1) {
-			close(_fd);
-			_fd = -1;
-			std::cerr << "fcntl() failed" << std::endl;
-		}
+		// Streamed bodies go out as the upstream produces them, their last
+		// segment must not wait for the ACK of the previous one
+		int nodelay = 1;
+		if (_fd != -1)
+			setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
 		gettimeofday(&ping, NULL);
 		#ifndef WEBSERV_BENCHMARK
 			_resolve_client_ip();
@@ -77,10 +100,12 @@ class Client {
 			delete req;
 		if (resp)
 			delete resp;
+		_snapshot->release();
+		_listener->release();
 	}
 
 	READ read_request() {
-		char buffer[WEBSERV_REQUEST_BUFFER_SIZE + 1] = {0};
+		char buffer[WEBSERV_REQUEST_BUFFER_SIZE];
 		ssize_t n = recv(_fd, buffer, WEBSERV_REQUEST_BUFFER_SIZE, 0);
 		if (n == -1) {
 			std::cerr << "recv() failed" << std::endl;
@@ -88,12 +113,17 @@ class Client {
 		} else if (n == 0) {
 			return READ_EOF;
 		} else {
+			// A streamed upload is as alive as its last buffer
+			gettimeofday(&ping, NULL);
 			if (req == NULL) {
-				req = new Request(buffer);
-				ping = *(req->get_time());
+				_refresh();
+				// Bodies may hold NUL bytes
+				req = new Request(std::string(buffer, n));
 			} else {
-				req->handle_buffer(buffer);
+				req->handle_buffer(std::string(buffer, n));
 			}
+			if (_writing)
+				return _stream_body();
 			return _request_status();
 		}
 	}
@@ -101,30 +131,110 @@ class Client {
 	void	abort(int code) {
 		if (resp)
 			delete resp;
+		_writing = false;
 		resp = new Response(code);
 		resp->prepare(_master);
 
-		if (send(_fd, resp->toString(), resp->size(), 0) == -1) {
-			std::cerr << "send() failed" << std::endl;
+		while (resp->size() > 0) {
+			ssize_t n = send(_fd, resp->toString(), resp->size(), MSG_NOSIGNAL);
+			if (n <= 0) {
+				std::cerr << "send() failed" << std::endl;
+				break;
+			}
+			resp->consume(n);
 		}
 	}
 
-	bool	send_response() {
-		if (resp)
-			delete resp;
-		resp = new Response(req);
-		#ifdef WEBSERV_SESSION
-		_start_session();
-		#endif
-		resp->prepare(_master);
-		#ifdef WEBSERV_SESSION
-		_save_session();
-		#endif
-		if (send(_fd, resp->toString(), resp->size(), 0) == -1) {
-			std::cerr << "send() failed" << std::endl;
-			return true;
+	/*
+		Send as much of the response as the socket accepts.
+			-> WRITE_WAIT until the whole response (streamed body included)
+			is sent, then WRITE_DONE or WRITE_CLOSE.
+			-> WRITE_PENDING while the response waits for its upstream (CGI,
+			FastCGI), the loop resumes the write once one of the handle_*()
+			returns true.
+			-> WRITE_BODY instead while the upstream takes more of a streamed
+			request body, read meanwhile by read_request().
+			-> The body of a direct() response is spliced to the socket once
+			what was read from the upstream is sent.
+			-> WRITE_UPGRADE once the 101 of a switched response is sent.
+	*/
+	WRITE	send_response() {
+		if (!_writing) {
+			if (resp)
+				delete resp;
+			resp = new Response(req);
+			#ifdef WEBSERV_SESSION
+			_start_session();
+			#endif
+			resp->prepare(_master, _reactor, this);
+			_writing = true;
+			_ready = false;
+		}
+		if (resp->pending())
+			return _awaiting();
+		if (!_ready) {
+			_ready = true;
+			gettimeofday(&ping, NULL);
+			#ifdef WEBSERV_SESSION
+			_save_session();
+			#endif
+		}
+
+		STREAM state;
+		while ((state = resp->refill()) == STREAM_OK) {
+			if (resp->size() == 0)
+				continue;
+			ssize_t n = send(_fd, resp->toString(), resp->size(),
+				MSG_NOSIGNAL | resp->send_flags());
+			if (n == -1) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					return WRITE_WAIT;
+				std::cerr << "send() failed" << std::endl;
+				return WRITE_CLOSE;
+			}
+			resp->consume(n);
+			gettimeofday(&ping, NULL);
+		}
+		if (state == STREAM_WAIT && resp->direct()) {
+			state = resp->splice(_fd);
+			gettimeofday(&ping, NULL);
+			if (state == STREAM_OK)
+				return WRITE_WAIT;
+		}
+		if (state == STREAM_WAIT)
+			return _awaiting();
+		_writing = false;
+		if (state == STREAM_ERROR)
+			return WRITE_CLOSE;
+		if (resp->upgraded()) {
+			_close();
+			return WRITE_UPGRADE;
 		}
-		return _close();
+		return _close() ? WRITE_CLOSE : WRITE_DONE;
+	}
+
+	/*
+		The connection switched protocols (WRITE_UPGRADE), its fd leaves
+		the client along with the upstream one.
+	*/
+	int		take_tunnel(int *upstream) {
+		const int fd = _fd;
+		*upstream = resp->take_tunnel();
+		_fd = -1;
+		return fd;
+	}
+
+	bool	handle_upstream(int fd, uint32_t events) {
+		return _writing && resp->handle_upstream(fd, events);
+	}
+	bool	handle_exit(pid_t pid) {
+		return _writing && resp->handle_exit(pid);
+	}
+	bool	handle_timeout(uint64_t now) {
+		return _writing && resp->handle_timeout(now);
+	}
+	bool	handle_wake() {
+		return _writing && resp->handle_wake();
 	}
 
 	int		get_fd() const { return _fd; }
@@ -132,19 +242,31 @@ class Client {
 		return (now - ping.tv_sec) > WEBSERV_CLIENT_TIMEOUT;
 	}
 
+	/*
+		Headers of the response went out, or are going: an error response
+		could only be written into its body.
+	*/
+	bool	responding() const { return _writing && _ready; }
+
+	/*
+		Waiting on its upstream or a queue, answered by their own timeouts
+		(cgi_timeout, cgi_limit, ...) whatever their length.
+	*/
+	bool	pending() const { return _writing && !_ready; }
+
  private:
 	#ifdef WEBSERV_SESSION
 	void	_start_session() {
 		const Cookies	&rcks = req->get_cookies();
 		const Cookies::const_iterator rit = rcks.find(WEBSERV_SESSION_ID);
 		if (_sid != "" && rit != req->get_cookies().end() && rit->second == _sid) {
-			const Session *sess = _master->get_session(_sid);
+			const Session *sess = _sessions->get(_sid);
 			if (sess && sess->alive())
 				return;
 		}
 
 		if (rit != rcks.end()) {
-			const Session *sess = _master->get_session(rit->second);
+			const Session *sess = _sessions->get(rit->second);
 			if (sess && sess->alive()) {
 				Cookies::const_iterator sit = sess->cookies.begin();
 				for (; sit != sess->cookies.end(); ++sit) {
@@ -157,7 +279,7 @@ class Client {
 		}
 
 		_sid = rand_string(WEBSERV_SESSION_ID_LENGTH);
-		while (!_master->add_session(_sid))
+		while (!_sessions->add(_sid))
 			_sid = rand_string(WEBSERV_SESSION_ID_LENGTH);
 		resp->add_header("Set-Cookie", std::string(WEBSERV_SESSION_ID) +
 			"=" + _sid + "; path=/");
@@ -169,7 +291,7 @@ class Client {
 		if (_sid == "")
 			return;
 
-		Session *sess = _master->get_session(_sid);
+		Session *sess = _sessions->get(_sid);
 		if (!sess)
 			return;
 		sess->refresh();
@@ -206,6 +328,9 @@ class Client {
 			}
 			if (req->get_method() == METH_POST) {
 				if (req->read_body() == false) {
+					// Gateways get the body as it comes, the response starts now
+					if (_streamable() && req->stream_body())
+						return READ_OK;
 					return READ_WAIT;
 				}
 				return READ_OK;
@@ -214,9 +339,56 @@ class Client {
 		}
 	}
 
+	bool	_streamable() const {
+		const Models::IBlock *block = _master->get_block_using_vhosts(
+			req->get_host(), req->get_uri());
+		return block->get_fastcgi(req->get_uri()) != ""
+			|| block->get_cgi(req->get_uri()) != ""
+			|| !block->get_proxy_pass().empty();
+	}
+
+	/*
+		Rest of a streamed body, forwarded to the response.
+			-> READ_WAIT while more is taken, READ_OK to let send_response()
+			decide what to wait for.
+	*/
+	READ	_stream_body() {
+		const std::string	body = req->take_body();
+		resp->write_body(body, req->body_complete());
+		if (!req->body_complete() && resp->wants_body())
+			return READ_WAIT;
+		return READ_OK;
+	}
+
+	WRITE	_awaiting() const {
+		if (req->body_streamed() && !req->body_complete() && resp->wants_body())
+			return WRITE_BODY;
+		return WRITE_PENDING;
+	}
+
+	/*
+		Move to the snapshot of a reload, the previous response goes with
+		the one it was built from.
+	*/
+	void	_refresh() {
+		Snapshot *current = _listener->get_snapshot();
+		if (current == _snapshot)
+			return;
+		if (resp) {
+			delete resp;
+			resp = 0;
+		}
+		current->acquire();
+		_snapshot->release();
+		_snapshot = current;
+		_master = _listener->get_server();
+	}
+
 	bool	_close() {
 		if (req) {
-			bool state = req->closed();
+			// The unread part of a streamed body can not be skipped
+			bool state = req->closed()
+				|| (req->body_streamed() && !req->body_complete());
 
 			#ifndef WEBSERV_BENCHMARK
 				__log();
@@ -30,6 +30,22 @@ enum READ {
 	READ_WAIT
 };
 
+enum WRITE {
+	WRITE_DONE,
+	WRITE_WAIT,
+	WRITE_PENDING,
+	WRITE_BODY,
+	WRITE_CLOSE,
+	WRITE_UPGRADE
+};
+
+enum STREAM {
+	STREAM_OK,
+	STREAM_WAIT,
+	STREAM_EOF,
+	STREAM_ERROR
+};
+
 enum STATUS_CODE {
 	CONTINUE = 100,
 	SWITCHING_PROTOCOLS = 101,
@@ -0,0 +1,153 @@
+/*
+	Streaming gzip / deflate encoder.
+		-> Input is fed by slices, output is produced through a bounded buffer.
+
+	Each time the buffer fills up (or the stream is flushed), its content is
+	appended to the bucket given by the caller, so memory usage stays
+	proportional to WEBSERV_GZIP_BUFFER_SIZE whatever the body size is.
+*/
+
+#ifndef HTTP_GZIP_HPP_
+#define HTTP_GZIP_HPP_
+
+#include <zlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "consts.hpp"
+
+namespace Webserv {
+namespace HTTP {
+
+enum ENCODING {
+	ENCODING_IDENTITY,
+	ENCODING_GZIP,
+	ENCODING_DEFLATE
+};
+
+/*
+	Parse an Accept-Encoding header value (already lowered by Request).
+		-> gzip is preferred over deflate, q=0 disable an encoding.
+*/
+static ENCODING	negociate_encoding(const std::string &accept) {
+	bool	gzip = false, deflate = false;
+	size_t	start = 0;
+
+	while (start < accept.size()) {
+		size_t end = accept.find(',', start);
+		if (end == std::string::npos)
+			end = accept.size();
+		std::string token = accept.substr(start, end - start);
+		start = end + 1;
+
+		size_t params = token.find(';');
+		bool disabled = params != std::string::npos
+			&& token.find("q=0", params) != std::string::npos
+			&& token.find_first_of("123456789", params) == std::string::npos;
+		token = token.substr(0, params);
+		token.erase(0, token.find_first_not_of(" \t"));
+		token.erase(token.find_last_not_of(" \t") + 1);
+
+		if (token == "gzip" || token == "x-gzip")
+			gzip = !disabled;
+		else if (token == "deflate")
+			deflate = !disabled;
+	}
+	if (gzip)
+		return ENCODING_GZIP;
+	if (deflate)
+		return ENCODING_DEFLATE;
+	return ENCODING_IDENTITY;
+}
+
+class Gzip {
+ private:
+	z_stream	_zs;
+	bool		_ready;
+	ENCODING	_encoding;
+
+	size_t		_bytes_in;
+	size_t		_bytes_out;
+
+	unsigned char	_buffer[WEBSERV_GZIP_BUFFER_SIZE];
+
+ public:
+	Gzip(ENCODING encoding, int level)
+	:	_ready(false),
+		_encoding(encoding),
+		_bytes_in(0), _bytes_out(0) {
+		memset(&_zs, 0, sizeof(_zs));
+		// windowBits + 16 asks zlib for a gzip wrapper instead of a zlib one
+		int window_bits = encoding == ENCODING_GZIP ? MAX_WBITS + 16 : MAX_WBITS;
+		_ready = deflateInit2(&_zs, level, Z_DEFLATED,
+			window_bits, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+	}
+
+	~Gzip() {
+		if (_ready)
+			deflateEnd(&_zs);
+	}
+
+	bool		ready() const { return _ready; }
+	size_t		bytes_in() const { return _bytes_in; }
+	size_t		bytes_out() const { return _bytes_out; }
+
+	const char	*name() const {
+		return _encoding == ENCODING_GZIP ? "gzip" : "deflate";
+	}
+
+	/*
+		Compress a slice, compressed bytes (if any) are appended to bucket.
+			-> zlib may keep some of them internally until the next call.
+	*/
+	bool	write(const char *data, size_t len, std::string *bucket) {
+		_bytes_in += len;
+		_zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+		_zs.avail_in = len;
+		return _deflate(Z_NO_FLUSH, bucket);
+	}
+
+	/*
+		Push every pending bytes into bucket, without ending the stream.
+			-> Used when the body is streamed and the client must see progress.
+	*/
+	bool	flush(std::string *bucket) {
+		_zs.next_in = 0;
+		_zs.avail_in = 0;
+		return _deflate(Z_SYNC_FLUSH, bucket);
+	}
+
+	bool	finish(std::string *bucket) {
+		_zs.next_in = 0;
+		_zs.avail_in = 0;
+		return _deflate(Z_FINISH, bucket);
+	}
+
+ private:
+	bool	_deflate(int mode, std::string *bucket) {
+		if (!_ready)
+			return false;
+		do {
+			_zs.next_out = _buffer;
+			_zs.avail_out = sizeof(_buffer);
+
+			int ret = deflate(&_zs, mode);
+			if (ret == Z_STREAM_ERROR)
+				return false;
+
+			size_t produced = sizeof(_buffer) - _zs.avail_out;
+			bucket->append(reinterpret_cast<char *>(_buffer), produced);
+			_bytes_out += produced;
+
+			if (mode == Z_FINISH && ret == Z_STREAM_END)
+				return true;
+		} while (_zs.avail_out == 0 || _zs.avail_in > 0);
+		return true;
+	}
+};
+
+}  // namespace HTTP
+}  // namespace Webserv
+
+#endif  // HTTP_GZIP_HPP_
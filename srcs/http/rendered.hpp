@@ -0,0 +1,193 @@
+/*
+	Error responses rendered once, at config load.
+		-> Status line, headers and body are stored in a single buffer.
+
+	Only the Date header changes between two sends, the buffer is never
+	written once rendered: it may be shared by responses still sending it.
+	Each one copies the head up to the Date value with the current date,
+	then sends the rest of the buffer as is.
+
+	Default status pages are shared by every block. The sources of the
+	custom error pages are interned at parse time, blocks only hold a
+	pointer to them, and they are rendered once by (code, source): a page
+	inherited by hundreds of locations is neither copied nor rendered again.
+*/
+
+#ifndef HTTP_RENDERED_HPP_
+#define HTTP_RENDERED_HPP_
+
+#include <time.h>
+#include <stdio.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+
+#include "consts.hpp"
+#include "http/codes.hpp"
+
+namespace Webserv {
+namespace HTTP {
+
+#define WEBSERV_HTTP_DATE_LENGTH	29
+
+/*
+	Current date formatted as an IMF-fixdate, refreshed once per second.
+*/
+static const char	*http_date() {
+	static time_t	last = 0;
+	static char		buffer[WEBSERV_HTTP_DATE_LENGTH + 1] = {0};
+
+	time_t	now = time(NULL);
+	if (now != last) {
+		struct tm	gmt;
+		gmtime_r(&now, &gmt);
+		strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+		last = now;
+	}
+	return buffer;
+}
+
+class RenderedResponse {
+ private:
+	std::string	_payload[2];
+	size_t		_date_offset[2];
+
+ public:
+	RenderedResponse(int code, const std::string &body) {
+		_render(code, body, false);
+		_render(code, body, true);
+	}
+
+	/*
+		Status line and headers up to the end of the Date value, refreshed.
+			-> The rest of get() follows from head->size() on.
+	*/
+	void	head(bool closed, std::string *head) const {
+		head->assign(_payload[closed], 0, _date_offset[closed]);
+		head->append(http_date(), WEBSERV_HTTP_DATE_LENGTH);
+	}
+
+	const std::string	&get(bool closed) const { return _payload[closed]; }
+
+ private:
+	void	_render(int code, const std::string &body, bool closed) {
+		char	length[32];
+		snprintf(length, sizeof(length), "%lu",
+			static_cast<unsigned long>(body.size()));
+		char	status[8];
+		snprintf(status, sizeof(status), "%d", code);
+
+		// Headers are kept in the same order as Response::_prepare_headers
+		std::string &payload = _payload[closed];
+		payload = std::string("HTTP/1.1 ") + status + " " + resolve_code(code)
+			+ "\r\n"
+			"Connection: " + (closed ? "closed" : "keep-alive") + "\r\n"
+			"Content-Length: " + length + "\r\n"
+			"Content-Type: text/html\r\n"
+			"Date: ";
+		_date_offset[closed] = payload.size();
+		payload += http_date();
+		payload += "\r\nServer: " WEBSERV_SERVER_VERSION;
+		#ifdef WEBSERV_BUILD_COMMIT
+			payload += WEBSERV_BUILD_COMMIT;
+		#endif
+		payload += "\r\n\r\n" + body + "\r\n";
+	}
+};
+
+typedef std::pair<int, const std::string *>				RenderedPageKey;
+typedef std::map<RenderedPageKey, RenderedResponse *>	RenderedPagesObject;
+
+static std::map<int, RenderedResponse *>	RENDERED_STATUS_PAGES;
+static RenderedPagesObject					RENDERED_ERROR_PAGES;
+static std::set<std::string>				ERROR_PAGE_SOURCES;
+
+/*
+	Shared copy of an error page source, the same for equal sources.
+*/
+const std::string	*intern_error_page(const std::string &source) {
+	return &*ERROR_PAGE_SOURCES.insert(source).first;
+}
+
+/*
+	Render a response for every error code known by resolve_code().
+		-> Must be called after init_status_map().
+*/
+void	init_rendered_status_pages() {
+	std::map<int, std::string>::const_iterator it = CODES.begin();
+	for (; it != CODES.end(); ++it) {
+		if (it->first < 400 || RENDERED_STATUS_PAGES.count(it->first))
+			continue;
+		RENDERED_STATUS_PAGES[it->first] =
+			new RenderedResponse(it->first, generate_status_page(it->first));
+	}
+}
+
+void	destroy_rendered_pages() {
+	std::map<int, RenderedResponse *>::iterator it =
+		RENDERED_STATUS_PAGES.begin();
+	for (; it != RENDERED_STATUS_PAGES.end(); ++it)
+		delete it->second;
+	RENDERED_STATUS_PAGES.clear();
+
+	RenderedPagesObject::iterator it2 = RENDERED_ERROR_PAGES.begin();
+	for (; it2 != RENDERED_ERROR_PAGES.end(); ++it2)
+		delete it2->second;
+	RENDERED_ERROR_PAGES.clear();
+}
+
+const RenderedResponse	*get_rendered_status_page(int code) {
+	std::map<int, RenderedResponse *>::const_iterator it =
+		RENDERED_STATUS_PAGES.find(code);
+	if (it != RENDERED_STATUS_PAGES.end())
+		return it->second;
+	return 0;
+}
+
+/*
+	source is interned by intern_error_page().
+*/
+const RenderedResponse	*render_error_page(int code, const std::string *source) {
+	const RenderedPageKey key(code, source);
+	RenderedPagesObject::const_iterator it = RENDERED_ERROR_PAGES.find(key);
+	if (it != RENDERED_ERROR_PAGES.end())
+		return it->second;
+	RenderedResponse *rendered = new RenderedResponse(code, *source);
+	RENDERED_ERROR_PAGES[key] = rendered;
+	return rendered;
+}
+
+/*
+	Drop the pages, and their sources, of the blocks of replaced
+	configurations: only those in live are still used.
+*/
+void	forget_error_pages(const std::set<RenderedPageKey> &live) {
+	std::set<const std::string *>	sources;
+	std::set<RenderedPageKey>::const_iterator key = live.begin();
+	for (; key != live.end(); ++key)
+		sources.insert(key->second);
+
+	RenderedPagesObject::iterator it = RENDERED_ERROR_PAGES.begin();
+	while (it != RENDERED_ERROR_PAGES.end()) {
+		if (live.count(it->first)) {
+			++it;
+			continue;
+		}
+		delete it->second;
+		RENDERED_ERROR_PAGES.erase(it++);
+	}
+	std::set<std::string>::iterator source = ERROR_PAGE_SOURCES.begin();
+	while (source != ERROR_PAGE_SOURCES.end()) {
+		if (sources.count(&*source))
+			++source;
+		else
+			ERROR_PAGE_SOURCES.erase(source++);
+	}
+}
+
+}  // namespace HTTP
+}  // namespace Webserv
+
+#endif  // HTTP_RENDERED_HPP_
@@ -2,6 +2,8 @@
 #define HTTP_REQUEST_HPP_
 
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 
 #include <map>
 #include <string>
@@ -36,6 +38,7 @@ class Request {
 
 	FORM		_post_form;
 	size_t		_body_size;
+	size_t		_body_received;
 	std::string	_multipart_boundary;
 
 	#ifdef WEBSERV_SESSION
@@ -45,6 +48,7 @@ class Request {
 	bool	_headers_ready;
 	bool	_body_ready;
 	bool	_chunked;
+	bool	_streamed;
 	bool	_closed;
 
 	STATUS_CODE	_http_code;
@@ -58,10 +62,11 @@ class Request {
 		_headers(),
 		_post_form(FORM_UNKNOWN),
 		_body_size(0),
+		_body_received(0),
 		_multipart_boundary(""),
 		_headers_ready(false),
 		 _body_ready(false),
-		_chunked(false), _closed(false),
+		_chunked(false), _streamed(false), _closed(false),
 		_http_code(OK) {
 		gettimeofday(&_time, NULL);
 	}
@@ -87,6 +92,8 @@ class Request {
 	}
 
 	bool	read_body() {
+		if (_streamed)
+			return _body_ready;
 		if (_chunked == true) {
 			if (_read_chunks() == READ_WAIT)
 				return false;
@@ -99,6 +106,41 @@ class Request {
 		return true;
 	}
 
+	/*
+		Hand the body over as it is received instead of buffering it whole,
+		see take_body(). Only bodies of a known length can be streamed.
+	*/
+	bool	stream_body() {
+		if (_chunked)
+			return false;
+		_streamed = true;
+		_body_ready = _body_size == 0;
+		return true;
+	}
+
+	/*
+		Body bytes received since the last call, streamed bodies only.
+	*/
+	std::string	take_body() {
+		std::string body;
+		body.swap(_raw_request);
+		if (body.size() > _body_size - _body_received)
+			body.erase(_body_size - _body_received);
+		_body_received += body.size();
+		_body_ready = _body_received >= _body_size;
+		return body;
+	}
+
+	bool	body_streamed() const { return _streamed; }
+	bool	body_complete() const { return _body_ready; }
+
+	/*
+		Size of the body, announced by Content-Length once streamed.
+	*/
+	size_t	get_body_length() const {
+		return _streamed ? _body_size : _raw_request.size();
+	}
+
 	bool	closed() {
 		if (!_closed) {
 			HeadersObject::const_iterator it = _headers.find("connection");
@@ -130,6 +172,24 @@ class Request {
 		return "";
 	}
 
+	/*
+		Media type of the Content-Type, its parameters (boundary, ...) left
+		aside. The value is kept as sent, types compare case-insensitively.
+	*/
+	bool	content_type_is(const char *type) const {
+		HeadersObject::const_iterator it = _headers.find("content-type");
+		if (it == _headers.end())
+			return false;
+		const std::string &value = it->second;
+		size_t end = value.find(';');
+		if (end == std::string::npos)
+			end = value.size();
+		while (end > 0 && (value[end - 1] == ' ' || value[end - 1] == '\t'))
+			--end;
+		return strlen(type) == end
+			&& strncasecmp(value.data(), type, end) == 0;
+	}
+
 	#ifdef WEBSERV_SESSION
 	const Cookies &get_cookies() const {
 		return _cookies;
@@ -219,6 +279,20 @@ class Request {
 		return true;
 	}
 
+	/*
+		Values compared by the server are lowercased, the others are kept
+		as sent (forwarded to scripts and upstreams: keys, tokens, ...).
+	*/
+	static bool	_token_header(const std::string &name) {
+		static const char *names[] = { "host", "connection",
+			"transfer-encoding", "accept-encoding", "range", "upgrade", 0 };
+		for (size_t i = 0; names[i]; ++i) {
+			if (name == names[i])
+				return true;
+		}
+		return false;
+	}
+
 	bool	_extract_headers(HeadersObject *bucket) {
 		size_t header_size = 0;
 		size_t	header_separator_pos = _raw_request.find("\r\n");
@@ -230,7 +304,7 @@ class Request {
 			std::string	header_name = header_str.substr(0, header_name_separator_pos);
 			std::string	header_value = header_str.substr(header_name_separator_pos + 1);
 			_strtolower(&header_name);
-			if (header_name != "cookie")
+			if (_token_header(header_name))
 				_strtolower(&header_value);
 			_trim(&header_value);
 			(*bucket)[header_name] = header_value;
@@ -288,9 +362,9 @@ class Request {
 		it = _headers.find("content-type");
 		if (it == _headers.end() || it->second == "")
 			return _invalid_request(BAD_REQUEST);
-		if (it->second == "application/x-www-form-urlencoded")
+		if (content_type_is("application/x-www-form-urlencoded"))
 			_post_form = FORM_URLENCODED;
-		else if (it->second == "multipart/form-data")
+		else if (content_type_is("multipart/form-data"))
 			_post_form = FORM_MULTIPART;
 		return true;
 	}
@@ -1,20 +1,36 @@
 #ifndef HTTP_RESPONSE_HPP_
 #define HTTP_RESPONSE_HPP_
 
+#include <time.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <string.h>
 #include <dirent.h>
+#include <strings.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 
 #include <map>
 #include <vector>
 #include <string>
 #include <utility>
+#include <algorithm>
 
+#include "http/gzip.hpp"
 #include "http/codes.hpp"
+#include "http/stream.hpp"
 #include "http/request.hpp"
+#include "http/rendered.hpp"
 #include "server/cgi.hpp"
+#include "server/fastcgi.hpp"
+#include "server/proxy.hpp"
+#include "server/workers.hpp"
+#include "server/throttle.hpp"
+#include "server/microcache.hpp"
+#include "server/diskcache.hpp"
+#include "server/iopool.hpp"
 #include "models/IServer.hpp"
 #include "server/autoindex.hpp"
 
@@ -22,6 +38,7 @@ namespace Webserv {
 namespace HTTP {
 class Response {
 	typedef Webserv::Models::IServer 				IServer;
+	typedef void	(Response::*IOContinuation)(Server::IOJob *job);
 	typedef std::map<std::string, std::string>		Headers;
 	typedef std::pair<std::string, std::string>		SetCookiePair;
 
@@ -30,6 +47,7 @@ class Response {
  private:
 	std::string _body;
 	std::string _payload;
+	size_t		_sent;
 
 	Headers _headers;
 	Cookies _cookies_to_set;
@@ -37,39 +55,273 @@ class Response {
 	int _status;
 
 	Request 	*_req;
-	IServer		*_master;
+	const IServer	*_master;
+
+	const Models::IBlock	*_block;
+	const std::string		*_rendered;
+	std::string				_file_uri;
+
+	bool		_dynamic;
+	bool		_chunked;
+	ENCODING	_encoding;
+
+	Stream		*_stream;
+	Gzip		*_gzip;
+	bool		_streamed;
+	bool		_direct;
+
+	Server::Gateway	*_gateway;
+	bool			_pending;
+	Server::Reactor	*_reactor;
+	Client			*_owner;
+
+	Server::MicroCache			*_cache;
+	std::string					_cache_key;
+	Server::MicroCache::Entry	*_cache_fill;
+	uint64_t					_cache_wait;
+	bool						_cache_skip;
+
+	Server::DiskCache			*_disk;
+	Server::DiskCache::Fill		*_disk_fill;
+	bool						_disk_stale;
+
+	int		_tunnel;
+
+	Server::Throttle	*_throttle;
+	uint64_t			_queued;
+	bool				_slot;
+
+	Server::IOJob		*_io;
+	IOContinuation		_io_next;
+
+	// Static file body, and its next window being read ahead
+	FileStream			*_file;
+	Server::IOJob		*_ahead;
 
  public:
 	explicit Response(Request *request)
-	:	_status(request->get_code()),
+	:	_sent(0),
+		_status(request->get_code()),
 		_req(request),
-		_master(0) {}
+		_master(0),
+		_block(0), _rendered(0),
+		_dynamic(false), _chunked(false),
+		_encoding(ENCODING_IDENTITY),
+		_stream(0), _gzip(0), _streamed(false), _direct(false),
+		_gateway(0), _pending(false), _reactor(0), _owner(0),
+		_cache(0), _cache_fill(0), _cache_wait(0), _cache_skip(false),
+		_disk(0), _disk_fill(0), _disk_stale(false),
+		_tunnel(-1),
+		_throttle(0), _queued(0), _slot(false),
+		_io(0), _io_next(0),
+		_file(0), _ahead(0) {}
 
 	explicit Response(int code)
-	:	_status(code),
+	:	_sent(0),
+		_status(code),
 		_req(0),
-		_master(0) {}
+		_master(0),
+		_block(0), _rendered(0),
+		_dynamic(false), _chunked(false),
+		_encoding(ENCODING_IDENTITY),
+		_stream(0), _gzip(0), _streamed(false), _direct(false),
+		_gateway(0), _pending(false), _reactor(0), _owner(0),
+		_cache(0), _cache_fill(0), _cache_wait(0), _cache_skip(false),
+		_disk(0), _disk_fill(0), _disk_stale(false),
+		_tunnel(-1),
+		_throttle(0), _queued(0), _slot(false),
+		_io(0), _io_next(0),
+		_file(0), _ahead(0) {}
+
+	~Response() {
+		if (_cache_wait)
+			_cache->cancel(_cache_key, _owner);
+		_cache_abort();
+		_disk_abort();
+		if (_gateway && _stream != _gateway)
+			delete _gateway;
+		if (_stream)
+			delete _stream;
+		if (_gzip)
+			delete _gzip;
+		if (_queued)
+			_throttle->cancel(_owner);
+		_release_slot();
+		if (_tunnel != -1)
+			close(_tunnel);
+		if (_io)
+			Server::get_io_pool(_reactor)->cancel(_io);
+		if (_ahead)
+			Server::get_io_pool(_reactor)->cancel(_ahead);
+	}
 
-	bool	prepare(IServer *master) {
+	/*
+		A gateway job (CGI, FastCGI) leaves the response pending() until the
+		upstream headers are received, a disk operation until it is done, it
+		is then completed by the handle_*() methods, called by the loop on
+		behalf of owner.
+	*/
+	bool	prepare(const IServer *master, Server::Reactor *reactor = 0,
+		Client *owner = 0) {
 		_master = master;
+		_reactor = reactor;
+		_owner = owner;
 		if (_req && _status < 400) { invoke(); }
-		if (_status >= 400) {
-			if (_req) {
-				_body = master->get_error_page(_status, _req->get_host(), _req->get_uri());
-				if (_body == "")
-					_body = generate_status_page(_status);
-			} else {
-				_body = generate_status_page(_status);
-			}
-		}
-		_payload = _prepare_headers() + _body + "\r\n";
-		return true;
+		if (_pending)
+			return true;
+		return _finalize();
 	}
 
+	bool	pending() const { return _pending; }
+
+	/*
+		Forward an event to the running job.
+			-> true once there is something new to send, or when the job
+			takes more of a streamed request body.
+	*/
+	bool	handle_upstream(int fd, uint32_t events) {
+		return _gateway && _gateway->handle(fd, events)
+			&& (_gateway_progress() || wants_body());
+	}
+	bool	handle_exit(pid_t pid) {
+		return _gateway && _gateway->handle_exit(pid) && _gateway_progress();
+	}
+	bool	handle_timeout(uint64_t now) {
+		if (_queued)
+			return now >= _queued && _dequeued(false);
+		if (_cache_wait)
+			return now >= _cache_wait && _cache_retry(true);
+		return _gateway && _gateway->handle_timeout(now) && _gateway_progress();
+	}
+	bool	handle_wake() {
+		if (_disk_fill && _disk_fill->job && _disk_fill->job->done())
+			return _disk_written();
+		if (_io)
+			return _io->done() && _io_progress();
+		if (_ahead)
+			return _ahead->done() && _readahead_done();
+		if (_queued)
+			return _dequeued(true);
+		if (_cache_wait)
+			return _cache_retry(false);
+		return _gateway && (_gateway_progress() || wants_body());
+	}
+
+	/*
+		Streamed request body, received after the response started.
+	*/
+	void	write_body(const std::string &data, bool last) {
+		if (_gateway)
+			_gateway->write_input(data, last);
+	}
+	bool	wants_body() const { return _gateway && _gateway->wants_input(); }
+
 	int		status() const { return _status; }
 	void	set_status(int status) { _status = status; }
-	const void *toString() const { return _payload.c_str(); }
-	size_t	size() const { return _payload.size(); }
+
+	/*
+		Bytes waiting to be sent, see refill() and consume(). A pre-rendered
+		error is sent from its head in _payload, then from the shared buffer.
+	*/
+	const void *toString() const {
+		if (_rendered && _sent >= _payload.size())
+			return _rendered->data() + _sent;
+		return _payload.data() + _sent;
+	}
+	size_t	size() const {
+		if (_rendered && _sent >= _payload.size())
+			return _rendered->size() - _sent;
+		return _payload.size() - _sent;
+	}
+	void	consume(size_t n) { _sent += n; }
+
+	/*
+		Pull the next slice of a streamed body once the previous one is sent.
+			-> STREAM_OK while there is something to send.
+	*/
+	STREAM	refill() {
+		// The end of a body stored on the disk waits for its file in place
+		if (_streamed && _disk_fill)
+			return STREAM_WAIT;
+		if (size() > 0)
+			return STREAM_OK;
+		if (!_stream || _streamed)
+			return STREAM_EOF;
+		if (_disk_fill && _disk_fill->job
+			&& _disk_fill->pending.size() >= WEBSERV_IO_WRITE_BACKLOG)
+			return STREAM_WAIT;
+
+		_payload.clear();
+		_sent = 0;
+		std::string	slice;
+		STREAM ret = _stream->read(&slice);
+		while (_readahead() && ret == STREAM_WAIT && slice.empty())
+			ret = _stream->read(&slice);
+		if (ret == STREAM_ERROR) {
+			_cache_abort();
+			_disk_abort();
+			_release_slot();
+			return STREAM_ERROR;
+		}
+		if (ret == STREAM_EOF) {
+			_streamed = true;
+			_release_slot();
+		}
+		if (_cache_fill)
+			_cache_append(slice);
+		if (_disk_fill)
+			_disk_append(slice);
+
+		if (_gzip) {
+			std::string encoded;
+			if (!_gzip->write(slice.data(), slice.size(), &encoded)
+				|| (_streamed && !_gzip->finish(&encoded)))
+				return STREAM_ERROR;
+			slice.swap(encoded);
+		}
+		if (_chunked) {
+			_append_chunk(&_payload, &slice);
+			if (_streamed)
+				_payload += "0\r\n\r\n";
+		} else {
+			_payload.swap(slice);
+		}
+		if (_streamed && _disk_fill)
+			return STREAM_WAIT;
+		return ret == STREAM_WAIT && size() == 0 ? STREAM_WAIT : STREAM_OK;
+	}
+
+	/*
+		Once refill() waits, the rest of a direct body is moved by the
+		stream itself to the socket fd, see Stream::splice().
+	*/
+	bool	direct() const { return _direct && !_streamed; }
+	/*
+		The headers of a file are held back to leave with its first bytes.
+	*/
+	int		send_flags() const { return direct() && !_dynamic ? MSG_MORE : 0; }
+	STREAM	splice(int fd) {
+		STREAM ret = _stream->splice(fd);
+		while (_readahead() && ret == STREAM_WAIT)
+			ret = _stream->splice(fd);
+		if (ret == STREAM_EOF)
+			_streamed = true;
+		if (ret == STREAM_EOF || ret == STREAM_ERROR)
+			_release_slot();
+		return ret;
+	}
+
+	/*
+		Once its 101 is sent, the client is relayed to the upstream
+		connection of the response, see Server::Tunnel.
+	*/
+	bool	upgraded() const { return _tunnel != -1; }
+	int		take_tunnel() {
+		const int fd = _tunnel;
+		_tunnel = -1;
+		return fd;
+	}
+
 	void	add_header(const std::string &key, const std::string &value) {
 		if (value.find(WEBSERV_COOKIE_PREFIX) != std::string::npos)
 			_cookies_to_set.insert(SetCookiePair(key, value));
@@ -111,82 +363,532 @@ class Response {
 	}
 
 	bool	_cgi_pass(const Models::IBlock *block) {
-		std::string cgi_path = block->get_cgi(_req->get_uri());
-		if (cgi_path == "")
+		const std::string	script = block->get_root() + _req->get_uri();
+		const std::string	fastcgi = block->get_fastcgi(_req->get_uri());
+		const std::string	cgi = block->get_cgi(_req->get_uri());
+		const Models::IBlock::CGIWorkers *workers =
+			block->find_cgi_workers(_req->get_uri());
+		Server::Gateway		*job;
+
+		if (fastcgi == "" && cgi == "")
 			return false;
-		Server::CGI cgi = Server::CGI(cgi_path,
-			block->get_root() + _req->get_uri(), _req->get_query(),
-			_req->get_method());
-		if (!cgi.setup(_req->get_raw_request(), _req->get_headers())) {
-			set_status(HTTP::INTERNAL_SERVER_ERROR);
+		if (_from_disk(block) || _from_cache(block)) {
+			_release_slot();
 			return true;
 		}
-		if (!cgi.run()) {
-			if (cgi.timed_out())
-				set_status(HTTP::GATEWAY_TIMEOUT);
-			else
-				set_status(HTTP::INTERNAL_SERVER_ERROR);
+		if (!_acquire_slot(block))
+			return true;
+		if (fastcgi != "")
+			job = new Server::FastCGIRequest(fastcgi, script, _req->get_query(),
+				_req->get_method());
+		else if (workers)
+			job = new Server::CGIWorkerRequest(cgi, *workers, script,
+				_req->get_query(), _req->get_method());
+		else
+			job = new Server::CGI(cgi, script, _req->get_query(),
+				_req->get_method());
+		job->set_timeout(block->get_cgi_timeout());
+		return _start_gateway(block, job);
+	}
+
+	/*
+		Every request of a proxy_pass location goes to its upstreams.
+	*/
+	bool	_proxy_pass(const Models::IBlock *block) {
+		if (block->get_method(_req->get_method()) == false) {
+			set_status(HTTP::METHOD_NOT_ALLOWED);
 			return true;
 		}
-		_body = cgi.get_output();
-		for (Server::CGI::Headers::const_iterator it = cgi.get_headers().begin();
-			it != cgi.get_headers().end(); ++it)
+		if (_from_disk(block))
+			return true;
+		if (!_reactor) {
+			set_status(HTTP::BAD_GATEWAY);
+			return true;
+		}
+		return _start_gateway(block, new Server::ProxyRequest(
+			Server::get_proxy_upstream(block, _reactor), _req));
+	}
+
+	/*
+		The response stays pending() until the upstream headers of job are
+		received, see _gateway_progress().
+	*/
+	bool	_start_gateway(const Models::IBlock *block, Server::Gateway *job) {
+		// A streamed body is handed over as it comes, see write_body()
+		const bool			streamed = _req->body_streamed();
+		const std::string	body = streamed
+			? _req->take_body() : _req->get_raw_request();
+		if (!_reactor
+			|| !job->setup(block->get_cgi_env(), body, _req->get_headers(),
+				!streamed || _req->body_complete())
+			|| !job->run(_reactor, _owner)) {
+			set_status(job->failure());
+			delete job;
+			_release_slot();
+			_serve_stale();
+			return true;
+		}
+		_gateway = job;
+		_pending = true;
+		return true;
+	}
+
+	/*
+		Once the upstream headers are parsed the response is built, its body
+		is then streamed out of the gateway.
+	*/
+	bool	_gateway_progress() {
+		if (!_pending)
+			return true;
+		if (!_gateway->ready())
+			return false;
+		_pending = false;
+
+		if (_gateway->error()) {
+			_cache_abort();
+			set_status(_gateway->error());
+			delete _gateway;
+			_gateway = 0;
+			_release_slot();
+			_serve_stale();
+			return !_pending && _finalize();
+		}
+		Server::Gateway::Headers::const_iterator it =
+			_gateway->get_headers().begin();
+		for (; it != _gateway->get_headers().end(); ++it) {
+			if (strcasecmp(it->first.c_str(), "Status") == 0) {
+				int code = atoi(it->second.c_str());
+				if (code >= 100 && code < 600)
+					set_status(code);
+				continue;
+			}
 			add_header(it->first, it->second);
+		}
+		if (_status == HTTP::SWITCHING_PROTOCOLS)
+			return _switch_protocols();
+		if (_status >= 500 && _serve_stale()) {
+			_cache_abort();
+			delete _gateway;
+			_gateway = 0;
+			_release_slot();
+			return !_pending && _finalize();
+		}
+		if (_find_header("X-Accel-Redirect") || _find_header("X-Sendfile"))
+			return _internal_redirect();
+		if (_cache_fill)
+			_cache_start();
+		if (_disk)
+			_disk_start();
+		_stream = _gateway;
+		_dynamic = true;
+		return _finalize();
+	}
+
+	/*
+		The upstream accepted the upgrade, the bytes it sent past its
+		headers follow the 101.
+	*/
+	bool	_switch_protocols() {
+		std::string data;
+		_tunnel = _gateway->take_tunnel(&data);
+		delete _gateway;
+		_gateway = 0;
+		if (_tunnel == -1) {
+			set_status(HTTP::BAD_GATEWAY);
+			return _finalize();
+		}
+		_payload = _prepare_headers() + data;
 		return true;
 	}
 
-	bool _dump_files_dir(const std::string &path,
-		std::vector<struct dirent> *bucket) {
-		errno = 0;
+	/*
+		X-Accel-Redirect (uri) or X-Sendfile (path): the script body is
+		dropped, the file is served by the static path from an internal
+		location, with the other headers of the script.
+	*/
+	bool	_internal_redirect() {
+		_cache_abort();
+		std::string uri;
+		if (_find_header("X-Accel-Redirect"))
+			uri = _find_header("X-Accel-Redirect")->substr(
+				0, _find_header("X-Accel-Redirect")->find('?'));
+		else
+			uri = _master->get_vhost(_req->get_host())->get_internal_uri(
+				*_find_header("X-Sendfile"));
+		_erase_header("X-Accel-Redirect");
+		_erase_header("X-Sendfile");
+		delete _gateway;
+		_gateway = 0;
+		_release_slot();
 
-		DIR	*dirptr = opendir(path.c_str());
-		if (!dirptr) {
-			set_status(HTTP::INTERNAL_SERVER_ERROR);
-			if (errno == EACCES || errno == EPERM)
-				set_status(HTTP::FORBIDDEN);
-			if (errno == ENOENT)
-				set_status(HTTP::NOT_FOUND);
+		set_status(HTTP::OK);
+		const Models::IBlock *block = uri == "" ? 0
+			: _master->get_block_using_vhosts(_req->get_host(), uri);
+		if (!block || !block->get_internal()
+			|| (uri + "/").find("/../") != std::string::npos) {
+			set_status(HTTP::NOT_FOUND);
+			return _finalize();
+		}
+		_block = block;
+		_file_uri = uri;
+
+		_run_io(new Server::FileJob(block->get_root() + uri, true),
+			&Response::_internal_file_done);
+		return !_pending && _finalize();
+	}
+
+	void	_internal_file_done(Server::IOJob *job) {
+		Server::FileJob *file = static_cast<Server::FileJob *>(job);
+		if (file->stat_errno() || !S_ISREG(file->st().st_mode))
+			set_status(file->stat_errno() == EACCES ? 403 : 404);
+		else
+			_get_file(file);
+	}
+
+	/*
+		GET responses of the scripts of a block with cgi_cache are looked
+		up first.
+			-> true when served from the cache, or waiting for the request
+			filling the entry. Otherwise this response fills it.
+	*/
+	bool	_from_cache(const Models::IBlock *block) {
+		if (_req->get_method() != METH_GET || block->get_cgi_cache().ttl == 0
+			|| !_reactor || _cache_skip || _cache_fill)
 			return false;
+		const uint64_t now = Server::monotonic_ms();
+		_cache = Server::get_microcache(block, _reactor);
+		_cache_key = _request_key();
+
+		const Server::MicroCache::Entry *entry = _cache->lookup(_cache_key, now);
+		if (entry && entry->pass)
+			return false;
+		if (entry) {
+			set_status(entry->status);
+			Server::Gateway::Headers::const_iterator it = entry->headers.begin();
+			for (; it != entry->headers.end(); ++it)
+				add_header(it->first, it->second);
+			_headers["Age"] = _toString((now - entry->stored) / 1000);
+			_body = entry->body;
+			_dynamic = true;
+			return true;
 		}
+		if (_cache->filling(_cache_key)) {
+			_cache->wait(_cache_key, _owner);
+			_cache_wait = now + block->get_cgi_timeout() * 1000;
+			_reactor->schedule(_cache_wait, _owner);
+			_pending = true;
+			return true;
+		}
+		_cache->fill(_cache_key);
+		_cache_fill = new Server::MicroCache::Entry();
+		return false;
+	}
 
-		struct dirent *file;
-		while ((file = readdir(dirptr))) {
-			if (errno) {
-				set_status(500);
-				closedir(dirptr);
-				return false;
-			}
-			bucket->push_back(*file);
+	/*
+		GET responses of a block with disk_cache are served from its files
+		while fresh, expired ones are kept in case the upstream fails.
+			-> true when served from the disk, once its file is opened.
+	*/
+	bool	_from_disk(const Models::IBlock *block) {
+		if (_req->get_method() != METH_GET
+			|| block->get_disk_cache().path == "" || _disk || !_reactor)
+			return false;
+		_disk = Server::get_disk_cache(block, _reactor);
+		const Server::DiskCache::Entry *entry = _disk->lookup(_request_key());
+		if (!entry)
+			return false;
+		if (entry->expires <= time(NULL))
+			return (_disk_stale = true, false);
+		_run_io(_disk->open(_request_key()), &Response::_disk_hit);
+		return true;
+	}
+
+	/*
+		The file is gone, the request goes to the upstream.
+	*/
+	void	_disk_hit(Server::IOJob *job) {
+		if (_serve_disk(job))
+			return;
+		if (!_block->get_proxy_pass().empty())
+			_proxy_pass(_block);
+		else
+			_cgi_pass(_block);
+	}
+
+	/*
+		Status, headers and body of the file of the request, the body is
+		sent with sendfile() unless compressed.
+	*/
+	bool	_serve_disk(Server::IOJob *job) {
+		Server::DiskOpenJob *file = static_cast<Server::DiskOpenJob *>(job);
+		const int fd = file->take_fd();
+		if (fd == -1) {
+			_disk->drop(_request_key());
+			return false;
 		}
-		closedir(dirptr);
+		const Server::DiskOpenJob::Head &head = file->head();
+		_headers.clear();
+		_cookies_to_set.clear();
+		set_status(head.status);
+		Server::Gateway::Headers::const_iterator it = head.headers.begin();
+		for (; it != head.headers.end(); ++it)
+			add_header(it->first, it->second);
+		_headers["Age"] = _toString(time(NULL) - head.stored);
+		_stream = new FileStream(fd, head.offset, head.length);
+		_dynamic = true;
 		return true;
 	}
 
-	bool	_get_index(const Models::IBlock *block,
-		const std::string &path,
-		const std::vector<struct dirent> &files) {
-		Models::IBlock::IndexObject indexs = block->get_indexs();
-		if (indexs.size() <= 0)
+	/*
+		The upstream failed (error, 5xx), the expired file of the request
+		is served in its place when there is one. Its headers are dropped:
+		when the file is gone too, the error is rendered by the block.
+			-> true when there is, the response is then pending().
+	*/
+	bool	_serve_stale() {
+		if (!_disk_stale)
+			return false;
+		_disk_stale = false;
+		Server::IOJob *job = _disk->open(_request_key());
+		if (!job)
 			return false;
+		_headers.clear();
+		_cookies_to_set.clear();
+		_run_io(job, &Response::_stale_opened);
+		return true;
+	}
 
-		Models::IBlock::IndexObject::const_iterator it;
-		for (it = indexs.begin(); it != indexs.end(); it++) {
-			std::vector<struct dirent>::const_iterator	it_file;
-			for (it_file = files.begin(); it_file != files.end(); it_file++)
-				if (it_file->d_name == *it)
-					return _get_file_path(block, path + "/" + it_file->d_name);
+	void	_stale_opened(Server::IOJob *job) {
+		(void)_serve_disk(job);
+	}
+
+	std::string	_request_key() const {
+		return "GET " + _req->get_host() + " " + _req->get_uri()
+			+ "?" + _req->get_query();
+	}
+
+	/*
+		Scripts of a block with cgi_limit start once they hold one of its
+		slots, the others wait in its queue (503 once it is full).
+			-> true when the script may start now.
+	*/
+	bool	_acquire_slot(const Models::IBlock *block) {
+		if (block->get_cgi_limit().processes == 0 || !_reactor || _slot)
+			return true;
+		_throttle = Server::get_throttle(block, _reactor);
+		if (_throttle->acquire())
+			return (_slot = true);
+		const size_t timeout = _throttle->limit().timeout;
+		if (timeout == 0 || !_throttle->enqueue(_owner)) {
+			_overloaded(block);
+			return false;
 		}
+		_queued = Server::monotonic_ms() + timeout * 1000;
+		_reactor->schedule(_queued, _owner);
+		_pending = true;
 		return false;
 	}
 
-	bool	_get_autoindex(const std::vector<struct dirent>& files,
-		const std::string &path) {
-		Server::AutoIndexBuilder autoindex(files, path);
-		_body = autoindex.toString();
-		set_status(200);
+	/*
+		Out of the queue, either handed a slot or past its timeout.
+	*/
+	bool	_dequeued(bool granted) {
+		_queued = 0;
+		_pending = false;
+		if (!granted) {
+			_throttle->cancel(_owner);
+			_overloaded(_block);
+			return _finalize();
+		}
+		_slot = true;
+		_cgi_pass(_block);
+		return !_pending && _finalize();
+	}
+
+	void	_overloaded(const Models::IBlock *block) {
+		set_status(HTTP::SERVICE_UNAVAILABLE);
+		_headers["Retry-After"] = _toString(block->get_cgi_timeout());
+	}
+
+	void	_release_slot() {
+		if (!_slot)
+			return;
+		_slot = false;
+		_throttle->release();
+	}
+
+	/*
+		The entry waited for is stored (or given up), look it up again.
+		Past the deadline the script is run without the cache.
+	*/
+	bool	_cache_retry(bool expired) {
+		if (expired) {
+			_cache->cancel(_cache_key, _owner);
+			_cache_skip = true;
+		}
+		_cache_wait = 0;
+		_pending = false;
+		_cgi_pass(_block);
+		return !_pending && _finalize();
+	}
+
+	/*
+		Responses other than 200, setting cookies, or with a Cache-Control
+		forbidding it are not kept, max-age overrides the ttl of the block.
+	*/
+	void	_cache_start() {
+		const uint64_t now = Server::monotonic_ms();
+		size_t ttl = _block->get_cgi_cache().ttl;
+		const std::string *control = _find_header("Cache-Control");
+		if (_status != HTTP::OK || _find_header("Set-Cookie"))
+			ttl = 0;
+		else if (control)
+			ttl = _cache_control_ttl(*control, ttl);
+
+		_cache_fill->status = _status;
+		_cache_fill->stored = now;
+		_cache_fill->pass = ttl == 0;
+		if (_cache_fill->pass) {
+			// Remembered for the ttl of the block, misses stop waiting
+			_cache_fill->expires = now + _block->get_cgi_cache().ttl * 1000;
+			return _cache_store();
+		}
+		_cache_fill->expires = now + ttl * 1000;
+		Server::Gateway::Headers::const_iterator it =
+			_gateway->get_headers().begin();
+		for (; it != _gateway->get_headers().end(); ++it) {
+			if (strcasecmp(it->first.c_str(), "Status") != 0)
+				_cache_fill->headers.insert(*it);
+		}
+	}
+
+	static size_t	_cache_control_ttl(const std::string &control, size_t ttl) {
+		std::string value = control;
+		for (size_t i = 0; i < value.size(); ++i)
+			value[i] = tolower(value[i]);
+		if (value.find("no-store") != std::string::npos
+			|| value.find("no-cache") != std::string::npos
+			|| value.find("private") != std::string::npos)
+			return 0;
+		size_t age = value.find("s-maxage=");
+		if (age != std::string::npos)
+			return strtoul(value.c_str() + age + 9, NULL, 10);
+		age = value.find("max-age=");
+		if (age != std::string::npos)
+			return strtoul(value.c_str() + age + 8, NULL, 10);
+		return ttl;
+	}
+
+	void	_cache_append(const std::string &slice) {
+		_cache_fill->body += slice;
+		if (_cache_fill->body.size() > _cache->budget()) {
+			_cache_fill->pass = true;
+			std::string().swap(_cache_fill->body);
+			_cache_fill->headers.clear();
+			return _cache_store();
+		}
+		if (_streamed)
+			_cache_store();
+	}
+
+	void	_cache_store() {
+		_cache->store(_cache_key, _cache_fill);
+		delete _cache_fill;
+		_cache_fill = 0;
+	}
+
+	/*
+		The fill failed, the waiters look the key up again.
+	*/
+	void	_cache_abort() {
+		if (!_cache_fill)
+			return;
+		delete _cache_fill;
+		_cache_fill = 0;
+		_cache->abort(_cache_key);
+	}
+
+	/*
+		Same rules as the microcache, with the ttl of disk_cache.
+	*/
+	void	_disk_start() {
+		size_t ttl = _block->get_disk_cache().ttl;
+		const std::string *control = _find_header("Cache-Control");
+		if (_status != HTTP::OK || _find_header("Set-Cookie"))
+			return;
+		if (control)
+			ttl = _cache_control_ttl(*control, ttl);
+		if (ttl)
+			_disk_fill = _disk->begin(_request_key(), _status,
+				_gateway->get_headers(), ttl);
+	}
+
+	/*
+		Slices are written one batch at a time on the io pool, those coming
+		meanwhile wait in the fill (WEBSERV_IO_WRITE_BACKLOG bytes at most,
+		see refill()).
+	*/
+	void	_disk_append(const std::string &slice) {
+		if (!_disk->append(_disk_fill, slice))
+			return _disk_abort();
+		if (!_disk_fill->job)
+			_disk_flush();
+	}
+
+	void	_disk_flush() {
+		if ((_streamed || !_disk_fill->pending.empty())
+			&& !_disk->flush(_disk_fill, _streamed, _owner))
+			_disk_abort();
+	}
+
+	bool	_disk_written() {
+		if (!_disk->written(_disk_fill)) {
+			_disk_abort();
+		} else if (_disk_fill->last) {
+			_disk->commit(_disk_fill);
+			_disk_fill = 0;
+		} else {
+			_disk_flush();
+		}
 		return true;
 	}
 
+	void	_disk_abort() {
+		if (!_disk_fill)
+			return;
+		_disk->discard(_disk_fill);
+		_disk_fill = 0;
+	}
+
+	/*
+		job runs on the io pool, the response is pending() until next is
+		called with it on the loop. A full pool is answered with a 503.
+	*/
+	void	_run_io(Server::IOJob *job, IOContinuation next) {
+		if (_reactor && Server::get_io_pool(_reactor)->submit(job, _owner)) {
+			_io = job;
+			_io_next = next;
+			_pending = true;
+			return;
+		}
+		delete job;
+		set_status(HTTP::SERVICE_UNAVAILABLE);
+		_headers["Retry-After"] = _toString(WEBSERV_IO_RETRY_AFTER);
+	}
+
+	/*
+		The disk operation is done, next may start another one.
+	*/
+	bool	_io_progress() {
+		Server::IOJob	*job = _io;
+		IOContinuation	next = _io_next;
+		_io = 0;
+		_pending = false;
+		(this->*next)(job);
+		delete job;
+		return !_pending && _finalize();
+	}
+
 	bool	_do_redirection(const Models::IBlock *block) {
 		set_status(block->get_redirection_code());
 		_headers["Location"] = block->get_redirection();
@@ -200,50 +902,182 @@ class Response {
 		if (path[path.size() - 1] == '/')
 			return _get_dir(block, path);
 
-		errno = 0;
-		struct stat db;
-		if (stat(path.c_str(), &db) == -1) {
+		_run_io(new Server::FileJob(path, true), &Response::_file_done);
+		return true;
+	}
+
+	void	_file_done(Server::IOJob *job) {
+		Server::FileJob *file = static_cast<Server::FileJob *>(job);
+		if (file->stat_errno()) {
 			set_status(500);
-			if (errno == ENOENT || errno == ENOTDIR)
+			if (file->stat_errno() == ENOENT || file->stat_errno() == ENOTDIR)
 				set_status(404);
-			return true;
+			return;
 		}
 
-		switch (db.st_mode & S_IFMT) {
+		switch (file->st().st_mode & S_IFMT) {
 			case S_IFDIR:
-				return _get_dir(block, _req->get_uri());
-			default: {
-				_body = _get_file_content(path);
-				return true;
-			}
+				return (void)_get_dir(_block, _req->get_uri());
+			default:
+				return (void)_get_file(file);
+		}
+	}
+
+	/*
+		Files are sent from their fd (sendfile), a single byte range may be
+		asked for.
+	*/
+	bool	_get_file(Server::FileJob *file) {
+		if (file->open_errno()) {
+			set_status(HTTP::INTERNAL_SERVER_ERROR);
+			if (file->open_errno() == EACCES)
+				set_status(HTTP::FORBIDDEN);
+			return true;
 		}
-		set_status(404);
+
+		const int fd = file->take_fd();
+		const size_t size = file->st().st_size;
+		size_t offset = 0, length = size;
+		_headers["Accept-Ranges"] = "bytes";
+		if (!_parse_range(size, &offset, &length)) {
+			close(fd);
+			set_status(HTTP::REQUESTED_RANGE_NOT_SATISFIABLE);
+			_headers["Content-Range"] = "bytes */" + _toString(size);
+			return true;
+		}
+		if (length != size) {
+			set_status(HTTP::PARTIAL_CONTENT);
+			_headers["Content-Range"] = "bytes " + _toString(offset) + "-"
+				+ _toString(offset + length - 1) + "/" + _toString(size);
+		}
+		// FileJob read the first window ahead
+		_file = new FileStream(fd, offset, length,
+			offset == 0 ? WEBSERV_IO_READAHEAD : 0);
+		_stream = _file;
 		return true;
 	}
 
-	bool	_get_dir(const Models::IBlock *block, const std::string &path) {
-		std::vector<struct dirent> files;
-		if (!_dump_files_dir(path, &files))
+	/*
+		The next window of a file body is read ahead on the io pool while
+		the previous one is sent, its stream waits for it at worst. When
+		the pool is full, sendfile() reads it.
+			-> true when the stream may go on right away.
+	*/
+	bool	_readahead() {
+		off_t	offset;
+		size_t	length;
+		if (!_file || !_file->prefetch(WEBSERV_IO_READAHEAD, &offset, &length))
 			return false;
-		if (_get_index(block, path, files))
+		Server::IOJob *job = new Server::ReadaheadJob(_file->fd(), offset, length);
+		if (!Server::get_io_pool(_reactor)->submit(job, _owner)) {
+			delete job;
+			_file->prefetched();
 			return true;
-		if (block->get_autoindex() == true)
-			return _get_autoindex(files, path);
-		set_status(404);
+		}
+		_ahead = job;
 		return false;
 	}
 
+	bool	_readahead_done() {
+		delete _ahead;
+		_ahead = 0;
+		_file->prefetched();
+		return true;
+	}
+
+	/*
+		Range: bytes=first-[last] or bytes=-suffix, lists of ranges and
+		other units are ignored (whole file).
+			-> false when the range starts after the end of the file.
+	*/
+	bool	_parse_range(size_t size, size_t *offset, size_t *length) const {
+		const std::string range = _req->get_header_value("range");
+		if (range.compare(0, 6, "bytes=") != 0
+			|| range.find(',') != std::string::npos)
+			return true;
+		const size_t dash = range.find('-', 6);
+		if (dash == std::string::npos)
+			return true;
+		const std::string first = range.substr(6, dash - 6);
+		const std::string last = range.substr(dash + 1);
+		if ((first == "" && last == "")
+			|| first.find_first_not_of("0123456789") != std::string::npos
+			|| last.find_first_not_of("0123456789") != std::string::npos)
+			return true;
+
+		if (first == "") {
+			size_t suffix = strtoull(last.c_str(), NULL, 10);
+			if (suffix == 0)
+				return false;
+			*length = std::min(suffix, size);
+			*offset = size - *length;
+			return true;
+		}
+		size_t start = strtoull(first.c_str(), NULL, 10);
+		if (start >= size)
+			return false;
+		size_t end = last == "" ? size - 1
+			: std::min(static_cast<size_t>(strtoull(last.c_str(), NULL, 10)), size - 1);
+		if (end < start)
+			return true;
+		*offset = start;
+		*length = end - start + 1;
+		return true;
+	}
+
+	bool	_get_dir(const Models::IBlock *block, const std::string &path) {
+		struct stat	known;
+		const bool	list = block->get_autoindex();
+		const bool	cached = list && Server::AUTOINDEX_CACHE.known(path, &known);
+		_run_io(new Server::DirJob(path, block->get_indexs(), list,
+			cached ? &known : 0), &Response::_dir_done);
+		return true;
+	}
+
+	/*
+		The first index found is served, otherwise the directory is listed
+		with autoindex.
+	*/
+	void	_dir_done(Server::IOJob *job) {
+		Server::DirJob *dir = static_cast<Server::DirJob *>(job);
+		if (dir->error()) {
+			set_status(HTTP::INTERNAL_SERVER_ERROR);
+			if (dir->error() == EACCES || dir->error() == EPERM)
+				set_status(HTTP::FORBIDDEN);
+			if (dir->error() == ENOENT)
+				set_status(HTTP::NOT_FOUND);
+			return;
+		}
+		if (dir->index() != "")
+			return (void)_get_file_path(_block, dir->path() + "/" + dir->index());
+		if (_block->get_autoindex() == false)
+			return set_status(404);
+		if (!dir->stat_ok())
+			return set_status(HTTP::INTERNAL_SERVER_ERROR);
+		// Evicted since the job started, the entries are read after all
+		if (!dir->listed() && !Server::AUTOINDEX_CACHE.holds(dir->st()))
+			return (void)_get_dir(_block, dir->path());
+		_stream = new Server::AutoIndexBuilder(dir->entries(), dir->st(),
+			dir->path());
+		_dynamic = true;
+		set_status(200);
+	}
+
 	void	DELETE(const Models::IBlock *block) {
 		const std::string path = _build_method_path(block, METH_DELETE, true);
 		if (path == "")
 			return;
 
-		errno = 0;
-		if (remove(path.c_str()) == -1) {
+		_run_io(new Server::RemoveJob(path), &Response::_remove_done);
+	}
+
+	void	_remove_done(Server::IOJob *job) {
+		const int error = static_cast<Server::RemoveJob *>(job)->error();
+		if (error) {
 			set_status(500);
-			if (errno == ENOENT || errno == ENOTDIR)
+			if (error == ENOENT || error == ENOTDIR)
 				set_status(404);
-			else if (errno == EACCES || errno == EPERM || errno == 39)
+			else if (error == EACCES || error == EPERM || error == ENOTEMPTY)
 				set_status(403);
 			return;
 		}
@@ -259,27 +1093,37 @@ class Response {
 			return;
 
 		_handle_upload(block, path);
+		if (!_pending)
+			_upload_status();
+	}
+
+	void	_upload_status() {
 		if (_status != HTTP::CONFLICT && _status != HTTP::FORBIDDEN
 			&& _status != HTTP::NO_CONTENT)
 			set_status(HTTP::METHOD_NOT_ALLOWED);
 	}
 
+	void	_upload_done(Server::IOJob *job) {
+		set_status(static_cast<Server::UploadJob *>(job)->status());
+		_upload_status();
+	}
+
 	void	_handle_upload(const Models::IBlock *block, const std::string &path) {
 		if (block->get_upload_pass() == "") {
 			set_status(HTTP::FORBIDDEN);
 			return;
 		}
-		const std::string content_type = _req->get_header_value("content-type");
-		if (content_type != "") {
-			if (content_type.find("multipart/form-data") != std::string::npos)
-				return _handle_upload_multipart(path);
-			else if (content_type == "application/x-www-form-urlencoded")
-				return;
-		}
-		_create_file(path, _req->get_raw_request());
+		if (_req->content_type_is("multipart/form-data"))
+			return _handle_upload_multipart(path);
+		else if (_req->content_type_is("application/x-www-form-urlencoded"))
+			return;
+		Server::UploadJob::FileList files;
+		files.push_back(std::make_pair(path, _req->get_raw_request()));
+		_run_io(new Server::UploadJob(files), &Response::_upload_done);
 	}
 
 	void	_handle_upload_multipart(const std::string &path) {
+		Server::UploadJob::FileList files;
 		std::string body = _req->get_raw_request();
 		const std::string boundary = _req->get_raw_request().substr(
 				0, _req->get_raw_request().find("\r\n"));
@@ -298,44 +1142,42 @@ class Response {
 				filename_pos + 10,
 				content_disposition.find("\"", filename_pos + 10) - filename_pos - 10);
 
-			const std::string file_path = path + filename;
-			if (!_create_file(file_path, body.substr(0, body.find("\r\n")))) {
-				return;
-			}
+			files.push_back(std::make_pair(path + filename,
+				body.substr(0, body.find("\r\n"))));
 			body.erase(0, body.find("\r\n") + 2);
 		}
-		set_status(HTTP::NO_CONTENT);
-		return;
+		_run_io(new Server::UploadJob(files), &Response::_upload_done);
 	}
 
-	bool		_create_file(const std::string &path, const std::string &content) {
-		if (access(path.c_str(), F_OK) == 0) {
-			set_status(HTTP::CONFLICT);
-			return false;
-		}
-
-		std::ofstream o(path.c_str());
-		if (!o) {
-			set_status(HTTP::INTERNAL_SERVER_ERROR);
-			return false;
-		}
-  		o << content;
-		if (o.bad()) {
-			set_status(HTTP::INTERNAL_SERVER_ERROR);
-			return false;
+	bool	_finalize() {
+		if (_status >= 400 && !_stream && _prepare_error())
+			return true;
+		_resolve_content_type();
+		if (_should_compress())
+			_start_compression();
+		else if (_stream && _stream->length() < 0)
+			_chunked = true;
+		else if (_stream && !_cache_fill && !_disk_fill)
+			_direct = _stream->direct();
+		_payload = _prepare_headers();
+		if (!_stream) {
+			_payload += _body;
+			_payload += "\r\n";
 		}
-		o.close();
-		set_status(HTTP::NO_CONTENT);
-		usleep(50);
 		return true;
 	}
 
 	void	invoke() {
 		const Models::IBlock *block = _master->get_block_using_vhosts(
 			_req->get_host(), _req->get_uri());
+		_block = block;
 
-		if (block->get_body_limit() < _req->get_raw_request().size())
+		if (block->get_internal())
+			return (set_status(HTTP::NOT_FOUND));
+		if (block->get_body_limit() < _req->get_body_length())
 			return (set_status(HTTP::PAYLOAD_TOO_LARGE));
+		if (!block->get_proxy_pass().empty())
+			return (void)_proxy_pass(block);
 
 		if (_req->get_method() == METH_GET)
 			GET(block);
@@ -347,21 +1189,142 @@ class Response {
 			set_status(HTTP::METHOD_NOT_ALLOWED);
 	}
 
+	/*
+		Error responses are pre-rendered at config load, the block (location
+		or server) is only resolved here when invoke() did not run.
+			-> Extra headers (cookies, ...) fallback on a regular render.
+	*/
+	bool	_prepare_error() {
+		if (!_block) {
+			_block = _req ? _master->get_block_using_vhosts(
+				_req->get_host(), _req->get_uri()) : _master;
+		}
+
+		const RenderedResponse *rendered = _block->get_rendered_error(_status);
+		if (rendered && _headers.empty() && _cookies_to_set.empty()) {
+			const bool closed = !_req || _req->closed();
+			rendered->head(closed, &_payload);
+			_rendered = &rendered->get(closed);
+			return true;
+		}
+
+		_body = _block->get_error_page(_status);
+		if (_body == "")
+			_body = generate_status_page(_status);
+		return false;
+	}
+
+	/*
+		Scripts may send their headers with any case (PHP: Content-type).
+	*/
+	const std::string *_find_header(const std::string &key) const {
+		Headers::const_iterator it = _headers.begin();
+		for (; it != _headers.end(); ++it) {
+			if (it->first.size() == key.size()
+				&& strncasecmp(it->first.c_str(), key.c_str(), key.size()) == 0)
+				return &it->second;
+		}
+		return 0;
+	}
+
+	void	_erase_header(const std::string &key) {
+		Headers::iterator it = _headers.begin();
+		while (it != _headers.end()) {
+			if (strcasecmp(it->first.c_str(), key.c_str()) == 0)
+				_headers.erase(it++);
+			else
+				++it;
+		}
+	}
+
+	void	_resolve_content_type() {
+		const std::string *content_type = _find_header("Content-Type");
+		if (content_type && *content_type != "")
+			return;
+
+		if (_status != HTTP::OK && _status != HTTP::PARTIAL_CONTENT)
+			_headers["Content-Type"] = get_mime_type(".html");
+		else if (_dynamic)
+			_headers["Content-Type"] = get_mime_type(".html");
+		else if (_file_uri != "")
+			_headers["Content-Type"] = get_mime_type(_file_uri);
+		else if (_req)
+			_headers["Content-Type"] = get_mime_type(_req->get_uri());
+		else
+			_headers["Content-Type"] = get_mime_type("/");
+	}
+
+	/*
+		Only dynamic bodies (CGI, autoindex) are compressed on the fly,
+		static files are left untouched.
+	*/
+	bool	_should_compress() {
+		if (!_req || !_block || !_dynamic || _status != HTTP::OK)
+			return false;
+		if (!_block->get_gzip())
+			return false;
+		ssize_t length = _stream ? _stream->length() : _body.size();
+		if (length >= 0
+			&& static_cast<size_t>(length) < _block->get_gzip_min_length())
+			return false;
+		if (_find_header("Content-Encoding") || _find_header("Content-Length"))
+			return false;
+
+		const std::string *content_type = _find_header("Content-Type");
+		if (!content_type || !_block->gzip_type_allowed(*content_type))
+			return false;
+		_encoding = negociate_encoding(_req->get_header_value("accept-encoding"));
+		return _encoding != ENCODING_IDENTITY;
+	}
+
+	/*
+		The body is fed to the encoder by slices, as refill() pulls them,
+		every slice of compressed output is sent as its own chunk.
+	*/
+	void	_start_compression() {
+		Gzip *gzip = new Gzip(_encoding, _block->get_gzip_comp_level());
+		if (!gzip->ready()) {
+			delete gzip;
+			if (_stream && _stream->length() < 0)
+				_chunked = true;
+			return;
+		}
+		if (!_stream)
+			_stream = new StringStream(&_body);
+		_gzip = gzip;
+		_chunked = true;
+		_headers["Content-Encoding"] = gzip->name();
+		_headers["Vary"] = "Accept-Encoding";
+	}
+
+	static void	_append_chunk(std::string *bucket, std::string *chunk) {
+		if (chunk->size() == 0)
+			return;
+		char	size[20];
+		snprintf(size, sizeof(size), "%lx\r\n",
+			static_cast<unsigned long>(chunk->size()));
+		*bucket += size;
+		*bucket += *chunk;
+		*bucket += "\r\n";
+		chunk->clear();
+	}
+
 	std::string _prepare_headers() {
-		if (!_req || (_req &&_req->closed()))
+		if (_tunnel != -1)
+			_headers["Connection"] = "Upgrade";
+		else if (!_req || (_req &&_req->closed()))
 			_headers["Connection"] = "closed";
 		else
 			_headers["Connection"] = "keep-alive";
 
-		if (_headers["Content-Type"] == "") {
-			if (_status != HTTP::OK)
-				_headers["Content-Type"] = get_mime_type(".html");
-			else if (_req)
-				_headers["Content-Type"] = get_mime_type(_req->get_uri());
-			else
-				_headers["Content-Type"] = get_mime_type("/");
-		}
-		_headers["Content-Length"] = _toString(_body.size());
+		_erase_header("Content-Length");
+		_erase_header("Transfer-Encoding");
+		if (_chunked)
+			_headers["Transfer-Encoding"] = "chunked";
+		else if (_stream)
+			_headers["Content-Length"] = _toString(_stream->length());
+		else if (_tunnel == -1)
+			_headers["Content-Length"] = _toString(_body.size());
 		_set_header_date();
 		_headers["Server"] = WEBSERV_SERVER_VERSION;
 		#ifdef WEBSERV_BUILD_COMMIT
@@ -387,11 +1350,7 @@ class Response {
 	}
 
 	void	_set_header_date() {
-		std::time_t t = std::time(NULL);
-		char buf[30];
-
-		strftime(buf, sizeof(buf), "%a, %d %b %Y %T %Z", std::localtime(&t));
-		_headers["Date"] = std::string(buf);
+		_headers["Date"] = http_date();
 	}
 
 	static std::string _toString(size_t size) {
@@ -399,24 +1358,6 @@ class Response {
 		ss << size;
 		return ss.str();
 	}
-
-	std::string _get_file_content(const std::string &path) {
-		int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK);
-		if (fd == -1) {
-			set_status(HTTP::INTERNAL_SERVER_ERROR);
-			if (errno == EACCES)
-				set_status(HTTP::FORBIDDEN);
-			return "";
-		}
-
-		ssize_t n;
-		char buf[1024];
-		std::stringstream ss;
-		while ((n = read(fd, buf, sizeof(buf))) > 0)
-			ss.write(buf, n);
-		close(fd);
-		return ss.str();
-	}
 };
 }  // namespace HTTP
 }  // namespace Webserv
@@ -4,6 +4,7 @@
 #include <map>
 #include <ctime>
 #include <string>
+#include <utility>
 
 #include "consts.hpp"
 
@@ -36,4 +37,64 @@ class Session {
 	}
 };
 
+/*
+	Sessions of a listener: they outlive the configuration it serves.
+*/
+class Sessions {
+	typedef std::map<std::string, Session *>	SessionObject;
+
+ private:
+	SessionObject	_sessions;
+
+ public:
+	Sessions() {}
+
+	~Sessions() {
+		SessionObject::iterator it = _sessions.begin();
+		for (; it != _sessions.end(); it++)
+			delete it->second;
+	}
+
+	void	collect() {
+		const time_t now = time(0);
+		SessionObject::iterator it = _sessions.begin();
+		while (it != _sessions.end()) {
+			if (!it->second->alive(now)) {
+				delete it->second;
+				_sessions.erase(it++);
+			} else {
+				++it;
+			}
+		}
+	}
+
+	/*
+		-> 0 when sid is already taken.
+	*/
+	Session	*add(const std::string &sid) {
+		Session *session = new Session(sid);
+		std::pair<SessionObject::iterator, bool> ret =
+			_sessions.insert(std::pair<std::string, Session *>(sid, session));
+		if (ret.second)
+			return session;
+		delete session;
+		return 0;
+	}
+
+	void	del(const std::string &sid) {
+		SessionObject::iterator it = _sessions.find(sid);
+		if (it != _sessions.end()) {
+			delete it->second;
+			_sessions.erase(it);
+		}
+	}
+
+	Session	*get(const std::string &sid) {
+		SessionObject::iterator it = _sessions.find(sid);
+		if (it != _sessions.end())
+			return it->second;
+		return 0;
+	}
+};
+
 #endif  // HTTP_SESSION_HPP_
@@ -0,0 +1,178 @@
+/*
+	Interface for response bodies produced while they are sent.
+		-> Response pulls slices from it each time the socket is writable.
+*/
+
+#ifndef HTTP_STREAM_HPP_
+#define HTTP_STREAM_HPP_
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/sendfile.h>
+
+#include <string>
+#include <algorithm>
+
+#include "consts.hpp"
+#include "http/enums.hpp"
+
+namespace Webserv {
+namespace HTTP {
+
+class Stream {
+ public:
+	virtual ~Stream() {}
+
+	/*
+		Append the next slice of the body to bucket.
+			-> STREAM_EOF once the last slice has been appended.
+	*/
+	virtual STREAM	read(std::string *bucket) = 0;
+
+	/*
+		Total body size when known in advance, -1 otherwise (chunked).
+	*/
+	virtual ssize_t	length() const { return -1; }
+
+	/*
+		Streams read from a pipe may move the rest of a body of known
+		length straight to the socket (splice(2)) once direct() agreed,
+		the response then calls splice() instead of read().
+			-> STREAM_OK when fd is full, STREAM_WAIT while nothing is
+			readable, STREAM_EOF once the body is sent.
+	*/
+	virtual bool	direct() { return false; }
+	virtual STREAM	splice(int fd) {
+		(void)fd;
+		return STREAM_ERROR;
+	}
+};
+
+/*
+	Body already in memory, served by slices (e.g. to be compressed).
+*/
+class StringStream : public Stream {
+ private:
+	std::string	_source;
+	size_t		_offset;
+
+ public:
+	explicit StringStream(std::string *source) : _offset(0) {
+		_source.swap(*source);
+	}
+
+	STREAM	read(std::string *bucket) {
+		size_t len = _source.size() - _offset;
+		if (len > WEBSERV_STREAM_CHUNK_SIZE)
+			len = WEBSERV_STREAM_CHUNK_SIZE;
+		bucket->append(_source, _offset, len);
+		_offset += len;
+		return _offset < _source.size() ? STREAM_OK : STREAM_EOF;
+	}
+
+	ssize_t	length() const { return _source.size(); }
+};
+
+/*
+	Range of an opened file (static files), sent with sendfile() once
+	direct(), the fd is closed with the stream.
+
+	Only its first cached bytes may be known to be read ahead: the stream
+	then waits (STREAM_WAIT) at the end of what was read ahead, the owner
+	reads the next window off the loop, see prefetch() and prefetched().
+*/
+class FileStream : public Stream {
+ private:
+	const int		_fd;
+	off_t			_offset;
+	size_t			_left;
+	const size_t	_length;
+	bool			_direct;
+
+	// End of the bytes read ahead, of the window being read
+	off_t			_ready;
+	off_t			_asked;
+
+ public:
+	FileStream(int fd, off_t offset, size_t length,
+		size_t cached = static_cast<size_t>(-1))
+	:	_fd(fd), _offset(offset), _left(length), _length(length),
+		_direct(false),
+		_ready(offset + std::min(length, cached)), _asked(_ready) {}
+
+	~FileStream() { close(_fd); }
+
+	STREAM	read(std::string *bucket) {
+		if (_direct || !_available())
+			return _left ? STREAM_WAIT : STREAM_EOF;
+		char	buffer[WEBSERV_STREAM_CHUNK_SIZE];
+		ssize_t	n = pread(_fd, buffer,
+			std::min(_available(), sizeof(buffer)), _offset);
+		if (n <= 0)
+			return _left ? STREAM_ERROR : STREAM_EOF;
+		bucket->append(buffer, n);
+		_offset += n;
+		_left -= n;
+		return _left ? STREAM_OK : STREAM_EOF;
+	}
+
+	ssize_t	length() const { return _length; }
+
+	bool	direct() {
+		_direct = _left > 0;
+		return _direct;
+	}
+
+	STREAM	splice(int fd) {
+		while (_left > 0) {
+			if (!_available())
+				return STREAM_WAIT;
+			ssize_t n = sendfile(fd, _fd, &_offset, _available());
+			if (n > 0) {
+				_left -= n;
+				continue;
+			}
+			if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				return STREAM_OK;
+			// The file was truncated meanwhile, or the client left
+			return STREAM_ERROR;
+		}
+		return STREAM_EOF;
+	}
+
+	int		fd() const { return _fd; }
+
+	/*
+		Next window to read ahead, once less than half of one is left in
+		front of the bytes sent.
+			-> false while a window is being read, or the range is.
+	*/
+	bool	prefetch(size_t window, off_t *offset, size_t *length) {
+		const off_t end = _offset + _left;
+		if (_asked != _ready || _asked >= end
+			|| static_cast<size_t>(_ready - _offset) > window / 2)
+			return false;
+		*offset = _asked;
+		*length = std::min(window, static_cast<size_t>(end - _asked));
+		_asked += *length;
+		return true;
+	}
+
+	/*
+		The window asked by prefetch() was read, or will not be.
+	*/
+	void	prefetched() { _ready = _asked; }
+
+ private:
+	size_t	_available() const {
+		if (_ready <= _offset)
+			return 0;
+		return std::min(_left, static_cast<size_t>(_ready - _offset));
+	}
+};
+
+}  // namespace HTTP
+}  // namespace Webserv
+
+#endif  // HTTP_STREAM_HPP_
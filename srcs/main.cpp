@@ -1,7 +1,10 @@
 #include <iostream>
 
 #include "conf/parser.hpp"
+#include "conf/snapshot.hpp"
 #include "server/poll.hpp"
+#include "server/master.hpp"
+#include "server/affinity.hpp"
 
 int	main(int ac, char **av) {
 	Webserv::Conf::Parser	parser;
@@ -10,13 +13,30 @@ int	main(int ac, char **av) {
 	}
 
 	Webserv::Server::Poll poll;
+	Webserv::Conf::Snapshot	*snapshot =
+		new Webserv::Conf::Snapshot(&parser);
 	try {
-		poll.init(parser.get_servers());
-		parser.clear();
-		return poll.run();
+		poll.listen(snapshot, ac, av);
+		snapshot->release();
 	} catch (std::exception &e) {
-		parser.clear();
+		snapshot->release();
+
+		std::cerr << "fatal: " << e.what() << std::endl;
+		return 1;
+	}
 
+	try {
+		if (poll.get_snapshot()->get_processes().workers > 0) {
+			Webserv::Server::Master	master(&poll, av);
+			int						status;
+			if (master.run(&status))
+				return status;
+		} else {
+			Webserv::Server::pin_worker(poll.get_snapshot()->get_processes(), 0);
+			poll.start();
+		}
+		return poll.run();
+	} catch (std::exception &e) {
 		std::cerr << "fatal: " << e.what() << std::endl;
 		return 1;
 	}
@@ -12,17 +12,54 @@
 #include <map>
 #include <vector>
 #include <string>
+#include <sstream>
 #include <utility>
 
 #include "consts.hpp"
+#include "http/rendered.hpp"
 
 namespace Webserv {
 namespace Models {
 class IBlock {
  public:
-	typedef std::map<int, std::string> 			ErrorPagesObject;
+	typedef std::map<int, const std::string *>	ErrorPagesObject;
+	typedef std::map<int, const HTTP::RenderedResponse *>	RenderedObject;
 	typedef std::map<std::string, std::string>	CGIObject;
+
+	// Pre-forked workers of a cgi mapping, recycled after requests (0: never)
+	struct CGIWorkers {
+		size_t	min;
+		size_t	max;
+		size_t	requests;
+	};
+	typedef std::map<std::string, CGIWorkers>	CGIWorkersObject;
+
+	// Microcache of the script responses, disabled while ttl is 0
+	struct CGICache {
+		size_t	ttl;
+		size_t	size;
+	};
+
+	// Scripts of the block running at once, then queued (timeout in seconds)
+	struct CGILimit {
+		size_t	processes;
+		size_t	queue;
+		size_t	timeout;
+	};
+
+	// Disk cache of the script and upstream responses, disabled without path
+	struct CacheDir {
+		std::string	path;
+		size_t		ttl;
+		size_t		size;
+	};
+
+	// Upstreams of proxy_pass, and how requests are spread over them
+	enum Balance { BALANCE_ROUND_ROBIN, BALANCE_LEAST_CONN, BALANCE_HASH };
+	typedef std::vector<std::string>			ProxyObject;
 	typedef std::vector<std::string>			IndexObject;
+	typedef std::vector<std::string>			MimeObject;
+	typedef std::vector<std::string>			EnvObject;
 
  protected:
 	std::string _name;
@@ -37,10 +74,26 @@ class IBlock {
 
 	bool 		_methods_allowed[WEBSERV_METHODS_SUPPORTED];
 	bool 		_autoindex;
+	bool		_internal;
+
+	bool		_gzip;
+	int			_gzip_comp_level;
+	size_t		_gzip_min_length;
+	MimeObject	_gzip_types;
 
 	IndexObject 		_indexs;
 	ErrorPagesObject	_error_pages;
+	RenderedObject		_rendered_errors;
 	CGIObject			_cgi;
+	CGIWorkersObject	_cgi_workers;
+	CGICache			_cgi_cache;
+	CGILimit			_cgi_limit;
+	size_t				_cgi_timeout;
+	CacheDir			_disk_cache;
+	CGIObject			_fastcgi;
+	EnvObject			_cgi_env;
+	ProxyObject			_proxy_pass;
+	Balance				_proxy_balance;
 
  public:
 	IBlock()
@@ -50,9 +103,24 @@ class IBlock {
 		_redirection(""), _redirection_code(0),
 		_body_limit(1000000),
 		_autoindex(false),
+		_internal(false),
+		_gzip(false),
+		_gzip_comp_level(WEBSERV_GZIP_COMP_LEVEL),
+		_gzip_min_length(WEBSERV_GZIP_MIN_LENGTH),
+		_gzip_types(1, "text/html"),
 		_indexs(),
 		_error_pages(),
-		_cgi() {
+		_rendered_errors(),
+		_cgi(),
+		_cgi_workers(),
+		_cgi_cache(),
+		_cgi_limit(),
+		_cgi_timeout(WEBSERV_CGI_TIMEOUT),
+		_disk_cache(),
+		_fastcgi(),
+		_cgi_env(),
+		_proxy_pass(),
+		_proxy_balance(BALANCE_ROUND_ROBIN) {
 		char cwd[PATH_MAX + 1];
 		if (getcwd(cwd, sizeof(cwd)) != NULL)
 			_root = cwd;
@@ -103,6 +171,35 @@ class IBlock {
 	void set_autoindex(bool value) { _autoindex = value; }
 	const bool &get_autoindex() const { return _autoindex; }
 
+	// Internal, only reached through X-Accel-Redirect / X-Sendfile
+	void set_internal(bool value) { _internal = value; }
+	const bool &get_internal() const { return _internal; }
+
+	// Gzip
+	void set_gzip(bool value) { _gzip = value; }
+	const bool &get_gzip() const { return _gzip; }
+	void set_gzip_comp_level(int level) { _gzip_comp_level = level; }
+	const int &get_gzip_comp_level() const { return _gzip_comp_level; }
+	void set_gzip_min_length(size_t length) { _gzip_min_length = length; }
+	const size_t &get_gzip_min_length() const { return _gzip_min_length; }
+	void set_gzip_types(const MimeObject &types) { _gzip_types = types; }
+	const MimeObject &get_gzip_types() const { return _gzip_types; }
+	bool	gzip_type_allowed(const std::string &content_type) const {
+		const std::string mime = content_type.substr(0, content_type.find(';'));
+		MimeObject::const_iterator it = _gzip_types.begin();
+		for (; it != _gzip_types.end(); it++) {
+			if (*it == "*" || *it == mime)
+				return true;
+		}
+		return false;
+	}
+	void	inherit_gzip(const IBlock &parent) {
+		_gzip = parent._gzip;
+		_gzip_comp_level = parent._gzip_comp_level;
+		_gzip_min_length = parent._gzip_min_length;
+		_gzip_types = parent._gzip_types;
+	}
+
 	// Index(s)
 	const IndexObject &get_indexs() const { return _indexs; }
 	void							add_index(const std::string &index) {
@@ -111,13 +208,31 @@ class IBlock {
 
 	// Error Pages
 	void	set_error_page(int code, const std::string &source) {
-		_error_pages[code] = source;
+		_error_pages[code] = HTTP::intern_error_page(source);
 	}
-	const std::string get_error_page(int code) const {
+	const ErrorPagesObject	&get_error_pages() const { return _error_pages; }
+	const std::string &get_error_page(int code) const {
+		static const std::string	none;
 		ErrorPagesObject::const_iterator it = _error_pages.find(code);
 		if (it != _error_pages.end())
+			return *it->second;
+		return none;
+	}
+
+	/*
+		Render every custom error page once, default pages are shared.
+	*/
+	void	render_error_pages() {
+		_rendered_errors.clear();
+		ErrorPagesObject::const_iterator it = _error_pages.begin();
+		for (; it != _error_pages.end(); ++it)
+			_rendered_errors[it->first] = HTTP::render_error_page(it->first, it->second);
+	}
+	const HTTP::RenderedResponse *get_rendered_error(int code) const {
+		RenderedObject::const_iterator it = _rendered_errors.find(code);
+		if (it != _rendered_errors.end())
 			return it->second;
-		return "";
+		return HTTP::get_rendered_status_page(code);
 	}
 
 	// CGI
@@ -134,6 +249,78 @@ class IBlock {
 			return it->second;
 		return "";
 	}
+
+	// CGI workers
+	void			set_cgi_workers(const std::string& extension,
+		const CGIWorkers &workers) {
+		_cgi_workers[extension] = workers;
+	}
+	const CGIWorkersObject &get_cgi_workers() const { return _cgi_workers; }
+	const CGIWorkers *find_cgi_workers(const std::string &uri) const {
+		const std::string ext = uri.find(".") != std::string::npos
+			? uri.substr(uri.find("."), uri.size()) : "";
+		CGIWorkersObject::const_iterator it = _cgi_workers.find(ext);
+		if (it != _cgi_workers.end())
+			return &it->second;
+		return 0;
+	}
+
+	/*
+		Request independent part of the CGI environment (KEY=VALUE), built
+		once for the block, server is the one it belongs to.
+	*/
+	void	build_cgi_env(const IBlock &server) {
+		std::stringstream port;
+		port << server._port;
+
+		_cgi_env.clear();
+		_cgi_env.push_back("GATEWAY_INTERFACE=CGI/1.1");
+		_cgi_env.push_back("REDIRECT_STATUS=200");
+		_cgi_env.push_back("SERVER_PROTOCOL=HTTP/1.1");
+		_cgi_env.push_back("SERVER_SOFTWARE=" WEBSERV_SERVER_VERSION);
+		_cgi_env.push_back("SERVER_NAME=" + server._name);
+		_cgi_env.push_back("SERVER_PORT=" + port.str());
+		_cgi_env.push_back("DOCUMENT_ROOT=" + _root);
+	}
+	const EnvObject &get_cgi_env() const { return _cgi_env; }
+
+	// CGI cache
+	void			set_cgi_cache(const CGICache &cache) { _cgi_cache = cache; }
+	const CGICache	&get_cgi_cache() const { return _cgi_cache; }
+
+	// CGI limits, no limit while processes is 0
+	void			set_cgi_limit(const CGILimit &limit) { _cgi_limit = limit; }
+	const CGILimit	&get_cgi_limit() const { return _cgi_limit; }
+	void			set_cgi_timeout(size_t seconds) { _cgi_timeout = seconds; }
+	size_t			get_cgi_timeout() const { return _cgi_timeout; }
+
+	// Disk cache
+	void			set_disk_cache(const CacheDir &cache) { _disk_cache = cache; }
+	const CacheDir	&get_disk_cache() const { return _disk_cache; }
+
+	// Proxy
+	void				add_proxy_pass(const std::string &address) {
+		_proxy_pass.push_back(address);
+	}
+	const ProxyObject	&get_proxy_pass() const { return _proxy_pass; }
+	void				set_proxy_balance(Balance balance) { _proxy_balance = balance; }
+	Balance				get_proxy_balance() const { return _proxy_balance; }
+
+	// FastCGI
+	void			set_fastcgi(const std::string& extension,
+		const std::string& address) {
+		_fastcgi[extension] = address;
+	}
+	const std::string get_fastcgi(const std::string &uri) const {
+		const std::string ext = uri.find(".") != std::string::npos
+			? uri.substr(uri.find("."), uri.size()) : "";
+		if (ext == "")
+			return "";
+		CGIObject::const_iterator it = _fastcgi.find(ext);
+		if (it != _fastcgi.end())
+			return it->second;
+		return "";
+	}
 };
 }  // namespace Models
 }  // namespace Webserv
@@ -26,16 +26,12 @@ class ILocation : public Webserv::Models::IBlock {
 		_name = host;
 		_port = port;
 	}
-	ILocation(const ILocation &lhs)
-	:	IBlock(lhs),
-		_path(lhs._path) {}
-
 	ILocation(const std::string &name,
 		const int &port,
 		const std::string &path,
 		const std::string &root,
 		const size_t &body_limit,
-		const std::map<int, std::string> &error_pages)
+		const ErrorPagesObject &error_pages)
 	:	_path(path) {
 		_name = name;
 		_port = port;
@@ -43,8 +39,6 @@ class ILocation : public Webserv::Models::IBlock {
 		_body_limit = body_limit;
 		_error_pages = error_pages;
 	}
-
-	ILocation *clone() { return new ILocation(*this); }
 };
 }  // namespace Models
 }  // namespace Webserv
@@ -1,22 +1,28 @@
 /*
 	Interface representing a server block
+
+	Servers are parsed once, then shared read-only through the
+	configuration snapshot (conf/snapshot.hpp): they own their locations
+	and vhosts, and are not copied.
 */
 
 #ifndef MODELS_ISERVER_HPP_
 #define MODELS_ISERVER_HPP_
 
+#include <limits.h>
+#include <stdlib.h>
+
 #include <map>
 #include <vector>
 #include <string>
 #include <memory>
 #include <utility>
 
-#ifdef WEBSERV_SESSION
-#include "http/session.hpp"
-#endif
-
 #include "models/IBlock.hpp"
 #include "models/ILocation.hpp"
+#include "models/trie.hpp"
+#include "models/regex.hpp"
+#include "models/vhosts.hpp"
 
 namespace Webserv {
 namespace Models {
@@ -26,21 +32,18 @@ class IServer : public Webserv::Models::IBlock {
 	typedef Webserv::Models::ILocation ILocation;
 
 	typedef std::map<std::string, ILocation *>	LocationObject;
-	typedef std::map<std::string, IServer *>	VHostsObject;
-
-	#ifdef WEBSERV_SESSION
-	typedef std::map<std::string, Session *>  	Sessions;
-	#endif
+	typedef std::vector<IServer *>				VHostsObject;
 
  protected:
 	const std::string _host;
 
-	LocationObject	_locations;
-	VHostsObject	_vhosts;
-
-	#ifdef WEBSERV_SESSION
-	Sessions	_sessions;
-	#endif
+	LocationObject				_locations;
+	LocationTrie				_routes;
+	LocationRegexSet			_regexes;
+	std::vector<std::string>	_regex_keys;
+	std::vector<std::string>	_server_names;
+	VHostsObject				_vhosts;
+	VHostIndex					_vhost_names;
 
  public:
 	IServer()
@@ -56,47 +59,6 @@ class IServer : public Webserv::Models::IBlock {
 		_port = port;
 	}
 
-	IServer(const IServer &lhs)
-	:	_host(lhs._host) {
-		_name = lhs._name;
-		_port = lhs._port;
-		_root = lhs._root;
-		_upload_pass = lhs._upload_pass;
-		_redirection = lhs._redirection;
-		_redirection_code = lhs._redirection_code;
-		_body_limit = lhs._body_limit;
-
-		for (int i = 0; i < WEBSERV_METHODS_SUPPORTED; i++)
-			_methods_allowed[i] = true;
-
-		_autoindex = lhs._autoindex;
-
-		LocationObject::const_iterator it;
-		for (it = lhs._locations.begin(); it != lhs._locations.end(); ++it) {
-			_locations[it->first] = it->second->clone();
-		}
-
-		std::vector<std::string>::const_iterator it2;
-		for (it2 = lhs._indexs.begin(); it2 != lhs._indexs.end(); ++it2) {
-			_indexs.push_back(*it2);
-		}
-
-		ErrorPagesObject::const_iterator it3;
-		for (it3 = lhs._error_pages.begin(); it3 != lhs._error_pages.end(); ++it3) {
-			_error_pages[it3->first] = it3->second;
-		}
-
-		CGIObject::const_iterator it4;
-		for (it4 = lhs._cgi.begin(); it4 != lhs._cgi.end(); ++it4) {
-			_cgi[it4->first] = it4->second;
-		}
-
-		VHostsObject::const_iterator it5;
-		for (it5 = lhs._vhosts.begin(); it5 != lhs._vhosts.end(); ++it5) {
-			_vhosts[it5->first] = new IServer(*(it5->second));
-		}
-	}
-
 	~IServer() {
 		LocationObject::iterator loc_it = _locations.begin();
 		for (; loc_it != _locations.end(); loc_it++)
@@ -104,11 +66,7 @@ class IServer : public Webserv::Models::IBlock {
 
 		VHostsObject::iterator vhost_it = _vhosts.begin();
 		for (; vhost_it != _vhosts.end(); vhost_it++)
-			delete vhost_it->second;
-
-		#ifdef WEBSERV_SESSION
-		destroy_sessions();
-		#endif
+			delete *vhost_it;
 	}
 
 	// Name
@@ -117,6 +75,18 @@ class IServer : public Webserv::Models::IBlock {
 		const_cast<std::string&>(_name) = name;
 	}
 
+	/*
+		server_name, the first one is the name of the server.
+	*/
+	void	add_server_name(const std::string &name) {
+		if (_server_names.empty())
+			set_name(name);
+		_server_names.push_back(name);
+	}
+	const std::vector<std::string>	&get_server_names() const {
+		return _server_names;
+	}
+
 	// Host:Port - IP
 	const std::string &	get_host() const { return _host; }
 	void				set_host(const std::string &host) {
@@ -128,35 +98,61 @@ class IServer : public Webserv::Models::IBlock {
 		const_cast<int&>(_port) = port;
 	}
 
-	// Location(s)
-	ILocation	*new_location(const std::string &key) {
+	/*
+		Location(s), keyed by their modifier (=, ^~, ~, ~*) and path.
+			-> 0 when it is already defined, or its regex is invalid.
+	*/
+	ILocation	*new_location(const std::string &path,
+		const std::string &modifier = "") {
+		const std::string key = modifier + path;
 		if (_locations.find(key) != _locations.end())
 			return 0;
 		ILocation *location = new ILocation(
 			_name, _port,
-			key,
+			path,
 			_root,
 			_body_limit,
 			_error_pages);
+		location->inherit_gzip(*this);
+		location->set_cgi_timeout(_cgi_timeout);
 
+		if (!_route(key, location)) {
+			delete location;
+			return 0;
+		}
 		_locations.insert(std::pair<std::string, ILocation *>(key, location));
 		return location;
 	}
 
-	// vHost(s) solver
+	/*
+		Every block served by this server: itself, its locations, its vhosts.
+	*/
+	void	get_blocks(std::vector<const IBlock *> *blocks) const {
+		blocks->push_back(this);
+		LocationObject::const_iterator it = _locations.begin();
+		for (; it != _locations.end(); ++it)
+			blocks->push_back(it->second);
+		VHostsObject::const_iterator it2 = _vhosts.begin();
+		for (; it2 != _vhosts.end(); ++it2)
+			(*it2)->get_blocks(blocks);
+	}
+
+	/*
+		vHost(s) solver: the server named by host (name[:port], lowercase),
+		this one (the default server) when none is.
+	*/
 	const IServer *get_vhost(const std::string &host) const {
-		if (_vhosts.size() > 0) {
-			std::string real_host = host;
-			int port = -1;
-			if (real_host.find(':') != std::string::npos) {
-				real_host = real_host.substr(0, real_host.find(':'));
-				port = atoi(host.substr(host.find(':') + 1).c_str());
-			}
-			VHostsObject::const_iterator it = _vhosts.find(real_host);
-			if (it != _vhosts.end() && (port == -1 || port == it->second->get_port()))
-				return it->second;
-		}
-		return this;
+		if (_vhost_names.empty())
+			return this;
+		size_t len = host[0] == '[' ? host.find(']') : host.find(':');
+		if (len == std::string::npos)
+			len = host.size();
+		else if (host[0] == '[')
+			++len;
+		if (len > 0 && host[len - 1] == '.')
+			--len;
+		const IServer *vhost = _vhost_names.find(host, len);
+		return vhost ? vhost : this;
 	}
 
 	const IBlock
@@ -167,24 +163,45 @@ class IServer : public Webserv::Models::IBlock {
 	}
 
 	const IBlock *get_block(const std::string &uri) const {
-		std::string real_uri = uri;
-		if (real_uri.find("/", 1) != std::string::npos)
-			real_uri = real_uri.substr(0, real_uri.find("/", 1));
-		LocationObject::const_iterator it = _locations.find(real_uri);
-		if (it != _locations.end())
-			return dynamic_cast<IBlock*>(it->second);
-		return dynamic_cast<IBlock*>(const_cast<IServer*>(this));
+		ILocation *location = get_location(uri);
+		if (location)
+			return location;
+		return this;
 	}
 
-	// ILocation(s) solver
+	/*
+		X-Sendfile: uri of the file at path in an internal location of this
+		server, "" when none serves it.
+	*/
+	const std::string	get_internal_uri(const std::string &path) const {
+		char	real_path[PATH_MAX], real_root[PATH_MAX];
+		if (!realpath(path.c_str(), real_path))
+			return "";
+		const std::string file = real_path;
+
+		LocationObject::const_iterator it = _locations.begin();
+		for (; it != _locations.end(); ++it) {
+			if (it->first[0] != '/' || !it->second->get_internal()
+				|| !realpath(it->second->get_root().c_str(), real_root))
+				continue;
+			const std::string prefix = real_root + it->first + "/";
+			if (file.compare(0, prefix.size(), prefix) == 0)
+				return file.substr(prefix.size() - it->first.size() - 1);
+		}
+		return "";
+	}
+
+	/*
+		ILocation(s) solver: an exact location, else the longest prefix
+		location unless a regex location matches after it (nginx order).
+	*/
 	ILocation *get_location(const std::string &uri) const {
-		std::string real_uri = uri;
-		if (real_uri.find("/", 1) != std::string::npos)
-			real_uri = real_uri.substr(0, real_uri.find("/", 1));
-		LocationObject::const_iterator loc_it = _locations.find(real_uri);
-		if (loc_it != _locations.end())
-			return loc_it->second;
-		return 0;
+		bool		final;
+		ILocation	*location = _routes.find(uri, &final);
+		if (final || _regexes.size() == 0)
+			return location;
+		ILocation	*regex = _regexes.find(uri);
+		return regex ? regex : location;
 	}
 
 	// Error Page(s) solver
@@ -204,75 +221,67 @@ class IServer : public Webserv::Models::IBlock {
 		return get_error_page(status, uri);
 	}
 
-	// Cookies / Sessions
-	#ifdef WEBSERV_SESSION
-	void	destroy_sessions() {
-		Sessions::iterator it = _sessions.begin();
-		for (; it != _sessions.end(); it++)
-			delete it->second;
-	}
-	#endif
-
-	#ifdef WEBSERV_SESSION
-	void	collect_sessions() {
-		time_t now = time(0);
-		Sessions::iterator it = _sessions.begin();
-		for (; it != _sessions.end(); it++) {
-			if (!it->second->alive(now)) {
-				delete it->second;
-				_sessions.erase(it);
-				return collect_sessions();
-			}
-		}
-	}
-	#endif
-
-	#ifdef WEBSERV_SESSION
-	Session *add_session(const std::string &sid) {
-		Session *session = new Session(sid);
-		std::pair<Sessions::iterator, bool> ret =
-			_sessions.insert(std::pair<std::string, Session *>(sid, session));
-		if (ret.second)
-			return session;
-		return 0;
-	}
-	#endif
-
-	#ifdef WEBSERV_SESSION
-	void	del_session(const std::string &sid) {
-		Sessions::iterator it = _sessions.find(sid);
-		if (it != _sessions.end()) {
-			delete it->second;
-			_sessions.erase(it);
-		}
-	}
-	#endif
-
-	#ifdef WEBSERV_SESSION
-	Session	*get_session(const std::string &sid) {
-		Sessions::iterator it = _sessions.find(sid);
-		if (it != _sessions.end())
-			return it->second;
-		return 0;
+	// Pre-rendered error responses, for this server, its locations and vhosts
+	void	render_error_pages() {
+		IBlock::render_error_pages();
+
+		LocationObject::iterator loc_it = _locations.begin();
+		for (; loc_it != _locations.end(); loc_it++)
+			loc_it->second->render_error_pages();
+
+		VHostsObject::iterator vhost_it = _vhosts.begin();
+		for (; vhost_it != _vhosts.end(); vhost_it++)
+			(*vhost_it)->render_error_pages();
 	}
-	#endif
 
-	// Other
-	IServer *clone() const {
-		return new IServer(*this);
+	// CGI environments, for this server, its locations and vhosts
+	void	build_cgi_env() {
+		IBlock::build_cgi_env(*this);
+
+		LocationObject::iterator loc_it = _locations.begin();
+		for (; loc_it != _locations.end(); loc_it++)
+			loc_it->second->build_cgi_env(*this);
+
+		VHostsObject::iterator vhost_it = _vhosts.begin();
+		for (; vhost_it != _vhosts.end(); vhost_it++)
+			(*vhost_it)->build_cgi_env();
 	}
 
+	/*
+		lhs shares the interface of this server, it is owned by it from now
+		on. The names of this server come first.
+	*/
 	void	merge(IServer *lhs) {
-		std::string lowered_name = lhs->get_name();
-		_vhosts.insert(std::pair<std::string, IServer *>(\
-			*_strtolower(&lowered_name), lhs->clone()));
+		if (_vhosts.empty())
+			_index_names(this);
+		_vhosts.push_back(lhs);
+		_index_names(lhs);
 	}
 
  private:
-	inline std::string* _strtolower(std::string *s) {
-		for (std::string::iterator it = s->begin(); it != s->end(); it++)
-			*it = std::tolower(*it);
-		return s;
+	// Compiled once into the configuration snapshot, never copied
+	IServer(const IServer &lhs);
+	IServer	&operator=(const IServer &lhs);
+
+	bool	_route(const std::string &key, ILocation *location) {
+		if (key[0] == '~') {
+			const bool icase = key.compare(0, 2, "~*") == 0;
+			if (!_regexes.add(key.substr(icase ? 2 : 1), icase, location))
+				return false;
+			_regex_keys.push_back(key);
+		} else if (key.compare(0, 2, "^~") == 0) {
+			_routes.insert(key.substr(2), location, false, true);
+		} else if (key[0] == '=') {
+			_routes.insert(key.substr(1), location, true);
+		} else {
+			_routes.insert(key, location, false);
+		}
+		return true;
+	}
+
+	void	_index_names(IServer *server) {
+		for (size_t i = 0; i < server->_server_names.size(); ++i)
+			_vhost_names.add(server->_server_names[i], server);
 	}
 };
 }  // namespace Models
@@ -0,0 +1,593 @@
+/*
+	http://nginx.org/en/docs/http/ngx_http_core_module.html#location
+
+	Regex locations of a server (location ~ / ~*), compiled together into a
+	single automaton as they are parsed.
+
+	Every pattern is compiled to a Thompson NFA, all of them run side by
+	side from a shared start. The DFA states (sets of NFA states) are built
+	lazily while uris are matched and kept with their transitions: once
+	warm, a uri is matched in one pass over its bytes, one table lookup per
+	byte, whatever the number of patterns. Bytes that no pattern tells
+	apart (all letters for \.php$) share a column of the table.
+
+	As in nginx, the first pattern (in the order of the configuration) that
+	matches somewhere in the uri wins: the states of the later patterns are
+	dropped as soon as an earlier one matched.
+
+	Supported syntax, a PCRE subset: literals, escapes (\d \w \s and their
+	negations, \. ...), ., [classes], (groups), (?:groups), |, the quantifiers
+	* + ? {m} {m,} {m,n} (lazy ones match the same uris), ^ and $.
+*/
+
+#ifndef MODELS_REGEX_HPP_
+#define MODELS_REGEX_HPP_
+
+#include <ctype.h>
+
+#include <map>
+#include <string>
+#include <vector>
+#include <bitset>
+#include <algorithm>
+
+#include "consts.hpp"
+#include "models/ILocation.hpp"
+
+namespace Webserv {
+namespace Models {
+
+class LocationRegexSet {
+	typedef std::bitset<256>	Class;
+	typedef std::vector<int>	StateSet;
+
+	enum { AST_EMPTY, AST_CLASS, AST_BEGIN, AST_END, AST_CONCAT, AST_ALT,
+		AST_REPEAT };
+	enum { NFA_CLASS, NFA_SPLIT, NFA_BEGIN, NFA_END, NFA_MATCH };
+	enum { AT_BEGIN = 1, AT_END = 2 };
+
+	/*
+		Parsed pattern, left / right are children, min / max bound a
+		repetition (max -1: unbounded).
+	*/
+	struct Node {
+		int		type;
+		size_t	cls;
+		int		left;
+		int		right;
+		int		min;
+		int		max;
+	};
+
+	/*
+		NFA state of the pattern id, class states step to out on the bytes
+		of their class, split states lead to out and out1 for free.
+	*/
+	struct State {
+		int		type;
+		size_t	cls;
+		int		out;
+		int		out1;
+		int		id;
+	};
+
+	/*
+		DFA state: the NFA states it stands for, the pattern matched once
+		the uri ends here (-1: none), and whether it is settled (no later
+		byte can change the winner).
+	*/
+	struct DState {
+		const StateSet	*set;
+		int				match;
+		bool			done;
+	};
+
+ private:
+	std::vector<ILocation *>	_locations;
+	std::vector<Class>			_classes;
+	std::vector<State>			_states;
+	std::vector<int>			_starts;
+
+	// Parser
+	std::vector<Node>	_nodes;
+	std::string			_pattern;
+	size_t				_pos;
+	bool				_icase;
+
+	// Lazy DFA, rebuilt from scratch once it holds WEBSERV_REGEX_STATES
+	mutable unsigned char				_bytes[256];
+	mutable unsigned char				_reps[256];
+	mutable size_t						_width;
+	mutable std::vector<DState>			_dstates;
+	mutable std::vector<int>			_table;
+	mutable std::map<StateSet, int>		_index;
+	mutable StateSet					_restart;
+	mutable std::vector<unsigned int>	_marks;
+	mutable unsigned int				_generation;
+	mutable std::vector<int>			_stack;
+
+ public:
+	LocationRegexSet() : _pos(0), _icase(false), _width(0), _generation(0) {}
+
+	size_t	size() const { return _locations.size(); }
+
+	/*
+		Compile pattern (case-insensitive for ~*) for location.
+			-> false on a syntax error.
+	*/
+	bool	add(const std::string &pattern, bool icase, ILocation *location) {
+		_nodes.clear();
+		_pattern = pattern;
+		_pos = 0;
+		_icase = icase;
+
+		const size_t	classes = _classes.size();
+		const int		root = _parse_alt();
+		if (root == -1 || _pos != _pattern.size()) {
+			_classes.resize(classes);
+			return false;
+		}
+		const int id = _locations.size();
+		const int match = _state(NFA_MATCH, 0, -1, -1, id);
+		_starts.push_back(_compile(root, match, id));
+		_locations.push_back(location);
+		_nodes.clear();
+		_dstates.clear();
+		return true;
+	}
+
+	/*
+		First regex location matching uri, 0 when none does.
+	*/
+	ILocation	*find(const std::string &uri) const {
+		if (_locations.empty())
+			return 0;
+		if (_dstates.empty() || _dstates.size() >= WEBSERV_REGEX_STATES)
+			_flush();
+		size_t state = 0;
+		for (size_t i = 0; i < uri.size() && !_dstates[state].done; ++i) {
+			const unsigned char	byte = _bytes[static_cast<unsigned char>(uri[i])];
+			const size_t		cell = state * _width + byte;
+			if (_table[cell] == -1) {
+				// _step() grows the table
+				const int next = _step(state, _reps[byte]);
+				_table[cell] = next;
+			}
+			state = _table[cell];
+		}
+		const int match = _dstates[state].match;
+		return match == -1 ? 0 : _locations[match];
+	}
+
+ private:
+	/*
+		Recursive descent parser: alternation < concatenation < repetition
+		< atom. -> index of the node, -1 on a syntax error.
+	*/
+	int		_parse_alt() {
+		int left = _parse_concat();
+		while (left != -1 && _pos < _pattern.size() && _pattern[_pos] == '|') {
+			++_pos;
+			const int right = _parse_concat();
+			left = right == -1 ? -1 : _node(AST_ALT, 0, left, right);
+		}
+		return left;
+	}
+
+	int		_parse_concat() {
+		int node = _node(AST_EMPTY, 0, -1, -1);
+		while (_pos < _pattern.size() && _pattern[_pos] != '|'
+			&& _pattern[_pos] != ')') {
+			const int atom = _parse_repeat();
+			if (atom == -1)
+				return -1;
+			node = _nodes[node].type == AST_EMPTY ? atom
+				: _node(AST_CONCAT, 0, node, atom);
+		}
+		return node;
+	}
+
+	int		_parse_repeat() {
+		int node = _parse_atom();
+		while (node != -1 && _pos < _pattern.size()) {
+			const char	c = _pattern[_pos];
+			int			min = c == '+' ? 1 : 0;
+			int			max = c == '?' ? 1 : -1;
+			if (c != '*' && c != '+' && c != '?'
+				&& (c != '{' || !_parse_bounds(&min, &max)))
+				break;
+			if (c != '{')
+				++_pos;
+			// Lazy and possessive forms match the same uris
+			if (_pos < _pattern.size()
+				&& (_pattern[_pos] == '?' || _pattern[_pos] == '+'))
+				++_pos;
+			if (max > WEBSERV_REGEX_REPEAT || (max != -1 && max < min))
+				return -1;
+			node = _node(AST_REPEAT, 0, node, -1);
+			_nodes[node].min = min;
+			_nodes[node].max = max;
+		}
+		return node;
+	}
+
+	/*
+		{m}, {m,} or {m,n}, anything else is a literal '{' as in PCRE.
+	*/
+	bool	_parse_bounds(int *min, int *max) {
+		size_t pos = _pos + 1;
+		if (!_read_int(&pos, min))
+			return false;
+		*max = *min;
+		if (pos < _pattern.size() && _pattern[pos] == ',') {
+			++pos;
+			*max = -1;
+			if (pos < _pattern.size() && isdigit(_pattern[pos])
+				&& !_read_int(&pos, max))
+				return false;
+		}
+		if (pos >= _pattern.size() || _pattern[pos] != '}'
+			|| *min > WEBSERV_REGEX_REPEAT)
+			return false;
+		_pos = pos + 1;
+		return true;
+	}
+
+	bool	_read_int(size_t *pos, int *n) const {
+		const size_t start = *pos;
+		*n = 0;
+		while (*pos < _pattern.size() && isdigit(_pattern[*pos])
+			&& *n <= WEBSERV_REGEX_REPEAT)
+			*n = *n * 10 + (_pattern[(*pos)++] - '0');
+		return *pos > start;
+	}
+
+	int		_parse_atom() {
+		const char c = _pattern[_pos++];
+		Class cls;
+
+		switch (c) {
+			case '(': {
+				if (_pattern.compare(_pos, 2, "?:") == 0)
+					_pos += 2;
+				const int node = _parse_alt();
+				if (node == -1 || _pos >= _pattern.size() || _pattern[_pos] != ')')
+					return -1;
+				++_pos;
+				return node;
+			}
+			case '[':
+				return _parse_class();
+			case '.':
+				cls.set();
+				return _node(AST_CLASS, _class(cls), -1, -1);
+			case '^':
+				return _node(AST_BEGIN, 0, -1, -1);
+			case '$':
+				return _node(AST_END, 0, -1, -1);
+			case '\\':
+				if (!_parse_escape(&cls))
+					return -1;
+				return _node(AST_CLASS, _class(cls), -1, -1);
+			case '*': case '+': case '?': case ')':
+				return -1;
+			default:
+				cls.set(static_cast<unsigned char>(c));
+				return _node(AST_CLASS, _class(cls), -1, -1);
+		}
+	}
+
+	/*
+		[abc], [^a-z], a ']' right after the opening bracket is a literal.
+	*/
+	int		_parse_class() {
+		Class	cls;
+		bool	negate = false;
+
+		if (_pos < _pattern.size() && _pattern[_pos] == '^') {
+			negate = true;
+			++_pos;
+		}
+		for (bool first = true; _pos < _pattern.size(); first = false) {
+			if (_pattern[_pos] == ']' && !first)
+				break;
+			Class	item;
+			int		low = static_cast<unsigned char>(_pattern[_pos++]);
+			if (low == '\\') {
+				if (!_parse_escape(&item))
+					return -1;
+				if (item.count() != 1) {
+					cls |= item;
+					continue;
+				}
+				for (low = 0; !item.test(low); ++low) {}
+			}
+			int high = low;
+			if (_pos + 1 < _pattern.size() && _pattern[_pos] == '-'
+				&& _pattern[_pos + 1] != ']') {
+				high = static_cast<unsigned char>(_pattern[_pos + 1]);
+				_pos += 2;
+				if (high == '\\' || high < low)
+					return -1;
+			}
+			for (int b = low; b <= high; ++b)
+				cls.set(b);
+		}
+		if (_pos >= _pattern.size())
+			return -1;
+		++_pos;
+		if (negate)
+			cls.flip();
+		return _node(AST_CLASS, _class(cls), -1, -1);
+	}
+
+	/*
+		Escape after its '\', as a class. Word anchors and back-references
+		are not supported.
+	*/
+	bool	_parse_escape(Class *cls) {
+		if (_pos >= _pattern.size())
+			return false;
+		const unsigned char c = _pattern[_pos++];
+		bool negate = isupper(c);
+
+		switch (tolower(c)) {
+			case 'd':
+				for (int b = '0'; b <= '9'; ++b)
+					cls->set(b);
+				break;
+			case 'w':
+				for (int b = 0; b < 256; ++b)
+					cls->set(b, isalnum(b) || b == '_');
+				break;
+			case 's':
+				for (int b = 0; b < 256; ++b)
+					cls->set(b, isspace(b));
+				break;
+			default:
+				if (isalnum(c) && c != 'n' && c != 't' && c != 'r')
+					return false;
+				negate = false;
+				cls->set(c == 'n' ? '\n' : c == 't' ? '\t' : c == 'r' ? '\r' : c);
+		}
+		if (negate)
+			cls->flip();
+		return true;
+	}
+
+	int		_node(int type, size_t cls, int left, int right) {
+		Node node;
+		node.type = type;
+		node.cls = cls;
+		node.left = left;
+		node.right = right;
+		node.min = 0;
+		node.max = 0;
+		_nodes.push_back(node);
+		return _nodes.size() - 1;
+	}
+
+	size_t	_class(Class cls) {
+		if (_icase) {
+			for (int b = 'a'; b <= 'z'; ++b) {
+				if (cls.test(b) || cls.test(toupper(b))) {
+					cls.set(b);
+					cls.set(toupper(b));
+				}
+			}
+		}
+		_classes.push_back(cls);
+		return _classes.size() - 1;
+	}
+
+	/*
+		Thompson construction, from the end of the pattern: node is
+		compiled to states leading to next. -> first state.
+	*/
+	int		_compile(int node, int next, int id) {
+		const Node n = _nodes[node];
+
+		switch (n.type) {
+			case AST_CLASS:
+				return _state(NFA_CLASS, n.cls, next, -1, id);
+			case AST_BEGIN:
+				return _state(NFA_BEGIN, 0, next, -1, id);
+			case AST_END:
+				return _state(NFA_END, 0, next, -1, id);
+			case AST_CONCAT:
+				return _compile(n.left, _compile(n.right, next, id), id);
+			case AST_ALT: {
+				const int left = _compile(n.left, next, id);
+				return _state(NFA_SPLIT, 0, left, _compile(n.right, next, id), id);
+			}
+			case AST_REPEAT: {
+				int start = next;
+				if (n.max == -1) {
+					start = _state(NFA_SPLIT, 0, -1, next, id);
+					// Compiling grows the states
+					const int body = _compile(n.left, start, id);
+					_states[start].out = body;
+				} else {
+					for (int i = n.min; i < n.max; ++i)
+						start = _state(NFA_SPLIT, 0,
+							_compile(n.left, start, id), next, id);
+				}
+				for (int i = 0; i < n.min; ++i)
+					start = _compile(n.left, start, id);
+				return start;
+			}
+			default:
+				return next;
+		}
+	}
+
+	int		_state(int type, size_t cls, int out, int out1, int id) {
+		State state;
+		state.type = type;
+		state.cls = cls;
+		state.out = out;
+		state.out1 = out1;
+		state.id = id;
+		_states.push_back(state);
+		return _states.size() - 1;
+	}
+
+	/*
+		Forget the DFA, it starts again from the state before the first
+		byte of a uri.
+	*/
+	void	_flush() const {
+		_dstates.clear();
+		_table.clear();
+		_index.clear();
+		_marks.assign(_states.size(), 0);
+		_byte_classes();
+
+		StateSet start;
+		++_generation;
+		for (size_t i = 0; i < _starts.size(); ++i)
+			_closure(_starts[i], AT_BEGIN, &start);
+		// States entered at every byte, patterns are not anchored
+		_restart.clear();
+		++_generation;
+		for (size_t i = 0; i < _starts.size(); ++i)
+			_closure(_starts[i], 0, &_restart);
+		_dstate(&start);
+	}
+
+	/*
+		Split the bytes by every class of the patterns, _bytes maps a byte
+		to its column, _reps a column to one of its bytes.
+	*/
+	void	_byte_classes() const {
+		int	ids[256] = { 0 };
+		int	count = 1;
+
+		for (size_t i = 0; i < _classes.size() && count < 256; ++i) {
+			int	renumber[512];
+			int	next = 0;
+			std::fill(renumber, renumber + 2 * count, -1);
+			for (int b = 0; b < 256; ++b) {
+				int &id = renumber[ids[b] * 2 + _classes[i].test(b)];
+				if (id == -1)
+					id = next++;
+				ids[b] = id;
+			}
+			count = next;
+		}
+		_width = count;
+		for (int b = 255; b >= 0; --b) {
+			_bytes[b] = ids[b];
+			_reps[ids[b]] = b;
+		}
+	}
+
+	/*
+		Add the states reached from state without reading a byte, the
+		anchors pass when flags say the uri starts / ends here.
+	*/
+	void	_closure(int state, int flags, StateSet *set) const {
+		std::vector<int> &stack = _stack;
+
+		stack.push_back(state);
+		while (!stack.empty()) {
+			const int s = stack.back();
+			stack.pop_back();
+			if (s == -1 || _marks[s] == _generation)
+				continue;
+			_marks[s] = _generation;
+			const State &st = _states[s];
+			if (st.type == NFA_SPLIT) {
+				stack.push_back(st.out1);
+				stack.push_back(st.out);
+			} else if (st.type == NFA_BEGIN) {
+				if (flags & AT_BEGIN)
+					stack.push_back(st.out);
+			} else if (st.type == NFA_END && (flags & AT_END)) {
+				stack.push_back(st.out);
+			} else {
+				set->push_back(s);
+			}
+		}
+	}
+
+	/*
+		DFA state reached from state on byte c.
+	*/
+	int		_step(size_t state, unsigned char c) const {
+		StateSet next;
+		++_generation;
+		const StateSet &set = *_dstates[state].set;
+		for (size_t i = 0; i < set.size(); ++i) {
+			const State &st = _states[set[i]];
+			if (st.type == NFA_MATCH)
+				_closure(set[i], 0, &next);
+			else if (st.type == NFA_CLASS && _classes[st.cls].test(c))
+				_closure(st.out, 0, &next);
+		}
+		for (size_t i = 0; i < _restart.size(); ++i) {
+			if (_marks[_restart[i]] != _generation) {
+				_marks[_restart[i]] = _generation;
+				next.push_back(_restart[i]);
+			}
+		}
+		return _dstate(&next);
+	}
+
+	/*
+		Index of the DFA state of set, created if needed. The states of the
+		patterns after the first one matched are dropped.
+	*/
+	int		_dstate(StateSet *set) const {
+		int matched = _starts.size();
+		for (size_t i = 0; i < set->size(); ++i) {
+			const State &st = _states[(*set)[i]];
+			if (st.type == NFA_MATCH && st.id < matched)
+				matched = st.id;
+		}
+		StateSet kept;
+		for (size_t i = 0; i < set->size(); ++i) {
+			const State &st = _states[(*set)[i]];
+			if (st.id < matched || st.type == NFA_MATCH)
+				kept.push_back((*set)[i]);
+		}
+		std::sort(kept.begin(), kept.end());
+
+		std::map<StateSet, int>::iterator it = _index.find(kept);
+		if (it != _index.end())
+			return it->second;
+
+		// The set is kept once, as the key of the index
+		it = _index.insert(std::make_pair(kept, _dstates.size())).first;
+		DState dstate;
+		dstate.set = &it->first;
+		dstate.match = _end_match(kept);
+		// Only the match left: no later byte can change it
+		dstate.done = kept.size() == 1 && _states[kept[0]].type == NFA_MATCH;
+		_dstates.push_back(dstate);
+		_table.resize(_table.size() + _width, -1);
+		return it->second;
+	}
+
+	/*
+		First pattern matched if the uri ends in set, through its $ anchors.
+	*/
+	int		_end_match(const StateSet &set) const {
+		StateSet	reached;
+		int			match = -1;
+
+		++_generation;
+		for (size_t i = 0; i < set.size(); ++i)
+			_closure(set[i], AT_END, &reached);
+		for (size_t i = 0; i < reached.size(); ++i) {
+			const State &st = _states[reached[i]];
+			if (st.type == NFA_MATCH && (match == -1 || st.id < match))
+				match = st.id;
+		}
+		return match;
+	}
+};
+}  // namespace Models
+}  // namespace Webserv
+
+#endif  // MODELS_REGEX_HPP_
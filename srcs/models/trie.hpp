@@ -0,0 +1,154 @@
+/*
+	http://nginx.org/en/docs/http/ngx_http_core_module.html#location
+
+	Radix trie of the locations of a server, built as they are parsed.
+
+	A uri is routed to the longest prefix location it starts with, on a
+	path boundary (/api serves /api and /api/x, not /apix), unless an exact
+	location (= /path) matches it whole. The lookup walks the uri once
+	and does not allocate.
+
+	Exact locations and ^~ prefix locations are final: the regex locations
+	are not tried after them.
+*/
+
+#ifndef MODELS_TRIE_HPP_
+#define MODELS_TRIE_HPP_
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include "models/ILocation.hpp"
+
+namespace Webserv {
+namespace Models {
+
+class LocationTrie {
+	typedef std::pair<char, size_t>	Edge;
+
+	/*
+		Nodes hold the part of the path leading to them from their parent,
+		their children are sorted by first character.
+	*/
+	struct Node {
+		std::string			label;
+		ILocation			*prefix;
+		ILocation			*exact;
+		bool				final;
+		std::vector<Edge>	children;
+
+		explicit Node(const std::string &label)
+		:	label(label), prefix(0), exact(0), final(false) {}
+	};
+
+ private:
+	std::vector<Node>	_nodes;
+
+ public:
+	LocationTrie() : _nodes(1, Node("")) {}
+
+	void	insert(const std::string &path, ILocation *location, bool exact,
+		bool final = false) {
+		size_t node = 0, pos = 0;
+
+		while (pos < path.size()) {
+			std::vector<Edge> &children = _nodes[node].children;
+			std::vector<Edge>::iterator it = std::lower_bound(children.begin(),
+				children.end(), Edge(path[pos], 0));
+			if (it == children.end() || it->first != path[pos]) {
+				const size_t leaf = _nodes.size();
+				children.insert(it, Edge(path[pos], leaf));
+				// Nodes may move from here on
+				_nodes.push_back(Node(path.substr(pos)));
+				node = leaf;
+				break;
+			}
+			const size_t	child = it->second;
+			const size_t	common = _common(_nodes[child].label, path, pos);
+			if (common < _nodes[child].label.size())
+				_split(child, common);
+			node = child;
+			pos += common;
+		}
+		if (exact) {
+			_nodes[node].exact = location;
+		} else {
+			_nodes[node].prefix = location;
+			_nodes[node].final = final;
+		}
+	}
+
+	/*
+		Location serving uri, 0 for the server itself. final tells whether
+		it is an exact or ^~ one.
+	*/
+	ILocation	*find(const std::string &uri, bool *final) const {
+		ILocation	*best = 0;
+		size_t		node = 0, pos = 0;
+
+		*final = false;
+		while (true) {
+			const Node &current = _nodes[node];
+			if (pos == uri.size() && current.exact) {
+				*final = true;
+				return current.exact;
+			}
+			if (current.prefix && (pos == uri.size() || uri[pos] == '/'
+				|| uri[pos - 1] == '/')) {
+				best = current.prefix;
+				*final = current.final;
+			}
+			if (pos == uri.size())
+				break;
+
+			std::vector<Edge>::const_iterator it = std::lower_bound(
+				current.children.begin(), current.children.end(),
+				Edge(uri[pos], 0));
+			if (it == current.children.end() || it->first != uri[pos])
+				break;
+			const std::string &label = _nodes[it->second].label;
+			if (uri.compare(pos, label.size(), label) != 0)
+				break;
+			pos += label.size();
+			node = it->second;
+		}
+		return best;
+	}
+
+ private:
+	static size_t	_common(const std::string &label, const std::string &path,
+		size_t pos) {
+		size_t n = 0;
+		while (n < label.size() && pos + n < path.size()
+			&& label[n] == path[pos + n])
+			++n;
+		return n;
+	}
+
+	/*
+		child keeps the first common characters of its label, the rest
+		moves to a new node taking over its children and locations.
+	*/
+	void	_split(size_t child, size_t common) {
+		const size_t tail = _nodes.size();
+		_nodes.push_back(Node(_nodes[child].label.substr(common)));
+
+		Node &node = _nodes[child];
+		Node &rest = _nodes[tail];
+		rest.children.swap(node.children);
+		rest.prefix = node.prefix;
+		rest.exact = node.exact;
+		rest.final = node.final;
+		node.prefix = 0;
+		node.exact = 0;
+		node.final = false;
+		node.label.erase(common);
+		node.children.push_back(Edge(rest.label[0], tail));
+	}
+};
+}  // namespace Models
+}  // namespace Webserv
+
+#endif  // MODELS_TRIE_HPP_
@@ -0,0 +1,289 @@
+/*
+	http://nginx.org/en/docs/http/server_names.html
+
+	Names of the virtual hosts sharing an interface, resolved from the Host
+	header of a request:
+		- exact names (www.example.com) are held in a hash table,
+		- leading wildcards (*.example.com) in a trie of the labels read
+		  from the right (com -> example),
+		- trailing wildcards (www.example.*) in a trie of the labels read
+		  from the left (www -> example).
+	Trie edges are held in hash tables too: a lookup hashes every label of
+	the host once, whatever the number of names, and does not allocate.
+
+	As in nginx, an exact name wins over the longest leading wildcard, which
+	wins over the longest trailing one. .example.com stands for both
+	example.com and *.example.com. A name declared twice keeps its first
+	server.
+*/
+
+#ifndef MODELS_VHOSTS_HPP_
+#define MODELS_VHOSTS_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace Webserv {
+namespace Models {
+
+class IServer;
+
+/*
+	Open addressing hash table of (parent, key) -> value, parent is -1 for
+	plain names and the node a label hangs from in a trie.
+*/
+class NameHash {
+	struct Slot {
+		uint32_t	hash;
+		int			parent;
+		int			value;
+		std::string	key;
+
+		Slot() : hash(0), parent(0), value(-1) {}
+	};
+
+ private:
+	std::vector<Slot>	_slots;
+	size_t				_used;
+
+ public:
+	NameHash() : _slots(16), _used(0) {}
+
+	size_t	size() const { return _used; }
+
+	/*
+		-> value of key[pos, pos + len) under parent, -1 when absent.
+	*/
+	int		find(int parent, const std::string &key, size_t pos,
+		size_t len) const {
+		const uint32_t	hash = _hash(parent, key, pos, len);
+		const size_t	mask = _slots.size() - 1;
+
+		for (size_t i = hash & mask; _slots[i].value != -1; i = (i + 1) & mask) {
+			const Slot &slot = _slots[i];
+			if (slot.hash == hash && slot.parent == parent
+				&& slot.key.size() == len && key.compare(pos, len, slot.key) == 0)
+				return slot.value;
+		}
+		return -1;
+	}
+
+	/*
+		-> the value held for key, value if it was not there yet.
+	*/
+	int		insert(int parent, const std::string &key, int value) {
+		const int found = find(parent, key, 0, key.size());
+		if (found != -1)
+			return found;
+		if ((_used + 1) * 2 > _slots.size())
+			_grow();
+		_place(_hash(parent, key, 0, key.size()), parent, key, value);
+		++_used;
+		return value;
+	}
+
+ private:
+	static uint32_t	_hash(int parent, const std::string &key, size_t pos,
+		size_t len) {
+		uint32_t h = 2166136261u ^ static_cast<uint32_t>(parent);
+		h *= 16777619u;
+		for (size_t i = pos; i < pos + len; ++i) {
+			h ^= static_cast<unsigned char>(key[i]);
+			h *= 16777619u;
+		}
+		return h;
+	}
+
+	void	_place(uint32_t hash, int parent, const std::string &key,
+		int value) {
+		const size_t mask = _slots.size() - 1;
+		size_t i = hash & mask;
+		while (_slots[i].value != -1)
+			i = (i + 1) & mask;
+		_slots[i].hash = hash;
+		_slots[i].parent = parent;
+		_slots[i].value = value;
+		_slots[i].key = key;
+	}
+
+	void	_grow() {
+		std::vector<Slot> slots(_slots.size() * 2);
+		slots.swap(_slots);
+		for (size_t i = 0; i < slots.size(); ++i) {
+			if (slots[i].value != -1)
+				_place(slots[i].hash, slots[i].parent, slots[i].key,
+					slots[i].value);
+		}
+	}
+};
+
+class VHostIndex {
+	/*
+		Trie node: wildcard serves the hosts with more labels past it, self
+		the host ending on it (.example.com).
+	*/
+	struct Node {
+		IServer	*wildcard;
+		IServer	*self;
+
+		Node() : wildcard(0), self(0) {}
+	};
+
+ private:
+	std::vector<IServer *>	_servers;
+	NameHash				_exact;
+	NameHash				_leading_edges;
+	NameHash				_trailing_edges;
+	std::vector<Node>		_leading;
+	std::vector<Node>		_trailing;
+	size_t					_names;
+
+ public:
+	VHostIndex() : _leading(1), _trailing(1), _names(0) {}
+
+	bool	empty() const { return _names == 0; }
+
+	/*
+		Lowercase name, (*.|.)labels or labels(.*): no other wildcard, no
+		empty label.
+	*/
+	static bool	valid(const std::string &name) {
+		size_t start = 0, end = name.size();
+		if (name.compare(0, 2, "*.") == 0)
+			start = 2;
+		else if (name.compare(0, 1, ".") == 0)
+			start = 1;
+		else if (name.size() > 2 && name.compare(name.size() - 2, 2, ".*") == 0)
+			end -= 2;
+		if (start >= end || name[end - 1] == '.')
+			return false;
+		for (size_t i = start; i < end; ++i) {
+			const char c = name[i];
+			if (c == '*' || (c >= 'A' && c <= 'Z') || c == ' ' || c == '\t'
+				|| (c == '.' && name[i - 1] == '.'))
+				return false;
+		}
+		return true;
+	}
+
+	/*
+		name, checked by valid(), resolves to server unless it already
+		resolves to another one.
+	*/
+	void	add(const std::string &name, IServer *server) {
+		++_names;
+		if (name[0] == '*' || name[0] == '.') {
+			const bool	dotted = name[0] == '.';
+			Node		&node = _leading[_leading_node(name.substr(dotted ? 1 : 2))];
+			if (!node.wildcard)
+				node.wildcard = server;
+			if (dotted && !node.self)
+				node.self = server;
+		} else if (name[name.size() - 1] == '*') {
+			Node &node = _trailing[_trailing_node(name.substr(0, name.size() - 2))];
+			if (!node.wildcard)
+				node.wildcard = server;
+		} else {
+			_exact.insert(-1, name, _server(server));
+		}
+	}
+
+	/*
+		Server of host[0, len), 0 when no name matches it.
+	*/
+	IServer	*find(const std::string &host, size_t len) const {
+		const int exact = _exact.find(-1, host, 0, len);
+		if (exact != -1)
+			return _servers[exact];
+
+		IServer	*best = 0;
+		size_t	end = len;
+		int		node = 0;
+		while (end > 0) {
+			const size_t dot = host.rfind('.', end - 1);
+			const size_t start = dot == std::string::npos ? 0 : dot + 1;
+			node = _leading_edges.find(node, host, start, end - start);
+			if (node == -1)
+				break;
+			if (dot == std::string::npos) {
+				if (_leading[node].self)
+					best = _leading[node].self;
+				break;
+			}
+			if (_leading[node].wildcard)
+				best = _leading[node].wildcard;
+			end = dot;
+		}
+		if (best)
+			return best;
+
+		size_t	start = 0;
+		node = 0;
+		while (start < len) {
+			const size_t dot = host.find('.', start);
+			if (dot == std::string::npos || dot >= len)
+				break;
+			node = _trailing_edges.find(node, host, start, dot - start);
+			if (node == -1)
+				break;
+			if (_trailing[node].wildcard)
+				best = _trailing[node].wildcard;
+			start = dot + 1;
+		}
+		return best;
+	}
+
+ private:
+	int		_server(IServer *server) {
+		if (_servers.empty() || _servers.back() != server)
+			_servers.push_back(server);
+		return _servers.size() - 1;
+	}
+
+	/*
+		Node of labels in the leading trie, read from the right.
+	*/
+	int		_leading_node(const std::string &labels) {
+		int		node = 0;
+		size_t	end = labels.size();
+		while (true) {
+			const size_t dot = labels.rfind('.', end - 1);
+			const size_t start = dot == std::string::npos ? 0 : dot + 1;
+			node = _edge(&_leading_edges, &_leading, node,
+				labels.substr(start, end - start));
+			if (dot == std::string::npos)
+				return node;
+			end = dot;
+		}
+	}
+
+	/*
+		Node of labels in the trailing trie, read from the left.
+	*/
+	int		_trailing_node(const std::string &labels) {
+		int		node = 0;
+		size_t	start = 0;
+		while (true) {
+			const size_t dot = labels.find('.', start);
+			node = _edge(&_trailing_edges, &_trailing, node,
+				labels.substr(start, dot == std::string::npos ? dot : dot - start));
+			if (dot == std::string::npos)
+				return node;
+			start = dot + 1;
+		}
+	}
+
+	static int	_edge(NameHash *edges, std::vector<Node> *nodes, int parent,
+		const std::string &label) {
+		const int child = edges->insert(parent, label, nodes->size());
+		if (child == static_cast<int>(nodes->size()))
+			nodes->push_back(Node());
+		return child;
+	}
+};
+}  // namespace Models
+}  // namespace Webserv
+
+#endif  // MODELS_VHOSTS_HPP_
@@ -0,0 +1,106 @@
+/*
+	http://nginx.org/en/docs/ngx_core_module.html#worker_cpu_affinity
+
+	CPU placement of the event loops. A pinned loop also asks the kernel
+	for the memory of the NUMA node of its CPU (MPOL_LOCAL): connection
+	buffers, caches and pages of the master written after the fork are
+	then allocated next to it, not on the node the master ran on.
+
+	Only the loop thread is pinned. Threads and children inherit the CPUs
+	and memory policy of the thread creating them, so the io pool threads
+	and the processes spawned by the loop (CGI scripts and workers, a new
+	binary) give them up: they run on the CPUs of the process before it
+	was pinned, with the default policy.
+*/
+
+#ifndef SERVER_AFFINITY_HPP_
+#define SERVER_AFFINITY_HPP_
+
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include <iostream>
+
+#include "conf/parser.hpp"
+
+namespace Webserv {
+namespace Server {
+
+static bool			PINNED = false;
+static cpu_set_t	PINNED_CPUS;
+static cpu_set_t	UNPINNED_CPUS;
+
+/*
+	CPUs of the worker at slot.
+		-> false when it is not pinned.
+*/
+bool	worker_cpus(const Conf::Parser::Processes &processes, size_t slot,
+	cpu_set_t *set) {
+	CPU_ZERO(set);
+	if (processes.auto_affinity) {
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		if (cpus <= 0)
+			return false;
+		CPU_SET(slot % cpus, set);
+		return true;
+	}
+	if (processes.affinity.empty())
+		return false;
+	*set = processes.affinity[std::min(slot, processes.affinity.size() - 1)];
+	return true;
+}
+
+/*
+	Pin the calling thread, the loop, as the worker at slot.
+		-> first CPU it runs on, -1 when it is not pinned.
+*/
+int		pin_worker(const Conf::Parser::Processes &processes, size_t slot) {
+	cpu_set_t	set;
+	if (!worker_cpus(processes, slot, &set))
+		return -1;
+	if (sched_getaffinity(0, sizeof(UNPINNED_CPUS), &UNPINNED_CPUS) == -1
+		|| sched_setaffinity(0, sizeof(set), &set) == -1) {
+		std::cerr << "affinity: unable to pin worker " << slot << std::endl;
+		return -1;
+	}
+	PINNED = true;
+	PINNED_CPUS = set;
+	#ifdef SYS_set_mempolicy
+	syscall(SYS_set_mempolicy, MPOL_LOCAL, NULL, 0);
+	#endif
+	for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (CPU_ISSET(cpu, &set))
+			return cpu;
+	}
+	return -1;
+}
+
+/*
+	The calling thread gets the CPUs and memory policy of the process
+	before pin_worker(): called by the threads of the pool, and by the
+	loop around a spawn (see repin_thread()).
+*/
+void	unpin_thread() {
+	if (!PINNED)
+		return;
+	sched_setaffinity(0, sizeof(UNPINNED_CPUS), &UNPINNED_CPUS);
+	#ifdef SYS_set_mempolicy
+	syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+	#endif
+}
+
+void	repin_thread() {
+	if (!PINNED)
+		return;
+	sched_setaffinity(0, sizeof(PINNED_CPUS), &PINNED_CPUS);
+	#ifdef SYS_set_mempolicy
+	syscall(SYS_set_mempolicy, MPOL_LOCAL, NULL, 0);
+	#endif
+}
+
+}  // namespace Server
+}  // namespace Webserv
+
+#endif  // SERVER_AFFINITY_HPP_
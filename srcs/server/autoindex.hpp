@@ -1,92 +1,395 @@
+/*
+	Directory listing, streamed to the client by slices.
+
+	Entries are read once with readdir() and fstatat() on the directory fd,
+	by the io pool (see DirJob), their names are packed in a single buffer
+	and sorted with memcmp(). Rows are then rendered
+	WEBSERV_STREAM_CHUNK_SIZE bytes at a time.
+
+	Rendered rows are cached, keyed by the directory device / inode and
+	invalidated as soon as its mtime changes (entry created, removed or
+	renamed). The page header and footer depend on the requested path, so
+	they are rendered for each request around the cached rows. The cache
+	tells a DirJob the version it holds for a path: the job only reads the
+	entries when fstat() finds another one.
+*/
+
 #ifndef SERVER_AUTOINDEX_HPP_
 #define SERVER_AUTOINDEX_HPP_
 
+#include <time.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <dirent.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 
+#include <map>
 #include <string>
 #include <vector>
 #include <utility>
-#include <sstream>
 #include <algorithm>
 
+#include "consts.hpp"
+#include "http/stream.hpp"
+
 namespace Webserv {
 namespace Server {
 
-class AutoIndexBuilder {
- private:
-	typedef std::vector<std::pair<std::string, std::string> > IndexObject;
+/*
+	Rendered rows of one version of a directory.
+		-> Shared between the cache and the builders streaming it.
+*/
+class AutoIndexListing {
+ public:
+	const dev_t				dev;
+	const ino_t				ino;
+	const struct timespec	mtime;
+	// Path the directory was listed from
+	const std::string		path;
 
-	std::stringstream _source;
+	std::string	rows;
+	time_t		last_used;
 
-	IndexObject _dirs;
-	IndexObject _files;
+ private:
+	int			_refs;
 
  public:
-	AutoIndexBuilder(const std::vector<struct dirent>& indexs,
-		const std::string &path) {
-		_build_header(path);
-		_table_header();
+	AutoIndexListing(const struct stat &st, const std::string &listed)
+	:	dev(st.st_dev), ino(st.st_ino), mtime(st.st_mtim), path(listed),
+		last_used(time(NULL)), _refs(1) {}
 
-		std::vector<struct dirent>::const_iterator it = indexs.begin();
-		for (; it != indexs.end(); it++)
-			_build_row(*it, path);
+	bool	fresh(const struct stat &st) const {
+		return st.st_mtim.tv_sec == mtime.tv_sec
+			&& st.st_mtim.tv_nsec == mtime.tv_nsec;
+	}
 
-		_sort_indexs();
-		_dump_indexs();
-		_table_footer();
-		_build_footer();
+	AutoIndexListing	*ref() {
+		++_refs;
+		last_used = time(NULL);
+		return this;
 	}
 
-	const std::string toString() const {
-		return _source.str();
+	void	unref() {
+		if (--_refs == 0)
+			delete this;
 	}
+};
+
+class AutoIndexCache {
+	typedef std::pair<dev_t, ino_t>							ListingKey;
+	typedef std::map<ListingKey, AutoIndexListing *>		ListingObject;
+	typedef std::map<std::string, ListingKey>				PathObject;
 
  private:
-	void	_build_row(struct dirent index, const std::string &path) {
-		const std::string file_path = path + std::string(index.d_name);
-		if (index.d_name[0] == '.' && strlen(index.d_name) == 1)
-			return;
-		struct stat st;
-		if (stat(file_path.c_str(), &st) == -1)
+	ListingObject	_listings;
+	PathObject		_paths;
+	size_t			_size;
+
+ public:
+	AutoIndexCache() : _size(0) {}
+
+	~AutoIndexCache() {
+		ListingObject::iterator it = _listings.begin();
+		for (; it != _listings.end(); ++it)
+			it->second->unref();
+	}
+
+	/*
+		Return a new reference on the listing of st, if still fresh.
+	*/
+	AutoIndexListing	*acquire(const struct stat &st) {
+		ListingObject::iterator it = _listings.find(ListingKey(st.st_dev, st.st_ino));
+		if (it == _listings.end())
+			return 0;
+		if (!it->second->fresh(st)) {
+			_erase(it);
+			return 0;
+		}
+		return it->second->ref();
+	}
+
+	/*
+		Directory, inode and mtime of the listing cached for path.
+			-> false when none is.
+	*/
+	bool	known(const std::string &path, struct stat *st) const {
+		PathObject::const_iterator it = _paths.find(path);
+		if (it == _paths.end())
+			return false;
+		const AutoIndexListing *listing = _listings.find(it->second)->second;
+		st->st_dev = listing->dev;
+		st->st_ino = listing->ino;
+		st->st_mtim = listing->mtime;
+		return true;
+	}
+
+	bool	holds(const struct stat &st) const {
+		ListingObject::const_iterator it =
+			_listings.find(ListingKey(st.st_dev, st.st_ino));
+		return it != _listings.end() && it->second->fresh(st);
+	}
+
+	void	store(AutoIndexListing *listing) {
+		if (listing->rows.size() > WEBSERV_AUTOINDEX_CACHE_ENTRY)
 			return;
 
-		char	date[64];
-		strftime(date, sizeof(date), "%d-%b-%Y %H:%M",
-			localtime(&st.st_mtime));
+		ListingObject::iterator it = _listings.find(
+			ListingKey(listing->dev, listing->ino));
+		if (it != _listings.end())
+			_erase(it);
+		while (_listings.size() > 0
+			&& (_listings.size() >= WEBSERV_AUTOINDEX_CACHE_ENTRIES
+			|| _size + listing->rows.size() > WEBSERV_AUTOINDEX_CACHE_SIZE))
+			_erase(_least_recently_used());
+
+		_listings[ListingKey(listing->dev, listing->ino)] = listing->ref();
+		_paths[listing->path] = ListingKey(listing->dev, listing->ino);
+		_size += listing->rows.size();
+	}
+
+ private:
+	ListingObject::iterator	_least_recently_used() {
+		ListingObject::iterator lru = _listings.begin();
+		ListingObject::iterator it = _listings.begin();
+		for (; it != _listings.end(); ++it) {
+			if (it->second->last_used < lru->second->last_used)
+				lru = it;
+		}
+		return lru;
+	}
+
+	void	_erase(ListingObject::iterator it) {
+		PathObject::iterator path = _paths.find(it->second->path);
+		if (path != _paths.end() && path->second == it->first)
+			_paths.erase(path);
+		_size -= it->second->rows.size();
+		it->second->unref();
+		_listings.erase(it);
+	}
+};
+
+static AutoIndexCache	AUTOINDEX_CACHE;
+
+/*
+	Same version of a directory: its listing is still valid.
+*/
+static bool	autoindex_unchanged(const struct stat &a, const struct stat &b) {
+	return a.st_dev == b.st_dev && a.st_ino == b.st_ino
+		&& a.st_mtim.tv_sec == b.st_mtim.tv_sec
+		&& a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
+/*
+	Sorted entries of a directory, does not touch the state of the loop.
+*/
+class AutoIndexEntries {
+ public:
+	struct Entry {
+		size_t	name;
+		size_t	len;
+		time_t	mtime;
+		off_t	size;
+	};
+
+	typedef std::vector<Entry>	EntryObject;
+
+	std::string		names;
+	EntryObject		dirs;
+	EntryObject		files;
+
+ private:
+	/*
+		Names are compared in place, inside the packed names buffer.
+	*/
+	struct EntryLess {
+		const char *names;
+
+		explicit EntryLess(const char *n) : names(n) {}
+		bool	operator()(const Entry &a, const Entry &b) const {
+			int ret = memcmp(names + a.name, names + b.name, std::min(a.len, b.len));
+			if (ret != 0)
+				return ret < 0;
+			return a.len < b.len;
+		}
+	};
+
+ public:
+	void	read(DIR *dir) {
+		int				fd = dirfd(dir);
+		struct dirent	*file;
+		struct stat		st;
+
+		while ((file = readdir(dir))) {
+			if (file->d_name[0] == '.' && file->d_name[1] == '\0')
+				continue;
+			if (fstatat(fd, file->d_name, &st, 0) == -1)
+				continue;
+
+			Entry entry;
+			entry.name = names.size();
+			entry.len = strlen(file->d_name);
+			entry.mtime = st.st_mtime;
+			entry.size = st.st_size;
+			names.append(file->d_name, entry.len);
+
+			if ((st.st_mode & S_IFMT) == S_IFDIR)
+				dirs.push_back(entry);
+			else
+				files.push_back(entry);
+		}
+		std::sort(dirs.begin(), dirs.end(), EntryLess(names.data()));
+		std::sort(files.begin(), files.end(), EntryLess(names.data()));
+	}
+
+	void	swap(AutoIndexEntries *other) {
+		names.swap(other->names);
+		dirs.swap(other->dirs);
+		files.swap(other->files);
+	}
+};
+
+class AutoIndexBuilder : public HTTP::Stream {
+ private:
+	enum PHASE {
+		PHASE_HEADER,
+		PHASE_ROWS,
+		PHASE_FOOTER,
+		PHASE_DONE
+	};
+
+	typedef AutoIndexEntries::Entry	Entry;
+
+	const std::string	_path;
+	PHASE				_phase;
+
+	AutoIndexListing	*_listing;
+	bool				_cached;
+	bool				_uncacheable;
+	size_t				_offset;
+
+	AutoIndexEntries	_entries;
+
+ public:
+	/*
+		entries of the directory described by st are taken, unless its
+		rows are cached.
+	*/
+	AutoIndexBuilder(AutoIndexEntries *entries, const struct stat &st,
+		const std::string &path)
+	:	_path(path),
+		_phase(PHASE_HEADER),
+		_listing(AUTOINDEX_CACHE.acquire(st)),
+		_cached(_listing != 0),
+		_uncacheable(false),
+		_offset(0) {
+		if (!_cached) {
+			_listing = new AutoIndexListing(st, path);
+			_entries.swap(entries);
+		}
+	}
+
+	~AutoIndexBuilder() {
+		_listing->unref();
+	}
+
+	ssize_t	length() const {
+		if (!_cached)
+			return -1;
+		return _header().size() + _listing->rows.size() + _footer().size();
+	}
 
-		switch (st.st_mode & S_IFMT) {
-			case S_IFDIR:
-				return _build_row_dir(index.d_name, date);
+	HTTP::STREAM	read(std::string *bucket) {
+		switch (_phase) {
+			case PHASE_HEADER:
+				bucket->append(_header());
+				_phase = PHASE_ROWS;
+				return HTTP::STREAM_OK;
+			case PHASE_ROWS:
+				if (_cached ? _read_cached(bucket) : _render_rows(bucket))
+					_phase = PHASE_FOOTER;
+				return HTTP::STREAM_OK;
+			case PHASE_FOOTER:
+				bucket->append(_footer());
+				_phase = PHASE_DONE;
+				return HTTP::STREAM_EOF;
 			default:
-				return _build_row_file(index.d_name, date, st.st_size);
+				return HTTP::STREAM_EOF;
 		}
 	}
 
-	void	_build_row_file(const std::string &name, const std::string &mtime,
-		const size_t size) {
-		std::stringstream obj;
+ private:
+	bool	_read_cached(std::string *bucket) {
+		const std::string &rows = _listing->rows;
+		size_t len = std::min(rows.size() - _offset,
+			static_cast<size_t>(WEBSERV_STREAM_CHUNK_SIZE));
+		bucket->append(rows, _offset, len);
+		_offset += len;
+		return _offset >= rows.size();
+	}
+
+	/*
+		Render rows until a slice is full, rows are kept for the cache
+		unless the listing grows over WEBSERV_AUTOINDEX_CACHE_ENTRY.
+	*/
+	bool	_render_rows(std::string *bucket) {
+		const AutoIndexEntries::EntryObject &dirs = _entries.dirs;
+		const AutoIndexEntries::EntryObject &files = _entries.files;
+		const size_t	total = dirs.size() + files.size();
+		std::string		&out = _uncacheable ? *bucket : _listing->rows;
+		const size_t	start = out.size();
+
+		while (_offset < total && out.size() - start < WEBSERV_STREAM_CHUNK_SIZE) {
+			if (_offset < dirs.size())
+				_render_row(dirs[_offset], true, &out);
+			else
+				_render_row(files[_offset - dirs.size()], false, &out);
+			++_offset;
+		}
+		if (!_uncacheable) {
+			bucket->append(out, start, std::string::npos);
+			if (out.size() > WEBSERV_AUTOINDEX_CACHE_ENTRY) {
+				_uncacheable = true;
+				std::string().swap(out);
+			}
+		}
 
-		obj << "<tr>\n"
-			"<td><a href=\"" << name << "\">" << name << "</a></td>\n"
-			"<td>" << mtime << "</td>\n"
-			"<td>" << size << "</td>\n"
-			"</tr>\n";
-		_files.push_back(std::make_pair(name, obj.str()));
+		if (_offset < total)
+			return false;
+		if (!_uncacheable)
+			AUTOINDEX_CACHE.store(_listing);
+		return true;
 	}
 
-	void	_build_row_dir(const std::string &name, const std::string &mtime) {
-		std::stringstream obj;
+	void	_render_row(const Entry &entry, bool is_dir, std::string *out) {
+		std::string	&rows = *out;
+		const char	*name = _entries.names.data() + entry.name;
 
-		obj << "<tr>\n"
-			"<td><a href=\"" << name << "/\">" << name << "</a></td>\n"
-			"<td>" << mtime << "</td>\n"
-			"<td>-</td>\n"
-			"</tr>\n";
-		_dirs.push_back(std::make_pair(name, obj.str()));
+		char		date[64];
+		struct tm	local;
+		localtime_r(&entry.mtime, &local);
+		strftime(date, sizeof(date), "%d-%b-%Y %H:%M", &local);
+
+		rows.append("<tr>\n<td><a href=\"");
+		rows.append(name, entry.len);
+		rows.append(is_dir ? "/\">" : "\">");
+		rows.append(name, entry.len);
+		rows.append("</a></td>\n<td>");
+		rows.append(date);
+		rows.append("</td>\n<td>");
+		if (is_dir) {
+			rows.append("-");
+		} else {
+			char size[32];
+			snprintf(size, sizeof(size), "%lld", static_cast<long long>(entry.size));
+			rows.append(size);
+		}
+		rows.append("</td>\n</tr>\n");
 	}
 
-	void	_build_header(const std::string &path) {
-		_source << "<html>\n"
+	const std::string	_header() const {
+		return "<html>\n"
 			"<head>\n"
 			"<title>Webserv Autoindex</title>\n"
 			"<style>\n"
@@ -97,25 +400,9 @@ class AutoIndexBuilder {
 			"</style>\n"
 			"</head>\n"
 			"<body>\n"
-			"<h3>Index of " << path << "</h3>\n"
-			"<hr />\n";
-	}
-
-	void	_build_footer() {
-		_source << "<hr />\n"
-			#ifdef WEBSERV_BUILD_COMMIT
-				"<p><em>Autoindexed by "
-				<< WEBSERV_SERVER_VERSION
-				<< WEBSERV_BUILD_COMMIT << "</em></p>\n"
-			#else
-				"<p><em>Autoindexed by Webserv</h3></p>\n"
-			#endif
-			"</body>\n"
-			"</html>";
-	}
-
-	void	_table_header() {
-		_source << "<table style=\"width: 100%;text-align:left;;\">\n"
+			"<h3>Index of " + _path + "</h3>\n"
+			"<hr />\n"
+			"<table style=\"width: 100%;text-align:left;;\">\n"
 			"<thead>\n"
 			"<tr>\n"
 			"<th>Name</th>\n"
@@ -126,22 +413,19 @@ class AutoIndexBuilder {
 			"<tbody>\n";
 	}
 
-	void	_table_footer() {
-		_source << "\t\t\t</tbody>\n"
-			"\t\t</table>\n";
-	}
-
-	void	_sort_indexs() {
-		std::sort(_dirs.begin(), _dirs.end());
-		std::sort(_files.begin(), _files.end());
-	}
-
-	void	_dump_indexs() {
-		IndexObject::const_iterator it;
-		for (it = _dirs.begin(); it != _dirs.end(); it++)
-			_source << it->second;
-		for (it = _files.begin(); it != _files.end(); it++)
-			_source << it->second;
+	const std::string	_footer() const {
+		return "\t\t\t</tbody>\n"
+			"\t\t</table>\n"
+			"<hr />\n"
+			#ifdef WEBSERV_BUILD_COMMIT
+				"<p><em>Autoindexed by "
+				WEBSERV_SERVER_VERSION
+				WEBSERV_BUILD_COMMIT "</em></p>\n"
+			#else
+				"<p><em>Autoindexed by Webserv</h3></p>\n"
+			#endif
+			"</body>\n"
+			"</html>";
 	}
 };
 
@@ -1,229 +1,334 @@
+/*
+	CGI scripts, run as non-blocking jobs of the event loop.
+		-> The request body is written to the script stdin and its output
+		read back, both pipes being registered in the loop epoll set.
+
+	A streamed request body is written as the client sends it, the stdin
+	pipe is only watched while some of it is waiting.
+
+	The output is parsed as it is read: the response starts once the
+	script headers are received, its body is done when stdout reaches EOF.
+	Reading pauses while the client has not drained the queued output.
+	A body of known length sent as is (no chunks, no gzip) is spliced from
+	the pipe to the client socket instead, see splice().
+
+	Scripts are started with posix_spawn() (vfork semantics), the cost of
+	a launch does not depend on the memory held by the server. Every fd of
+	the server is close-on-exec, the script only gets its two pipes.
+
+	The child is reaped by the loop (SIGCHLD through a signalfd). A script
+	sending no headers within its cgi_timeout is killed (504).
+*/
+
 #ifndef SERVER_CGI_HPP_
 #define SERVER_CGI_HPP_
 
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
 
 #include <map>
 #include <string>
+#include <vector>
 #include <utility>
 
-#include "http/request.hpp"
-#include "http/utils.hpp"
+#include "consts.hpp"
+#include "server/gateway.hpp"
+#include "server/affinity.hpp"
 
 namespace Webserv {
 namespace Server {
 
-class CGI {
- public:
-	typedef std::multimap<std::string, std::string> Headers;
-	typedef std::pair<std::string, std::string>		HeaderPair;
-	typedef std::map<std::string, std::string> 		EnvVar;
-
+class CGI : public Gateway {
  private:
 	const std::string	_bin_path;
-	const std::string	_file_path;
-	const std::string	_out_file;
 
-	EnvVar	_env;
-
-	HTTP::METHODS	_method;
-
-	std::string		_body;
-	Headers			_headers;
-
-	int		_fds[2];
-	int		_out_fd;
-	bool	_timed_out;
+	Reactor			*_reactor;
+	HTTP::Client	*_owner;
+	int				_in_fd;
+	int				_out_fd;
+	bool			_in_armed;
+	bool			_paused;
+	bool			_direct;
+	pid_t			_pid;
+	bool			_exited;
+	uint64_t		_deadline;
 
  public:
 	CGI(const std::string &bin_path,
 		const std::string &file_path, const std::string &query,
 		const HTTP::METHODS &method)
-	:	_bin_path(bin_path),
-		_file_path(file_path),
-		_out_file(HTTP::rand_string(16)),
-		_method(method),
-		_timed_out(false) {
-		_env["QUERY_STRING"] = query;
-	}
+	:	Gateway(file_path, query, method, HTTP::INTERNAL_SERVER_ERROR),
+		_bin_path(bin_path),
+		_reactor(0), _owner(0),
+		_in_fd(-1), _out_fd(-1),
+		_in_armed(false),
+		_paused(false),
+		_direct(false),
+		_pid(-1),
+		_exited(false),
+		_deadline(0) {}
 
 	~CGI() {
-		_delete_temp_file();
+		_close_input();
+		_close_output();
+		if (_pid > 0 && !_exited) {
+			kill(_pid, SIGKILL);
+			_reactor->unwatch_child(_pid);
+		}
 	}
 
-	bool	setup(const std::string &request,
-		const HTTP::Request::HeadersObject &headers) {
-		if (pipe(_fds) == -1)
-			return false;
-
-		write(_fds[1], request.c_str(), request.size());
-		_env["CONTENT_LENGTH"] = _toString(request.size());
+	/*
+		Start the script, its pipes, pid and deadline are registered in
+		reactor on behalf of owner, then run() returns immediately.
+	*/
+	bool	run(Reactor *reactor, HTTP::Client *owner) {
+		int	in[2], out[2];
 
-		_out_fd = open(_out_file.c_str(), O_RDWR | O_CREAT, S_IWRITE | S_IREAD);
-		if (_out_fd == -1)
+		if (pipe2(in, O_CLOEXEC) == -1)
 			return false;
-		close(_fds[STDOUT_FILENO]);
-		return setup_env(headers);
-	}
+		if (pipe2(out, O_CLOEXEC) == -1) {
+			close(in[0]);
+			close(in[1]);
+			return false;
+		}
 
-	bool	setup_env(const HTTP::Request::HeadersObject &headers) {
-		HTTP::Request::HeadersObject::const_iterator it = headers.begin();
-		for (; it != headers.end(); ++it) {
-			if (it->first == "content-type")
-				_env["CONTENT_TYPE"] = it->second;
-			_env["HTTP_" + _header_to_hcgi(it->first)] = it->second;
+		// The block part of the environment is shared, only pointed to
+		std::vector<std::string>	env = _dump_env();
+		std::vector<char *>			envp;
+		for (size_t i = 0; i < _base_env->size(); ++i)
+			envp.push_back(const_cast<char *>((*_base_env)[i].c_str()));
+		for (size_t i = 0; i < env.size(); ++i)
+			envp.push_back(const_cast<char *>(env[i].c_str()));
+		envp.push_back(NULL);
+
+		int err = _spawn(in[STDIN_FILENO], out[STDOUT_FILENO], &envp[0]);
+		close(in[STDIN_FILENO]);
+		close(out[STDOUT_FILENO]);
+		_in_fd = in[STDOUT_FILENO];
+		_out_fd = out[STDIN_FILENO];
+		if (err != 0) {
+			_pid = -1;
+			std::cerr << "posix_spawn() failed: " << strerror(err) << std::endl;
+			return false;
 		}
 
-		_env["GATEWAY_INTERFACE"] = "CGI/1.1";
-		_env["SCRIPT_FILENAME"] = _file_path;
-		_env["REDIRECT_STATUS"] = "200";
+		_reactor = reactor;
+		_owner = owner;
+		_reactor->watch_child(_pid, owner);
+		if (fcntl(_in_fd, F_SETFL, O_NONBLOCK) == -1
+			|| fcntl(_out_fd, F_SETFL, O_NONBLOCK) == -1
+			|| !_reactor->watch(_out_fd, EPOLLIN, owner))
+			return false;
+		if (_input_eof && _input.empty())
+			_close_input();
+		else if (!_reactor->watch(_in_fd,
+			_input.empty() ? 0 : static_cast<uint32_t>(EPOLLOUT), owner))
+			return false;
+		_in_armed = !_input.empty();
 
-		if (_method == HTTP::METH_GET)
-			_env["REQUEST_METHOD"] = "GET";
-		else if (_method == HTTP::METH_POST)
-			_env["REQUEST_METHOD"] = "POST";
-		else
-			_env["REQUEST_METHOD"] = "UNKNOWN";
+		_deadline = monotonic_ms() + _timeout * 1000;
+		_reactor->schedule(_deadline, owner);
 		return true;
 	}
 
-	bool		run() {
-		pid_t	worker;
+	/*
+		Event on one of the pipes, the response is woken once the headers
+		are parsed, then for every piece of body.
+	*/
+	bool	handle(int fd, uint32_t events) {
+		(void)events;
+		bool resumed = false;
+		if (fd == _in_fd)
+			resumed = _write_input();
+		else if (fd == _out_fd)
+			_read_output();
+		return ready() || resumed;
+	}
 
-		worker = fork();
-		if (worker < 0) {
-			std::cerr << "fork() failed" << std::endl;
-			close(_out_fd);
+	/*
+		The rest of the output is spliced, unless it was already read.
+	*/
+	bool	direct() {
+		if (_out_fd == -1 || _error || length() < 0)
 			return false;
-		} else if (worker == 0) {
-			__worker_flow();
-		} else {
-			int pid, state;
-			struct timeval current_time;
-			struct timeval start_time;
-
-			gettimeofday(&start_time, NULL);
-			while (true) {
-				pid = waitpid(worker, &state, WNOHANG);
-				if (pid == -1) {
-					if (_timed_out)
-						break;
-					std::cerr << "waitpid() failed" << std::endl;
-					close(_out_fd);
-					return false;
-				}
-
-				usleep(WEBSERV_CGI_TICKS_US);
-				if (pid && WIFEXITED(state))
-					break;
-
-				gettimeofday(&current_time, NULL);
-				if (current_time.tv_sec >= start_time.tv_sec + WEBSERV_CGI_TIMEOUT) {
-					if (current_time.tv_usec < start_time.tv_usec)
-						continue;
-					kill(worker, SIGKILL);
-					_timed_out = true;
-				}
-			}
+		_direct = true;
+		return true;
+	}
+
+	HTTP::STREAM	splice(int fd) {
+		const size_t	total = length();
+		ssize_t			n = 0;
+
+		while (_delivered < total && (n = ::splice(_out_fd, NULL, fd, NULL,
+			total - _delivered, SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) > 0)
+			_delivered += n;
+		if (_delivered >= total) {
+			_close_output();
+			_eof = true;
+			return HTTP::STREAM_EOF;
 		}
-		close(_out_fd);
-		if (_timed_out)
-			return false;
-		return _extract_response();
+		if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+			// The script sent less than its Content-Length
+			_close_output();
+			return HTTP::STREAM_ERROR;
+		}
+
+		// EAGAIN from either side, the pipe tells which one is blocking
+		int	pending = 0;
+		if (ioctl(_out_fd, FIONREAD, &pending) == 0 && pending > 0)
+			return HTTP::STREAM_OK;
+		_paused = false;
+		_reactor->watch(_out_fd, EPOLLIN, _owner);
+		return HTTP::STREAM_WAIT;
 	}
 
-	const std::string &get_output() const { return _body; }
-	const Headers &get_headers() const { return _headers; }
-	const bool &timed_out() const { return _timed_out; }
+	bool	handle_exit(pid_t pid) {
+		if (pid == _pid)
+			_exited = true;
+		return false;
+	}
+
+	bool	handle_timeout(uint64_t now) {
+		if (_pid <= 0 || ready() || now < _deadline)
+			return false;
+		kill(_pid, SIGKILL);
+		_fail(HTTP::GATEWAY_TIMEOUT);
+		_close_input();
+		_close_output();
+		return true;
+	}
 
  private:
-	void	__worker_flow() {
-		dup2(_fds[STDIN_FILENO], STDIN_FILENO);
-		dup2(_out_fd, STDOUT_FILENO);
-		close(_fds[STDIN_FILENO]);
+	/*
+		The script gets the pipes as stdin / stdout, an empty signal mask
+		and the default SIGPIPE action (ignored by the server). It runs on
+		any CPU, see unpin_thread().
+			-> 0 or the error of posix_spawn().
+	*/
+	int		_spawn(int in, int out, char **envp) {
+		posix_spawn_file_actions_t	actions;
+		posix_spawnattr_t			attr;
+		sigset_t					mask, defaults;
+
+		sigemptyset(&mask);
+		sigemptyset(&defaults);
+		sigaddset(&defaults, SIGPIPE);
+
+		posix_spawn_file_actions_init(&actions);
+		posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+		posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+		posix_spawnattr_init(&attr);
+		posix_spawnattr_setsigmask(&attr, &mask);
+		posix_spawnattr_setsigdefault(&attr, &defaults);
+		posix_spawnattr_setflags(&attr,
+			POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
 
 		char	*argv[] = {
 			const_cast<char*>(_bin_path.c_str()),
 			const_cast<char*>(_file_path.c_str()),
 		NULL};
-		if (execve(argv[0], argv, _dump_env()) == -1)
-			_exit(EXIT_FAILURE);
-	}
+		unpin_thread();
+		int err = posix_spawn(&_pid, argv[0], &actions, &attr, argv, envp);
+		repin_thread();
 
-	void	__timer_flow() {
-		sleep(WEBSERV_CGI_TIMEOUT);
+		posix_spawnattr_destroy(&attr);
+		posix_spawn_file_actions_destroy(&actions);
+		return err;
 	}
 
-	void	_delete_temp_file() { remove(_out_file.c_str()); }
-
-	char	**_dump_env() {
-		char **ret = reinterpret_cast<char**>(
-				malloc(sizeof(char *) * (_env.size() + 1)));
-		ret[_env.size()] = 0;
-
-		EnvVar::const_iterator it = _env.begin();
-		for (std::size_t i = 0; it != _env.end(); ++it, i++) {
-			std::string payload = it->first + "=" + it->second;
-			ret[i] = strdup(payload.c_str());
+	/*
+		-> true when the client may send more of the body.
+	*/
+	bool	_write_input() {
+		ssize_t n = write(_in_fd, _input.data() + _input_sent, _input_left());
+		if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+			// The script does not read its stdin, the rest is dropped
+			_input_discard = true;
+			_close_input();
+			return _input_consumed(_input_left());
 		}
-		return ret;
-	}
-
-	bool	_extract_response() {
-		std::ifstream	file(_out_file.c_str());
-		if (!file.is_open())
-			return false;
-		std::string data((std::istreambuf_iterator<char>(file)),
-			std::istreambuf_iterator<char>());
-		file.close();
-		return _parse_headers(data);
+		bool resumed = _input_consumed(n > 0 ? n : 0);
+		if (_input_left() == 0 && _input_eof)
+			_close_input();
+		else if (_input_left() == 0 && _in_armed)
+			_in_armed = !_reactor->watch(_in_fd, 0, _owner);
+		return resumed;
 	}
 
-	static inline std::string _header_to_hcgi(std::string in) {
-		for (std::size_t i = 0; i < in.size(); i++) {
-			if (in[i] >= 'a' && in[i] <= 'z')
-				in[i] = in[i] - 32;
-			else if (in[i] == '-')
-				in[i] = '_';
-		}
-		return in;
+	void	_input_ready() {
+		if (_in_fd == -1)
+			return;
+		if (_input_left() == 0 && _input_eof)
+			return _close_input();
+		if (_input_left() > 0 && !_in_armed)
+			_in_armed = _reactor->watch(_in_fd, EPOLLOUT, _owner);
 	}
 
-	bool	_parse_headers(std::string data) {
-		std::size_t sep_pos = data.find("\r\n\r\n");
-		if (sep_pos == std::string::npos)
-			return false;
+	void	_read_output() {
+		char	buffer[WEBSERV_STREAM_CHUNK_SIZE];
+		ssize_t	n = -1;
 
-		std::string headers = data.substr(0, sep_pos);
-		_body = data.substr(sep_pos + 4);
+		// Readable again, the client is woken to splice it
+		if (_direct) {
+			_paused = _reactor->watch(_out_fd, 0, _owner);
+			return;
+		}
 
-		while ((sep_pos = headers.find(": ")) != std::string::npos) {
-			const std::string key = headers.substr(0, sep_pos);
+		errno = EAGAIN;
+		while (!_full() && !_error
+			&& (n = ::read(_out_fd, buffer, sizeof(buffer))) > 0)
+			_feed(buffer, n);
+		if (_full() && !_error) {
+			_paused = _reactor->watch(_out_fd, 0, _owner);
+			return;
+		}
+		if (_error || n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+			_close_output();
+			_end();
+		}
+	}
 
-			std::size_t nl_pos = 0;
-			while (headers[nl_pos] && headers[nl_pos] != '\r')
-				++nl_pos;
-			std::string value = headers.substr(sep_pos + 2, nl_pos);
+	void	_drained() {
+		if (!_paused || _out_fd == -1)
+			return;
+		_paused = false;
+		_reactor->watch(_out_fd, EPOLLIN, _owner);
+	}
 
-			if (value.find("\r") != std::string::npos)
-				value = value.substr(0, value.find("\r"));
+	void	_close_input() {
+		if (_in_fd == -1)
+			return;
+		if (_reactor)
+			_reactor->unwatch(_in_fd);
+		close(_in_fd);
+		_in_fd = -1;
+	}
 
-			_headers.insert(HeaderPair(key, value));
-			if (key.size() + 2 + value.size() >= headers.size())
-				break;
-			headers = headers.substr(nl_pos + 2);
-		}
-		return true;
+	void	_close_output() {
+		if (_out_fd == -1)
+			return;
+		if (_reactor)
+			_reactor->unwatch(_out_fd);
+		close(_out_fd);
+		_out_fd = -1;
 	}
 
-	std::string	_toString(size_t num) {
-		std::stringstream ss;
+	std::vector<std::string>	_dump_env() const {
+		std::vector<std::string> ret;
 
-		ss << num;
-		return ss.str();
+		EnvVar::const_iterator it = _env.begin();
+		for (; it != _env.end(); ++it)
+			ret.push_back(it->first + "=" + it->second);
+		return ret;
 	}
 };
 
@@ -0,0 +1,557 @@
+/*
+	Disk-backed cache of the GET responses of the scripts and upstreams of
+	a block (disk_cache), kept across restarts.
+
+	Every response is a file of the cache directory, sharded on two levels
+	by the hash of its key (dir/f/3a/<hash>), so that no directory grows
+	too large. Its head holds the key, dates, status and headers, the body
+	follows as it was sent. Only keys, sizes and dates are held in memory,
+	the least recently used files are removed once the directory exceeds
+	its byte budget.
+
+	Responses are written to a temporary file as they are streamed, then
+	renamed in place once complete. Hits are sent from the file with
+	sendfile(). Expired entries are kept until evicted: they are served in
+	place of an upstream failure.
+
+	Files are opened, written and removed on the io pool (DiskOpenJob,
+	DiskWriteJob, RemoveJob), the loop only holds the index. The index is
+	rebuilt at startup from the first bytes of every file.
+
+	With worker_processes, each worker indexes a directory of its own
+	(path/worker-<slot>) with its part of the budget: no file is known by
+	two indexes.
+*/
+
+#ifndef SERVER_DISKCACHE_HPP_
+#define SERVER_DISKCACHE_HPP_
+
+#include <time.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <map>
+#include <list>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <utility>
+#include <iostream>
+#include <algorithm>
+
+#include "consts.hpp"
+#include "models/IBlock.hpp"
+#include "server/iopool.hpp"
+#include "server/gateway.hpp"
+
+namespace Webserv {
+namespace Server {
+
+#define WEBSERV_DISK_CACHE_MAGIC	"WEBSERV-CACHE 1"
+
+/*
+	open() of the file of a key and read of its head, the body is length
+	bytes at offset.
+*/
+class DiskOpenJob : public IOJob {
+ public:
+	struct Head {
+		int					status;
+		time_t				stored;
+		Gateway::Headers	headers;
+		off_t				offset;
+		size_t				length;
+	};
+
+ private:
+	const std::string	_path;
+	const std::string	_key;
+	int					_fd;
+	Head				_head;
+
+ public:
+	DiskOpenJob(const std::string &path, const std::string &key)
+	:	_path(path), _key(key), _fd(-1), _head() {}
+
+	~DiskOpenJob() {
+		if (_fd != -1)
+			close(_fd);
+	}
+
+	void	run() {
+		_fd = ::open(_path.c_str(), O_RDONLY | O_CLOEXEC);
+		struct stat st;
+		if (_fd == -1 || fstat(_fd, &st) == -1 || !_read_head()
+			|| static_cast<size_t>(st.st_size) < static_cast<size_t>(_head.offset)) {
+			if (_fd != -1)
+				close(_fd);
+			_fd = -1;
+			return;
+		}
+		_head.length = st.st_size - _head.offset;
+	}
+
+	const Head	&head() const { return _head; }
+
+	// Positioned nowhere (pread), -1 when the file is gone or unreadable
+	int		take_fd() {
+		const int fd = _fd;
+		_fd = -1;
+		return fd;
+	}
+
+ private:
+	bool	_read_head() {
+		std::string	data;
+		char		buffer[4096];
+		size_t		end;
+		ssize_t		n;
+
+		while ((end = data.find("\n\n")) == std::string::npos) {
+			if (data.size() > WEBSERV_GATEWAY_HEADERS_SIZE + _key.size()
+				|| (n = pread(_fd, buffer, sizeof(buffer), data.size())) <= 0)
+				return false;
+			data.append(buffer, n);
+		}
+		_head.offset = end + 2;
+		data.erase(end + 1);
+
+		std::istringstream	lines(data);
+		std::string			line;
+		time_t				expires;
+		if (!std::getline(lines, line) || line != WEBSERV_DISK_CACHE_MAGIC
+			|| !std::getline(lines, line) || line != _key
+			|| !(lines >> _head.stored >> expires >> _head.status)
+			|| !std::getline(lines, line))
+			return false;
+		while (std::getline(lines, line)) {
+			const size_t sep = line.find(": ");
+			if (sep != std::string::npos)
+				_head.headers.insert(Gateway::HeaderPair(line.substr(0, sep),
+					line.substr(sep + 2)));
+		}
+		return true;
+	}
+};
+
+/*
+	Bytes appended to the temporary file of a response, created by its
+	first write. The last one renames it to path.
+*/
+class DiskWriteJob : public IOJob {
+ private:
+	const std::string	_temp;
+	const std::string	_path;
+	const bool			_create;
+	std::string			_data;
+	bool				_ok;
+
+ public:
+	// data is taken, path is "" but for the last write
+	DiskWriteJob(const std::string &temp, const std::string &path,
+		std::string *data, bool create)
+	:	_temp(temp), _path(path), _create(create), _ok(false) {
+		_data.swap(*data);
+	}
+
+	void	run() {
+		const int flags = O_WRONLY | O_APPEND | O_CLOEXEC
+			| (_create ? O_CREAT | O_TRUNC : 0);
+		int fd = ::open(_temp.c_str(), flags, 0600);
+		if (fd == -1)
+			return;
+		const bool written = _write(fd);
+		if (close(fd) == -1 || !written)
+			return;
+		if (_path != "") {
+			const std::string shard = _path.substr(0, _path.rfind('/'));
+			mkdir(shard.substr(0, shard.rfind('/')).c_str(), 0700);
+			mkdir(shard.c_str(), 0700);
+			if (rename(_temp.c_str(), _path.c_str()) == -1)
+				return;
+		}
+		_ok = true;
+	}
+
+	bool	ok() const { return _ok; }
+
+	// The response is gone, so is its file
+	IOJob	*abandoned() {
+		return new RemoveJob(_ok && _path != "" ? _path : _temp);
+	}
+
+ private:
+	bool	_write(int fd) {
+		size_t written = 0;
+		while (written < _data.size()) {
+			ssize_t n = write(fd, _data.data() + written,
+				_data.size() - written);
+			if (n == -1 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return false;
+			written += n;
+		}
+		return true;
+	}
+};
+
+class DiskCache {
+ public:
+	struct Entry {
+		std::string							path;
+		size_t								size;
+		time_t								stored;
+		time_t								expires;
+		std::list<std::string>::iterator	lru;
+	};
+
+	/*
+		Response being written to a temporary file, see begin(). Its bytes
+		wait in pending while the previous write is running (job).
+	*/
+	struct Fill {
+		std::string		key;
+		std::string		temp;
+		std::string		pending;
+		size_t			size;
+		time_t			stored;
+		time_t			expires;
+		bool			created;
+		bool			last;
+		DiskWriteJob	*job;
+	};
+
+ private:
+	typedef std::map<std::string, Entry>	EntryObject;
+
+	const std::string	_dir;
+	const size_t		_budget;
+	Reactor				*_reactor;
+	size_t				_size;
+	bool				_usable;
+	size_t				_temps;
+
+	EntryObject				_entries;
+	std::list<std::string>	_lru;
+
+ public:
+	DiskCache(const std::string &dir, size_t budget, Reactor *reactor)
+	:	_dir(dir), _budget(budget), _reactor(reactor), _size(0),
+		_usable(false), _temps(0) {}
+
+	/*
+		Index the files left by previous runs, temporary and unreadable
+		files are removed.
+			-> number of entries.
+	*/
+	size_t	load() {
+		if (mkdir(_dir.c_str(), 0700) == -1 && errno != EEXIST) {
+			std::cerr << "disk_cache: unable to create " << _dir << std::endl;
+			return 0;
+		}
+		_usable = true;
+
+		std::vector<std::pair<time_t, std::string> >	order;
+		std::map<std::string, Entry>					found;
+		_scan(_dir, 0, &found);
+		EntryObject::const_iterator it = found.begin();
+		for (; it != found.end(); ++it)
+			order.push_back(std::make_pair(it->second.stored, it->first));
+		// Oldest first, the most recent end up at the front of the LRU
+		std::sort(order.begin(), order.end());
+		for (size_t i = 0; i < order.size(); ++i)
+			_insert(order[i].second, found[order[i].second]);
+		_evict();
+		return _entries.size();
+	}
+
+	/*
+		Entry of key, expired or not, 0 on a miss.
+	*/
+	const Entry	*lookup(const std::string &key) {
+		EntryObject::iterator it = _entries.find(key);
+		if (it == _entries.end())
+			return 0;
+		_lru.splice(_lru.begin(), _lru, it->second.lru);
+		return &it->second;
+	}
+
+	/*
+		Job opening the file of key, 0 on a miss. Once it fails the entry
+		is dropped.
+	*/
+	DiskOpenJob	*open(const std::string &key) const {
+		EntryObject::const_iterator it = _entries.find(key);
+		if (it == _entries.end())
+			return 0;
+		return new DiskOpenJob(it->second.path, key);
+	}
+
+	void	drop(const std::string &key) {
+		EntryObject::iterator it = _entries.find(key);
+		if (it != _entries.end())
+			_erase(it);
+	}
+
+	/*
+		Start storing the response of key, fresh for ttl seconds. Nothing
+		is written until flush().
+			-> 0 when the directory is not usable.
+	*/
+	Fill	*begin(const std::string &key, int status,
+		const Gateway::Headers &headers, size_t ttl) {
+		if (!_usable)
+			return 0;
+		std::stringstream	temp, head;
+		const time_t		now = time(NULL);
+
+		temp << _dir << "/.tmp-" << getpid() << "-" << ++_temps;
+		head << WEBSERV_DISK_CACHE_MAGIC << "\n" << key << "\n"
+			<< now << " " << now + ttl << " " << status << "\n";
+		Gateway::Headers::const_iterator it = headers.begin();
+		for (; it != headers.end(); ++it) {
+			if (strcasecmp(it->first.c_str(), "Status") != 0)
+				head << it->first << ": " << it->second << "\n";
+		}
+		head << "\n";
+
+		Fill *fill = new Fill();
+		fill->key = key;
+		fill->temp = temp.str();
+		fill->pending = head.str();
+		fill->size = fill->pending.size();
+		fill->stored = now;
+		fill->expires = now + ttl;
+		fill->created = false;
+		fill->last = false;
+		fill->job = 0;
+		return fill;
+	}
+
+	/*
+		-> false once the file can not hold the response (larger than the
+		budget), it is then discarded by the caller.
+	*/
+	bool	append(Fill *fill, const std::string &data) {
+		fill->pending += data;
+		fill->size += data.size();
+		return fill->size <= _budget;
+	}
+
+	/*
+		Write the pending bytes of fill on the io pool, owner is woken once
+		done, see written(). The last write puts the file in place.
+			-> false when the pool is full, fill is discarded by the caller.
+	*/
+	bool	flush(Fill *fill, bool last, HTTP::Client *owner) {
+		DiskWriteJob *job = new DiskWriteJob(fill->temp,
+			last ? _path(fill->key) : "", &fill->pending, !fill->created);
+		if (!get_io_pool(_reactor)->submit(job, owner)) {
+			delete job;
+			return false;
+		}
+		fill->created = true;
+		fill->last = last;
+		fill->job = job;
+		return true;
+	}
+
+	/*
+		The write of fill is done(), the last one is then committed.
+			-> false when it failed, fill is discarded by the caller.
+	*/
+	bool	written(Fill *fill) {
+		const bool ok = fill->job->ok();
+		delete fill->job;
+		fill->job = 0;
+		return ok;
+	}
+
+	/*
+		The file of fill is in place, it replaces the previous one.
+	*/
+	void	commit(Fill *fill) {
+		EntryObject::iterator it = _entries.find(fill->key);
+		if (it != _entries.end())
+			_forget(it);
+		Entry entry;
+		entry.path = _path(fill->key);
+		entry.size = fill->size;
+		entry.stored = fill->stored;
+		entry.expires = fill->expires;
+		_insert(fill->key, entry);
+		_evict();
+		delete fill;
+	}
+
+	/*
+		The file of fill is removed, once finished by a running write.
+	*/
+	void	discard(Fill *fill) {
+		if (fill->job)
+			get_io_pool(_reactor)->cancel(fill->job);
+		else if (fill->created)
+			_remove(fill->temp);
+		delete fill;
+	}
+
+ private:
+	/*
+		Cache files sit two levels down, as dir/<1 hex>/<2 hex>/<16 hex>.
+		Temporary files are those of a process which is gone, but for a
+		draining worker still writing to the directory of its slot.
+	*/
+	void	_scan(const std::string &dir, int depth, EntryObject *found) {
+		DIR *dirptr = opendir(dir.c_str());
+		if (!dirptr)
+			return;
+		struct dirent *ent;
+		while ((ent = readdir(dirptr)) != NULL) {
+			const std::string name = ent->d_name;
+			if (name == "." || name == "..")
+				continue;
+			const std::string path = dir + "/" + name;
+			if (depth == 0 && name.compare(0, 5, ".tmp-") == 0) {
+				const pid_t writer = atoi(name.c_str() + 5);
+				if (writer <= 0 || writer == getpid() || kill(writer, 0) == -1)
+					unlink(path.c_str());
+			} else if (depth < 2) {
+				struct stat st;
+				if (name.size() == static_cast<size_t>(depth + 1)
+					&& stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+					_scan(path, depth + 1, found);
+			} else {
+				Entry		entry;
+				std::string	key;
+				if (_index(path, &key, &entry))
+					(*found)[key] = entry;
+				else
+					unlink(path.c_str());
+			}
+		}
+		closedir(dirptr);
+	}
+
+	/*
+		Key and dates of a cache file, only its first bytes are read.
+	*/
+	bool	_index(const std::string &path, std::string *key, Entry *entry) {
+		char		buffer[4096];
+		struct stat	st;
+
+		int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd == -1)
+			return false;
+		ssize_t n = pread(fd, buffer, sizeof(buffer), 0);
+		bool ok = n > 0 && fstat(fd, &st) == 0;
+		close(fd);
+		if (!ok)
+			return false;
+
+		std::istringstream	head(std::string(buffer, n));
+		std::string			magic;
+		int					status;
+		if (!std::getline(head, magic) || magic != WEBSERV_DISK_CACHE_MAGIC
+			|| !std::getline(head, *key)
+			|| !(head >> entry->stored >> entry->expires >> status))
+			return false;
+		entry->path = path;
+		entry->size = st.st_size;
+		return _path(*key) == path;
+	}
+
+	std::string	_path(const std::string &key) const {
+		uint64_t h = 14695981039346656037ULL;
+		for (size_t i = 0; i < key.size(); ++i) {
+			h ^= static_cast<unsigned char>(key[i]);
+			h *= 1099511628211ULL;
+		}
+		char hex[17];
+		snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(h));
+		return _dir + "/" + hex[15] + "/" + std::string(hex + 13, 2) + "/" + hex;
+	}
+
+	void	_insert(const std::string &key, const Entry &entry) {
+		_lru.push_front(key);
+		Entry &inserted = _entries[key];
+		inserted = entry;
+		inserted.lru = _lru.begin();
+		_size += entry.size;
+	}
+
+	void	_evict() {
+		while (_size > _budget && !_lru.empty())
+			_erase(_entries.find(_lru.back()));
+	}
+
+	void	_erase(EntryObject::iterator it) {
+		_remove(it->second.path);
+		_forget(it);
+	}
+
+	/*
+		On the io pool, or right away when it is full.
+	*/
+	void	_remove(const std::string &path) {
+		IOJob *job = new RemoveJob(path);
+		if (!get_io_pool(_reactor)->submit(job, 0)) {
+			delete job;
+			unlink(path.c_str());
+		}
+	}
+
+	/*
+		Out of the index, the file is left as is.
+	*/
+	void	_forget(EntryObject::iterator it) {
+		_size -= it->second.size;
+		_lru.erase(it->second.lru);
+		_entries.erase(it);
+	}
+};
+
+static std::map<std::string, DiskCache *>	DISK_CACHES;
+
+/*
+	Cache of the directory of block, blocks sharing a directory share its
+	index (and the budget of the first one).
+*/
+static DiskCache	*get_disk_cache(const Models::IBlock *block,
+	Reactor *reactor) {
+	const Models::IBlock::CacheDir &conf = block->get_disk_cache();
+	std::map<std::string, DiskCache *>::iterator it = DISK_CACHES.find(conf.path);
+	if (it != DISK_CACHES.end())
+		return it->second;
+	std::stringstream dir;
+	dir << conf.path;
+	if (reactor->workers() > 1) {
+		mkdir(conf.path.c_str(), 0700);
+		dir << "/worker-" << reactor->worker();
+	}
+	DiskCache *cache = new DiskCache(dir.str(), worker_share(reactor, conf.size),
+		reactor);
+	DISK_CACHES[conf.path] = cache;
+	cache->load();
+	return cache;
+}
+
+void	destroy_disk_caches() {
+	std::map<std::string, DiskCache *>::iterator it = DISK_CACHES.begin();
+	for (; it != DISK_CACHES.end(); ++it)
+		delete it->second;
+	DISK_CACHES.clear();
+}
+
+}  // namespace Server
+}  // namespace Webserv
+
+#endif  // SERVER_DISKCACHE_HPP_
@@ -0,0 +1,752 @@
+/*
+	FastCGI client, requests are multiplexed over a pool of persistent
+	connections per upstream address (unix:/path/to.sock or host:port).
+
+	Each new connection first asks the application whether it accepts
+	several requests at once (FCGI_MPXS_CONNS), until it answers only one
+	request at a time is sent on it. When every connection of the pool is
+	busy, requests wait in a queue for the first free slot.
+
+	The request body is sent by FCGI_STDIN records as the socket drains,
+	FCGI_STDOUT records are fed to the response as they arrive. Reading a
+	connection pauses while its only request has WEBSERV_GATEWAY_BUFFER_SIZE
+	bytes queued, until its client drains them. A request sharing the
+	connection does not hold the others: it queues up to
+	WEBSERV_FASTCGI_SPILL_SIZE more bytes, then it alone is aborted.
+*/
+
+#ifndef SERVER_FASTCGI_HPP_
+#define SERVER_FASTCGI_HPP_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/epoll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <map>
+#include <deque>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+#include "consts.hpp"
+#include "server/gateway.hpp"
+#include "server/reactor.hpp"
+
+namespace Webserv {
+namespace Server {
+
+#define FCGI_VERSION_1			1
+#define FCGI_HEADER_LEN			8
+#define FCGI_MAX_CONTENT		65535
+#define FCGI_RESPONDER			1
+#define FCGI_KEEP_CONN			1
+#define FCGI_MPXS_CONNS			"FCGI_MPXS_CONNS"
+
+enum FCGI_TYPE {
+	FCGI_BEGIN_REQUEST = 1,
+	FCGI_ABORT_REQUEST,
+	FCGI_END_REQUEST,
+	FCGI_PARAMS,
+	FCGI_STDIN,
+	FCGI_STDOUT,
+	FCGI_STDERR,
+	FCGI_DATA,
+	FCGI_GET_VALUES,
+	FCGI_GET_VALUES_RESULT,
+	FCGI_UNKNOWN_TYPE
+};
+
+/*
+	Append one record, content must fit in FCGI_MAX_CONTENT.
+*/
+static void	fcgi_record(std::string *out, FCGI_TYPE type, uint16_t id,
+	const char *content, size_t len) {
+	const size_t padding = (8 - len % 8) % 8;
+	const char header[FCGI_HEADER_LEN] = {
+		FCGI_VERSION_1, static_cast<char>(type),
+		static_cast<char>(id >> 8), static_cast<char>(id & 0xff),
+		static_cast<char>(len >> 8), static_cast<char>(len & 0xff),
+		static_cast<char>(padding), 0
+	};
+	out->append(header, FCGI_HEADER_LEN);
+	out->append(content, len);
+	out->append(padding, '\0');
+}
+
+/*
+	Name-value pair, lengths over 127 are sent on four bytes.
+*/
+static void	fcgi_pair(std::string *out, const std::string &name,
+	const std::string &value) {
+	const size_t lengths[2] = { name.size(), value.size() };
+	for (int i = 0; i < 2; ++i) {
+		if (lengths[i] < 128) {
+			out->push_back(static_cast<char>(lengths[i]));
+		} else {
+			out->push_back(static_cast<char>((lengths[i] >> 24) | 0x80));
+			out->push_back(static_cast<char>(lengths[i] >> 16));
+			out->push_back(static_cast<char>(lengths[i] >> 8));
+			out->push_back(static_cast<char>(lengths[i]));
+		}
+	}
+	out->append(name);
+	out->append(value);
+}
+
+static size_t	fcgi_pair_length(const unsigned char *p, size_t *len) {
+	if (p[0] < 128) {
+		*len = p[0];
+		return 1;
+	}
+	*len = (static_cast<size_t>(p[0] & 0x7f) << 24)
+		| (static_cast<size_t>(p[1]) << 16)
+		| (static_cast<size_t>(p[2]) << 8) | p[3];
+	return 4;
+}
+
+class FastCGIPool;
+class FastCGIConnection;
+
+class FastCGIRequest : public Gateway {
+	friend class FastCGIConnection;
+	friend class FastCGIPool;
+
+ protected:
+	const std::string	_address;
+
+ private:
+
+	Reactor				*_reactor;
+	HTTP::Client		*_owner;
+	FastCGIPool			*_pool;
+	FastCGIConnection	*_conn;
+	uint16_t			_id;
+
+	bool		_input_done;
+	bool		_replayable;
+	bool		_received;
+	size_t		_tries;
+	uint64_t	_deadline;
+
+ public:
+	FastCGIRequest(const std::string &address,
+		const std::string &file_path, const std::string &query,
+		const HTTP::METHODS &method)
+	:	Gateway(_absolute(file_path), query, method, HTTP::BAD_GATEWAY),
+		_address(address),
+		_reactor(0), _owner(0),
+		_pool(0), _conn(0), _id(0),
+		_input_done(false),
+		_replayable(true),
+		_received(false),
+		_tries(0),
+		_deadline(0) {}
+
+	~FastCGIRequest();
+
+	bool	run(Reactor *reactor, HTTP::Client *owner);
+	bool	handle_timeout(uint64_t now);
+
+	HTTP::Client	*owner() const { return _owner; }
+
+ protected:
+	/*
+		Pool the request is submitted to.
+	*/
+	virtual FastCGIPool	*_resolve(Reactor *reactor);
+
+ private:
+	/*
+		Records sent once the request got a connection.
+	*/
+	void	_begin(FastCGIConnection *conn, uint16_t id, std::string *out) {
+		_conn = conn;
+		_id = id;
+
+		const char body[8] = { 0, FCGI_RESPONDER, FCGI_KEEP_CONN, 0, 0, 0, 0, 0 };
+		fcgi_record(out, FCGI_BEGIN_REQUEST, _id, body, sizeof(body));
+
+		std::string params;
+		BaseEnv::const_iterator base = _base_env->begin();
+		for (; base != _base_env->end(); ++base) {
+			size_t sep = base->find('=');
+			fcgi_pair(&params, base->substr(0, sep), base->substr(sep + 1));
+		}
+		EnvVar::const_iterator it = _env.begin();
+		for (; it != _env.end(); ++it)
+			fcgi_pair(&params, it->first, it->second);
+		for (size_t i = 0; i < params.size(); i += FCGI_MAX_CONTENT) {
+			fcgi_record(out, FCGI_PARAMS, _id, params.data() + i,
+				std::min(params.size() - i, static_cast<size_t>(FCGI_MAX_CONTENT)));
+		}
+		fcgi_record(out, FCGI_PARAMS, _id, "", 0);
+	}
+
+	/*
+		Next slice of the body, the empty record closes the stream.
+	*/
+	bool	_write_input(std::string *out) {
+		if (!_has_input())
+			return false;
+		size_t len = std::min(_input_left(),
+			static_cast<size_t>(WEBSERV_STREAM_CHUNK_SIZE));
+		fcgi_record(out, FCGI_STDIN, _id, _input.data() + _input_sent, len);
+		// Slices of a body still streaming are dropped once sent
+		if (len && !_input_eof)
+			_replayable = false;
+		if (_input_consumed(len))
+			_reactor->wake(_owner);
+		if (len == 0)
+			_input_done = true;
+		return true;
+	}
+
+	bool	_has_input() const {
+		return !_input_done && (_input_left() > 0 || _input_eof);
+	}
+
+	void	_input_ready();
+	void	_drained();
+
+	void	_stdout(const char *data, size_t len) {
+		_received = true;
+		_feed(data, len);
+	}
+
+	void	_finish() {
+		_conn = 0;
+		std::string().swap(_input);
+		_end();
+	}
+
+	bool	_retry();
+
+	void	_lost() {
+		_conn = 0;
+		_pool = 0;
+		_fail(_failure);
+	}
+
+	static std::string	_absolute(const std::string &path) {
+		if (path.size() && path[0] == '/')
+			return path;
+		char cwd[PATH_MAX + 1];
+		if (getcwd(cwd, sizeof(cwd)) == NULL)
+			return path;
+		return std::string(cwd) + "/" + path;
+	}
+};
+
+class FastCGIConnection : public EventHandler {
+	typedef std::map<uint16_t, FastCGIRequest *>	RequestObject;
+
+ private:
+	FastCGIPool		*_pool;
+	Reactor			*_reactor;
+	int				_fd;
+	bool			_connected;
+	bool			_probed;
+	bool			_multiplex;
+	bool			_closed;
+	uint32_t		_events;
+
+	std::string		_out;
+	size_t			_out_sent;
+	std::string		_in;
+
+	// Aborted requests stay as NULL until their FCGI_END_REQUEST
+	RequestObject	_requests;
+	uint16_t		_next_id;
+
+	const size_t	_limit;
+	size_t			_begun;
+
+ public:
+	/*
+		limit is the number of requests served before the connection is
+		closed, 0 for none.
+	*/
+	FastCGIConnection(FastCGIPool *pool, Reactor *reactor, size_t limit = 0)
+	:	_pool(pool), _reactor(reactor),
+		_fd(-1), _connected(false), _probed(false), _multiplex(false), _closed(false),
+		_events(0),
+		_out_sent(0), _next_id(0),
+		_limit(limit), _begun(0) {}
+
+	~FastCGIConnection() {
+		if (_fd != -1) {
+			_reactor->unwatch(_fd);
+			close(_fd);
+		}
+		RequestObject::iterator it = _requests.begin();
+		for (; it != _requests.end(); ++it) {
+			if (it->second)
+				it->second->_lost();
+		}
+	}
+
+	bool	open(const std::string &address) {
+		if ((_fd = upstream_connect(address, &_connected)) == -1)
+			return false;
+
+		std::string query;
+		fcgi_pair(&query, FCGI_MPXS_CONNS, "");
+		fcgi_record(&_out, FCGI_GET_VALUES, 0, query.data(), query.size());
+		return _arm();
+	}
+
+	bool	available() const {
+		if (_fd == -1 || _closed || (_limit && _begun >= _limit))
+			return false;
+		return _requests.size() < (_multiplex ? WEBSERV_FASTCGI_MPX_REQUESTS : 1);
+	}
+
+	/*
+		Busy until GET_VALUES is answered, it may then take more requests.
+	*/
+	bool	probing() const { return _fd != -1 && !_probed; }
+
+	/*
+		Served its limit of requests, closed once they all ended.
+	*/
+	bool	exhausted() const {
+		return _limit && _begun >= _limit && _requests.empty();
+	}
+
+	void	begin(FastCGIRequest *req) {
+		while (_requests.count(++_next_id) || _next_id == 0) {}
+		_requests[_next_id] = req;
+		++_begun;
+		req->_begin(this, _next_id, &_out);
+		_arm();
+	}
+
+	void	abort(uint16_t id) {
+		RequestObject::iterator it = _requests.find(id);
+		if (it == _requests.end())
+			return;
+		it->second = 0;
+		fcgi_record(&_out, FCGI_ABORT_REQUEST, id, "", 0);
+		_arm();
+	}
+
+	void	handle_event(int fd, uint32_t events);
+
+	/*
+		A request got more body to send, or its output was drained.
+	*/
+	void	resume() { _arm(); }
+
+ private:
+	bool	_arm() {
+		uint32_t events = _stalled() ? 0 : static_cast<uint32_t>(EPOLLIN);
+		if (!_connected || _out_sent < _out.size() || _pending_input())
+			events |= EPOLLOUT;
+		if (events == _events)
+			return true;
+		_events = events;
+		return _reactor->watch(_fd, events, this);
+	}
+
+	/*
+		The only running request has a full queue, reading waits for its
+		client. Requests sharing the connection are spilled instead, see
+		_dispatch(); aborted ones do not count.
+	*/
+	bool	_stalled() const {
+		const FastCGIRequest *only = 0;
+		RequestObject::const_iterator it = _requests.begin();
+		for (; it != _requests.end(); ++it) {
+			if (!it->second)
+				continue;
+			if (only)
+				return false;
+			only = it->second;
+		}
+		return only && only->_full();
+	}
+
+	bool	_pending_input() const {
+		RequestObject::const_iterator it = _requests.begin();
+		for (; it != _requests.end(); ++it) {
+			if (it->second && it->second->_has_input())
+				return true;
+		}
+		return false;
+	}
+
+	/*
+		Top the output buffer with body slices of the running requests.
+	*/
+	void	_fill() {
+		bool	more = true;
+		while (more && _out.size() - _out_sent < WEBSERV_STREAM_CHUNK_SIZE) {
+			more = false;
+			RequestObject::iterator it = _requests.begin();
+			for (; it != _requests.end(); ++it) {
+				if (it->second && it->second->_write_input(&_out))
+					more = true;
+			}
+		}
+	}
+
+	bool	_flush() {
+		_fill();
+		while (_out_sent < _out.size()) {
+			ssize_t n = send(_fd, _out.data() + _out_sent,
+				_out.size() - _out_sent, MSG_NOSIGNAL);
+			if (n == -1)
+				return errno == EAGAIN || errno == EWOULDBLOCK;
+			_out_sent += n;
+			if (_out_sent == _out.size()) {
+				_out.clear();
+				_out_sent = 0;
+				_fill();
+			}
+		}
+		return true;
+	}
+
+	/*
+		Records received before the upstream closed the connection are
+		still dispatched. Reading stops once a request is _stalled(),
+		unless the connection hung up.
+			-> false once it is closed.
+	*/
+	bool	_read(bool hup) {
+		char	buffer[WEBSERV_STREAM_CHUNK_SIZE];
+
+		while (hup || !_stalled()) {
+			const ssize_t n = recv(_fd, buffer, sizeof(buffer), 0);
+			if (n <= 0) {
+				_closed = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+				break;
+			}
+			_in.append(buffer, n);
+			_parse();
+		}
+		return !_closed;
+	}
+
+	void	_parse() {
+		size_t	offset = 0;
+		while (_in.size() - offset >= FCGI_HEADER_LEN) {
+			const unsigned char *h =
+				reinterpret_cast<const unsigned char *>(_in.data() + offset);
+			const size_t len = (h[4] << 8) | h[5];
+			const size_t total = FCGI_HEADER_LEN + len + h[6];
+			if (_in.size() - offset < total)
+				break;
+			_dispatch(static_cast<FCGI_TYPE>(h[1]), (h[2] << 8) | h[3],
+				_in.data() + offset + FCGI_HEADER_LEN, len);
+			offset += total;
+		}
+		_in.erase(0, offset);
+	}
+
+	void	_dispatch(FCGI_TYPE type, uint16_t id, const char *data, size_t len);
+
+	void	_values(const char *data, size_t len) {
+		const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+		size_t	i = 0, name, value;
+		while (i < len) {
+			i += fcgi_pair_length(p + i, &name);
+			i += fcgi_pair_length(p + i, &value);
+			if (i + name + value > len)
+				return;
+			if (std::string(data + i, name) == FCGI_MPXS_CONNS)
+				_multiplex = std::string(data + i + name, value) == "1";
+			i += name + value;
+		}
+	}
+};
+
+class FastCGIPool {
+ protected:
+	typedef std::vector<FastCGIConnection *>	ConnectionObject;
+	typedef std::deque<FastCGIRequest *>		WaitingObject;
+
+	const std::string	_address;
+	Reactor				*_reactor;
+	const size_t		_size;
+
+	ConnectionObject	_conns;
+	WaitingObject		_waiting;
+
+ public:
+	FastCGIPool(const std::string &address, Reactor *reactor,
+		size_t size = WEBSERV_FASTCGI_POOL_SIZE)
+	:	_address(address), _reactor(reactor), _size(size) {}
+
+	virtual ~FastCGIPool() {
+		for (size_t i = 0; i < _conns.size(); ++i)
+			delete _conns[i];
+		for (size_t i = 0; i < _waiting.size(); ++i)
+			_waiting[i]->_lost();
+	}
+
+	/*
+		Start req on a free connection or queue it.
+			-> false if the upstream can not be reached.
+	*/
+	bool	submit(FastCGIRequest *req) {
+		FastCGIConnection *conn = 0;
+		if (_waiting.empty()) {
+			if (!_slot(&conn))
+				return false;
+			if (conn) {
+				conn->begin(req);
+				return true;
+			}
+		}
+		_waiting.push_back(req);
+		return true;
+	}
+
+	/*
+		Sent again before the requests waiting, its connection closed.
+	*/
+	void	retry(FastCGIRequest *req) { _waiting.push_front(req); }
+
+	size_t	size() const { return _size; }
+
+	void	cancel(FastCGIRequest *req) {
+		WaitingObject::iterator it = std::find(_waiting.begin(), _waiting.end(), req);
+		if (it != _waiting.end())
+			_waiting.erase(it);
+	}
+
+	/*
+		Start waiting requests while connections have free slots.
+	*/
+	void	pump() {
+		while (!_waiting.empty()) {
+			FastCGIConnection *conn = 0;
+			if (!_slot(&conn)) {
+				FastCGIRequest *req = _waiting.front();
+				_waiting.pop_front();
+				req->_lost();
+				_reactor->wake(req->owner());
+				continue;
+			}
+			if (!conn)
+				return;
+			FastCGIRequest *req = _waiting.front();
+			_waiting.pop_front();
+			conn->begin(req);
+		}
+	}
+
+	virtual void	remove(FastCGIConnection *conn) {
+		ConnectionObject::iterator it = std::find(_conns.begin(), _conns.end(), conn);
+		if (it != _conns.end())
+			_conns.erase(it);
+		delete conn;
+		pump();
+	}
+
+ private:
+	/*
+		A connection with a free slot, a new one while the pool is not full.
+			-> false if connecting failed, conn left NULL if the pool is full
+			or a connection is still probing for multiplexing.
+	*/
+	bool	_slot(FastCGIConnection **conn) {
+		for (size_t i = 0; i < _conns.size(); ++i) {
+			if (_conns[i]->available()) {
+				*conn = _conns[i];
+				return true;
+			}
+		}
+		for (size_t i = 0; i < _conns.size(); ++i) {
+			if (_conns[i]->probing())
+				return true;
+		}
+		if (_conns.size() >= _size)
+			return true;
+
+		FastCGIConnection *created = _connect();
+		if (!created)
+			return false;
+		_conns.push_back(created);
+		*conn = created;
+		return true;
+	}
+
+ protected:
+	/*
+		New connection to the upstream, NULL on failure.
+	*/
+	virtual FastCGIConnection	*_connect() {
+		FastCGIConnection *created = new FastCGIConnection(this, _reactor);
+		if (!created->open(_address)) {
+			std::cerr << "fastcgi: unable to connect to " << _address << std::endl;
+			delete created;
+			return 0;
+		}
+		return created;
+	}
+};
+
+static std::map<std::string, FastCGIPool *>	FASTCGI_POOLS;
+
+static FastCGIPool	*get_fastcgi_pool(const std::string &address,
+	Reactor *reactor) {
+	std::map<std::string, FastCGIPool *>::iterator it =
+		FASTCGI_POOLS.find(address);
+	if (it != FASTCGI_POOLS.end())
+		return it->second;
+	FastCGIPool *pool = new FastCGIPool(address, reactor);
+	FASTCGI_POOLS[address] = pool;
+	return pool;
+}
+
+void	destroy_fastcgi_pools() {
+	std::map<std::string, FastCGIPool *>::iterator it = FASTCGI_POOLS.begin();
+	for (; it != FASTCGI_POOLS.end(); ++it)
+		delete it->second;
+	FASTCGI_POOLS.clear();
+}
+
+FastCGIRequest::~FastCGIRequest() {
+	if (_conn)
+		_conn->abort(_id);
+	else if (_pool)
+		_pool->cancel(this);
+}
+
+bool	FastCGIRequest::run(Reactor *reactor, HTTP::Client *owner) {
+	_reactor = reactor;
+	_owner = owner;
+
+	_pool = _resolve(reactor);
+	if (!_pool->submit(this)) {
+		_pool = 0;
+		return false;
+	}
+	_deadline = monotonic_ms() + _timeout * 1000;
+	_reactor->schedule(_deadline, owner);
+	return true;
+}
+
+void	FastCGIRequest::_input_ready() {
+	if (_conn)
+		_conn->resume();
+}
+
+void	FastCGIRequest::_drained() {
+	if (_conn)
+		_conn->resume();
+}
+
+FastCGIPool	*FastCGIRequest::_resolve(Reactor *reactor) {
+	return get_fastcgi_pool(_address, reactor);
+}
+
+/*
+	The connection closed before any output of the request, which may
+	only have been written to a pooled connection the upstream was
+	closing: it is sent again while its body is whole.
+		-> false when the request is lost.
+*/
+bool	FastCGIRequest::_retry() {
+	_conn = 0;
+	if (_received || !_replayable || !_pool || ++_tries > _pool->size())
+		return false;
+	_input_sent = 0;
+	_input_done = false;
+	_pool->retry(this);
+	return true;
+}
+
+bool	FastCGIRequest::handle_timeout(uint64_t now) {
+	if (ready() || now < _deadline)
+		return false;
+	if (_conn)
+		_conn->abort(_id);
+	else if (_pool)
+		_pool->cancel(this);
+	_conn = 0;
+	_pool = 0;
+	_fail(HTTP::GATEWAY_TIMEOUT);
+	return true;
+}
+
+void	FastCGIConnection::handle_event(int fd, uint32_t events) {
+	(void)fd;
+	bool alive = !(events & EPOLLERR);
+
+	if (alive && !_connected && (events & EPOLLOUT)) {
+		int			err = 0;
+		socklen_t	len = sizeof(err);
+		getsockopt(_fd, SOL_SOCKET, SO_ERROR, &err, &len);
+		alive = err == 0;
+		_connected = alive;
+	}
+	if (alive && _connected && (events & EPOLLOUT))
+		alive = _flush();
+	if (alive && (events & (EPOLLIN | EPOLLHUP)))
+		alive = _read(events & EPOLLHUP);
+	if (alive && !exhausted() && _arm())
+		return;
+
+	// Requests in flight are sent again or lost, answered with a 502
+	RequestObject requests;
+	requests.swap(_requests);
+	RequestObject::iterator it = requests.begin();
+	for (; it != requests.end(); ++it) {
+		if (!it->second || it->second->_retry())
+			continue;
+		it->second->_lost();
+		_reactor->wake(it->second->owner());
+	}
+	_pool->remove(this);
+}
+
+void	FastCGIConnection::_dispatch(FCGI_TYPE type, uint16_t id,
+	const char *data, size_t len) {
+	if (type == FCGI_GET_VALUES_RESULT) {
+		_probed = true;
+		_values(data, len);
+		return _pool->pump();
+	}
+	if (type == FCGI_STDERR) {
+		std::cerr.write(data, len);
+		return;
+	}
+
+	RequestObject::iterator it = _requests.find(id);
+	if (it == _requests.end())
+		return;
+	FastCGIRequest *req = it->second;
+	if (type == FCGI_STDOUT && req) {
+		req->_stdout(data, len);
+		// Its client is too slow for the others on the connection
+		if (req->_full(WEBSERV_FASTCGI_SPILL_SIZE)) {
+			abort(id);
+			req->_lost();
+		}
+		_reactor->wake(req->owner());
+	} else if (type == FCGI_END_REQUEST) {
+		// GET_VALUES left unanswered, one request at a time
+		_probed = true;
+		_requests.erase(it);
+		if (req) {
+			req->_finish();
+			_reactor->wake(req->owner());
+		}
+		_pool->pump();
+	}
+}
+
+}  // namespace Server
+}  // namespace Webserv
+
+#endif  // SERVER_FASTCGI_HPP_
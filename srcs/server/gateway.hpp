@@ -0,0 +1,387 @@
+/*
+	Base of the jobs building a response out of an upstream application
+	(CGI script, FastCGI responder).
+
+	The upstream output is fed as it arrives: headers are parsed once the
+	blank line is received, body bytes are then queued and pulled by the
+	response like any other body Stream. Upstreams stop reading once
+	WEBSERV_GATEWAY_BUFFER_SIZE bytes are queued, until the client
+	drained them.
+
+	The request body may still be arriving once the job runs (streamed
+	bodies): it is appended by write_input(), the client stops reading it
+	while WEBSERV_GATEWAY_BUFFER_SIZE bytes are waiting to be sent.
+*/
+
+#ifndef SERVER_GATEWAY_HPP_
+#define SERVER_GATEWAY_HPP_
+
+#include <netdb.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <map>
+#include <string>
+#include <sstream>
+#include <utility>
+
+#include "consts.hpp"
+#include "http/enums.hpp"
+#include "http/stream.hpp"
+#include "http/request.hpp"
+#include "models/IBlock.hpp"
+#include "server/reactor.hpp"
+
+namespace Webserv {
+namespace Server {
+
+/*
+	Non-blocking connection to a unix (unix:/path) or TCP (host:port)
+	upstream, connected is set unless it is still in progress.
+		-> the socket, -1 on failure.
+*/
+static int	upstream_connect(const std::string &address, bool *connected) {
+	int		fd = -1;
+	bool	pending = false;
+
+	if (address.compare(0, 5, "unix:") == 0) {
+		struct sockaddr_un	addr = {};
+		const std::string	path = address.substr(5);
+		if (path.size() >= sizeof(addr.sun_path))
+			return -1;
+		addr.sun_family = AF_UNIX;
+		memcpy(addr.sun_path, path.c_str(), path.size());
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd == -1)
+			return -1;
+		*connected = connect(fd, reinterpret_cast<struct sockaddr *>(&addr),
+			sizeof(addr)) == 0;
+		pending = errno == EINPROGRESS;
+	} else {
+		struct addrinfo hints = {}, *res = 0;
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		const size_t sep = address.rfind(':');
+		if (sep == std::string::npos || getaddrinfo(
+			address.substr(0, sep).c_str(), address.substr(sep + 1).c_str(),
+			&hints, &res) != 0)
+			return -1;
+		fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd != -1) {
+			*connected = connect(fd, res->ai_addr, res->ai_addrlen) == 0;
+			pending = errno == EINPROGRESS;
+		}
+		freeaddrinfo(res);
+		if (fd == -1)
+			return -1;
+	}
+	if (!*connected && !pending) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+class Gateway : public HTTP::Stream {
+ public:
+	typedef std::multimap<std::string, std::string> Headers;
+	typedef std::pair<std::string, std::string>		HeaderPair;
+	typedef std::map<std::string, std::string> 		EnvVar;
+	typedef Models::IBlock::EnvObject				BaseEnv;
+
+ protected:
+	const std::string	_file_path;
+	const std::string	_query;
+	const HTTP::METHODS	_method;
+
+	const BaseEnv	*_base_env;
+	EnvVar			_env;
+	size_t			_timeout;
+
+	std::string	_input;
+	size_t		_input_sent;
+	bool		_input_eof;
+	bool		_input_blocked;
+	bool		_input_discard;
+
+	Headers		_headers;
+	std::string	_head;
+	std::string	_queue;
+	size_t		_delivered;
+
+	bool		_parsed;
+	bool		_eof;
+	int			_error;
+	const int	_failure;
+
+ public:
+	/*
+		failure is the status answered when the upstream misbehaves.
+	*/
+	Gateway(const std::string &file_path, const std::string &query,
+		const HTTP::METHODS &method, int failure)
+	:	_file_path(file_path),
+		_query(query),
+		_method(method),
+		_base_env(0),
+		_timeout(WEBSERV_CGI_TIMEOUT),
+		_input_sent(0),
+		_input_eof(true),
+		_input_blocked(false),
+		_input_discard(false),
+		_delivered(0),
+		_parsed(false),
+		_eof(false),
+		_error(0),
+		_failure(failure) {}
+
+	virtual ~Gateway() {}
+
+	/*
+		base is the environment shared by the requests of the block, _env
+		only holds the request part. body is the request body received so
+		far, the rest is given to write_input() unless complete.
+	*/
+	bool	setup(const BaseEnv &base, const std::string &body,
+		const HTTP::Request::HeadersObject &headers, bool complete = true) {
+		_base_env = &base;
+		_input = body;
+		_input_eof = complete;
+		_env["QUERY_STRING"] = _query;
+		_env["CONTENT_LENGTH"] = _toString(body.size());
+
+		HTTP::Request::HeadersObject::const_iterator it = headers.begin();
+		for (; it != headers.end(); ++it) {
+			if (it->first == "content-type")
+				_env["CONTENT_TYPE"] = it->second;
+			if (it->first == "content-length" && !complete)
+				_env["CONTENT_LENGTH"] = it->second;
+			_env["HTTP_" + _header_to_hcgi(it->first)] = it->second;
+		}
+
+		_env["SCRIPT_FILENAME"] = _file_path;
+
+		if (_method == HTTP::METH_GET)
+			_env["REQUEST_METHOD"] = "GET";
+		else if (_method == HTTP::METH_POST)
+			_env["REQUEST_METHOD"] = "POST";
+		else
+			_env["REQUEST_METHOD"] = "UNKNOWN";
+		return true;
+	}
+
+	/*
+		Seconds given to the upstream to send its headers (cgi_timeout).
+	*/
+	void	set_timeout(size_t seconds) { _timeout = seconds; }
+
+	/*
+		Start the job on behalf of owner, returns immediately.
+	*/
+	virtual bool	run(Reactor *reactor, HTTP::Client *owner) = 0;
+
+	/*
+		Events forwarded by the loop, each returns true when the response
+		made progress (headers parsed, body queued, end of output, failure).
+	*/
+	virtual bool	handle(int fd, uint32_t events) {
+		(void)fd;
+		(void)events;
+		return false;
+	}
+	virtual bool	handle_exit(pid_t pid) {
+		(void)pid;
+		return false;
+	}
+	virtual bool	handle_timeout(uint64_t now) = 0;
+
+	/*
+		Upstream connection of a response that switched protocols (101),
+		with the bytes already read from it.
+			-> -1 for the other gateways.
+	*/
+	virtual int		take_tunnel(std::string *data) {
+		(void)data;
+		return -1;
+	}
+
+	/*
+		Next piece of a streamed request body, last once it is complete.
+	*/
+	void	write_input(const std::string &data, bool last) {
+		if (_input_sent == _input.size()) {
+			_input.clear();
+			_input_sent = 0;
+		} else if (_input_sent >= WEBSERV_GATEWAY_BUFFER_SIZE) {
+			_input.erase(0, _input_sent);
+			_input_sent = 0;
+		}
+		if (!_input_discard && !_error)
+			_input.append(data);
+		_input_eof = last;
+		if (!wants_input())
+			_input_blocked = !_input_eof;
+		_input_ready();
+	}
+
+	/*
+		More of the request body can be taken, once the upstream is gone
+		the rest is read and dropped.
+	*/
+	bool	wants_input() const {
+		if (_input_eof)
+			return false;
+		return _input_discard || _error
+			|| _input.size() - _input_sent < WEBSERV_GATEWAY_BUFFER_SIZE;
+	}
+
+	bool			ready() const { return _parsed || _error; }
+	int				error() const { return _error; }
+	int				failure() const { return _failure; }
+	const Headers	&get_headers() const { return _headers; }
+
+	/*
+		Content-Length announced by the upstream, if any.
+	*/
+	ssize_t	length() const {
+		Headers::const_iterator it = _headers.begin();
+		for (; it != _headers.end(); ++it) {
+			if (strcasecmp(it->first.c_str(), "Content-Length") == 0)
+				return strtol(it->second.c_str(), NULL, 10);
+		}
+		return -1;
+	}
+
+	HTTP::STREAM	read(std::string *bucket) {
+		if (_error)
+			return HTTP::STREAM_ERROR;
+		if (_queue.empty())
+			return _eof ? HTTP::STREAM_EOF : HTTP::STREAM_WAIT;
+		_delivered += _queue.size();
+		if (bucket->empty()) {
+			bucket->swap(_queue);
+		} else {
+			bucket->append(_queue);
+			_queue.clear();
+		}
+		_drained();
+		return _eof ? HTTP::STREAM_EOF : HTTP::STREAM_OK;
+	}
+
+ protected:
+	/*
+		The queue was pulled by the response, reading may resume.
+	*/
+	virtual void	_drained() {}
+
+	/*
+		write_input() appended to the request body.
+	*/
+	virtual void	_input_ready() {}
+
+	/*
+		n bytes of the request body were sent upstream.
+			-> true when the client may read the body again.
+	*/
+	bool	_input_consumed(size_t n) {
+		_input_sent += n;
+		if (!_input_blocked || !wants_input())
+			return false;
+		_input_blocked = false;
+		return true;
+	}
+
+	size_t	_input_left() const { return _input.size() - _input_sent; }
+
+	bool	_full(size_t spill = 0) const {
+		return _queue.size() >= WEBSERV_GATEWAY_BUFFER_SIZE + spill;
+	}
+
+	/*
+		Output of the upstream, headers end on the first blank line.
+	*/
+	void	_feed(const char *data, size_t len) {
+		if (_error)
+			return;
+		if (_parsed)
+			return (void)_queue.append(data, len);
+
+		_head.append(data, len);
+		size_t	end = _head.find("\r\n\r\n"), skip = 4;
+		size_t	lf = _head.find("\n\n");
+		if (lf != std::string::npos && (end == std::string::npos || lf < end)) {
+			end = lf;
+			skip = 2;
+		}
+		if (end == std::string::npos) {
+			if (_head.size() > WEBSERV_GATEWAY_HEADERS_SIZE)
+				_fail(_failure);
+			return;
+		}
+		_parse_headers(_head.substr(0, end));
+		_queue.assign(_head, end + skip, std::string::npos);
+		std::string().swap(_head);
+		_parsed = true;
+	}
+
+	void	_end() {
+		if (!_parsed)
+			_fail(_failure);
+		_eof = true;
+	}
+
+	void	_fail(int code) {
+		if (!_error)
+			_error = code;
+	}
+
+ private:
+	void	_parse_headers(const std::string &head) {
+		size_t	start = 0;
+
+		while (start < head.size()) {
+			size_t end = head.find('\n', start);
+			if (end == std::string::npos)
+				end = head.size();
+			std::string line = head.substr(start, end - start);
+			start = end + 1;
+
+			if (line.size() && line[line.size() - 1] == '\r')
+				line.erase(line.size() - 1);
+			size_t sep = line.find(':');
+			if (sep == std::string::npos || sep == 0)
+				continue;
+			size_t value = line.find_first_not_of(" \t", sep + 1);
+			_headers.insert(HeaderPair(line.substr(0, sep),
+				value == std::string::npos ? "" : line.substr(value)));
+		}
+	}
+
+	static inline std::string _header_to_hcgi(std::string in) {
+		for (std::size_t i = 0; i < in.size(); i++) {
+			if (in[i] >= 'a' && in[i] <= 'z')
+				in[i] = in[i] - 32;
+			else if (in[i] == '-')
+				in[i] = '_';
+		}
+		return in;
+	}
+
+	static std::string	_toString(size_t num) {
+		std::stringstream ss;
+
+		ss << num;
+		return ss.str();
+	}
+};
+
+}  // namespace Server
+}  // namespace Webserv
+
+#endif  // SERVER_GATEWAY_HPP_
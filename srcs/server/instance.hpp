@@ -1,3 +1,17 @@
+/*
+	Listening socket of a master server, sharing the configuration
+	snapshot it belongs to.
+
+	A worker steering connections (worker_incoming_cpu) listens on a socket
+	of its own per interface, sharing the sessions of the socket of the
+	master.
+
+	A reload keeps the socket of an interface still configured and points
+	it to the new snapshot. Clients hold their listener: one removed from
+	the configuration stops accepting, and is freed with its sessions once
+	its last client is gone.
+*/
+
 #ifndef SERVER_INSTANCE_HPP_
 #define SERVER_INSTANCE_HPP_
 
@@ -8,35 +22,120 @@
 #include <sys/socket.h>
 
 #include <string>
+#include <stdexcept>
 
 #include "consts.hpp"
+#include "conf/snapshot.hpp"
 #include "models/IServer.hpp"
 
+#ifdef WEBSERV_SESSION
+#include "http/session.hpp"
+#endif
+
 namespace Webserv {
 namespace Server {
-class Instance : public Webserv::Models::IServer {
+class Instance {
  public:
 	typedef Webserv::Models::IServer IServer;
-	typedef Webserv::Models::ILocation ILocation;
+	typedef Webserv::Conf::Snapshot Snapshot;
 
  private:
-	int	_fd;
+	const IServer	*_server;
+	Snapshot		*_snapshot;
+	int				_fd;
+	size_t			_refs;
+	Instance		*_shared;
+	int				_cpu;
+
+	#ifdef WEBSERV_SESSION
+	Sessions		_sessions;
+	#endif
 
  public:
-	explicit Instance(const IServer &serv)
-		: IServer(serv), _fd(-1) {
-		_setup();
+	/*
+		server is one of the masters of snapshot. fd, when given, is its
+		socket already listening, inherited through a binary upgrade.
+	*/
+	Instance(const IServer *server, Snapshot *snapshot, int fd = -1)
+	:	_server(server), _snapshot(snapshot->acquire()), _fd(fd), _refs(1),
+		_shared(0), _cpu(-1) {
+		try {
+			_setup();
+		} catch (std::exception &e) {
+			_snapshot->release();
+			if (_fd != -1)
+				close(_fd);
+			throw;
+		}
+	}
+
+	/*
+		Socket of the interface of shared, taking the connections processed
+		on cpu.
+	*/
+	Instance(Instance *shared, int cpu)
+	:	_server(shared->_server), _snapshot(shared->_snapshot->acquire()),
+		_fd(-1), _refs(1), _shared(shared->acquire()), _cpu(cpu) {
+		try {
+			_setup();
+		} catch (std::exception &e) {
+			_snapshot->release();
+			_shared->release();
+			if (_fd != -1)
+				close(_fd);
+			throw;
+		}
 	}
 
 	~Instance() {
+		_snapshot->release();
+		if (_shared)
+			_shared->release();
 		if (_fd != -1)
 			close(_fd);
 	}
 
+	Instance	*acquire() {
+		++_refs;
+		return this;
+	}
+
+	void	release() {
+		if (--_refs == 0)
+			delete this;
+	}
+
+	/*
+		server, of the same interface, is now served from snapshot.
+	*/
+	void	reload(const IServer *server, Snapshot *snapshot) {
+		snapshot->acquire();
+		_snapshot->release();
+		_snapshot = snapshot;
+		_server = server;
+	}
+
+	// Stop accepting, the clients already accepted are still served
+	void	stop() {
+		if (_fd != -1)
+			close(_fd);
+		_fd = -1;
+	}
+
 	int get_fd() const { return _fd; }
+	const IServer	*get_server() const { return _server; }
+	Snapshot		*get_snapshot() const { return _snapshot; }
+
+	#ifdef WEBSERV_SESSION
+	Sessions		*get_sessions() {
+		return _shared ? _shared->get_sessions() : &_sessions;
+	}
+	#endif
 
  private:
 	void	_setup() {
+		if (_fd != -1)
+			return _adopt_socket();
 		_create_socket();
 		_set_noblock();
 		_set_sockopt();
@@ -44,8 +143,16 @@ class Instance : public Webserv::Models::IServer {
 		_listen_socket();
 	}
 
+	void	_adopt_socket() {
+		if (fcntl(_fd, F_SETFD, FD_CLOEXEC) == -1)
+			throw std::runtime_error("fcntl() failed");
+		_set_noblock();
+		std::cout << "[📍] " << _server->get_name() << " inherited on "
+			<< _server->get_host() << ":" << _server->get_port() << std::endl;
+	}
+
 	void	_create_socket() {
-		_fd = socket(AF_INET, SOCK_STREAM, 0);
+		_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
 		if (_fd == -1)
 			throw std::runtime_error("socket() failed");
 	}
@@ -57,13 +164,24 @@ class Instance : public Webserv::Models::IServer {
 		int _true = 1;
 		if (setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &_true, sizeof(_true)) == -1)
 			throw std::runtime_error("setsockopt() failed");
+		// Workers may steer connections to sockets of their own
+		if (_shared || _snapshot->get_processes().incoming_cpu) {
+			if (setsockopt(_fd, SOL_SOCKET, SO_REUSEPORT, &_true,
+				sizeof(_true)) == -1)
+				throw std::runtime_error("setsockopt() failed");
+		}
+		#ifdef SO_INCOMING_CPU
+		if (_cpu != -1 && setsockopt(_fd, SOL_SOCKET, SO_INCOMING_CPU, &_cpu,
+			sizeof(_cpu)) == -1)
+			throw std::runtime_error("setsockopt() failed");
+		#endif
 	}
 	void	_bind_socket() {
 		struct sockaddr_in addr;
 
 		addr.sin_family = AF_INET;
-		addr.sin_port = htons(_port);
-		addr.sin_addr.s_addr = inet_addr(_host.c_str());
+		addr.sin_port = htons(_server->get_port());
+		addr.sin_addr.s_addr = inet_addr(_server->get_host().c_str());
 
 		if (bind(_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
 			throw std::runtime_error("bind() failed");
@@ -71,8 +189,11 @@ class Instance : public Webserv::Models::IServer {
 	void	_listen_socket() {
 		if (listen(_fd, WEBSERV_MAX_CONNS) == -1)
 			throw std::runtime_error("listen() failed");
-		std::cout << "[📍] " << _name << " bound on "
-			<< _host << ":" << _port << std::endl;
+		std::cout << "[📍] " << _server->get_name() << " bound on "
+			<< _server->get_host() << ":" << _server->get_port();
+		if (_cpu != -1)
+			std::cout << " for cpu " << _cpu;
+		std::cout << std::endl;
 	}
 };
 }  // namespace Server
@@ -0,0 +1,458 @@
+/*
+	Pool of threads running the blocking disk operations of the responses
+	(stat, open, opendir, remove, uploads): a slow or cold disk stalls the
+	requests waiting on it, not every connection of the loop. File bodies
+	are read ahead by windows of WEBSERV_IO_READAHEAD bytes as they are
+	sent, the first one when the file is opened (FileJob), the next ones
+	by ReadaheadJob: sendfile() then finds them in the page cache.
+
+	Jobs are queued by the loop and run by WEBSERV_IO_THREADS threads, the
+	finished ones are queued back and an eventfd is written: the loop then
+	marks them done() and wakes their owner, which takes the result. A job
+	whose owner is gone (cancel()) is deleted once finished, the job
+	cleaning up after it is queued if any (abandoned()). When
+	WEBSERV_IO_QUEUE jobs are already waiting, submit() refuses the job: the
+	request is answered with a 503, the loop never waits on the disk.
+
+	Threads only run IOJob::run(), which does not touch the state of the
+	loop: jobs copy what they need and hold their results until taken.
+*/
+
+#ifndef SERVER_IOPOOL_HPP_
+#define SERVER_IOPOOL_HPP_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <signal.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/types.h>
+#include <sys/eventfd.h>
+
+#include <map>
+#include <deque>
+#include <string>
+#include <vector>
+#include <utility>
+#include <iostream>
+
+#include "consts.hpp"
+#include "server/reactor.hpp"
+#include "server/affinity.hpp"
+#include "server/autoindex.hpp"
+
+namespace Webserv {
+namespace Server {
+
+class IOJob {
+ private:
+	bool	_done;
+
+ public:
+	IOJob() : _done(false) {}
+	virtual ~IOJob() {}
+
+	// On a thread of the pool
+	virtual void	run() = 0;
+	/*
+		On the loop, once finished without an owner (see IOPool::cancel()).
+			-> a job cleaning up after it, 0 for none.
+	*/
+	virtual IOJob	*abandoned() { return 0; }
+
+	bool	done() const { return _done; }
+	void	set_done() { _done = true; }
+};
+
+/*
+	stat() of a path, opened when it is a regular file. Its first bytes
+	are read ahead: the response sends them without waiting on the disk.
+*/
+class FileJob : public IOJob {
+ private:
+	const std::string	_path;
+	const bool			_open;
+	int					_stat_errno;
+	int					_open_errno;
+	struct stat			_st;
+	int					_fd;
+
+ public:
+	FileJob(const std::string &path, bool open_file)
+	:	_path(path), _open(open_file), _stat_errno(0), _open_errno(0), _st(),
+		_fd(-1) {}
+
+	~FileJob() {
+		if (_fd != -1)
+			close(_fd);
+	}
+
+	void	run() {
+		errno = 0;
+		if (stat(_path.c_str(), &_st) == -1) {
+			_stat_errno = errno;
+			return;
+		}
+		if (!_open || !S_ISREG(_st.st_mode))
+			return;
+		_fd = ::open(_path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (_fd == -1) {
+			_open_errno = errno;
+			return;
+		}
+		readahead(_fd, 0, WEBSERV_IO_READAHEAD);
+	}
+
+	const std::string	&path() const { return _path; }
+	int					stat_errno() const { return _stat_errno; }
+	int					open_errno() const { return _open_errno; }
+	const struct stat	&st() const { return _st; }
+
+	// The fd is closed by the caller from now on
+	int		take_fd() {
+		const int fd = _fd;
+		_fd = -1;
+		return fd;
+	}
+};
+
+/*
+	Window of a file read ahead for its HTTP::FileStream, on a duplicate
+	of its fd: the stream may be gone before the job.
+*/
+class ReadaheadJob : public IOJob {
+ private:
+	const int		_fd;
+	const off_t		_offset;
+	const size_t	_length;
+
+ public:
+	ReadaheadJob(int fd, off_t offset, size_t length)
+	:	_fd(fcntl(fd, F_DUPFD_CLOEXEC, 0)), _offset(offset), _length(length) {}
+
+	~ReadaheadJob() {
+		if (_fd != -1)
+			close(_fd);
+	}
+
+	void	run() {
+		if (_fd != -1)
+			readahead(_fd, _offset, _length);
+	}
+};
+
+/*
+	opendir() of a path: the first of indexes found in it, or its stat()
+	and, when listed, its entries for the autoindex. Those are not read
+	when the directory is still the version known by the cache.
+*/
+class DirJob : public IOJob {
+ private:
+	const std::string				_path;
+	const std::vector<std::string>	_indexs;
+	const bool						_list;
+	const bool						_known;
+	struct stat						_known_st;
+	int								_errno;
+	std::string						_index;
+	bool							_stat_ok;
+	struct stat						_st;
+	bool							_listed;
+	AutoIndexEntries				_entries;
+
+ public:
+	/*
+		known is the version of the directory cached by the loop, NULL for
+		none.
+	*/
+	DirJob(const std::string &path, const std::vector<std::string> &indexs,
+		bool list, const struct stat *known)
+	:	_path(path), _indexs(indexs), _list(list), _known(known != 0),
+		_known_st(), _errno(0), _stat_ok(false), _st(), _listed(false) {
+		if (known)
+			_known_st = *known;
+	}
+
+	void	run() {
+		errno = 0;
+		DIR *dir = opendir(_path.c_str());
+		if (!dir) {
+			_errno = errno;
+			return;
+		}
+		for (size_t i = 0; i < _indexs.size(); ++i) {
+			if (faccessat(dirfd(dir), _indexs[i].c_str(), F_OK, 0) == 0) {
+				_index = _indexs[i];
+				closedir(dir);
+				return;
+			}
+		}
+		_stat_ok = fstat(dirfd(dir), &_st) == 0;
+		if (_list && _stat_ok
+			&& !(_known && autoindex_unchanged(_known_st, _st))) {
+			_entries.read(dir);
+			_listed = true;
+		}
+		closedir(dir);
+	}
+
+	const std::string	&path() const { return _path; }
+	int					error() const { return _errno; }
+	const std::string	&index() const { return _index; }
+	bool				stat_ok() const { return _stat_ok; }
+	const struct stat	&st() const { return _st; }
+	// false when the cached listing is still valid
+	bool				listed() const { return _listed; }
+	AutoIndexEntries	*entries() { return &_entries; }
+};
+
+class RemoveJob : public IOJob {
+ private:
+	const std::string	_path;
+	int					_errno;
+
+ public:
+	explicit RemoveJob(const std::string &path) : _path(path), _errno(0) {}
+
+	void	run() {
+		errno = 0;
+		if (remove(_path.c_str()) == -1)
+			_errno = errno;
+	}
+
+	int		error() const { return _errno; }
+};
+
+/*
+	Files created one after the other, the first one already there or
+	failing stops the upload.
+*/
+class UploadJob : public IOJob {
+ public:
+	typedef std::vector<std::pair<std::string, std::string> >	FileList;
+
+ private:
+	const FileList	_files;
+	int				_status;
+
+ public:
+	explicit UploadJob(const FileList &files) : _files(files), _status(204) {}
+
+	void	run() {
+		for (size_t i = 0; i < _files.size(); ++i) {
+			if (!_create(_files[i].first, _files[i].second))
+				return;
+		}
+	}
+
+	// 204, 409 when a file exists, 500
+	int		status() const { return _status; }
+
+ private:
+	bool	_create(const std::string &path, const std::string &content) {
+		int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+			0666);
+		if (fd == -1) {
+			_status = errno == EEXIST ? 409 : 500;
+			return false;
+		}
+		size_t written = 0;
+		while (written < content.size()) {
+			ssize_t n = write(fd, content.data() + written,
+				content.size() - written);
+			if (n == -1 && errno == EINTR)
+				continue;
+			if (n <= 0) {
+				close(fd);
+				_status = 500;
+				return false;
+			}
+			written += n;
+		}
+		close(fd);
+		return true;
+	}
+};
+
+class IOPool : public EventHandler {
+	typedef std::map<IOJob *, HTTP::Client *>	OwnerObject;
+
+ private:
+	Reactor					*_reactor;
+	int						_event_fd;
+	std::vector<pthread_t>	_threads;
+
+	pthread_mutex_t			_lock;
+	pthread_cond_t			_cond;
+	std::deque<IOJob *>		_queue;
+	std::vector<IOJob *>	_finished;
+	bool					_stopping;
+
+	// Jobs submitted by the loop and not collected yet
+	OwnerObject				_owners;
+
+ public:
+	IOPool(Reactor *reactor, size_t threads)
+	:	_reactor(reactor), _event_fd(-1), _stopping(false) {
+		pthread_mutex_init(&_lock, NULL);
+		pthread_cond_init(&_cond, NULL);
+		_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (_event_fd == -1 || !_reactor->watch(_event_fd, EPOLLIN, this)) {
+			std::cerr << "io_pool: unable to watch its eventfd" << std::endl;
+			return;
+		}
+
+		// Signals are left to the loop
+		sigset_t	all, previous;
+		sigfillset(&all);
+		pthread_sigmask(SIG_BLOCK, &all, &previous);
+		for (size_t i = 0; i < threads; ++i) {
+			pthread_t thread;
+			if (pthread_create(&thread, NULL, &IOPool::_thread, this) != 0) {
+				std::cerr << "io_pool: pthread_create() failed" << std::endl;
+				break;
+			}
+			_threads.push_back(thread);
+		}
+		pthread_sigmask(SIG_SETMASK, &previous, NULL);
+	}
+
+	~IOPool() {
+		pthread_mutex_lock(&_lock);
+		_stopping = true;
+		pthread_cond_broadcast(&_cond);
+		pthread_mutex_unlock(&_lock);
+		for (size_t i = 0; i < _threads.size(); ++i)
+			pthread_join(_threads[i], NULL);
+
+		for (size_t i = 0; i < _queue.size(); ++i)
+			delete _queue[i];
+		for (size_t i = 0; i < _finished.size(); ++i)
+			delete _finished[i];
+		if (_event_fd != -1) {
+			_reactor->unwatch(_event_fd);
+			close(_event_fd);
+		}
+		pthread_cond_destroy(&_cond);
+		pthread_mutex_destroy(&_lock);
+	}
+
+	/*
+		Run job on a thread, owner is woken once it is done(). Without an
+		owner it is deleted once finished.
+			-> false when the pool is full, job is left to the caller.
+	*/
+	bool	submit(IOJob *job, HTTP::Client *owner) {
+		pthread_mutex_lock(&_lock);
+		if (_threads.empty() || _queue.size() >= WEBSERV_IO_QUEUE) {
+			pthread_mutex_unlock(&_lock);
+			return false;
+		}
+		_queue.push_back(job);
+		pthread_cond_signal(&_cond);
+		pthread_mutex_unlock(&_lock);
+		_owners[job] = owner;
+		return true;
+	}
+
+	/*
+		The owner of job is gone, it is deleted once finished (right away
+		when already done()).
+	*/
+	void	cancel(IOJob *job) {
+		OwnerObject::iterator it = _owners.find(job);
+		if (it != _owners.end())
+			it->second = 0;
+		else if (job->done())
+			_abandon(job);
+	}
+
+	void	handle_event(int fd, uint32_t events) {
+		(void)events;
+		uint64_t	count;
+		if (read(fd, &count, sizeof(count)) != sizeof(count))
+			return;
+
+		std::vector<IOJob *> finished;
+		pthread_mutex_lock(&_lock);
+		finished.swap(_finished);
+		pthread_mutex_unlock(&_lock);
+
+		for (size_t i = 0; i < finished.size(); ++i) {
+			OwnerObject::iterator it = _owners.find(finished[i]);
+			HTTP::Client *owner = it->second;
+			_owners.erase(it);
+			if (!owner) {
+				_abandon(finished[i]);
+				continue;
+			}
+			finished[i]->set_done();
+			_reactor->wake(owner);
+		}
+	}
+
+ private:
+	void	_abandon(IOJob *job) {
+		IOJob *next = job->abandoned();
+		delete job;
+		if (next && !submit(next, 0))
+			delete next;
+	}
+
+	static void	*_thread(void *arg) {
+		IOPool *pool = static_cast<IOPool *>(arg);
+		const uint64_t one = 1;
+
+		unpin_thread();
+
+		pthread_mutex_lock(&pool->_lock);
+		while (true) {
+			while (pool->_queue.empty() && !pool->_stopping)
+				pthread_cond_wait(&pool->_cond, &pool->_lock);
+			if (pool->_queue.empty())
+				break;
+			IOJob *job = pool->_queue.front();
+			pool->_queue.pop_front();
+			pthread_mutex_unlock(&pool->_lock);
+
+			job->run();
+
+			pthread_mutex_lock(&pool->_lock);
+			pool->_finished.push_back(job);
+			if (write(pool->_event_fd, &one, sizeof(one)) == -1)
+				std::cerr << "io_pool: unable to notify the loop" << std::endl;
+		}
+		pthread_mutex_unlock(&pool->_lock);
+		return NULL;
+	}
+
+	IOPool(const IOPool &lhs);
+	IOPool	&operator=(const IOPool &lhs);
+};
+
+static IOPool	*IO_POOL = 0;
+
+/*
+	Pool of the process, started on first use: the threads of a master
+	would not survive the fork of its workers.
+*/
+static IOPool	*get_io_pool(Reactor *reactor) {
+	if (!IO_POOL)
+		IO_POOL = new IOPool(reactor, WEBSERV_IO_THREADS);
+	return IO_POOL;
+}
+
+void	destroy_io_pool() {
+	delete IO_POOL;
+	IO_POOL = 0;
+}
+
+}  // namespace Server
+}  // namespace Webserv
+
+#endif  // SERVER_IOPOOL_HPP_
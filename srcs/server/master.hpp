@@ -0,0 +1,333 @@
+/*
+	http://nginx.org/en/docs/ngx_core_module.html#worker_processes
+
+	Master process of the worker_processes mode: it binds the listeners,
+	then forks the workers polling them, each with its own Poll. The master
+	serves no request, it supervises:
+		- a worker exiting is started again (after a delay when it had just
+		  been started, a worker crashing on startup does not spin), the
+		  CGI processes it left in its process group are terminated,
+		- SIGHUP parses the configuration again, starts a new generation of
+		  workers with it and drains the previous one (SIGQUIT),
+		- SIGTERM, SIGINT stop the workers, SIGQUIT drains them,
+		- SIGUSR2 upgrades the binary as a single process does, the workers
+		  are drained once the new master is ready.
+	Workers are pinned to the CPUs of worker_cpu_affinity. With
+	worker_incoming_cpu, each one also listens on a socket of its own per
+	interface (SO_REUSEPORT), taking the connections whose packets are
+	processed on its CPU (SO_INCOMING_CPU): the NIC queue, the softirq and
+	the worker share the CPU caches. The shared sockets still take the
+	others.
+*/
+
+#ifndef SERVER_MASTER_HPP_
+#define SERVER_MASTER_HPP_
+
+#include <poll.h>
+#include <errno.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/types.h>
+#include <sys/signalfd.h>
+
+#include <map>
+#include <utility>
+#include <iostream>
+
+#include "consts.hpp"
+#include "server/poll.hpp"
+#include "server/reactor.hpp"
+#include "server/affinity.hpp"
+#include "server/upgrade.hpp"
+
+namespace Webserv {
+namespace Server {
+class Master {
+	struct Worker {
+		size_t	generation;
+		size_t		slot;
+		uint64_t	started;
+	};
+	typedef std::map<pid_t, Worker>			WorkerObject;
+	// Slots started again once due, in monotonic_ms()
+	typedef std::multimap<uint64_t, size_t>	RespawnObject;
+
+ private:
+	Poll			*_poll;
+	char			**_av;
+
+	WorkerObject	_workers;
+	RespawnObject	_respawns;
+	size_t			_generation;
+	bool			_stopping;
+
+	int				_signal_fd;
+	int				_upgrade_fd;
+
+ public:
+	Master(Poll *poll, char **av)
+	:	_poll(poll), _av(av),
+		_generation(0), _stopping(false),
+		_signal_fd(-1), _upgrade_fd(-1) {}
+
+	~Master() {
+		if (_signal_fd != -1)
+			close(_signal_fd);
+		if (_upgrade_fd != -1)
+			close(_upgrade_fd);
+	}
+
+	/*
+		Supervise the workers until they are all stopped.
+			-> true in the master, exiting with *status, false in a worker,
+			which is to run the poll.
+	*/
+	bool	run(int *status) {
+		*status = 1;
+		sigset_t	mask;
+		sigemptyset(&mask);
+		sigaddset(&mask, SIGCHLD);
+		sigaddset(&mask, SIGHUP);
+		sigaddset(&mask, SIGUSR2);
+		sigaddset(&mask, SIGTERM);
+		sigaddset(&mask, SIGINT);
+		sigaddset(&mask, SIGQUIT);
+		if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
+			return true;
+		_signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+		if (_signal_fd == -1) {
+			std::cerr << "master: signalfd() failed" << std::endl;
+			return true;
+		}
+
+		if (!_spawn_generation())
+			return false;
+		notify_upgraded();
+		std::cout << "[👷] master of " << _workers.size() << " workers"
+			<< std::endl;
+
+		while (!_stopping || !_workers.empty()) {
+			struct pollfd fds[2] = {};
+			fds[0].fd = _signal_fd;
+			fds[0].events = POLLIN;
+			fds[1].fd = _upgrade_fd;
+			fds[1].events = POLLIN;
+			if (::poll(fds, 2, _next_respawn()) == -1) {
+				if (errno == EINTR)
+					continue;
+				std::cerr << "master: poll() failed" << std::endl;
+				return true;
+			}
+			if (fds[1].revents)
+				_handle_upgrade();
+			if (fds[0].revents && !_handle_signals())
+				return false;
+			if (!_respawn())
+				return false;
+		}
+		*status = 0;
+		return true;
+	}
+
+ private:
+	/*
+		Start the workers of a new generation.
+			-> false in a worker.
+	*/
+	bool	_spawn_generation() {
+		const size_t workers = _poll->get_snapshot()->get_processes().workers;
+		++_generation;
+		_respawns.clear();
+		for (size_t slot = 0; slot < workers; ++slot) {
+			if (!_spawn(slot))
+				return false;
+		}
+		return true;
+	}
+
+	/*
+		-> false in the worker forked.
+	*/
+	bool	_spawn(size_t slot) {
+		const pid_t pid = fork();
+		if (pid == -1) {
+			std::cerr << "master: fork() failed" << std::endl;
+			return true;
+		}
+		if (pid == 0) {
+			_worker_flow(slot);
+			return false;
+		}
+		// Also set by the worker, whichever runs first
+		setpgid(pid, pid);
+		Worker worker = { _generation, slot, monotonic_ms() };
+		_workers[pid] = worker;
+		return true;
+	}
+
+	/*
+		Workers die with the master, they leave it the signals but those
+		of their poll. Each one leads a process group of its own, holding
+		the CGI processes it spawns.
+	*/
+	void	_worker_flow(size_t slot) {
+		setpgid(0, 0);
+		close(_signal_fd);
+		_signal_fd = -1;
+		if (_upgrade_fd != -1) {
+			close(_upgrade_fd);
+			_upgrade_fd = -1;
+		}
+		sigset_t	mask;
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+		signal(SIGHUP, SIG_IGN);
+		signal(SIGUSR2, SIG_IGN);
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+		const Conf::Parser::Processes &processes =
+			_poll->get_snapshot()->get_processes();
+		const int cpu = pin_worker(processes, slot);
+		if (cpu != -1 && processes.incoming_cpu)
+			_poll->steer(cpu);
+		_poll->start(false, slot);
+	}
+
+	void	_kill(int sig, bool old_only) {
+		WorkerObject::const_iterator it = _workers.begin();
+		for (; it != _workers.end(); ++it) {
+			if (!old_only || it->second.generation != _generation)
+				kill(it->first, sig);
+		}
+	}
+
+	/*
+		-> false in a worker started again.
+	*/
+	bool	_handle_signals() {
+		struct signalfd_siginfo	info;
+		bool	child = false, reload = false, upgrade = false;
+		bool	term = false, quit = false;
+		while (read(_signal_fd, &info, sizeof(info)) == sizeof(info)) {
+			child = child || info.ssi_signo == SIGCHLD;
+			reload = reload || info.ssi_signo == SIGHUP;
+			upgrade = upgrade || info.ssi_signo == SIGUSR2;
+			term = term || info.ssi_signo == SIGTERM
+				|| info.ssi_signo == SIGINT;
+			quit = quit || info.ssi_signo == SIGQUIT;
+		}
+		if (term) {
+			_stopping = true;
+			_respawns.clear();
+			_kill(SIGTERM, false);
+		} else if (quit) {
+			_stopping = true;
+			_respawns.clear();
+			_kill(SIGQUIT, false);
+		}
+		if (child && !_reap())
+			return false;
+		if (reload && !_stopping && _poll->reload()) {
+			if (!_spawn_generation())
+				return false;
+			_kill(SIGQUIT, true);
+		}
+		if (upgrade && !_stopping && _upgrade_fd == -1) {
+			std::cout << "[🔁] upgrading binary..." << std::endl;
+			_upgrade_fd = spawn_upgrade(_av, _poll->get_listeners());
+			if (_upgrade_fd == -1)
+				std::cerr << "upgrade: unable to start the new binary" << std::endl;
+		}
+		return true;
+	}
+
+	/*
+		Collect the exited children, the processes left in the group of a
+		worker are terminated. Workers of the current generation are
+		started again, those which had just been started once their delay
+		is over: the loop keeps serving signals meanwhile.
+			-> false in a worker started again.
+	*/
+	bool	_reap() {
+		int		status;
+		pid_t	pid;
+		while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+			WorkerObject::iterator it = _workers.find(pid);
+			if (it == _workers.end())
+				continue;
+			const Worker worker = it->second;
+			_workers.erase(it);
+			kill(-pid, SIGTERM);
+			if (_stopping || worker.generation != _generation)
+				continue;
+
+			std::cerr << "master: worker " << worker.slot << " exited, starting it"
+				" again" << std::endl;
+			const uint64_t now = monotonic_ms();
+			if (now - worker.started < WEBSERV_WORKER_RESPAWN_DELAY * 1000) {
+				_respawns.insert(std::make_pair(
+					now + WEBSERV_WORKER_RESPAWN_DELAY * 1000, worker.slot));
+				continue;
+			}
+			if (!_spawn(worker.slot))
+				return false;
+		}
+		return true;
+	}
+
+	/*
+		Timeout of poll() until the first respawn is due, -1 for none.
+	*/
+	int		_next_respawn() const {
+		if (_respawns.empty())
+			return -1;
+		const uint64_t now = monotonic_ms();
+		const uint64_t due = _respawns.begin()->first;
+		return due > now ? static_cast<int>(due - now) : 0;
+	}
+
+	/*
+		Start the slots whose delay is over.
+			-> false in a worker started again.
+	*/
+	bool	_respawn() {
+		const uint64_t now = monotonic_ms();
+		while (!_respawns.empty() && _respawns.begin()->first <= now) {
+			const size_t slot = _respawns.begin()->second;
+			_respawns.erase(_respawns.begin());
+			if (!_spawn(slot))
+				return false;
+		}
+		return true;
+	}
+
+	/*
+		Once the new master is ready the workers are drained, the listeners
+		stay open in it.
+	*/
+	void	_handle_upgrade() {
+		char	ready;
+		ssize_t	n = read(_upgrade_fd, &ready, 1);
+		close(_upgrade_fd);
+		_upgrade_fd = -1;
+		if (n != 1) {
+			std::cerr << "upgrade: the new process failed, still serving"
+				<< std::endl;
+			return;
+		}
+		std::cout << "[🔁] upgraded" << std::endl;
+		_stopping = true;
+		_respawns.clear();
+		_kill(SIGQUIT, false);
+	}
+
+	Master(const Master &lhs);
+	Master	&operator=(const Master &lhs);
+};
+}  // namespace Server
+}  // namespace Webserv
+
+#endif  // SERVER_MASTER_HPP_
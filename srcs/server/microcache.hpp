@@ -0,0 +1,192 @@
+/*
+	Short-lived cache of the GET responses of the CGI / FastCGI scripts of
+	a location (cgi_cache), keyed by method, vhost, uri and query string.
+
+	Entries live for the ttl of the location, or the max-age given by the
+	script Cache-Control, within a byte budget (least recently used
+	entries are evicted first).
+
+	Misses for a key being filled wait for the request filling it instead
+	of starting their own script, they are woken once it is stored. A
+	response that can not be cached is remembered as such for the ttl:
+	its requests then run the script without waiting on each other.
+
+	The cache lives in each worker process (worker_processes), with its
+	part of the byte budget.
+*/
+
+#ifndef SERVER_MICROCACHE_HPP_
+#define SERVER_MICROCACHE_HPP_
+
+#include <stdint.h>
+
+#include <map>
+#include <list>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "models/IBlock.hpp"
+#include "server/gateway.hpp"
+#include "server/reactor.hpp"
+
+namespace Webserv {
+namespace Server {
+
+class MicroCache {
+ public:
+	struct Entry {
+		int					status;
+		Gateway::Headers	headers;
+		std::string			body;
+		uint64_t			stored;
+		uint64_t			expires;
+		bool				pass;
+		// Place of the key in the recency list, moved by splice()
+		std::list<std::string>::iterator	lru;
+	};
+
+ private:
+	typedef std::map<std::string, Entry>							EntryObject;
+	typedef std::map<std::string, std::vector<HTTP::Client *> >	WaitingObject;
+
+	Reactor			*_reactor;
+	const size_t	_budget;
+	size_t			_size;
+
+	EntryObject				_entries;
+	std::list<std::string>	_lru;
+	WaitingObject			_waiting;
+
+ public:
+	MicroCache(Reactor *reactor, size_t budget)
+	:	_reactor(reactor), _budget(budget), _size(0) {}
+
+	/*
+		Fresh entry of key, 0 on a miss.
+	*/
+	const Entry	*lookup(const std::string &key, uint64_t now) {
+		EntryObject::iterator it = _entries.find(key);
+		if (it == _entries.end())
+			return 0;
+		if (it->second.expires <= now) {
+			_erase(it);
+			return 0;
+		}
+		_lru.splice(_lru.begin(), _lru, it->second.lru);
+		return &it->second;
+	}
+
+	/*
+		A request runs the script of key, the next misses wait() for it.
+	*/
+	bool	filling(const std::string &key) const {
+		return _waiting.find(key) != _waiting.end();
+	}
+	void	fill(const std::string &key) { _waiting[key]; }
+	void	wait(const std::string &key, HTTP::Client *client) {
+		_waiting[key].push_back(client);
+	}
+	void	cancel(const std::string &key, HTTP::Client *client) {
+		WaitingObject::iterator it = _waiting.find(key);
+		if (it != _waiting.end())
+			it->second.erase(std::remove(it->second.begin(), it->second.end(),
+				client), it->second.end());
+	}
+
+	/*
+		End of the fill of key, the entry is stored when it fits in the
+		budget. Waiters are woken in any case, they look the key up again.
+	*/
+	void	store(const std::string &key, Entry *entry) {
+		const size_t cost = _cost(key, *entry);
+		EntryObject::iterator it = _entries.find(key);
+		if (it != _entries.end())
+			_erase(it);
+		if (cost <= _budget) {
+			while (_size + cost > _budget)
+				_erase(_entries.find(_lru.back()));
+			Entry &stored = _entries[key];
+			stored.status = entry->status;
+			stored.headers.swap(entry->headers);
+			stored.body.swap(entry->body);
+			stored.stored = entry->stored;
+			stored.expires = entry->expires;
+			stored.pass = entry->pass;
+			_lru.push_front(key);
+			stored.lru = _lru.begin();
+			_size += cost;
+		}
+		abort(key);
+	}
+
+	void	abort(const std::string &key) {
+		WaitingObject::iterator it = _waiting.find(key);
+		if (it == _waiting.end())
+			return;
+		std::vector<HTTP::Client *> waiters;
+		waiters.swap(it->second);
+		_waiting.erase(it);
+		for (size_t i = 0; i < waiters.size(); ++i)
+			_reactor->wake(waiters[i]);
+	}
+
+	size_t	budget() const { return _budget; }
+
+ private:
+	void	_erase(EntryObject::iterator it) {
+		_size -= _cost(it->first, it->second);
+		_lru.erase(it->second.lru);
+		_entries.erase(it);
+	}
+
+	static size_t	_cost(const std::string &key, const Entry &entry) {
+		size_t cost = key.size() + entry.body.size();
+		Gateway::Headers::const_iterator it = entry.headers.begin();
+		for (; it != entry.headers.end(); ++it)
+			cost += it->first.size() + it->second.size();
+		return cost;
+	}
+};
+
+static std::map<const Models::IBlock *, MicroCache *>	MICROCACHES;
+
+/*
+	Cache of the scripts of block, created on first use.
+*/
+static MicroCache	*get_microcache(const Models::IBlock *block,
+	Reactor *reactor) {
+	std::map<const Models::IBlock *, MicroCache *>::iterator it =
+		MICROCACHES.find(block);
+	if (it != MICROCACHES.end())
+		return it->second;
+	MicroCache *cache = new MicroCache(reactor,
+		worker_share(reactor, block->get_cgi_cache().size));
+	MICROCACHES[block] = cache;
+	return cache;
+}
+
+/*
+	block belongs to a configuration no request is served from anymore.
+*/
+void	forget_microcache(const Models::IBlock *block) {
+	std::map<const Models::IBlock *, MicroCache *>::iterator it =
+		MICROCACHES.find(block);
+	if (it == MICROCACHES.end())
+		return;
+	delete it->second;
+	MICROCACHES.erase(it);
+}
+
+void	destroy_microcaches() {
+	std::map<const Models::IBlock *, MicroCache *>::iterator it =
+		MICROCACHES.begin();
+	for (; it != MICROCACHES.end(); ++it)
+		delete it->second;
+	MICROCACHES.clear();
+}
+
+}  // namespace Server
+}  // namespace Webserv
+
+#endif  // SERVER_MICROCACHE_HPP_
@@ -2,14 +2,19 @@
 #define SERVER_POLL_HPP_
 
 #include <errno.h>
+#include <signal.h>
 #include <string.h>
+#include <sys/wait.h>
 #include <sys/types.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/signalfd.h>
 
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <csignal>
 #include <stdexcept>
 #include <iostream>
@@ -18,28 +23,62 @@
 #include "http/enums.hpp"
 #include "http/codes.hpp"
 #include "http/client.hpp"
+#include "conf/parser.hpp"
+#include "conf/snapshot.hpp"
 #include "models/IServer.hpp"
+#include "server/reactor.hpp"
 #include "server/instance.hpp"
+#include "server/workers.hpp"
+#include "server/tunnel.hpp"
+#include "server/iopool.hpp"
+#include "server/upgrade.hpp"
 
 namespace Webserv {
 namespace Server {
-class Poll {
+class Poll : public Reactor {
  public:
 	typedef Webserv::Models::IServer	IServer;
+	typedef Webserv::Conf::Snapshot		Snapshot;
 
 	typedef std::map<int, Instance *>		InstanceObject;
 	typedef std::map<int, HTTP::Client *> 	ClientObject;
 
+	typedef std::map<int, HTTP::Client *>				UpstreamObject;
+	typedef std::map<int, EventHandler *>				HandlerObject;
+	typedef std::map<pid_t, HTTP::Client *>				ChildObject;
+	typedef std::multimap<uint64_t, HTTP::Client *>		TimerObject;
+
  private:
 	bool	_alive;
+	bool	_draining;
+	bool	_standalone;
+	size_t	_worker;
+	size_t	_workers;
 	int		epoll_fd;
+	int		signal_fd;
+	int		upgrade_fd;
+
+	int						_ac;
+	char					**_av;
+	Snapshot				*_snapshot;
+	std::vector<Snapshot *>	_retired;
+	ListenerFds				_inherited;
 
 	InstanceObject	_instances;
 	ClientObject	_clients;
 
+	UpstreamObject	_upstreams;
+	HandlerObject	_handlers;
+	ChildObject		_children;
+	TimerObject		_timers;
+
  public:
 	Poll()
-	:	_alive(true), epoll_fd(-1) {
+	:	_alive(true), _draining(false), _standalone(true),
+		_worker(0), _workers(1),
+		epoll_fd(-1), signal_fd(-1),
+		upgrade_fd(-1),
+		_ac(0), _av(0), _snapshot(0) {
 		#ifdef WEBSERV_BENCHMARK
 		std::cout << "[🚀] starting in benchmark mode" << std::endl;
 		#endif
@@ -48,27 +87,148 @@ class Poll {
 		#endif
 		HTTP::init_status_map();
 		HTTP::init_mime_types_map();
+		HTTP::init_rendered_status_pages();
 	}
 
 	~Poll() {
 		for (InstanceObject::iterator it = _instances.begin();
 			it != _instances.end(); ++it)
-			delete it->second;
+			it->second->release();
 
 		for (ClientObject::iterator it = _clients.begin(); it != _clients.end(); ++it)
 			delete it->second;
+		if (_snapshot)
+			_snapshot->release();
+		for (size_t i = 0; i < _retired.size(); ++i)
+			_retired[i]->release();
+		destroy_fastcgi_pools();
+		destroy_microcaches();
+		destroy_throttles();
+		destroy_proxies();
+		destroy_disk_caches();
+		destroy_tunnels();
+		destroy_io_pool();
 		close(epoll_fd);
+		if (signal_fd != -1)
+			close(signal_fd);
+		if (upgrade_fd != -1)
+			close(upgrade_fd);
+		HTTP::destroy_rendered_pages();
+	}
+
+	void	init(Snapshot *snapshot, int ac, char **av) {
+		listen(snapshot, ac, av);
+		start();
 	}
 
-	void	init(const std::vector<IServer *> &servers) {
+	/*
+		Bind the interfaces of snapshot, each listener holds a reference to
+		it. ac, av are the arguments the configuration is parsed from again
+		on reload.
+	*/
+	void	listen(Snapshot *snapshot, int ac, char **av) {
+		_ac = ac;
+		_av = av;
+		_snapshot = snapshot->acquire();
+		_inherited = inherited_listeners();
+		if (!_add_servers(snapshot))
+			throw std::runtime_error("Error while adding servers to epoll.");
+		// Interfaces no longer configured, their backlog goes with them
+		for (ListenerFds::iterator it = _inherited.begin();
+			it != _inherited.end(); ++it)
+			close(it->second);
+		_inherited.clear();
+	}
+
+	/*
+		Poll the listeners from this process. A worker (standalone false)
+		leaves stdin, reloads and upgrades to its master, it holds its part
+		of the limits of the configuration (see worker_share()).
+	*/
+	void	start(bool standalone = true, size_t worker = 0) {
+		_standalone = standalone;
+		_worker = worker;
+		_workers = standalone ? 1
+			: std::max<size_t>(_snapshot->get_processes().workers, 1);
 		if (!_create_poll())
 			throw std::runtime_error("Error while initializing epoll.");
-		if (!_add_servers(servers))
-			throw std::runtime_error("Error while adding servers to epoll.");
+		InstanceObject::const_iterator it = _instances.begin();
+		for (; it != _instances.end(); ++it) {
+			if (!_watch_listener(it->first))
+				throw std::runtime_error("Error while adding servers to epoll.");
+		}
+		if (!_add_signals())
+			throw std::runtime_error("Error while adding signals to epoll.");
+		_add_cgi_workers(_snapshot->get_blocks());
+		_add_disk_caches(_snapshot->get_blocks());
+		if (!_standalone)
+			return;
 		#ifndef WEBSERV_TESTS
 		if (!_add_stdin())
 			throw std::runtime_error("Error while adding stdin to epoll.");
 		#endif
+		notify_upgraded();
+	}
+
+	/*
+		Parse the configuration again, an invalid one leaves the current
+		one in place. The requests starting from now on are served from the
+		new snapshot, those in flight complete on the one they started on.
+	*/
+	bool	reload() {
+		std::cout << "[🔄] reloading configuration..." << std::endl;
+		Conf::Parser parser;
+		if (!parser.run(_ac, _av)) {
+			std::cerr << "reload: invalid configuration, keeping the current one"
+				<< std::endl;
+			return false;
+		}
+
+		Snapshot *next = new Snapshot(&parser);
+		_swap_listeners(next);
+		_retired.push_back(_snapshot);
+		_snapshot = next;
+		if (epoll_fd != -1) {
+			_add_cgi_workers(next->get_blocks());
+			_add_disk_caches(next->get_blocks());
+		} else {
+			_collect_snapshots();
+		}
+		std::cout << "[🔄] configuration reloaded" << std::endl;
+		return true;
+	}
+
+	/*
+		Listen on each interface again, from a socket taking the connections
+		processed on cpu. Called by a worker before start().
+	*/
+	void	steer(int cpu) {
+		const InstanceObject shared(_instances);
+		InstanceObject::const_iterator it = shared.begin();
+		for (; it != shared.end(); ++it) {
+			try {
+				Instance *steered = new Instance(it->second, cpu);
+				_instances[steered->get_fd()] = steered;
+			} catch (std::exception &e) {
+				std::cerr << "steer: " << e.what() << ", "
+					<< it->second->get_server()->get_name()
+					<< " only accepts from the shared socket" << std::endl;
+			}
+		}
+	}
+
+	const Snapshot	*get_snapshot() const { return _snapshot; }
+
+	// Listening fds, by interface
+	ListenerFds	get_listeners() const {
+		ListenerFds listeners;
+		InstanceObject::const_iterator it = _instances.begin();
+		for (; it != _instances.end(); ++it) {
+			const IServer *server = it->second->get_server();
+			listeners[std::make_pair(server->get_host(), server->get_port())] =
+				it->first;
+		}
+		return listeners;
 	}
 
 	int	run() {
@@ -76,7 +236,8 @@ class Poll {
 		int i, evs = 0;
 		std::cout << "[📭] up and awaiting..." << std::endl;
 		while (_alive) {
-			int nfds = epoll_wait(epoll_fd, events, WEBSERV_MAX_CONNS, 1000);
+			int nfds = epoll_wait(epoll_fd, events, WEBSERV_MAX_CONNS,
+				_next_timeout());
 			for (i = 0; i < nfds; ++i) {
 				++evs;
 				int ev_fd = events[i].data.fd;
@@ -84,6 +245,25 @@ class Poll {
 					_handle_stdin();
 					continue;
 				}
+				if (ev_fd == signal_fd) {
+					_handle_signals();
+					continue;
+				}
+				if (ev_fd == upgrade_fd) {
+					_handle_upgrade();
+					continue;
+				}
+				UpstreamObject::iterator up = _upstreams.find(ev_fd);
+				if (up != _upstreams.end()) {
+					HTTP::Client *client = up->second;
+					_resume(client, client->handle_upstream(ev_fd, events[i].events));
+					continue;
+				}
+				HandlerObject::iterator handler = _handlers.find(ev_fd);
+				if (handler != _handlers.end()) {
+					handler->second->handle_event(ev_fd, events[i].events);
+					continue;
+				}
 				if (events[i].events & EPOLLERR || events[i].events & EPOLLHUP) {
 					_handle_aborted(ev_fd);
 					continue;
@@ -98,31 +278,87 @@ class Poll {
 					_handle_write(ev_fd);
 				}
 			}
+			_run_timers();
 			if (nfds == 0 || evs > 500)
 				_garbage_collector(&evs);
+			if (_draining && _clients.empty() && TUNNELS.empty())
+				_alive = false;
 		}
 
 		return 0;
 	}
 
+	bool	watch(int fd, uint32_t events, HTTP::Client *owner) {
+		struct epoll_event event = {};
+		event.events = events;
+		event.data.fd = fd;
+		int op = _upstreams.count(fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+		if (epoll_ctl(epoll_fd, op, fd, &event) == -1) {
+			std::cerr << "watch: epoll_ctl failed" << std::endl;
+			return false;
+		}
+		_upstreams[fd] = owner;
+		return true;
+	}
+
+	bool	watch(int fd, uint32_t events, EventHandler *handler) {
+		struct epoll_event event = {};
+		event.events = events;
+		event.data.fd = fd;
+		int op = _handlers.count(fd) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+		if (epoll_ctl(epoll_fd, op, fd, &event) == -1) {
+			std::cerr << "watch: epoll_ctl failed" << std::endl;
+			return false;
+		}
+		_handlers[fd] = handler;
+		return true;
+	}
+
+	void	unwatch(int fd) {
+		if (_upstreams.erase(fd) || _handlers.erase(fd))
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	}
+
+	void	wake(HTTP::Client *owner) {
+		_resume(owner, owner->handle_wake());
+	}
+
+	void	watch_child(pid_t pid, HTTP::Client *owner) {
+		_children[pid] = owner;
+	}
+
+	void	unwatch_child(pid_t pid) {
+		_children.erase(pid);
+	}
+
+	void	schedule(uint64_t deadline, HTTP::Client *owner) {
+		_timers.insert(std::make_pair(deadline, owner));
+	}
+
+	size_t	worker() const { return _worker; }
+	size_t	workers() const { return _workers; }
+
  private:
 	void	_garbage_collector(int *evs) {
 		#ifdef WEBSERV_SESSION
 		_collect_expired_sessions();
 		#endif
 		_handle_expired_clients();
+		expire_tunnels();
+		_collect_snapshots();
 		*evs = 0;
 	}
 
 	bool	_create_poll() {
-		epoll_fd = epoll_create1(0);
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 		return (epoll_fd != -1);
 	}
 
-	bool	_add_servers(const std::vector<IServer *> &servers) {
-		std::vector<IServer *>::const_iterator it = servers.begin();
+	bool	_add_servers(Snapshot *snapshot) {
+		const Snapshot::IServerList &servers = snapshot->get_servers();
+		Snapshot::IServerList::const_iterator it = servers.begin();
 		for (; it != servers.end(); it++) {
-			if (!_add_server(*it)) {
+			if (!_add_server(*it, snapshot)) {
 				std::cout << "unable to add " << (*it)->get_name()
 				<< " (" << (*it)->get_host() << ":" << (*it)->get_port() << ")"
 				<< std::endl;
@@ -131,10 +367,17 @@ class Poll {
 		}
 		return true;
 	}
-	bool	_add_server(const IServer* serv) {
+	bool	_add_server(const IServer* serv, Snapshot *snapshot) {
 		Instance *new_server;
+		int inherited = -1;
+		ListenerFds::iterator fd = _inherited.find(
+			std::make_pair(serv->get_host(), serv->get_port()));
+		if (fd != _inherited.end()) {
+			inherited = fd->second;
+			_inherited.erase(fd);
+		}
 		try {
-			new_server = new Instance(*serv);
+			new_server = new Instance(serv, snapshot, inherited);
 			if (!new_server) {
 				std::cerr << "add_server: alloc failed" << std::endl;
 				return false;
@@ -145,23 +388,59 @@ class Poll {
 
 		int new_fd = new_server->get_fd();
 		if (new_fd == -1) {
-			delete new_server;
+			new_server->release();
 			std::cerr << "add_server: invalid fd" << std::endl;
 			return false;
 		}
 
-		struct epoll_event event = {};
-		event.events = EPOLLIN;
-		event.data.fd = new_fd;
-		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, new_fd, &event) == -1) {
-			delete new_server;
-			std::cerr << "add_server: epoll_ctl failed" << std::endl;
+		// Not polled yet while the loop is not started
+		if (epoll_fd != -1 && !_watch_listener(new_fd)) {
+			new_server->release();
 			return false;
 		}
 
 		_instances[new_fd] = new_server;
 		return true;
 	}
+
+	/*
+		Processes polling a same listener are not all woken by a connection
+		(EPOLLEXCLUSIVE).
+	*/
+	bool	_watch_listener(int fd) {
+		struct epoll_event event = {};
+		event.events = EPOLLIN | EPOLLEXCLUSIVE;
+		event.data.fd = fd;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+			std::cerr << "add_server: epoll_ctl failed" << std::endl;
+			return false;
+		}
+		return true;
+	}
+	/*
+		Pre-fork the workers of every cgi_workers mapping.
+	*/
+	void	_add_cgi_workers(const Snapshot::IBlockList &blocks) {
+		for (size_t i = 0; i < blocks.size(); ++i) {
+			const Models::IBlock::CGIWorkersObject &workers =
+				blocks[i]->get_cgi_workers();
+			Models::IBlock::CGIWorkersObject::const_iterator it = workers.begin();
+			for (; it != workers.end(); ++it)
+				get_cgi_worker_pool(blocks[i]->get_cgi(it->first), it->second,
+					blocks[i]->get_cgi_env(), this);
+		}
+	}
+
+	/*
+		Rebuild the index of every disk_cache directory.
+	*/
+	void	_add_disk_caches(const Snapshot::IBlockList &blocks) {
+		for (size_t i = 0; i < blocks.size(); ++i) {
+			if (blocks[i]->get_disk_cache().path != "")
+				get_disk_cache(blocks[i], this);
+		}
+	}
+
 	bool	_add_stdin() {
 		struct	epoll_event event = {};
 		event.events = EPOLLIN;
@@ -173,8 +452,45 @@ class Poll {
 		return true;
 	}
 
-	void	_handle_connection(IServer *master, int fd) {
-		HTTP::Client *client = new HTTP::Client(master, fd);
+	/*
+		SIGCHLD, SIGHUP, SIGUSR2, SIGQUIT, SIGTERM and SIGINT are blocked
+		and received through a signalfd, children are then reaped, reloads,
+		upgrades and shutdowns run from the loop: a stopped loop still
+		destroys its pools, their spawned workers go with it. Writes to a
+		pipe whose reader exited must fail with EPIPE instead of killing
+		the server.
+	*/
+	bool	_add_signals() {
+		sigset_t	mask;
+		sigemptyset(&mask);
+		sigaddset(&mask, SIGCHLD);
+		sigaddset(&mask, SIGHUP);
+		sigaddset(&mask, SIGUSR2);
+		sigaddset(&mask, SIGQUIT);
+		sigaddset(&mask, SIGTERM);
+		sigaddset(&mask, SIGINT);
+		if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
+			return false;
+		signal(SIGPIPE, SIG_IGN);
+
+		signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+		if (signal_fd == -1) {
+			std::cerr << "add_signals: signalfd failed" << std::endl;
+			return false;
+		}
+
+		struct epoll_event event = {};
+		event.events = EPOLLIN;
+		event.data.fd = signal_fd;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event) == -1) {
+			std::cerr << "add_signals: epoll_ctl failed" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	void	_handle_connection(Instance *listener, int fd) {
+		HTTP::Client *client = new HTTP::Client(listener, fd, this);
 		if (!client) {
 			std::cerr << "handle_connection: alloc failed" << std::endl;
 			return;
@@ -183,7 +499,6 @@ class Poll {
 		int new_fd = client->get_fd();
 		if (new_fd == -1) {
 			delete client;
-			std::cerr << "handle_connection: invalid fd" << std::endl;
 			return;
 		}
 
@@ -217,11 +532,32 @@ class Poll {
 			return;
 		}
 
-		if (client->send_response())
+		HTTP::WRITE ret = client->send_response();
+		if (ret == HTTP::WRITE_WAIT)
+			return;
+		if (ret == HTTP::WRITE_PENDING)
+			return _change_epoll_state(ev_fd, 0);
+		if (ret == HTTP::WRITE_BODY)
+			return _change_epoll_state(ev_fd, EPOLLIN);
+		if (ret == HTTP::WRITE_CLOSE)
 			return _delete_client(ev_fd, client);
+		if (ret == HTTP::WRITE_UPGRADE)
+			return _upgrade_client(ev_fd, client);
 		return _change_epoll_state(ev_fd, EPOLLIN);
 	}
 
+	/*
+		Both the client and its upstream are relayed by a tunnel from now
+		on, past WEBSERV_TUNNEL_TIMEOUT instead of WEBSERV_CLIENT_TIMEOUT.
+	*/
+	void	_upgrade_client(int ev_fd, HTTP::Client *client) {
+		int upstream;
+		const int fd = client->take_tunnel(&upstream);
+		_delete_client(ev_fd, client);
+		if (!open_tunnel(fd, upstream, this))
+			std::cerr << "upgrade: unable to open tunnel" << std::endl;
+	}
+
 	void	_handle_stdin() {
 		std::string line;
 
@@ -229,6 +565,8 @@ class Poll {
 			if (!std::getline(std::cin, line) || line == "quit" || line == "exit") {
 				_alive = false;
 				std::cout << "[📪] shutting down..." << std::endl;
+			} else if (line == "reload") {
+				_reload();
 			}
 		#else
 			std::getline(std::cin, line);
@@ -239,6 +577,242 @@ class Poll {
 		#endif
 	}
 
+	/*
+		Reap every exited child, even those whose owner is gone, then
+		reload on SIGHUP, upgrade on SIGUSR2 and drain on SIGQUIT.
+	*/
+	void	_handle_signals() {
+		struct signalfd_siginfo	info;
+		bool					reload = false, upgrade = false, quit = false;
+		bool					stop = false;
+		while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+			reload = reload || info.ssi_signo == SIGHUP;
+			upgrade = upgrade || info.ssi_signo == SIGUSR2;
+			quit = quit || info.ssi_signo == SIGQUIT;
+			stop = stop || info.ssi_signo == SIGTERM
+				|| info.ssi_signo == SIGINT;
+		}
+
+		int		state;
+		pid_t	pid;
+		while ((pid = waitpid(-1, &state, WNOHANG)) > 0) {
+			ChildObject::iterator it = _children.find(pid);
+			if (it == _children.end())
+				continue;
+			HTTP::Client *client = it->second;
+			_children.erase(it);
+			_resume(client, client->handle_exit(pid));
+		}
+		if (reload)
+			_reload();
+		if (upgrade)
+			_upgrade();
+		if (quit)
+			_drain();
+		if (stop)
+			_alive = false;
+	}
+
+	// Workers are reloaded by their master, which starts new ones
+	void	_reload() {
+		if (_standalone && !_draining)
+			reload();
+	}
+
+	/*
+		Listeners of an interface still configured move to next, the others
+		stop accepting first (their port may be taken again), then the new
+		interfaces are bound.
+	*/
+	void	_swap_listeners(Snapshot *next) {
+		typedef std::map<std::pair<std::string, int>, const IServer *>
+			InterfaceObject;
+		InterfaceObject		interfaces;
+
+		const Snapshot::IServerList &servers = next->get_servers();
+		for (size_t i = 0; i < servers.size(); ++i) {
+			interfaces[std::make_pair(servers[i]->get_host(),
+				servers[i]->get_port())] = servers[i];
+		}
+
+		InstanceObject::iterator it = _instances.begin();
+		while (it != _instances.end()) {
+			const IServer *server = it->second->get_server();
+			InterfaceObject::iterator kept = interfaces.find(
+				std::make_pair(server->get_host(), server->get_port()));
+			if (kept == interfaces.end()) {
+				epoll_ctl(epoll_fd, EPOLL_CTL_DEL, it->first, NULL);
+				it->second->stop();
+				it->second->release();
+				_instances.erase(it++);
+				continue;
+			}
+			it->second->reload(kept->second, next);
+			interfaces.erase(kept);
+			++it;
+		}
+
+		InterfaceObject::const_iterator added = interfaces.begin();
+		for (; added != interfaces.end(); ++added) {
+			if (!_add_server(added->second, next)) {
+				std::cerr << "reload: unable to add " << added->second->get_name()
+					<< " (" << added->second->get_host() << ":"
+					<< added->second->get_port() << ")" << std::endl;
+			}
+		}
+	}
+
+	/*
+		Start the binary again with the listening sockets, this process
+		keeps serving until the new one is ready.
+	*/
+	void	_upgrade() {
+		if (!_standalone || _draining || upgrade_fd != -1)
+			return;
+		std::cout << "[🔁] upgrading binary..." << std::endl;
+		upgrade_fd = spawn_upgrade(_av, get_listeners());
+		if (upgrade_fd == -1) {
+			std::cerr << "upgrade: unable to start " << _av[0] << std::endl;
+			return;
+		}
+		struct epoll_event event = {};
+		event.events = EPOLLIN;
+		event.data.fd = upgrade_fd;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, upgrade_fd, &event) == -1) {
+			std::cerr << "upgrade: epoll_ctl failed" << std::endl;
+			close(upgrade_fd);
+			upgrade_fd = -1;
+		}
+	}
+
+	/*
+		The new process is ready, or exited before (end of file).
+	*/
+	void	_handle_upgrade() {
+		char	ready;
+		const ssize_t n = read(upgrade_fd, &ready, 1);
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, upgrade_fd, NULL);
+		close(upgrade_fd);
+		upgrade_fd = -1;
+		if (n != 1) {
+			std::cerr << "upgrade: the new process failed, still serving"
+				<< std::endl;
+			return;
+		}
+		std::cout << "[🔁] upgraded" << std::endl;
+		_drain();
+	}
+
+	/*
+		Stop accepting, then exit once the last connection is closed. After
+		an upgrade, or a reload of the workers, the sockets stay open in
+		the processes accepting what is queued.
+	*/
+	void	_drain() {
+		if (_draining)
+			return;
+		std::cout << "[📪] draining connections..." << std::endl;
+		InstanceObject::iterator it = _instances.begin();
+		for (; it != _instances.end(); ++it) {
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, it->first, NULL);
+			it->second->stop();
+			it->second->release();
+		}
+		_instances.clear();
+		#ifndef WEBSERV_TESTS
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+		#endif
+		_draining = true;
+	}
+
+	/*
+		A replaced snapshot only held by the loop serves no request
+		anymore: the state kept for its blocks goes with it, along with the
+		worker pools and error pages no other snapshot uses.
+	*/
+	void	_collect_snapshots() {
+		const size_t retired = _retired.size();
+		std::vector<Snapshot *>::iterator it = _retired.begin();
+		while (it != _retired.end()) {
+			if ((*it)->refs() > 1) {
+				++it;
+				continue;
+			}
+			const Snapshot::IBlockList &blocks = (*it)->get_blocks();
+			for (size_t i = 0; i < blocks.size(); ++i) {
+				forget_throttle(blocks[i]);
+				forget_microcache(blocks[i]);
+				forget_proxy_upstream(blocks[i]);
+			}
+			(*it)->release();
+			it = _retired.erase(it);
+		}
+		if (_retired.size() == retired)
+			return;
+
+		std::set<std::string>				pools;
+		std::set<HTTP::RenderedPageKey>		pages;
+		_live_state(_snapshot->get_blocks(), &pools, &pages);
+		for (size_t i = 0; i < _retired.size(); ++i)
+			_live_state(_retired[i]->get_blocks(), &pools, &pages);
+		forget_cgi_worker_pools(pools);
+		HTTP::forget_error_pages(pages);
+	}
+
+	void	_live_state(const Snapshot::IBlockList &blocks,
+		std::set<std::string> *pools, std::set<HTTP::RenderedPageKey> *pages) {
+		for (size_t i = 0; i < blocks.size(); ++i) {
+			const Models::IBlock::CGIWorkersObject &workers =
+				blocks[i]->get_cgi_workers();
+			Models::IBlock::CGIWorkersObject::const_iterator it = workers.begin();
+			for (; it != workers.end(); ++it) {
+				pools->insert(cgi_worker_pool_key(
+					blocks[i]->get_cgi(it->first), it->second));
+			}
+			const Models::IBlock::ErrorPagesObject &errors =
+				blocks[i]->get_error_pages();
+			Models::IBlock::ErrorPagesObject::const_iterator page = errors.begin();
+			for (; page != errors.end(); ++page)
+				pages->insert(HTTP::RenderedPageKey(page->first, page->second));
+		}
+	}
+
+	int		_next_timeout() const {
+		if (_timers.empty())
+			return 1000;
+		uint64_t now = monotonic_ms();
+		if (_timers.begin()->first <= now)
+			return 0;
+		return std::min<uint64_t>(_timers.begin()->first - now, 1000);
+	}
+
+	void	_run_timers() {
+		uint64_t now = monotonic_ms();
+		while (!_timers.empty() && _timers.begin()->first <= now) {
+			HTTP::Client *client = _timers.begin()->second;
+			_timers.erase(_timers.begin());
+			_resume(client, client->handle_timeout(now));
+		}
+	}
+
+	void	_cancel_timers(HTTP::Client *client) {
+		TimerObject::iterator it = _timers.begin();
+		while (it != _timers.end()) {
+			if (it->second == client)
+				_timers.erase(it++);
+			else
+				++it;
+		}
+	}
+
+	/*
+		The response of client is complete, sending it can start.
+	*/
+	void	_resume(HTTP::Client *client, bool ready) {
+		if (ready)
+			_change_epoll_state(client->get_fd(), EPOLLOUT);
+	}
+
 	void	_handle_aborted(int ev_fd) {
 		if (_clients.find(ev_fd) != _clients.end())
 			_delete_client(ev_fd, _clients[ev_fd]);
@@ -246,17 +820,24 @@ class Poll {
 			close(ev_fd);
 	}
 
+	/*
+		Idle clients are answered with a 408, those whose response started
+		are only closed. A pending response is left to its own timeout.
+	*/
 	void	_handle_expired_clients() {
 		struct timeval now;
 		gettimeofday(&now, NULL);
 
 		ClientObject::iterator it = _clients.begin();
-		for (; it != _clients.end(); it++) {
-			if (it->second->is_expired(now.tv_sec)) {
-				it->second->abort(408);
-				_delete_client(it->first, it->second);
-				return _handle_expired_clients();
-			}
+		while (it != _clients.end()) {
+			HTTP::Client *client = it->second;
+			const int fd = it->first;
+			++it;
+			if (client->pending() || !client->is_expired(now.tv_sec))
+				continue;
+			if (!client->responding())
+				client->abort(408);
+			_delete_client(fd, client);
 		}
 	}
 
@@ -264,12 +845,13 @@ class Poll {
 	void	_collect_expired_sessions() const {
 		InstanceObject::const_iterator it = _instances.begin();
 		for (; it != _instances.end(); it++)
-			it->second->collect_sessions();
+			it->second->get_sessions()->collect();
 	}
 	#endif
 
 	void	_delete_client(int ev_fd, HTTP::Client *client) {
 		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, ev_fd, NULL);
+		_cancel_timers(client);
 		delete client;
 		_clients.erase(ev_fd);
 	}
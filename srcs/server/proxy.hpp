@@ -0,0 +1,867 @@
+/*
+	HTTP/1.1 reverse proxy (proxy_pass), requests are sent on keep-alive
+	connections pooled per upstream address (host:port or unix:/path).
+
+	A location may list several upstreams, requests are spread over them
+	in turn (round_robin), to the one with the fewest requests in flight
+	(least_conn), or by a consistent hash of the uri (hash): adding or
+	removing an upstream only moves the uris it owned.
+
+	An upstream refusing connections is skipped for WEBSERV_PROXY_FAIL_TIMEOUT
+	seconds, the request is retried on the next one. A request whose
+	pooled connection was closed before any answer is retried as well, as
+	long as its body was received whole.
+
+	Both bodies are streamed: the request body is sent as the client sends
+	it, the response body is decoded (chunked) and queued as it arrives.
+	Reading pauses while the client has not drained the queued body.
+
+	Upgrade requests (WebSocket) get a connection of their own, once the
+	upstream answers 101 it is handed over to the response with the bytes
+	read past its headers, to be relayed by a Tunnel.
+*/
+
+#ifndef SERVER_PROXY_HPP_
+#define SERVER_PROXY_HPP_
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <utility>
+#include <iostream>
+#include <algorithm>
+
+#include "consts.hpp"
+#include "http/request.hpp"
+#include "models/IBlock.hpp"
+#include "server/gateway.hpp"
+#include "server/reactor.hpp"
+
+namespace Webserv {
+namespace Server {
+
+class ProxyPool;
+class ProxyUpstream;
+class ProxyConnection;
+
+class ProxyRequest : public Gateway {
+	friend class ProxyConnection;
+	friend class ProxyUpstream;
+
+ private:
+	ProxyUpstream		*_upstream;
+	const std::string	_key;
+	const bool			_upgrade;
+	const std::string	_request;
+
+	Reactor					*_reactor;
+	HTTP::Client			*_owner;
+	ProxyConnection			*_conn;
+	std::set<ProxyPool *>	_tried;
+	size_t					_tries;
+	bool					_replayable;
+	uint64_t				_deadline;
+
+	int						_tunnel;
+	std::string				_tunnel_data;
+
+ public:
+	ProxyRequest(ProxyUpstream *upstream, HTTP::Request *req)
+	:	Gateway(req->get_uri(), req->get_query(), req->get_method(),
+			HTTP::BAD_GATEWAY),
+		_upstream(upstream),
+		_key(req->get_uri()),
+		_upgrade(req->get_method() == HTTP::METH_GET
+			&& req->get_header_value("upgrade") != ""),
+		_request(_head(req, _upgrade)),
+		_reactor(0), _owner(0), _conn(0),
+		_tries(0),
+		_replayable(false),
+		_deadline(0),
+		_tunnel(-1) {
+		_timeout = WEBSERV_PROXY_TIMEOUT;
+	}
+
+	~ProxyRequest();
+
+	bool	run(Reactor *reactor, HTTP::Client *owner);
+	bool	handle_timeout(uint64_t now);
+
+	int		take_tunnel(std::string *data) {
+		const int fd = _tunnel;
+		_tunnel = -1;
+		data->swap(_tunnel_data);
+		return fd;
+	}
+
+	HTTP::Client	*owner() const { return _owner; }
+
+	/*
+		Headers of a single connection, not forwarded either way.
+	*/
+	static bool	hop_by_hop(const std::string &name) {
+		static const char *names[] = { "Connection", "Keep-Alive",
+			"Proxy-Connection", "TE", "Trailer", "Transfer-Encoding", "Upgrade",
+			"Expect", 0 };
+		for (size_t i = 0; names[i]; ++i) {
+			if (strcasecmp(name.c_str(), names[i]) == 0)
+				return true;
+		}
+		return false;
+	}
+
+ private:
+	/*
+		Request line and headers sent upstream, the body is framed by its
+		Content-Length (only bodies of a known length are streamed).
+	*/
+	static std::string	_head(HTTP::Request *req, bool upgrade) {
+		std::string head = req->get_method() == HTTP::METH_POST ? "POST"
+			: req->get_method() == HTTP::METH_DELETE ? "DELETE" : "GET";
+		head += " " + req->get_uri();
+		if (req->get_query() != "")
+			head += "?" + req->get_query();
+		head += " HTTP/1.1\r\n";
+
+		const HTTP::Request::HeadersObject &headers = req->get_headers();
+		HTTP::Request::HeadersObject::const_iterator it = headers.begin();
+		for (; it != headers.end(); ++it) {
+			if (!hop_by_hop(it->first) && it->first != "content-length")
+				head += it->first + ": " + it->second + "\r\n";
+		}
+		if (req->get_method() == HTTP::METH_POST || req->get_body_length())
+			head += "Content-Length: " + _toString(req->get_body_length()) + "\r\n";
+		if (upgrade)
+			head += "Connection: Upgrade\r\nUpgrade: "
+				+ req->get_header_value("upgrade") + "\r\n";
+		return head + "\r\n";
+	}
+
+	/*
+		Next slice of the body.
+			-> true when the client may send more of it.
+	*/
+	bool	_write_input(std::string *out) {
+		const size_t len = std::min(_input_left(),
+			static_cast<size_t>(WEBSERV_STREAM_CHUNK_SIZE));
+		out->append(_input, _input_sent, len);
+		return _input_consumed(len);
+	}
+	bool	_has_input() const { return _input_left() > 0; }
+	bool	_input_done() const { return _input_eof && _input_left() == 0; }
+
+	void	_input_ready();
+	void	_drained();
+
+	void	_response(const char *data, size_t len) { _feed(data, len); }
+
+	/*
+		The response is complete, the rest of the request body is dropped.
+	*/
+	void	_finish() {
+		_conn = 0;
+		if (!_input_done()) {
+			_input_discard = true;
+			_input_consumed(_input_left());
+		}
+		_end();
+	}
+
+	void	_lost(bool retry);
+
+	static std::string	_toString(size_t num) {
+		std::stringstream ss;
+
+		ss << num;
+		return ss.str();
+	}
+};
+
+class ProxyConnection : public EventHandler {
+	enum STATE {
+		PROXY_HEAD,
+		PROXY_LENGTH,
+		PROXY_CHUNK_SIZE,
+		PROXY_CHUNK_DATA,
+		PROXY_CHUNK_END,
+		PROXY_TRAILERS,
+		PROXY_CLOSE,
+		PROXY_DONE,
+		PROXY_UPGRADE
+	};
+
+ private:
+	ProxyPool		*_pool;
+	Reactor			*_reactor;
+	int				_fd;
+	bool			_connected;
+	uint32_t		_events;
+
+	ProxyRequest	*_req;
+	std::string		_out;
+	size_t			_out_sent;
+	std::string		_in;
+
+	STATE			_state;
+	size_t			_left;
+	bool			_keepalive;
+	bool			_received;
+	bool			_paused;
+	size_t			_served;
+
+	// Set when the request is gone while it is being woken
+	bool			_dispatching;
+	bool			_dead;
+
+ public:
+	ProxyConnection(ProxyPool *pool, Reactor *reactor)
+	:	_pool(pool), _reactor(reactor),
+		_fd(-1), _connected(false), _events(0),
+		_req(0), _out_sent(0),
+		_state(PROXY_HEAD), _left(0),
+		_keepalive(false), _received(false), _paused(false), _served(0),
+		_dispatching(false), _dead(false) {}
+
+	~ProxyConnection() {
+		if (_fd != -1) {
+			_reactor->unwatch(_fd);
+			close(_fd);
+		}
+	}
+
+	bool	open(const std::string &address) {
+		return (_fd = upstream_connect(address, &_connected)) != -1;
+	}
+
+	void	begin(ProxyRequest *req) {
+		_req = req;
+		_req->_conn = this;
+		_out = req->_request;
+		_out_sent = 0;
+		_in.clear();
+		_state = PROXY_HEAD;
+		_keepalive = true;
+		_received = false;
+		_paused = false;
+		++_served;
+		_arm();
+	}
+
+	/*
+		Back in the pool, any event is then the upstream closing it.
+	*/
+	void	idle() {
+		std::string().swap(_out);
+		_out_sent = 0;
+		_paused = false;
+		_arm();
+	}
+
+	/*
+		The request is gone before its response ended, the connection can
+		not be reused.
+	*/
+	void	abandon() {
+		_req = 0;
+		if (_dispatching)
+			_dead = true;
+		else
+			_remove();
+	}
+
+	/*
+		The client drained the response, or sent more of the body.
+	*/
+	void	resume() {
+		_paused = false;
+		_arm();
+	}
+
+	void	handle_event(int fd, uint32_t events);
+
+ private:
+	bool	_arm() {
+		uint32_t events = _paused ? 0 : static_cast<uint32_t>(EPOLLIN);
+		if (!_connected || _out_sent < _out.size() || (_req && _req->_has_input()))
+			events |= EPOLLOUT;
+		if (events == _events)
+			return true;
+		_events = events;
+		return _reactor->watch(_fd, events, this);
+	}
+
+	bool	_flush(bool *wake) {
+		while (_req) {
+			if (_out_sent == _out.size()) {
+				_out.clear();
+				_out_sent = 0;
+				if (!_req->_has_input())
+					return true;
+				*wake = _req->_write_input(&_out) || *wake;
+			}
+			ssize_t n = send(_fd, _out.data() + _out_sent,
+				_out.size() - _out_sent, MSG_NOSIGNAL);
+			if (n == -1)
+				return errno == EAGAIN || errno == EWOULDBLOCK;
+			_out_sent += n;
+		}
+		return true;
+	}
+
+	bool	_read(bool *wake) {
+		char	buffer[WEBSERV_STREAM_CHUNK_SIZE];
+		ssize_t	n = -1;
+
+		errno = EAGAIN;
+		while (!_ended() && !_req->_full()
+			&& (n = recv(_fd, buffer, sizeof(buffer), 0)) > 0) {
+			_in.append(buffer, n);
+			_received = true;
+			*wake = true;
+			if (!_parse())
+				return false;
+		}
+		if (_ended())
+			return true;
+		if (_req->_full()) {
+			_paused = true;
+			return true;
+		}
+		if (n == 0 && _state == PROXY_CLOSE) {
+			_state = PROXY_DONE;
+			_keepalive = false;
+			return true;
+		}
+		return n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+	}
+
+	/*
+		Upstream output, the body is decoded to the request queue.
+			-> false on a malformed response.
+	*/
+	bool	_parse() {
+		while (!_ended()) {
+			if (_state == PROXY_HEAD) {
+				size_t	end = _in.find("\r\n\r\n"), skip = 4;
+				size_t	lf = _in.find("\n\n");
+				if (lf != std::string::npos && (end == std::string::npos || lf < end)) {
+					end = lf;
+					skip = 2;
+				}
+				if (end == std::string::npos)
+					return _in.size() <= WEBSERV_GATEWAY_HEADERS_SIZE;
+				const std::string head = _in.substr(0, end);
+				_in.erase(0, end + skip);
+				if (!_parse_head(head))
+					return false;
+			} else if (_state == PROXY_CHUNK_SIZE || _state == PROXY_TRAILERS) {
+				size_t end = _in.find("\r\n");
+				if (end == std::string::npos)
+					return _in.size() <= WEBSERV_GATEWAY_HEADERS_SIZE;
+				if (_state == PROXY_TRAILERS) {
+					if (end == 0)
+						_state = PROXY_DONE;
+				} else {
+					char *stop;
+					_left = strtoul(_in.c_str(), &stop, 16);
+					if (stop == _in.c_str())
+						return false;
+					_state = _left ? PROXY_CHUNK_DATA : PROXY_TRAILERS;
+				}
+				_in.erase(0, end + 2);
+			} else if (_state == PROXY_CHUNK_END) {
+				if (_in.size() < 2)
+					return true;
+				if (_in.compare(0, 2, "\r\n") != 0)
+					return false;
+				_in.erase(0, 2);
+				_state = PROXY_CHUNK_SIZE;
+			} else {
+				size_t len = _state == PROXY_CLOSE
+					? _in.size() : std::min(_left, _in.size());
+				if (len == 0)
+					return true;
+				_req->_response(_in.data(), len);
+				_in.erase(0, len);
+				if (_state == PROXY_CLOSE || (_left -= len) > 0)
+					return true;
+				_state = _state == PROXY_LENGTH ? PROXY_DONE : PROXY_CHUNK_END;
+			}
+		}
+		return true;
+	}
+
+	/*
+		Status line and headers, handed to the request as CGI headers
+		(Status: code) without the hop-by-hop ones.
+	*/
+	bool	_parse_head(const std::string &head) {
+		size_t		start = head.find('\n');
+		std::string	line = head.substr(0, start);
+		if (line.size() && line[line.size() - 1] == '\r')
+			line.erase(line.size() - 1);
+		const size_t sp = line.find(' ');
+		if (line.compare(0, 5, "HTTP/") != 0 || sp == std::string::npos)
+			return false;
+		const int code = atoi(line.c_str() + sp + 1);
+		if (code < 100 || code >= 600)
+			return false;
+		// Interim responses (100 Continue, ...) are dropped
+		if (code < 200 && !(code == HTTP::SWITCHING_PROTOCOLS && _req->_upgrade))
+			return true;
+
+		const bool	http10 = line.compare(0, 8, "HTTP/1.0") == 0;
+		std::string	cgi = "Status: " + line.substr(sp + 1) + "\r\n";
+		ssize_t		length = -1;
+		bool		chunked = false;
+
+		_keepalive = !http10;
+		while (start != std::string::npos && start < head.size()) {
+			size_t end = head.find('\n', start + 1);
+			line = head.substr(start + 1, end == std::string::npos
+				? std::string::npos : end - start - 1);
+			start = end;
+			if (line.size() && line[line.size() - 1] == '\r')
+				line.erase(line.size() - 1);
+			const size_t sep = line.find(':');
+			if (sep == std::string::npos || sep == 0)
+				continue;
+			const std::string name = line.substr(0, sep);
+			const std::string value = line.substr(sep + 1);
+			if (strcasecmp(name.c_str(), "Connection") == 0) {
+				if (strcasestr(value.c_str(), "close"))
+					_keepalive = false;
+				else if (http10 && strcasestr(value.c_str(), "keep-alive"))
+					_keepalive = true;
+			} else if (strcasecmp(name.c_str(), "Transfer-Encoding") == 0) {
+				chunked = strcasestr(value.c_str(), "chunked") != NULL;
+			} else if (strcasecmp(name.c_str(), "Content-Length") == 0) {
+				length = strtol(value.c_str(), NULL, 10);
+			}
+			if (!ProxyRequest::hop_by_hop(name)
+				|| (code < 200 && strcasecmp(name.c_str(), "Upgrade") == 0))
+				cgi += line + "\r\n";
+		}
+
+		if (code < 200) {
+			_state = PROXY_UPGRADE;
+		} else if (code == 204 || code == 304 || length == 0) {
+			_state = PROXY_DONE;
+		} else if (chunked) {
+			_state = PROXY_CHUNK_SIZE;
+		} else if (length > 0) {
+			_state = PROXY_LENGTH;
+			_left = length;
+		} else {
+			_state = PROXY_CLOSE;
+			_keepalive = false;
+		}
+		cgi += "\r\n";
+		_req->_response(cgi.data(), cgi.size());
+		return true;
+	}
+
+	bool	_ended() const {
+		return _state == PROXY_DONE || _state == PROXY_UPGRADE;
+	}
+
+	void	_complete();
+	void	_switch();
+	void	_lose(bool refused);
+	void	_remove();
+};
+
+class ProxyPool {
+	typedef std::vector<ProxyConnection *>	ConnectionObject;
+
+ private:
+	const std::string	_address;
+	Reactor				*_reactor;
+	ConnectionObject	_conns;
+	ConnectionObject	_idle;
+	uint64_t			_down_until;
+
+ public:
+	ProxyPool(const std::string &address, Reactor *reactor)
+	:	_address(address), _reactor(reactor), _down_until(0) {}
+
+	~ProxyPool() {
+		for (size_t i = 0; i < _conns.size(); ++i)
+			delete _conns[i];
+	}
+
+	/*
+		An idle connection, or a new one (always for an upgrade).
+			-> NULL when the upstream can not be reached.
+	*/
+	ProxyConnection	*acquire(bool fresh) {
+		if (!fresh && !_idle.empty()) {
+			ProxyConnection *conn = _idle.back();
+			_idle.pop_back();
+			return conn;
+		}
+		ProxyConnection *conn = new ProxyConnection(this, _reactor);
+		if (!conn->open(_address)) {
+			std::cerr << "proxy: unable to connect to " << _address << std::endl;
+			delete conn;
+			fail();
+			return 0;
+		}
+		_conns.push_back(conn);
+		return conn;
+	}
+
+	/*
+		End of a request, up to WEBSERV_PROXY_KEEPALIVE connections are
+		kept for the next ones.
+	*/
+	void	release(ProxyConnection *conn, bool reuse) {
+		if (!reuse || _idle.size() >= WEBSERV_PROXY_KEEPALIVE)
+			return remove(conn);
+		_idle.push_back(conn);
+		conn->idle();
+	}
+
+	void	remove(ProxyConnection *conn) {
+		ConnectionObject::iterator it = std::find(_idle.begin(), _idle.end(), conn);
+		if (it != _idle.end())
+			_idle.erase(it);
+		it = std::find(_conns.begin(), _conns.end(), conn);
+		if (it != _conns.end())
+			_conns.erase(it);
+		delete conn;
+	}
+
+	/*
+		A kept connection was closed by the upstream, the others likely were.
+	*/
+	void	drop_idle() {
+		while (!_idle.empty())
+			remove(_idle.back());
+	}
+
+	void	fail() {
+		_down_until = monotonic_ms() + WEBSERV_PROXY_FAIL_TIMEOUT * 1000;
+	}
+	bool	up(uint64_t now) const { return now >= _down_until; }
+	size_t	active() const { return _conns.size() - _idle.size(); }
+};
+
+static std::map<std::string, ProxyPool *>	PROXY_POOLS;
+
+static ProxyPool	*get_proxy_pool(const std::string &address, Reactor *reactor) {
+	std::map<std::string, ProxyPool *>::iterator it = PROXY_POOLS.find(address);
+	if (it != PROXY_POOLS.end())
+		return it->second;
+	ProxyPool *pool = new ProxyPool(address, reactor);
+	PROXY_POOLS[address] = pool;
+	return pool;
+}
+
+class ProxyUpstream {
+	typedef std::pair<uint32_t, size_t>	Point;
+
+ private:
+	const Models::IBlock::Balance	_balance;
+	std::vector<ProxyPool *>		_pools;
+	std::vector<Point>				_ring;
+	size_t							_next;
+
+ public:
+	ProxyUpstream(const Models::IBlock *block, Reactor *reactor)
+	:	_balance(block->get_proxy_balance()), _next(0) {
+		const Models::IBlock::ProxyObject &addresses = block->get_proxy_pass();
+		for (size_t i = 0; i < addresses.size(); ++i) {
+			_pools.push_back(get_proxy_pool(addresses[i], reactor));
+			if (_balance != Models::IBlock::BALANCE_HASH)
+				continue;
+			for (size_t point = 0; point < WEBSERV_PROXY_HASH_POINTS; ++point) {
+				std::stringstream ss;
+				ss << addresses[i] << "#" << point;
+				_ring.push_back(Point(_hash(ss.str()), i));
+			}
+		}
+		std::sort(_ring.begin(), _ring.end());
+	}
+
+	size_t	size() const { return _pools.size(); }
+
+	/*
+		Start req on the upstream chosen for it, the next ones are tried
+		when it can not be reached. Upstreams marked down come last.
+			-> false once every upstream failed.
+	*/
+	bool	submit(ProxyRequest *req) {
+		std::vector<size_t>	order;
+		const uint64_t		now = monotonic_ms();
+
+		_order(req->_key, &order);
+		for (int pass = 0; pass < 2; ++pass) {
+			for (size_t i = 0; i < order.size(); ++i) {
+				ProxyPool *pool = _pools[order[i]];
+				if (req->_tried.count(pool) || pool->up(now) != (pass == 0))
+					continue;
+				++req->_tries;
+				ProxyConnection *conn = pool->acquire(req->_upgrade);
+				if (!conn) {
+					req->_tried.insert(pool);
+					continue;
+				}
+				conn->begin(req);
+				return true;
+			}
+		}
+		return false;
+	}
+
+ private:
+	/*
+		Upstreams by preference for key.
+	*/
+	void	_order(const std::string &key, std::vector<size_t> *order) {
+		const size_t n = _pools.size();
+
+		if (_balance == Models::IBlock::BALANCE_HASH) {
+			std::vector<bool> seen(n, false);
+			std::vector<Point>::const_iterator it = std::lower_bound(
+				_ring.begin(), _ring.end(), Point(_hash(key), 0));
+			for (size_t i = 0; i < _ring.size() && order->size() < n; ++i, ++it) {
+				if (it == _ring.end())
+					it = _ring.begin();
+				if (!seen[it->second]) {
+					seen[it->second] = true;
+					order->push_back(it->second);
+				}
+			}
+			return;
+		}
+
+		const size_t start = _next++ % n;
+		for (size_t i = 0; i < n; ++i)
+			order->push_back((start + i) % n);
+		if (_balance != Models::IBlock::BALANCE_LEAST_CONN)
+			return;
+		// Stable insertion sort, ties keep the round-robin order
+		for (size_t i = 1; i < n; ++i) {
+			for (size_t j = i; j > 0 && _pools[(*order)[j]]->active()
+				< _pools[(*order)[j - 1]]->active(); --j)
+				std::swap((*order)[j], (*order)[j - 1]);
+		}
+	}
+
+	/*
+		FNV-1a, mixed to spread the points of close keys over the ring.
+	*/
+	static uint32_t	_hash(const std::string &key) {
+		uint32_t h = 2166136261u;
+		for (size_t i = 0; i < key.size(); ++i) {
+			h ^= static_cast<unsigned char>(key[i]);
+			h *= 16777619u;
+		}
+		h ^= h >> 16;
+		h *= 0x85ebca6bu;
+		h ^= h >> 13;
+		h *= 0xc2b2ae35u;
+		h ^= h >> 16;
+		return h;
+	}
+};
+
+static std::map<const Models::IBlock *, ProxyUpstream *>	PROXY_UPSTREAMS;
+
+/*
+	Upstreams of the proxy_pass of block, created on first use.
+*/
+static ProxyUpstream	*get_proxy_upstream(const Models::IBlock *block,
+	Reactor *reactor) {
+	std::map<const Models::IBlock *, ProxyUpstream *>::iterator it =
+		PROXY_UPSTREAMS.find(block);
+	if (it != PROXY_UPSTREAMS.end())
+		return it->second;
+	ProxyUpstream *upstream = new ProxyUpstream(block, reactor);
+	PROXY_UPSTREAMS[block] = upstream;
+	return upstream;
+}
+
+/*
+	block belongs to a configuration no request is served from anymore.
+*/
+void	forget_proxy_upstream(const Models::IBlock *block) {
+	std::map<const Models::IBlock *, ProxyUpstream *>::iterator it =
+		PROXY_UPSTREAMS.find(block);
+	if (it == PROXY_UPSTREAMS.end())
+		return;
+	delete it->second;
+	PROXY_UPSTREAMS.erase(it);
+}
+
+void	destroy_proxies() {
+	std::map<const Models::IBlock *, ProxyUpstream *>::iterator it =
+		PROXY_UPSTREAMS.begin();
+	for (; it != PROXY_UPSTREAMS.end(); ++it)
+		delete it->second;
+	PROXY_UPSTREAMS.clear();
+	std::map<std::string, ProxyPool *>::iterator pool = PROXY_POOLS.begin();
+	for (; pool != PROXY_POOLS.end(); ++pool)
+		delete pool->second;
+	PROXY_POOLS.clear();
+}
+
+ProxyRequest::~ProxyRequest() {
+	if (_conn)
+		_conn->abandon();
+	if (_tunnel != -1)
+		close(_tunnel);
+}
+
+bool	ProxyRequest::run(Reactor *reactor, HTTP::Client *owner) {
+	_reactor = reactor;
+	_owner = owner;
+	_replayable = _input_eof;
+	if (!_upstream->submit(this))
+		return false;
+	_deadline = monotonic_ms() + _timeout * 1000;
+	_reactor->schedule(_deadline, owner);
+	return true;
+}
+
+bool	ProxyRequest::handle_timeout(uint64_t now) {
+	if (ready() || now < _deadline)
+		return false;
+	if (_conn) {
+		ProxyConnection *conn = _conn;
+		_conn = 0;
+		conn->abandon();
+	}
+	_fail(HTTP::GATEWAY_TIMEOUT);
+	return true;
+}
+
+void	ProxyRequest::_input_ready() {
+	if (_conn)
+		_conn->resume();
+}
+
+void	ProxyRequest::_drained() {
+	if (_conn)
+		_conn->resume();
+}
+
+/*
+	The connection died, the request is sent again when nothing of the
+	response was received and its body is still whole.
+*/
+void	ProxyRequest::_lost(bool retry) {
+	_conn = 0;
+	if (retry && _replayable && _tries <= _upstream->size()) {
+		_input_sent = 0;
+		if (_upstream->submit(this))
+			return;
+	}
+	_fail(_failure);
+	_reactor->wake(_owner);
+}
+
+void	ProxyConnection::handle_event(int fd, uint32_t events) {
+	(void)fd;
+	bool	alive = !(events & EPOLLERR);
+	bool	refused = !_connected && !alive;
+	bool	wake = false;
+
+	if (!_req)
+		return _remove();
+
+	if (alive && !_connected && (events & EPOLLOUT)) {
+		int			err = 0;
+		socklen_t	len = sizeof(err);
+		getsockopt(_fd, SOL_SOCKET, SO_ERROR, &err, &len);
+		alive = err == 0;
+		refused = !alive;
+		_connected = alive;
+	}
+	if (alive && _connected && (events & EPOLLOUT))
+		alive = _flush(&wake);
+	if (alive && (events & (EPOLLIN | EPOLLHUP)))
+		alive = _read(&wake);
+
+	if (alive && _state == PROXY_UPGRADE)
+		return _switch();
+	if (alive && _state == PROXY_DONE)
+		return _complete();
+	if (!alive)
+		return _lose(refused);
+	if (wake) {
+		_dispatching = true;
+		_reactor->wake(_req->owner());
+		_dispatching = false;
+		if (_dead)
+			return _remove();
+	}
+	_arm();
+}
+
+void	ProxyConnection::_complete() {
+	ProxyRequest	*req = _req;
+	HTTP::Client	*owner = req->owner();
+	Reactor			*reactor = _reactor;
+	const bool		reuse = _keepalive && _in.empty()
+		&& _out_sent == _out.size() && req->_input_done();
+
+	_req = 0;
+	req->_finish();
+	_pool->release(this, reuse);
+	reactor->wake(owner);
+}
+
+/*
+	The upstream switched protocols, its fd leaves the pool with the
+	request.
+*/
+void	ProxyConnection::_switch() {
+	ProxyRequest	*req = _req;
+	HTTP::Client	*owner = req->owner();
+	Reactor			*reactor = _reactor;
+
+	_reactor->unwatch(_fd);
+	req->_tunnel = _fd;
+	req->_tunnel_data.swap(_in);
+	_fd = -1;
+	_req = 0;
+	req->_finish();
+	_pool->remove(this);
+	reactor->wake(owner);
+}
+
+void	ProxyConnection::_lose(bool refused) {
+	ProxyRequest	*req = _req;
+	ProxyPool		*pool = _pool;
+	const bool		stale = _served > 1 && !_received;
+
+	_req = 0;
+	if (refused) {
+		pool->fail();
+		req->_tried.insert(pool);
+	}
+	if (stale)
+		pool->drop_idle();
+	pool->remove(this);
+	req->_lost(refused || stale);
+}
+
+void	ProxyConnection::_remove() {
+	_pool->remove(this);
+}
+
+}  // namespace Server
+}  // namespace Webserv
+
+#endif  // SERVER_PROXY_HPP_
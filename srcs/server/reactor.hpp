@@ -0,0 +1,79 @@
+/*
+	Interface exposed by the event loop to the jobs running on behalf of a
+	client (CGI processes, FastCGI requests, ...).
+
+	Every fd, child process or timer is registered with the client owning
+	it, the loop then forwards the matching events to that client.
+	Fds shared by several clients (pooled upstream connections) are
+	registered with their own EventHandler, which wakes the clients whose
+	response made progress.
+*/
+
+#ifndef SERVER_REACTOR_HPP_
+#define SERVER_REACTOR_HPP_
+
+#include <time.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace Webserv {
+namespace HTTP {
+class Client;
+}  // namespace HTTP
+
+namespace Server {
+
+/*
+	Milliseconds from an arbitrary point, not affected by clock changes.
+*/
+static uint64_t	monotonic_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+class EventHandler {
+ public:
+	virtual ~EventHandler() {}
+
+	virtual void	handle_event(int fd, uint32_t events) = 0;
+};
+
+class Reactor {
+ public:
+	virtual ~Reactor() {}
+
+	// Add or modify an fd in the epoll set (EPOLLIN, EPOLLOUT)
+	virtual bool	watch(int fd, uint32_t events, HTTP::Client *owner) = 0;
+	virtual bool	watch(int fd, uint32_t events, EventHandler *handler) = 0;
+	virtual void	unwatch(int fd) = 0;
+
+	// The response of owner made progress outside of its own fds
+	virtual void	wake(HTTP::Client *owner) = 0;
+
+	// Child processes, reaped by the loop once SIGCHLD is received
+	virtual void	watch_child(pid_t pid, HTTP::Client *owner) = 0;
+	virtual void	unwatch_child(pid_t pid) = 0;
+
+	// Timers, deadline is given in monotonic_ms()
+	virtual void	schedule(uint64_t deadline, HTTP::Client *owner) = 0;
+
+	// Slot of the worker process running the loop, out of workers() (0 of
+	// 1 for a single process)
+	virtual size_t	worker() const = 0;
+	virtual size_t	workers() const = 0;
+};
+
+/*
+	Part of a limit of the configuration held by the worker of reactor,
+	the first workers take the remainder: the parts add up to total.
+*/
+static size_t	worker_share(const Reactor *reactor, size_t total) {
+	const size_t workers = reactor->workers();
+	return total / workers + (reactor->worker() < total % workers ? 1 : 0);
+}
+
+}  // namespace Server
+}  // namespace Webserv
+
+#endif  // SERVER_REACTOR_HPP_
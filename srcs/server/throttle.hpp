@@ -0,0 +1,123 @@
+/*
+	Concurrency limit of the CGI / FastCGI scripts of a block (cgi_limit).
+
+	At most `processes` scripts of the block run at once, the next requests
+	wait in a FIFO of `queue` clients, for `timeout` seconds at most. Once
+	the queue is full, or its timeout is reached, requests are answered
+	with a 503 and a Retry-After instead.
+
+	A slot freed by release() is handed over to the first waiting client,
+	which is woken to start its script: a burst does not starve the queue.
+
+	With worker_processes, each worker holds its part of the processes (at
+	least one) and of the queue.
+*/
+
+#ifndef SERVER_THROTTLE_HPP_
+#define SERVER_THROTTLE_HPP_
+
+#include <map>
+#include <deque>
+#include <algorithm>
+
+#include "models/IBlock.hpp"
+#include "server/reactor.hpp"
+
+namespace Webserv {
+namespace Server {
+
+class Throttle {
+ private:
+	Reactor							*_reactor;
+	const Models::IBlock::CGILimit	_limit;
+	size_t							_running;
+	std::deque<HTTP::Client *>		_waiting;
+
+ public:
+	Throttle(Reactor *reactor, const Models::IBlock::CGILimit &limit)
+	:	_reactor(reactor), _limit(limit), _running(0) {}
+
+	/*
+		-> true when the caller may start its script now.
+	*/
+	bool	acquire() {
+		if (_running >= _limit.processes)
+			return false;
+		++_running;
+		return true;
+	}
+
+	/*
+		Wait for a slot, woken by release() once it is handed over.
+			-> false when the queue is full.
+	*/
+	bool	enqueue(HTTP::Client *client) {
+		if (_waiting.size() >= _limit.queue)
+			return false;
+		_waiting.push_back(client);
+		return true;
+	}
+
+	void	cancel(HTTP::Client *client) {
+		std::deque<HTTP::Client *>::iterator it =
+			std::find(_waiting.begin(), _waiting.end(), client);
+		if (it != _waiting.end())
+			_waiting.erase(it);
+	}
+
+	void	release() {
+		if (_waiting.empty()) {
+			--_running;
+			return;
+		}
+		HTTP::Client *next = _waiting.front();
+		_waiting.pop_front();
+		_reactor->wake(next);
+	}
+
+	const Models::IBlock::CGILimit	&limit() const { return _limit; }
+};
+
+static std::map<const Models::IBlock *, Throttle *>	THROTTLES;
+
+/*
+	Limit of the scripts of block, created on first use.
+*/
+static Throttle	*get_throttle(const Models::IBlock *block, Reactor *reactor) {
+	std::map<const Models::IBlock *, Throttle *>::iterator it =
+		THROTTLES.find(block);
+	if (it != THROTTLES.end())
+		return it->second;
+	Models::IBlock::CGILimit limit = block->get_cgi_limit();
+	limit.processes = std::max<size_t>(
+		worker_share(reactor, limit.processes), 1);
+	limit.queue = worker_share(reactor, limit.queue);
+	Throttle *throttle = new Throttle(reactor, limit);
+	THROTTLES[block] = throttle;
+	return throttle;
+}
+
+/*
+	block belongs to a configuration no request is served from anymore.
+*/
+void	forget_throttle(const Models::IBlock *block) {
+	std::map<const Models::IBlock *, Throttle *>::iterator it =
+		THROTTLES.find(block);
+	if (it == THROTTLES.end())
+		return;
+	delete it->second;
+	THROTTLES.erase(it);
+}
+
+void	destroy_throttles() {
+	std::map<const Models::IBlock *, Throttle *>::iterator it =
+		THROTTLES.begin();
+	for (; it != THROTTLES.end(); ++it)
+		delete it->second;
+	THROTTLES.clear();
+}
+
+}  // namespace Server
+}  // namespace Webserv
+
+#endif  // SERVER_THROTTLE_HPP_
@@ -0,0 +1,235 @@
+/*
+	Byte tunnel between a client and an upstream, once a proxied request
+	switched protocols (101, WebSocket).
+
+	Each direction is relayed with splice() through a pipe of its own: the
+	bytes stay in kernel buffers, nothing is copied through the server.
+	A side is only read while its pipe has room (WEBSERV_TUNNEL_BUFFER),
+	and watched for EPOLLOUT while its peer pipe holds bytes for it: a slow
+	reader throttles its writer instead of growing a buffer.
+
+	The end of a direction is forwarded as a half close (shutdown), the
+	tunnel is closed once both directions ended, on an error, or after
+	WEBSERV_TUNNEL_TIMEOUT seconds without traffic.
+*/
+
+#ifndef SERVER_TUNNEL_HPP_
+#define SERVER_TUNNEL_HPP_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include <set>
+#include <iostream>
+
+#include "consts.hpp"
+#include "server/reactor.hpp"
+
+namespace Webserv {
+namespace Server {
+
+class Tunnel : public EventHandler {
+	/*
+		One direction, from the fd src to the fd dst.
+	*/
+	struct Relay {
+		int		src;
+		int		dst;
+		int		pipe[2];
+		size_t	buffered;
+		bool	eof;
+		bool	shut;
+	};
+
+ private:
+	Reactor		*_reactor;
+	int			_fds[2];
+	uint32_t	_events[2];
+	Relay		_relays[2];
+	uint64_t	_last;
+
+ public:
+	/*
+		Both fds are owned by the tunnel from now on.
+	*/
+	Tunnel(int client, int upstream, Reactor *reactor)
+	:	_reactor(reactor), _last(monotonic_ms()) {
+		_fds[0] = client;
+		_fds[1] = upstream;
+		for (int i = 0; i < 2; ++i) {
+			_events[i] = ~0u;
+			_relays[i].src = _fds[i];
+			_relays[i].dst = _fds[1 - i];
+			_relays[i].pipe[0] = -1;
+			_relays[i].pipe[1] = -1;
+			_relays[i].buffered = 0;
+			_relays[i].eof = false;
+			_relays[i].shut = false;
+		}
+	}
+
+	~Tunnel() {
+		for (int i = 0; i < 2; ++i) {
+			_reactor->unwatch(_fds[i]);
+			close(_fds[i]);
+			if (_relays[i].pipe[0] != -1) {
+				close(_relays[i].pipe[0]);
+				close(_relays[i].pipe[1]);
+			}
+		}
+	}
+
+	/*
+		-> false when the pipes can not be created.
+	*/
+	bool	open() {
+		for (int i = 0; i < 2; ++i) {
+			if (pipe2(_relays[i].pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+				std::cerr << "tunnel: pipe2() failed" << std::endl;
+				return false;
+			}
+			fcntl(_relays[i].pipe[1], F_SETPIPE_SZ, WEBSERV_TUNNEL_BUFFER);
+		}
+		return _arm();
+	}
+
+	/*
+		Both directions are pumped on any event, a blocked side is then
+		re-armed for what it waits for.
+	*/
+	void	handle_event(int fd, uint32_t events) {
+		(void)fd;
+		bool alive = !(events & EPOLLERR);
+		for (int i = 0; i < 2 && alive; ++i)
+			alive = _pump(&_relays[i]);
+		if (!alive || (_relays[0].shut && _relays[1].shut) || !_arm())
+			return _close();
+	}
+
+	bool	expired(uint64_t now) const {
+		return now - _last > WEBSERV_TUNNEL_TIMEOUT * 1000;
+	}
+
+ private:
+	/*
+		Move what src has to the pipe, and what the pipe holds to dst.
+			-> false on an error of either side.
+	*/
+	bool	_pump(Relay *relay) {
+		bool	progress = true;
+		ssize_t	n;
+
+		while (progress) {
+			progress = false;
+			n = 0;
+			while (!relay->eof && relay->buffered < WEBSERV_TUNNEL_BUFFER) {
+				n = splice(relay->src, NULL, relay->pipe[1], NULL,
+					WEBSERV_TUNNEL_BUFFER - relay->buffered,
+					SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+				if (n == 0)
+					relay->eof = true;
+				if (n <= 0)
+					break;
+				relay->buffered += n;
+				progress = true;
+			}
+			if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+				return false;
+			n = 0;
+			while (relay->buffered > 0) {
+				n = splice(relay->pipe[0], NULL, relay->dst, NULL,
+					relay->buffered, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+				if (n <= 0)
+					break;
+				relay->buffered -= n;
+				progress = true;
+			}
+			if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+				return false;
+			if (progress)
+				_last = monotonic_ms();
+		}
+		if (relay->eof && relay->buffered == 0 && !relay->shut) {
+			shutdown(relay->dst, SHUT_WR);
+			relay->shut = true;
+		}
+		return true;
+	}
+
+	/*
+		fd i is read for the relay it feeds, and written for the one
+		draining to it.
+	*/
+	bool	_arm() {
+		for (int i = 0; i < 2; ++i) {
+			const Relay &in = _relays[i];
+			const Relay &out = _relays[1 - i];
+			uint32_t events = 0;
+			if (!in.eof && in.buffered < WEBSERV_TUNNEL_BUFFER)
+				events |= EPOLLIN;
+			if (out.buffered > 0)
+				events |= EPOLLOUT;
+			if (events == _events[i])
+				continue;
+			_events[i] = events;
+			if (!_reactor->watch(_fds[i], events, this))
+				return false;
+		}
+		return true;
+	}
+
+	void	_close();
+};
+
+static std::set<Tunnel *>	TUNNELS;
+
+/*
+	Relay client and upstream from now on.
+		-> false when the tunnel can not be set up, both fds are closed.
+*/
+static bool	open_tunnel(int client, int upstream, Reactor *reactor) {
+	Tunnel *tunnel = new Tunnel(client, upstream, reactor);
+	if (!tunnel->open()) {
+		delete tunnel;
+		return false;
+	}
+	TUNNELS.insert(tunnel);
+	return true;
+}
+
+void	Tunnel::_close() {
+	TUNNELS.erase(this);
+	delete this;
+}
+
+/*
+	Close the tunnels idle for WEBSERV_TUNNEL_TIMEOUT seconds.
+*/
+void	expire_tunnels() {
+	const uint64_t now = monotonic_ms();
+	std::set<Tunnel *>::iterator it = TUNNELS.begin();
+	while (it != TUNNELS.end()) {
+		if ((*it)->expired(now)) {
+			delete *it;
+			TUNNELS.erase(it++);
+		} else {
+			++it;
+		}
+	}
+}
+
+void	destroy_tunnels() {
+	std::set<Tunnel *>::iterator it = TUNNELS.begin();
+	for (; it != TUNNELS.end(); ++it)
+		delete *it;
+	TUNNELS.clear();
+}
+
+}  // namespace Server
+}  // namespace Webserv
+
+#endif  // SERVER_TUNNEL_HPP_
@@ -0,0 +1,137 @@
+/*
+	Binary upgrade (SIGUSR2): the running server executes its binary again,
+	and hands it its listening sockets.
+
+	The listening fds are inherited across execve(), along with their
+	interfaces in WEBSERV_LISTENERS (host:port=fd;...). The new process
+	adopts them instead of binding: connections waiting in the backlog are
+	accepted by it, none is refused. Once its listeners are polled it
+	writes to the pipe named by WEBSERV_READY, the old process then stops
+	accepting and exits once its last connection is closed. If the new
+	process dies before, the old one keeps serving.
+*/
+
+#ifndef SERVER_UPGRADE_HPP_
+#define SERVER_UPGRADE_HPP_
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <map>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <utility>
+#include <iostream>
+
+#include "consts.hpp"
+#include "server/affinity.hpp"
+
+extern char	**environ;
+
+namespace Webserv {
+namespace Server {
+
+typedef std::map<std::pair<std::string, int>, int>	ListenerFds;
+
+/*
+	Listening fds handed over by the process upgraded from, by interface.
+*/
+ListenerFds	inherited_listeners() {
+	ListenerFds	fds;
+	const char	*env = getenv(WEBSERV_ENV_LISTENERS);
+	if (!env)
+		return fds;
+
+	const std::string	list(env);
+	size_t				pos = 0;
+	while (pos < list.size()) {
+		size_t end = list.find(';', pos);
+		if (end == std::string::npos)
+			end = list.size();
+		const std::string	item = list.substr(pos, end - pos);
+		const size_t		eq = item.find('=');
+		const size_t		colon = item.rfind(':', eq);
+		if (eq != std::string::npos && colon != std::string::npos) {
+			const int port = atoi(item.substr(colon + 1, eq - colon - 1).c_str());
+			fds[std::make_pair(item.substr(0, colon), port)] =
+				atoi(item.substr(eq + 1).c_str());
+		}
+		pos = end + 1;
+	}
+	unsetenv(WEBSERV_ENV_LISTENERS);
+	return fds;
+}
+
+/*
+	Tell the process upgraded from that the listeners are polled.
+*/
+void	notify_upgraded() {
+	const char *env = getenv(WEBSERV_ENV_READY);
+	if (!env)
+		return;
+	const int fd = atoi(env);
+	unsetenv(WEBSERV_ENV_READY);
+	if (write(fd, "1", 1) != 1)
+		std::cerr << "upgrade: unable to notify the previous process" << std::endl;
+	close(fd);
+}
+
+/*
+	Execute av[0] with av in a child, handing it listeners.
+		-> read end of the pipe the new process writes to once ready, -1
+		when it can not be started.
+	The environment is built before the fork: the child of a process
+	running the io pool threads must not allocate.
+*/
+int	spawn_upgrade(char **av, const ListenerFds &listeners) {
+	int	ready[2];
+	if (pipe2(ready, O_CLOEXEC) == -1)
+		return -1;
+
+	std::stringstream	list, notify;
+	ListenerFds::const_iterator it = listeners.begin();
+	for (; it != listeners.end(); ++it)
+		list << it->first.first << ":" << it->first.second << "=" << it->second << ";";
+	notify << ready[1];
+	const std::string	list_env = std::string(WEBSERV_ENV_LISTENERS) + "="
+		+ list.str();
+	const std::string	notify_env = std::string(WEBSERV_ENV_READY) + "="
+		+ notify.str();
+
+	// Both were unset when this process started
+	std::vector<char *>	envp;
+	for (char **env = environ; *env; ++env)
+		envp.push_back(*env);
+	envp.push_back(const_cast<char *>(list_env.c_str()));
+	envp.push_back(const_cast<char *>(notify_env.c_str()));
+	envp.push_back(NULL);
+
+	const pid_t pid = fork();
+	if (pid == -1) {
+		close(ready[0]);
+		close(ready[1]);
+		return -1;
+	}
+	if (pid == 0) {
+		for (it = listeners.begin(); it != listeners.end(); ++it)
+			fcntl(it->second, F_SETFD, 0);
+		fcntl(ready[1], F_SETFD, 0);
+
+		sigset_t	mask;
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+		unpin_thread();
+		execve(av[0], av, &envp[0]);
+		_exit(EXIT_FAILURE);
+	}
+	close(ready[1]);
+	return ready[0];
+}
+
+}  // namespace Server
+}  // namespace Webserv
+
+#endif  // SERVER_UPGRADE_HPP_
@@ -0,0 +1,261 @@
+/*
+	Pre-forked CGI workers, long-lived processes serving the requests of a
+	cgi mapping one after the other instead of a fork() per request.
+
+	Workers are started the FastCGI way: fd 0 is a listening socket the
+	binary accepts the server connection on (php-cgi, any FastCGI library).
+	The pool keeps min workers alive, spawns up to max of them when every
+	worker is busy, then queues requests. A worker is replaced once it
+	served its number of requests.
+
+	Like CGI scripts, workers are started with posix_spawn() and the
+	environment of the block (the one starting the pool), every other fd
+	of the server being close-on-exec. They are terminated along with
+	their pool.
+*/
+
+#ifndef SERVER_WORKERS_HPP_
+#define SERVER_WORKERS_HPP_
+
+#include <errno.h>
+#include <spawn.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+
+#include "consts.hpp"
+#include "models/IBlock.hpp"
+#include "server/fastcgi.hpp"
+#include "server/reactor.hpp"
+#include "server/affinity.hpp"
+
+namespace Webserv {
+namespace Server {
+
+class CGIWorkerPool : public FastCGIPool {
+	typedef Models::IBlock::CGIWorkers			CGIWorkers;
+	typedef Models::IBlock::EnvObject			EnvObject;
+	typedef std::map<FastCGIConnection *, pid_t>	WorkerObject;
+
+ private:
+	const std::string	_bin_path;
+	const CGIWorkers	_workers;
+	const EnvObject		_env;
+
+	WorkerObject		_pids;
+	size_t				_spawned;
+
+ public:
+	CGIWorkerPool(const std::string &key, const std::string &bin_path,
+		const CGIWorkers &workers, const EnvObject &env, Reactor *reactor)
+	:	FastCGIPool(key, reactor, workers.max),
+		_bin_path(bin_path),
+		_workers(workers),
+		_env(env),
+		_spawned(0) {}
+
+	~CGIWorkerPool() {
+		WorkerObject::iterator it = _pids.begin();
+		for (; it != _pids.end(); ++it)
+			kill(it->second, SIGTERM);
+	}
+
+	/*
+		Start workers until min of them are alive.
+	*/
+	void	prefork() {
+		while (_conns.size() < _workers.min) {
+			FastCGIConnection *created = _connect();
+			if (!created)
+				return;
+			_conns.push_back(created);
+		}
+	}
+
+	void	remove(FastCGIConnection *conn) {
+		WorkerObject::iterator it = _pids.find(conn);
+		if (it != _pids.end()) {
+			kill(it->second, SIGTERM);
+			_pids.erase(it);
+		}
+		FastCGIPool::remove(conn);
+		prefork();
+	}
+
+ protected:
+	FastCGIConnection	*_connect() {
+		std::stringstream ss;
+		ss << WEBSERV_CGI_WORKERS_SOCKET << "." << getpid() << "."
+			<< _spawned++ << ".sock";
+		const std::string path = ss.str();
+
+		struct sockaddr_un	addr = {};
+		if (path.size() >= sizeof(addr.sun_path))
+			return 0;
+		addr.sun_family = AF_UNIX;
+		memcpy(addr.sun_path, path.c_str(), path.size());
+
+		unlink(path.c_str());
+		int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (listener == -1)
+			return 0;
+		if (bind(listener, reinterpret_cast<struct sockaddr *>(&addr),
+			sizeof(addr)) == -1 || listen(listener, SOMAXCONN) == -1) {
+			close(listener);
+			unlink(path.c_str());
+			return 0;
+		}
+
+		pid_t	pid;
+		int		err = _spawn(listener, &pid);
+		close(listener);
+		if (err != 0) {
+			std::cerr << "posix_spawn() failed: " << strerror(err) << std::endl;
+			unlink(path.c_str());
+			return 0;
+		}
+
+		// The socket file is only needed until the server is connected
+		FastCGIConnection *created =
+			new FastCGIConnection(this, _reactor, _workers.requests);
+		bool connected = created->open("unix:" + path);
+		unlink(path.c_str());
+		if (!connected) {
+			std::cerr << "cgi_workers: unable to start " << _bin_path << std::endl;
+			kill(pid, SIGTERM);
+			delete created;
+			return 0;
+		}
+		_pids[created] = pid;
+		return created;
+	}
+
+ private:
+	/*
+		The worker gets the listening socket as stdin, an empty signal mask
+		and the default SIGPIPE action (ignored by the server). It joins the
+		process group of the server: with worker_processes, the master
+		terminates that group once the worker process exits. It runs on any
+		CPU, see unpin_thread().
+			-> 0 or the error of posix_spawn().
+	*/
+	int		_spawn(int listener, pid_t *pid) {
+		posix_spawn_file_actions_t	actions;
+		posix_spawnattr_t			attr;
+		sigset_t					mask, defaults;
+
+		sigemptyset(&mask);
+		sigemptyset(&defaults);
+		sigaddset(&defaults, SIGPIPE);
+
+		posix_spawn_file_actions_init(&actions);
+		posix_spawn_file_actions_adddup2(&actions, listener, STDIN_FILENO);
+		posix_spawnattr_init(&attr);
+		posix_spawnattr_setsigmask(&attr, &mask);
+		posix_spawnattr_setsigdefault(&attr, &defaults);
+		posix_spawnattr_setpgroup(&attr, getpgrp());
+		posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK
+			| POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+
+		std::vector<char *>	envp;
+		for (size_t i = 0; i < _env.size(); ++i)
+			envp.push_back(const_cast<char *>(_env[i].c_str()));
+		envp.push_back(NULL);
+		char	*argv[] = { const_cast<char*>(_bin_path.c_str()), NULL };
+		unpin_thread();
+		int err = posix_spawn(pid, argv[0], &actions, &attr, argv, &envp[0]);
+		repin_thread();
+
+		posix_spawnattr_destroy(&attr);
+		posix_spawn_file_actions_destroy(&actions);
+		return err;
+	}
+};
+
+#define WEBSERV_CGI_WORKERS_KEY		"workers:"
+
+/*
+	Key of the pool of a cgi mapping in FASTCGI_POOLS, mappings with the
+	same binary and settings share it.
+*/
+static std::string	cgi_worker_pool_key(const std::string &bin_path,
+	const Models::IBlock::CGIWorkers &workers) {
+	std::stringstream key;
+	key << WEBSERV_CGI_WORKERS_KEY << bin_path << ":" << workers.min << ":"
+		<< workers.max << ":" << workers.requests;
+	return key.str();
+}
+
+/*
+	Pool of the workers of a cgi mapping, started on first use with env.
+*/
+static FastCGIPool	*get_cgi_worker_pool(const std::string &bin_path,
+	const Models::IBlock::CGIWorkers &workers,
+	const Models::IBlock::EnvObject &env, Reactor *reactor) {
+	const std::string key = cgi_worker_pool_key(bin_path, workers);
+
+	std::map<std::string, FastCGIPool *>::iterator it = FASTCGI_POOLS.find(key);
+	if (it != FASTCGI_POOLS.end())
+		return it->second;
+	CGIWorkerPool *pool = new CGIWorkerPool(key, bin_path, workers, env,
+		reactor);
+	FASTCGI_POOLS[key] = pool;
+	pool->prefork();
+	return pool;
+}
+
+/*
+	Stop the pools whose key is not in live, left by the mappings of a
+	replaced configuration: their workers are terminated.
+*/
+void	forget_cgi_worker_pools(const std::set<std::string> &live) {
+	std::map<std::string, FastCGIPool *>::iterator it = FASTCGI_POOLS.begin();
+	while (it != FASTCGI_POOLS.end()) {
+		if (it->first.compare(0, sizeof(WEBSERV_CGI_WORKERS_KEY) - 1,
+			WEBSERV_CGI_WORKERS_KEY) != 0 || live.count(it->first)) {
+			++it;
+			continue;
+		}
+		delete it->second;
+		FASTCGI_POOLS.erase(it++);
+	}
+}
+
+/*
+	FastCGI request served by the worker pool of a cgi mapping.
+*/
+class CGIWorkerRequest : public FastCGIRequest {
+ private:
+	const std::string					_bin_path;
+	const Models::IBlock::CGIWorkers	_workers;
+
+ public:
+	CGIWorkerRequest(const std::string &bin_path,
+		const Models::IBlock::CGIWorkers &workers,
+		const std::string &file_path, const std::string &query,
+		const HTTP::METHODS &method)
+	:	FastCGIRequest("", file_path, query, method),
+		_bin_path(bin_path),
+		_workers(workers) {}
+
+ protected:
+	FastCGIPool	*_resolve(Reactor *reactor) {
+		return get_cgi_worker_pool(_bin_path, _workers, *_base_env, reactor);
+	}
+};
+
+}  // namespace Server
+}  // namespace Webserv
+
+#endif  // SERVER_WORKERS_HPP_
@@ -0,0 +1,101 @@
+import os
+import sys
+import time
+import socket
+import threading
+import subprocess
+import http.client
+
+CONFIG = "/tmp/webserv_affinity_bench.conf"
+SERVER = """worker_processes	{workers};
+{main}
+server {{
+	server_name	bench;
+	listen		0.0.0.0:8000;
+	root		tests/www/html;
+}}
+"""
+SCENARIOS = [
+	("shared", ""),
+	("pinned", "worker_cpu_affinity\tauto;\n"),
+	("steered", "worker_cpu_affinity\tauto;\nworker_incoming_cpu\ton;\n"),
+]
+
+def wait_port(timeout: float) -> bool:
+	end = time.time() + timeout
+	while time.time() < end:
+		try:
+			socket.create_connection(("127.0.0.1", 8000)).close()
+			return True
+		except ConnectionRefusedError:
+			time.sleep(.01)
+	return False
+
+def percentile(latencies: list, p: float) -> float:
+	return latencies[min(len(latencies) - 1, int(len(latencies) * p))]
+
+def run(reps: int, concurrency: int, keepalive: bool) -> dict:
+	"""
+		concurrency clients sending reps requests each, on a new connection
+		per request unless keepalive: accepts are then part of the latency.
+	"""
+	latencies, errors = [], []
+	lock = threading.Lock()
+	def client():
+		mine = []
+		conn = http.client.HTTPConnection("127.0.0.1", 8000)
+		for _ in range(reps):
+			start = time.perf_counter()
+			conn.request("GET", "/index.html")
+			resp = conn.getresponse()
+			resp.read()
+			mine.append(time.perf_counter() - start)
+			if resp.status != 200:
+				errors.append(resp.status)
+			if not keepalive:
+				conn.close()
+		conn.close()
+		with lock:
+			latencies.extend(mine)
+
+	start = time.time()
+	threads = [threading.Thread(target=client) for _ in range(concurrency)]
+	for t in threads:
+		t.start()
+	for t in threads:
+		t.join()
+	elapsed = time.time() - start
+	latencies.sort()
+	return {
+		"errors": len(errors),
+		"rps": len(latencies) / elapsed,
+		"p50_ms": percentile(latencies, .50) * 1000,
+		"p99_ms": percentile(latencies, .99) * 1000,
+	}
+
+def main():
+	reps = int(sys.argv[1]) if len(sys.argv) > 1 else 500
+	concurrency = int(sys.argv[2]) if len(sys.argv) > 2 else 8
+	workers = int(sys.argv[3]) if len(sys.argv) > 3 else os.cpu_count()
+
+	for name, main_rules in SCENARIOS:
+		with open(CONFIG, "w") as f:
+			f.write(SERVER.format(workers=workers, main=main_rules))
+		webserv = subprocess.Popen(["./webserv", CONFIG],
+			stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+		try:
+			if not wait_port(10):
+				raise RuntimeError("webserv did not start")
+			for keepalive in (False, True):
+				res = run(reps, concurrency, keepalive)
+				print("{:>8} | {:>10} | {:4d} errors | {:8.1f} req/s | p50 {:6.2f} ms"
+					" | p99 {:6.2f} ms".format(name,
+					"keep-alive" if keepalive else "close", res["errors"],
+					res["rps"], res["p50_ms"], res["p99_ms"]))
+		finally:
+			webserv.terminate()
+			webserv.wait()
+	os.remove(CONFIG)
+
+if __name__ == "__main__":
+	main()
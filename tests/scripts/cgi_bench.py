@@ -0,0 +1,59 @@
+import sys
+import time
+import threading
+import subprocess
+import http.client
+
+CONFIG = "tests/configs/cgi_workers.conf"
+SCENARIOS = [
+	("spawn", "/cgi/python/index.py"),
+	("workers", "/workers/index.py"),
+]
+
+def fetch(conn: http.client.HTTPConnection, path: str) -> int:
+	conn.request("GET", path)
+	resp = conn.getresponse()
+	resp.read()
+	return resp.status
+
+def run(path: str, reps: int, concurrency: int) -> dict:
+	errors = []
+	def worker():
+		conn = http.client.HTTPConnection("127.0.0.1", 8000)
+		for _ in range(reps):
+			if fetch(conn, path) != 200:
+				errors.append(path)
+		conn.close()
+
+	start = time.time()
+	threads = [threading.Thread(target=worker) for _ in range(concurrency)]
+	for t in threads:
+		t.start()
+	for t in threads:
+		t.join()
+	elapsed = time.time() - start
+	return {
+		"requests": reps * concurrency,
+		"errors": len(errors),
+		"wall_s": elapsed,
+		"rps": reps * concurrency / elapsed,
+	}
+
+def main():
+	reps = int(sys.argv[1]) if len(sys.argv) > 1 else 50
+	concurrency = int(sys.argv[2]) if len(sys.argv) > 2 else 2
+
+	webserv = subprocess.Popen(["./webserv", CONFIG],
+		stdin=subprocess.PIPE, stdout=subprocess.DEVNULL)
+	time.sleep(.5)
+
+	try:
+		for name, path in SCENARIOS:
+			res = run(path, reps, concurrency)
+			print("{:>8} | {:6d} requests | {:4d} errors | {:7.2f} s | {:8.1f} req/s"
+				.format(name, res["requests"], res["errors"], res["wall_s"], res["rps"]))
+	finally:
+		webserv.terminate()
+
+if __name__ == "__main__":
+	main()
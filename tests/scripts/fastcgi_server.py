@@ -0,0 +1,142 @@
+#!/usr/bin/python3
+# Minimal multiplexing FastCGI responder, stand-in for php-fpm in tests.
+#
+#   fastcgi_server.py <unix socket path> [--no-mpx] [--close]
+#   fastcgi_server.py                      (pre-forked worker, fd 0 listens)
+#
+# Every request is answered with its QUERY_STRING followed by its body.
+# The query may hold "sleep=<seconds>", "drip=<seconds>" (delay between the
+# headers and the body), "size=<bytes>" (body of as many "x" instead) or
+# "status=<code>", each response
+# reports the process (X-Worker) and connection (X-Connection) it was served
+# on, and how many requests that connection carried (X-Requests).
+# With --close, connections are closed after each FCGI_END_REQUEST.
+
+import os
+import sys
+import socket
+import asyncio
+import itertools
+import urllib.parse
+
+BEGIN_REQUEST, ABORT_REQUEST, END_REQUEST, PARAMS, STDIN, STDOUT = 1, 2, 3, 4, 5, 6
+GET_VALUES, GET_VALUES_RESULT = 9, 10
+
+CONNECTIONS = itertools.count(1)
+
+def record(type: int, req_id: int, content: bytes = b"") -> bytes:
+	out = b""
+	while True:
+		chunk, content = content[:65535], content[65535:]
+		padding = (8 - len(chunk) % 8) % 8
+		out += bytes([1, type, req_id >> 8, req_id & 0xff,
+			len(chunk) >> 8, len(chunk) & 0xff, padding, 0]) + chunk + b"\0" * padding
+		if not content:
+			return out
+
+def pair(name: bytes, value: bytes) -> bytes:
+	def length(n):
+		return bytes([n]) if n < 128 else (n | 0x80000000).to_bytes(4, "big")
+	return length(len(name)) + length(len(value)) + name + value
+
+def parse_pairs(data: bytes) -> dict:
+	pairs, i = {}, 0
+	def length():
+		nonlocal i
+		if data[i] < 128:
+			i += 1
+			return data[i - 1]
+		i += 4
+		return int.from_bytes(data[i - 4:i], "big") & 0x7fffffff
+	while i < len(data):
+		n, v = length(), length()
+		pairs[data[i:i + n].decode()] = data[i + n:i + n + v].decode()
+		i += n + v
+	return pairs
+
+class Connection:
+	def __init__(self, reader, writer, multiplex: bool, close: bool):
+		self.reader, self.writer = reader, writer
+		self.multiplex, self.close = multiplex, close
+		self.id = next(CONNECTIONS)
+		self.served = 0
+		self.requests = {}
+
+	async def run(self):
+		try:
+			while True:
+				header = await self.reader.readexactly(8)
+				length = (header[4] << 8) | header[5]
+				content = await self.reader.readexactly(length + header[6])
+				self.handle(header[1], (header[2] << 8) | header[3], content[:length])
+		except (asyncio.IncompleteReadError, ConnectionError):
+			pass
+		for task in self.requests.values():
+			if "task" in task:
+				task["task"].cancel()
+		self.writer.close()
+
+	def handle(self, type: int, req_id: int, content: bytes):
+		if type == GET_VALUES:
+			value = b"1" if self.multiplex else b"0"
+			self.writer.write(record(GET_VALUES_RESULT, 0, pair(b"FCGI_MPXS_CONNS", value)))
+		elif type == BEGIN_REQUEST:
+			self.requests[req_id] = {"params": b"", "stdin": b""}
+		elif type == PARAMS:
+			self.requests[req_id]["params"] += content
+		elif type == STDIN and content:
+			self.requests[req_id]["stdin"] += content
+		elif type == STDIN:
+			req = self.requests[req_id]
+			req["task"] = asyncio.ensure_future(self.respond(req_id, req))
+		elif type == ABORT_REQUEST and req_id in self.requests:
+			if "task" in self.requests[req_id]:
+				self.requests[req_id]["task"].cancel()
+			self.end(req_id)
+
+	async def respond(self, req_id: int, req: dict):
+		params = parse_pairs(req["params"])
+		query = urllib.parse.parse_qs(params.get("QUERY_STRING", ""))
+		await asyncio.sleep(float(query.get("sleep", ["0"])[0]))
+
+		self.served += 1
+		head = "Content-Type: text/plain\r\n"
+		head += "X-Worker: {}\r\n".format(os.getpid())
+		head += "X-Connection: {}\r\nX-Requests: {}\r\n".format(self.id, self.served)
+		head += "X-Script: {}\r\n".format(params.get("SCRIPT_FILENAME", ""))
+		if "status" in query:
+			head += "Status: {} Custom\r\n".format(query["status"][0])
+		body = params.get("QUERY_STRING", "").encode() + req["stdin"]
+		# Headers and body in separate records, as php-fpm does
+		self.writer.write(record(STDOUT, req_id, (head + "\r\n").encode()))
+		await asyncio.sleep(float(query.get("drip", ["0"])[0]))
+		if "size" in query:
+			for left in range(int(query["size"][0]), 0, -65535):
+				self.writer.write(record(STDOUT, req_id, b"x" * min(left, 65535)))
+				await self.writer.drain()
+		else:
+			self.writer.write(record(STDOUT, req_id, body))
+		self.end(req_id)
+
+	def end(self, req_id: int):
+		self.requests.pop(req_id, None)
+		self.writer.write(record(STDOUT, req_id) + record(END_REQUEST, req_id, bytes(8)))
+		if self.close:
+			self.writer.close()
+
+async def main(path: str, multiplex: bool, close: bool):
+	async def accept(reader, writer):
+		await Connection(reader, writer, multiplex, close).run()
+	if path:
+		server = await asyncio.start_unix_server(accept, path=path)
+	else:
+		listener = socket.socket(fileno=0)
+		server = await asyncio.start_unix_server(accept, sock=listener)
+	async with server:
+		await server.serve_forever()
+
+if __name__ == "__main__":
+	# Workers serve one request at a time, like php-cgi
+	path = sys.argv[1] if len(sys.argv) > 1 and sys.argv[1][0] != "-" else None
+	asyncio.run(main(path, path is not None and "--no-mpx" not in sys.argv,
+		"--close" in sys.argv))
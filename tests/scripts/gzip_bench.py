@@ -0,0 +1,78 @@
+import os
+import sys
+import time
+import shutil
+import subprocess
+import http.client
+
+CONFIG = "tests/configs/gzip.conf"
+BENCH_DIR = "tests/www/html/gzip_bench"
+
+def server_cpu_time(pid: int) -> float:
+	with open("/proc/{}/stat".format(pid), "r") as f:
+		fields = f.read().rsplit(")", 1)[1].split()
+	# utime and stime are the 14th and 15th fields of /proc/<pid>/stat
+	return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+def fetch(path: str, encoding: str) -> (int, int):
+	conn = http.client.HTTPConnection("127.0.0.1", 8000)
+	conn.request("GET", path, headers={"Accept-Encoding": encoding})
+	resp = conn.getresponse()
+	wire = resp.read()
+	conn.close()
+	if resp.getheader("Content-Encoding") is None:
+		return len(wire), len(wire)
+	import zlib
+	wbits = 16 + zlib.MAX_WBITS if resp.getheader("Content-Encoding") == "gzip" \
+		else zlib.MAX_WBITS
+	return len(zlib.decompress(wire, wbits)), len(wire)
+
+def run(pid: int, path: str, encoding: str, reps: int) -> dict:
+	raw, wire = 0, 0
+	cpu = server_cpu_time(pid)
+	start = time.time()
+	for _ in range(reps):
+		r, w = fetch(path, encoding)
+		raw += r
+		wire += w
+	return {
+		"encoding": encoding,
+		"raw_mb": raw / 1e6,
+		"wire_mb": wire / 1e6,
+		"cpu_s": server_cpu_time(pid) - cpu,
+		"wall_s": time.time() - start,
+	}
+
+def setup(files: int):
+	os.makedirs(BENCH_DIR, exist_ok=True)
+	for i in range(files):
+		open(os.path.join(BENCH_DIR, "file_{:06d}.txt".format(i)), "w").close()
+
+def main():
+	reps = int(sys.argv[1]) if len(sys.argv) > 1 else 50
+	files = int(sys.argv[2]) if len(sys.argv) > 2 else 2000
+
+	setup(files)
+	webserv = subprocess.Popen(["./webserv", CONFIG], stdout=subprocess.DEVNULL)
+	time.sleep(.5)
+
+	try:
+		path = "/" + os.path.basename(BENCH_DIR) + "/"
+		identity = run(webserv.pid, path, "identity", reps)
+		for encoding in ["identity", "gzip", "deflate"]:
+			res = identity if encoding == "identity" \
+				else run(webserv.pid, path, encoding, reps)
+			saved = 1 - res["wire_mb"] / res["raw_mb"]
+			extra_cpu = res["cpu_s"] - identity["cpu_s"]
+			print("{:>8} | {:8.2f} MB raw | {:8.2f} MB wire | {:5.1f}% saved"
+				" | {:7.2f} ms cpu/MB | {:+7.2f} ms cpu per MB saved".format(
+					encoding, res["raw_mb"], res["wire_mb"], saved * 100,
+					res["cpu_s"] * 1000 / res["raw_mb"],
+					extra_cpu * 1000 / max(identity["wire_mb"] - res["wire_mb"], 1e-9)
+						if encoding != "identity" else 0))
+	finally:
+		webserv.terminate()
+		shutil.rmtree(BENCH_DIR, ignore_errors=True)
+
+if __name__ == "__main__":
+	main()
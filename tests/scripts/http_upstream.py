@@ -0,0 +1,74 @@
+#!/usr/bin/python3
+# Minimal keep-alive HTTP/1.1 upstream, stand-in for proxied services in tests.
+#
+#   http_upstream.py <port>
+#
+# Every request is answered with "<port> <path>", or its body for a POST.
+# The query may hold "sleep=<seconds>", "status=<code>", "size=<bytes>" of
+# padding, "chunked" (Transfer-Encoding: chunked) or "close" (body ended by
+# closing the connection). Each response reports the upstream (X-Upstream),
+# the connection it was served on (X-Connection), how many requests that
+# connection carried (X-Requests) and the Content-Type it received
+# (X-Content-Type).
+
+import sys
+import time
+import itertools
+import urllib.parse
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+CONNECTIONS = itertools.count(1)
+
+class Handler(BaseHTTPRequestHandler):
+	protocol_version = "HTTP/1.1"
+
+	def setup(self):
+		super().setup()
+		self.connection_id = next(CONNECTIONS)
+		self.served = 0
+
+	def log_message(self, format, *args):
+		pass
+
+	def respond(self):
+		self.served += 1
+		path, _, query = self.path.partition("?")
+		query = urllib.parse.parse_qs(query, keep_blank_values=True)
+		length = int(self.headers.get("Content-Length", 0))
+		body = self.rfile.read(length) if length else b""
+		time.sleep(float(query.get("sleep", ["0"])[0]))
+
+		if self.command != "POST":
+			body = "{} {}".format(self.server.server_port, path).encode()
+		body += b"a" * int(query.get("size", ["0"])[0])
+		self.send_response(int(query.get("status", ["200"])[0]))
+		self.send_header("Content-Type", "text/plain")
+		self.send_header("X-Upstream", str(self.server.server_port))
+		self.send_header("X-Connection", str(self.connection_id))
+		self.send_header("X-Requests", str(self.served))
+		self.send_header("X-Host", self.headers.get("Host", ""))
+		self.send_header("X-Content-Type", self.headers.get("Content-Type", ""))
+		if "chunked" in query:
+			self.send_header("Transfer-Encoding", "chunked")
+			self.end_headers()
+			for i in range(0, len(body), 1000):
+				chunk = body[i:i + 1000]
+				self.wfile.write(b"%x\r\n%s\r\n" % (len(chunk), chunk))
+			self.wfile.write(b"0\r\n\r\n")
+		elif "close" in query:
+			self.send_header("Connection", "close")
+			self.end_headers()
+			self.wfile.write(body)
+			self.close_connection = True
+		else:
+			self.send_header("Content-Length", str(len(body)))
+			self.end_headers()
+			self.wfile.write(body)
+
+	do_GET = respond
+	do_POST = respond
+	do_DELETE = respond
+
+if __name__ == "__main__":
+	ThreadingHTTPServer.daemon_threads = True
+	ThreadingHTTPServer(("127.0.0.1", int(sys.argv[1])), Handler).serve_forever()
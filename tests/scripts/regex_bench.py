@@ -0,0 +1,93 @@
+import os
+import sys
+import time
+import random
+import subprocess
+import http.client
+
+CONFIG = "/tmp/webserv_regex_bench.conf"
+
+def server_cpu_time(pid: int) -> float:
+	with open("/proc/{}/stat".format(pid), "r") as f:
+		fields = f.read().rsplit(")", 1)[1].split()
+	# utime and stime are the 14th and 15th fields of /proc/<pid>/stat
+	return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+def patterns(count: int) -> list:
+	kinds = [
+		"~ ^/api/v{0}/resource{1}/\\d+$",
+		"~* \\.ext{1}$",
+		"~ ^/static/bucket{1}/[^/]+\\.(css|js)$",
+		"~ /users/{1}(/|$)",
+		"~* ^/(?:docs|wiki){1}/[a-z0-9_-]+\\.md$",
+	]
+	return [kinds[i % len(kinds)].format(i % 3 + 1, i) for i in range(count)]
+
+def uris(count: int, reps: int) -> list:
+	random.seed(42)
+	base = [
+		"/index.html",
+		"/assets/app.min.js",
+		"/api/v2/resource{}/1234",
+		"/static/bucket{}/main.css",
+		"/docs{}/getting-started.md",
+		"/blog/2021/05/some-long-article-title-with-words",
+		"/users/{}/profile",
+		"/images/photo.EXT{}",
+	]
+	res = []
+	for _ in range(reps):
+		uri = random.choice(base)
+		res.append(uri.format(random.randrange(max(count, 1))))
+	return res
+
+def setup(count: int):
+	with open(CONFIG, "w") as f:
+		f.write("server {\n\tserver_name\twebserv;\n\tlisten\t\t0.0.0.0:8000;\n"
+			"\troot\t\ttests/www/html;\n"
+			# Same answer with or without a match, only routing differs
+			"\tredirect\t301 /;\n\n")
+		for pattern in patterns(count):
+			f.write("\tlocation {} {{\n\t\tredirect\t301 /;\n\t}}\n".format(pattern))
+		f.write("}\n")
+
+def run(count: int, reps: int) -> dict:
+	setup(count)
+	webserv = subprocess.Popen(["./webserv", CONFIG], stdout=subprocess.DEVNULL)
+	time.sleep(.5)
+	try:
+		conn = http.client.HTTPConnection("127.0.0.1", 8000)
+		requests = uris(count, reps)
+		# Steady state: the automaton is built while warming up
+		for uri in requests:
+			conn.request("GET", uri)
+			conn.getresponse().read()
+		cpu = server_cpu_time(webserv.pid)
+		start = time.time()
+		for uri in requests:
+			conn.request("GET", uri)
+			conn.getresponse().read()
+		conn.close()
+		return {
+			"cpu_s": server_cpu_time(webserv.pid) - cpu,
+			"wall_s": time.time() - start,
+		}
+	finally:
+		webserv.terminate()
+		webserv.wait()
+		os.remove(CONFIG)
+
+def main():
+	reps = int(sys.argv[1]) if len(sys.argv) > 1 else 20000
+	count = int(sys.argv[2]) if len(sys.argv) > 2 else 500
+
+	baseline = run(0, reps)
+	for n in [0, count]:
+		res = baseline if n == 0 else run(n, reps)
+		print("{:>5} regex locations | {:6.2f} us cpu/request | {:6.2f} us"
+			" wall/request | {:+6.2f} us cpu/request".format(n,
+				res["cpu_s"] * 1e6 / reps, res["wall_s"] * 1e6 / reps,
+				(res["cpu_s"] - baseline["cpu_s"]) * 1e6 / reps))
+
+if __name__ == "__main__":
+	main()
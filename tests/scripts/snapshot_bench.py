@@ -0,0 +1,75 @@
+import os
+import sys
+import time
+import socket
+import subprocess
+import http.client
+
+CONFIG = "/tmp/webserv_snapshot_bench.conf"
+PAGE = "/tmp/webserv_snapshot_bench.html"
+
+def server_rss_mb(pid: int) -> float:
+	with open("/proc/{}/status".format(pid), "r") as f:
+		for line in f:
+			if line.startswith("VmRSS:"):
+				return int(line.split()[1]) / 1024
+	return 0
+
+def setup(locations: int, page_kb: int):
+	"""
+		One server, locations inheriting its error pages of page_kb each.
+	"""
+	with open(PAGE, "w") as f:
+		f.write("<html>" + "x" * (page_kb * 1024) + "</html>")
+	with open(CONFIG, "w") as f:
+		f.write("server {\n\tserver_name\tbench;\n\tlisten\t\t0.0.0.0:8000;\n")
+		for code in (403, 404, 500):
+			f.write("\terror_page\t{} {};\n".format(code, PAGE))
+		for i in range(locations):
+			f.write("\tlocation /loc{} {{\n\t\tautoindex\ton;\n\t}}\n".format(i))
+		f.write("}\n")
+
+def wait_port(timeout: float) -> bool:
+	end = time.time() + timeout
+	while time.time() < end:
+		try:
+			socket.create_connection(("127.0.0.1", 8000)).close()
+			return True
+		except ConnectionRefusedError:
+			time.sleep(.01)
+	return False
+
+def run(locations: int, page_kb: int) -> dict:
+	setup(locations, page_kb)
+	start = time.time()
+	webserv = subprocess.Popen(["./webserv", CONFIG], stdout=subprocess.DEVNULL,
+		stdin=subprocess.PIPE)
+	try:
+		if not wait_port(120):
+			raise RuntimeError("webserv did not start")
+		load = time.time() - start
+		conn = http.client.HTTPConnection("127.0.0.1", 8000)
+		conn.request("GET", "/loc{}/missing".format(locations - 1))
+		resp = conn.getresponse()
+		body = resp.read()
+		conn.close()
+		if resp.status != 404 or len(body) < page_kb * 1024:
+			raise RuntimeError("unexpected error page")
+		return {"load_s": load, "rss_mb": server_rss_mb(webserv.pid)}
+	finally:
+		webserv.terminate()
+		webserv.wait()
+		os.remove(CONFIG)
+		os.remove(PAGE)
+
+def main():
+	locations = int(sys.argv[1]) if len(sys.argv) > 1 else 10000
+	page_kb = int(sys.argv[2]) if len(sys.argv) > 2 else 16
+
+	for n in [1, locations]:
+		res = run(n, page_kb)
+		print("{:>6} locations | {:3} KB error pages | {:6.2f} s load"
+			" | {:7.1f} MB rss".format(n, page_kb, res["load_s"], res["rss_mb"]))
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,100 @@
+import os
+import sys
+import time
+import random
+import socket
+import subprocess
+import http.client
+
+CONFIG = "/tmp/webserv_vhost_bench.conf"
+
+def server_cpu_time(pid: int) -> float:
+	with open("/proc/{}/stat".format(pid), "r") as f:
+		fields = f.read().rsplit(")", 1)[1].split()
+	# utime and stime are the 14th and 15th fields of /proc/<pid>/stat
+	return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+def server_rss_mb(pid: int) -> float:
+	with open("/proc/{}/status".format(pid), "r") as f:
+		for line in f:
+			if line.startswith("VmRSS:"):
+				return int(line.split()[1]) / 1024
+	return 0
+
+def setup(blocks: int, names: int):
+	"""
+		blocks servers on the same port, names server_name each: exact
+		names, then a leading and a trailing wildcard.
+	"""
+	with open(CONFIG, "w") as f:
+		for i in range(blocks):
+			hosts = ["site{}-{}.example.com".format(i, n) for n in range(names - 2)]
+			hosts += ["*.customer{}.net".format(i), "www.customer{}.*".format(i)]
+			f.write("server {{\n\tserver_name\t{};\n\tlisten\t\t0.0.0.0:8000;\n"
+				"\tredirect\t301 /;\n}}\n".format(" ".join(hosts)))
+
+def hosts(blocks: int, names: int, reps: int) -> list:
+	random.seed(42)
+	res = []
+	for _ in range(reps):
+		i = random.randrange(blocks)
+		res.append(random.choice([
+			"site{}-{}.example.com".format(i, random.randrange(names - 2)),
+			"a.b.customer{}.net".format(i),
+			"www.customer{}.org".format(i),
+			"unknown{}.test".format(i),
+		]))
+	return res
+
+def wait_port(timeout: float) -> bool:
+	end = time.time() + timeout
+	while time.time() < end:
+		try:
+			socket.create_connection(("127.0.0.1", 8000)).close()
+			return True
+		except ConnectionRefusedError:
+			time.sleep(.01)
+	return False
+
+def run(blocks: int, names: int, reps: int) -> dict:
+	setup(blocks, names)
+	start = time.time()
+	webserv = subprocess.Popen(["./webserv", CONFIG], stdout=subprocess.DEVNULL,
+		stdin=subprocess.PIPE)
+	try:
+		if not wait_port(120):
+			raise RuntimeError("webserv did not start")
+		load = time.time() - start
+		conn = http.client.HTTPConnection("127.0.0.1", 8000)
+		requests = hosts(blocks, names, reps)
+		cpu = server_cpu_time(webserv.pid)
+		start = time.time()
+		for host in requests:
+			conn.request("GET", "/", headers={"Host": host})
+			conn.getresponse().read()
+		conn.close()
+		return {
+			"load_s": load,
+			"rss_mb": server_rss_mb(webserv.pid),
+			"cpu_s": server_cpu_time(webserv.pid) - cpu,
+			"wall_s": time.time() - start,
+		}
+	finally:
+		webserv.terminate()
+		webserv.wait()
+		os.remove(CONFIG)
+
+def main():
+	reps = int(sys.argv[1]) if len(sys.argv) > 1 else 20000
+	blocks = int(sys.argv[2]) if len(sys.argv) > 2 else 10000
+	names = int(sys.argv[3]) if len(sys.argv) > 3 else 10
+
+	for b, n in [(1, 3), (blocks, names)]:
+		res = run(b, n, reps)
+		print("{:>7} names in {:>6} servers | {:6.2f} s load | {:7.1f} MB rss"
+			" | {:6.2f} us cpu/request | {:6.2f} us wall/request".format(
+				b * n, b, res["load_s"], res["rss_mb"],
+				res["cpu_s"] * 1e6 / reps, res["wall_s"] * 1e6 / reps))
+
+if __name__ == "__main__":
+	main()
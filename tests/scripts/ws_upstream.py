@@ -0,0 +1,86 @@
+#!/usr/bin/python3
+# Minimal WebSocket echo upstream, stand-in for proxied services in tests.
+#
+#   ws_upstream.py <port>
+#
+# Upgrade requests are answered with a 101, immediately followed by a
+# "hello <port>" text frame, then every message is echoed back. Other
+# requests get a plain "<port> <path>" response.
+
+import sys
+import base64
+import struct
+import hashlib
+import socketserver
+
+GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+def read_exact(f, n):
+	data = f.read(n)
+	if len(data) < n:
+		raise EOFError
+	return data
+
+def frame(opcode, payload):
+	head = bytes([0x80 | opcode])
+	if len(payload) < 126:
+		head += bytes([len(payload)])
+	elif len(payload) < 65536:
+		head += bytes([126]) + struct.pack("!H", len(payload))
+	else:
+		head += bytes([127]) + struct.pack("!Q", len(payload))
+	return head + payload
+
+class Handler(socketserver.StreamRequestHandler):
+	def handle(self):
+		head = b""
+		while not head.endswith(b"\r\n\r\n"):
+			line = self.rfile.readline()
+			if not line:
+				return
+			head += line
+		lines = head.decode().split("\r\n")
+		path = lines[0].split(" ")[1]
+		headers = {}
+		for line in lines[1:]:
+			if ":" in line:
+				name, value = line.split(":", 1)
+				headers[name.strip().lower()] = value.strip()
+
+		if headers.get("upgrade", "").lower() != "websocket":
+			body = "{} {}".format(self.server.server_address[1], path).encode()
+			self.wfile.write(b"HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+				b"Connection: close\r\nContent-Length: %d\r\n\r\n%s"
+				% (len(body), body))
+			return
+
+		accept = base64.b64encode(hashlib.sha1(
+			(headers["sec-websocket-key"] + GUID).encode()).digest())
+		self.wfile.write(b"HTTP/1.1 101 Switching Protocols\r\n"
+			b"Upgrade: websocket\r\nConnection: Upgrade\r\n"
+			b"Sec-WebSocket-Accept: " + accept + b"\r\n\r\n"
+			+ frame(1, b"hello %d" % self.server.server_address[1]))
+		try:
+			while True:
+				first, second = read_exact(self.rfile, 2)
+				length = second & 0x7f
+				if length == 126:
+					length = struct.unpack("!H", read_exact(self.rfile, 2))[0]
+				elif length == 127:
+					length = struct.unpack("!Q", read_exact(self.rfile, 8))[0]
+				mask = read_exact(self.rfile, 4) if second & 0x80 else b"\0" * 4
+				payload = bytes(b ^ mask[i % 4] for i, b
+					in enumerate(read_exact(self.rfile, length)))
+				if first & 0x0f == 8:
+					self.wfile.write(frame(8, payload))
+					return
+				self.wfile.write(frame(first & 0x0f, payload))
+		except (EOFError, ConnectionError):
+			pass
+
+if __name__ == "__main__":
+	socketserver.ThreadingTCPServer.daemon_threads = True
+	socketserver.ThreadingTCPServer.allow_reuse_address = True
+	socketserver.ThreadingTCPServer.request_queue_size = 512
+	socketserver.ThreadingTCPServer(("127.0.0.1", int(sys.argv[1])),
+		Handler).serve_forever()
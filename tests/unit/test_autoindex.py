@@ -0,0 +1,50 @@
+import os
+import shutil
+import unittest
+import requests
+
+import utils as u
+
+CONFIG = "tests/configs/default.conf"
+DIR = "tests/www/html/autoindex_test"
+
+class TestAutoindex(unittest.TestCase):
+	pid, fd = 0, 0
+
+	@classmethod
+	def setUpClass(cls):
+		cls.pid, cls.fd = u.start_server(CONFIG)
+		os.makedirs(DIR + "/subdir", exist_ok=True)
+		for i in range(3000):
+			open(DIR + "/file_{:05d}.txt".format(i), "w").close()
+
+	@classmethod
+	def tearDownClass(cls):
+		shutil.rmtree(DIR, ignore_errors=True)
+		if cls.fd and cls.pid:
+			u.stop_server(cls.pid, cls.fd)
+
+	def test_1_streamed_listing(self):
+		r = requests.get("http://localhost:8000/html/autoindex_test/")
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.headers['Transfer-Encoding'], 'chunked')
+		self.assertEqual(r.text.count("<tr>"), 1 + 3002)
+		self.assertLess(r.text.index('href="subdir/"'), r.text.index('href="file_00000.txt"'))
+		self.assertLess(r.text.index('href="file_00999.txt"'), r.text.index('href="file_01000.txt"'))
+
+	def test_2_cached_listing(self):
+		r1 = requests.get("http://localhost:8000/html/autoindex_test/")
+		r2 = requests.get("http://localhost:8000/html/autoindex_test/")
+		self.assertEqual(r2.status_code, 200)
+		self.assertEqual(r2.headers['Content-Length'], str(len(r2.content)))
+		self.assertEqual(r1.text, r2.text)
+
+	def test_3_invalidated_listing(self):
+		requests.get("http://localhost:8000/html/autoindex_test/")
+		open(DIR + "/new_file.txt", "w").close()
+		r = requests.get("http://localhost:8000/html/autoindex_test/")
+		self.assertEqual(r.status_code, 200)
+		self.assertIn('href="new_file.txt"', r.text)
+
+if __name__ == '__main__':
+	unittest.main()
@@ -0,0 +1,169 @@
+import time
+import socket
+import unittest
+import requests
+import threading
+
+import utils as u
+
+CONFIG = "tests/configs/default.conf"
+SLEEP = "http://localhost:8000/cgi/python/sleep.py"
+STREAM = "http://localhost:8000/cgi/python/stream.py"
+
+def post_in_two_parts(path: str, body: bytes, between) -> bytes:
+	half = len(body) // 2
+	s = socket.create_connection(("localhost", 8000), timeout=2)
+	s.sendall("POST {} HTTP/1.1\r\nHost: localhost\r\nContent-Type: text/plain\r\n"
+		"Content-Length: {}\r\nConnection: close\r\n\r\n".format(path, len(body))
+		.encode() + body[:half])
+	response = between(s)
+	s.sendall(body[half:])
+	while True:
+		data = s.recv(65536)
+		if not data:
+			break
+		response += data
+	s.close()
+	return response
+
+def dechunk(payload: bytes) -> bytes:
+	body = b""
+	while True:
+		size, payload = payload.split(b"\r\n", 1)
+		if int(size, 16) == 0:
+			return body
+		body += payload[:int(size, 16)]
+		payload = payload[int(size, 16) + 2:]
+
+class TestCGI(unittest.TestCase):
+	pid, fd = 0, 0
+
+	@classmethod
+	def setUpClass(cls):
+		cls.pid, cls.fd = u.start_server(CONFIG)
+
+	@classmethod
+	def tearDownClass(cls):
+		if cls.fd and cls.pid:
+			u.stop_server(cls.pid, cls.fd)
+
+	def test_cgi_query(self):
+		r = requests.get(SLEEP + "?hello")
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.text, "hello")
+
+	def test_cgi_post_body(self):
+		body = u.get_random_string(256 * 1024)
+		r = requests.post(SLEEP, data=body,
+			headers={"Content-Type": "text/plain"})
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.text, body)
+
+	def test_cgi_concurrent(self):
+		results = []
+		def fetch(i):
+			r = requests.get(SLEEP + "?" + str(i))
+			results.append((r.status_code, r.text == str(i)))
+
+		start = time.time()
+		threads = [threading.Thread(target=fetch, args=(i,)) for i in range(4)]
+		for t in threads:
+			t.start()
+		for t in threads:
+			t.join()
+		self.assertLess(time.time() - start, 1.5)
+		self.assertEqual(results, [(200, True)] * 4)
+
+	def test_cgi_static_not_blocked(self):
+		worker = threading.Thread(target=requests.get, args=(SLEEP,))
+		worker.start()
+		time.sleep(.1)
+		start = time.time()
+		r = requests.get("http://localhost:8000/ping/")
+		self.assertLess(time.time() - start, .3)
+		self.assertEqual(r.status_code, 200)
+		worker.join()
+
+	def test_cgi_binary_body(self):
+		body = b"abc\0def" + bytes(range(256))
+		r = requests.post("http://localhost:8000/cgi/python/echo.py", data=body,
+			headers={"Content-Type": "application/octet-stream"}, timeout=5)
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.content, body)
+
+	def test_cgi_body_streamed(self):
+		body = u.get_random_string(64 * 1024).encode()
+		# The script answers before the whole body is sent
+		response = post_in_two_parts("/cgi/python/echo.py", body,
+			lambda s: s.recv(65536))
+		self.assertTrue(response.startswith(b"HTTP/1.1 200"))
+		self.assertEqual(dechunk(response.split(b"\r\n\r\n", 1)[1]), body)
+
+	def test_cgi_headers_before_exit(self):
+		start = time.time()
+		r = requests.get(STREAM, stream=True)
+		self.assertEqual(r.status_code, 200)
+		self.assertLess(time.time() - start, .4)
+		self.assertEqual(r.text, "first\nsecond\n")
+
+	def test_cgi_large_output(self):
+		size = 8 * 1024 * 1024
+		r = requests.get(STREAM + "?" + str(size))
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(len(r.content), size + len("first\n"))
+
+	def test_cgi_chunked_output(self):
+		r = requests.get(STREAM + "?100000")
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.headers["Transfer-Encoding"], "chunked")
+		self.assertEqual(len(r.content), 100000 + len("first\n"))
+
+	def test_cgi_spliced_output(self):
+		size = 8 * 1024 * 1024
+		with requests.Session() as s:
+			r = s.get(STREAM + "?{}&length".format(size))
+			self.assertEqual(r.status_code, 200)
+			self.assertEqual(r.headers["Content-Length"], str(size + len("first\n")))
+			self.assertEqual(r.content, b"first\n" + b"a" * size)
+			# The connection is kept for the next request
+			r = s.get(SLEEP + "?alive")
+			self.assertEqual(r.text, "alive")
+
+	def test_cgi_environment(self):
+		r = requests.get("http://localhost:8000/cgi/python/env.py?a=b")
+		self.assertEqual(r.status_code, 200)
+		env = dict(line.split("=", 1) for line in r.text.splitlines())
+		self.assertEqual(env["QUERY_STRING"], "a=b")
+		self.assertEqual(env["REQUEST_METHOD"], "GET")
+		self.assertEqual(env["GATEWAY_INTERFACE"], "CGI/1.1")
+		self.assertEqual(env["SERVER_PORT"], "8000")
+		self.assertTrue(env["SCRIPT_FILENAME"].endswith("/cgi/python/env.py"))
+		# Sockets and pipes of the server are close-on-exec
+		self.assertEqual(env["FDS"], "0,1,2")
+
+	def test_cgi_content_type_kept(self):
+		content_type = "multipart/form-data; boundary=AbCdEf"
+		r = requests.post("http://localhost:8000/cgi/python/env.py",
+			data="--AbCdEf--\r\n", headers={"Content-Type": content_type})
+		self.assertEqual(r.status_code, 200)
+		env = dict(line.split("=", 1) for line in r.text.splitlines())
+		self.assertEqual(env["CONTENT_TYPE"], content_type)
+
+	def test_cgi_timeout(self):
+		start = time.time()
+		r = requests.get("http://localhost:8000/cgi/python/infinite_loop.py")
+		self.assertEqual(r.status_code, 504)
+		self.assertLess(time.time() - start, 2)
+
+	def test_cgi_timeout_keeps_serving(self):
+		worker = threading.Thread(target=requests.get,
+			args=("http://localhost:8000/cgi/python/infinite_loop.py",))
+		worker.start()
+		time.sleep(.1)
+		r = requests.get(SLEEP + "?alive")
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.text, "alive")
+		worker.join()
+
+if __name__ == '__main__':
+	unittest.main()
@@ -0,0 +1,64 @@
+import time
+import unittest
+import requests
+import threading
+
+import utils as u
+
+CONFIG = "tests/configs/cgi_limit.conf"
+SLEEP = "http://localhost:8000/limited/sleep.py?sleep="
+
+class TestCGILimit(unittest.TestCase):
+	pid, fd = 0, 0
+
+	@classmethod
+	def setUpClass(cls):
+		cls.pid, cls.fd = u.start_server(CONFIG)
+
+	@classmethod
+	def tearDownClass(cls):
+		if cls.fd and cls.pid:
+			u.stop_server(cls.pid, cls.fd)
+
+	def _burst(self, delays):
+		# One request per sleep value, each sent 0.1s after the previous one
+		responses = [None] * len(delays)
+		def fetch(i):
+			responses[i] = requests.get(SLEEP + str(delays[i]))
+		threads = []
+		for i in range(len(delays)):
+			threads.append(threading.Thread(target=fetch, args=(i,)))
+			threads[-1].start()
+			time.sleep(.1)
+		for t in threads:
+			t.join()
+		return responses
+
+	def test_cgi_timeout(self):
+		r = requests.get("http://localhost:8000/cached/stamp.py?sleep=1.5")
+		self.assertEqual(r.status_code, 504)
+
+	def test_cgi_timeout_location(self):
+		r = requests.get(SLEEP + "1.5")
+		self.assertEqual(r.status_code, 200)
+
+	def test_cgi_limit_queue(self):
+		start = time.time()
+		first, second, third = self._burst([.5, 0, 0])
+		self.assertEqual(first.status_code, 200)
+		self.assertEqual(second.status_code, 200)
+		self.assertGreaterEqual(time.time() - start, .5)
+		self.assertEqual(third.status_code, 503)
+		self.assertEqual(third.headers["Retry-After"], "3")
+		self.assertEqual(requests.get(SLEEP + "0").status_code, 200)
+
+	def test_cgi_limit_queue_timeout(self):
+		start = time.time()
+		first, second = self._burst([1.5, 0])
+		self.assertEqual(first.status_code, 200)
+		self.assertEqual(second.status_code, 503)
+		self.assertEqual(requests.get(SLEEP + "0").status_code, 200)
+		self.assertLess(time.time() - start, 2.5)
+
+if __name__ == '__main__':
+	unittest.main()
@@ -0,0 +1,97 @@
+import os
+import time
+import signal
+import unittest
+import requests
+import threading
+
+import utils as u
+
+CONFIG = "tests/configs/cgi_workers.conf"
+WORKERS = "http://localhost:8000/workers/index.py"
+RECYCLE = "http://localhost:8000/recycle/index.py"
+
+def workers_of(pid: int) -> list:
+	found = []
+	for entry in os.listdir("/proc"):
+		if not entry.isdigit():
+			continue
+		try:
+			with open("/proc/{}/stat".format(entry), "r") as f:
+				ppid = int(f.read().rsplit(")", 1)[1].split()[1])
+			with open("/proc/{}/cmdline".format(entry), "rb") as f:
+				cmdline = f.read()
+		except OSError:
+			continue
+		if ppid == pid and b"fastcgi_server.py" in cmdline:
+			found.append(int(entry))
+	return found
+
+class TestCGIWorkers(unittest.TestCase):
+	pid, fd = 0, 0
+
+	@classmethod
+	def setUpClass(cls):
+		cls.pid, cls.fd = u.start_server(CONFIG)
+
+	@classmethod
+	def tearDownClass(cls):
+		if cls.fd and cls.pid:
+			u.stop_server(cls.pid, cls.fd)
+
+	def test_workers_preforked(self):
+		self.assertEqual(len(workers_of(self.pid.pid)), 3)
+
+	def test_workers_query(self):
+		r = requests.get(WORKERS + "?hello")
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.text, "hello")
+
+	def test_workers_post_body(self):
+		body = u.get_random_string(256 * 1024)
+		r = requests.post(WORKERS, data=body,
+			headers={"Content-Type": "text/plain"})
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.text, body)
+
+	def test_workers_reused(self):
+		first = requests.get(WORKERS)
+		second = requests.get(WORKERS)
+		self.assertEqual(first.headers["X-Worker"], second.headers["X-Worker"])
+
+	def test_workers_queue(self):
+		results = []
+		def fetch(i):
+			r = requests.get(WORKERS + "?sleep=0.3&n=" + str(i))
+			results.append((r.status_code, r.headers.get("X-Worker")))
+
+		start = time.time()
+		threads = [threading.Thread(target=fetch, args=(i,)) for i in range(4)]
+		for t in threads:
+			t.start()
+		for t in threads:
+			t.join()
+		elapsed = time.time() - start
+		self.assertEqual([r[0] for r in results], [200] * 4)
+		# Two workers, each serving one request at a time
+		self.assertEqual(len(set(r[1] for r in results)), 2)
+		self.assertGreater(elapsed, .55)
+		self.assertLess(elapsed, 1)
+
+	def test_workers_recycled(self):
+		served = [requests.get(RECYCLE) for _ in range(7)]
+		self.assertEqual([r.status_code for r in served], [200] * 7)
+		self.assertTrue(all(int(r.headers["X-Requests"]) <= 3 for r in served))
+		self.assertGreaterEqual(len(set(r.headers["X-Worker"] for r in served)), 3)
+
+	def test_workers_respawned(self):
+		pid = int(requests.get(WORKERS).headers["X-Worker"])
+		os.kill(pid, signal.SIGKILL)
+		time.sleep(.2)
+		for _ in range(4):
+			r = requests.get(WORKERS + "?alive")
+			self.assertEqual(r.status_code, 200)
+			self.assertNotEqual(int(r.headers["X-Worker"]), pid)
+
+if __name__ == '__main__':
+	unittest.main()
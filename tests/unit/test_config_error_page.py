@@ -1,3 +1,5 @@
+import time
+import socket
 import unittest
 import requests
 
@@ -23,5 +25,35 @@ class TestConfigErrorPage(unittest.TestCase):
 		self.assertEqual(r.text, u.get_html_file("custom_error.html"))
 		self.assertNotEqual(r.text, u.get_html_file("404.html"))
 
+	def test_error_page_404_location(self):
+		r = requests.get("http://localhost:8000/ping/not_found")
+		self.assertEqual(r.status_code, 404)
+		self.assertEqual(r.text, u.get_html_file("404.html"))
+
+	def test_error_page_rendered_twice(self):
+		r1 = requests.get("http://localhost:8000/not_found")
+		r2 = requests.get("http://localhost:8000/not_found_either")
+		self.assertEqual(r1.text, r2.text)
+		self.assertEqual(r1.headers['Content-Length'], r2.headers['Content-Length'])
+		self.assertTrue(r2.headers['Date'].endswith(" GMT"))
+
+	def test_error_page_date_refreshed(self):
+		def fetch():
+			r = requests.get("http://localhost:8000/not_found")
+			self.assertEqual(r.text, u.get_html_file("custom_error.html"))
+			return r.headers['Date']
+		first = fetch()
+		time.sleep(1.1)
+		self.assertNotEqual(fetch(), first)
+
+	def test_default_status_page(self):
+		s = socket.create_connection(("localhost", 8000))
+		s.sendall(b"BREW / HTTP/1.1\r\nHost: localhost\r\n\r\n")
+		data = s.recv(65536).decode()
+		s.close()
+		self.assertTrue(data.startswith("HTTP/1.1 400 Bad Request\r\n"))
+		self.assertIn("Connection: closed\r\n", data)
+		self.assertIn("<h1>400 - Bad Request</h1>", data)
+
 if __name__ == '__main__':
-	unittest.main()
\ No newline at end of file
+	unittest.main()
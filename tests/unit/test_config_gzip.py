@@ -0,0 +1,66 @@
+import unittest
+import requests
+
+import utils as u
+
+CONFIG = "tests/configs/gzip.conf"
+
+class TestConfigGzip(unittest.TestCase):
+	pid, fd = 0, 0
+
+	@classmethod
+	def setUpClass(cls):
+		cls.pid, cls.fd = u.start_server(CONFIG)
+
+	@classmethod
+	def tearDownClass(cls):
+		if cls.pid and cls.fd:
+			u.stop_server(cls.pid, cls.fd)
+
+	def test_autoindex_gzip(self):
+		r = requests.get("http://localhost:8000/", headers={'Accept-Encoding': 'gzip'})
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.headers['Content-Encoding'], 'gzip')
+		self.assertEqual(r.headers['Transfer-Encoding'], 'chunked')
+		self.assertNotIn('Content-Length', r.headers)
+		self.assertIn("<h3>Index of tests/www/html/</h3>", r.text)
+
+	def test_autoindex_deflate(self):
+		r = requests.get("http://localhost:8000/", headers={'Accept-Encoding': 'deflate'})
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.headers['Content-Encoding'], 'deflate')
+		self.assertIn("<h3>Index of tests/www/html/</h3>", r.text)
+
+	def test_autoindex_identity(self):
+		r = requests.get("http://localhost:8000/", headers={'Accept-Encoding': 'identity'})
+		self.assertEqual(r.status_code, 200)
+		self.assertNotIn('Content-Encoding', r.headers)
+		self.assertIn("<h3>Index of tests/www/html/</h3>", r.text)
+
+	def test_gzip_disabled_by_q(self):
+		r = requests.get("http://localhost:8000/", headers={'Accept-Encoding': 'gzip;q=0'})
+		self.assertEqual(r.status_code, 200)
+		self.assertNotIn('Content-Encoding', r.headers)
+
+	def test_cgi_gzip(self):
+		r = requests.get("http://localhost:8000/cgi/python/index.py",
+			headers={'Accept-Encoding': 'gzip'})
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.headers['Content-Encoding'], 'gzip')
+		self.assertIn("Hello World!", r.text)
+
+	def test_static_not_compressed(self):
+		r = requests.get("http://localhost:8000/index.html",
+			headers={'Accept-Encoding': 'gzip'})
+		self.assertEqual(r.status_code, 200)
+		self.assertNotIn('Content-Encoding', r.headers)
+		self.assertEqual(r.text, u.get_html_file("index.html"))
+
+	def test_min_length(self):
+		r = requests.get("http://localhost:8000/html/",
+			headers={'Accept-Encoding': 'gzip'})
+		self.assertEqual(r.status_code, 200)
+		self.assertNotIn('Content-Encoding', r.headers)
+
+if __name__ == '__main__':
+	unittest.main()
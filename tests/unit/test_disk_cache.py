@@ -0,0 +1,136 @@
+import os
+import glob
+import time
+import shutil
+import socket
+import unittest
+import requests
+import subprocess
+
+import utils as u
+
+CONFIG = "tests/configs/disk_cache.conf"
+STAMP = "http://localhost:8000/cached/stamp.py"
+URL = "http://localhost:8000"
+PORT = 9104
+DIRS = ["/tmp/webserv_cache_cgi", "/tmp/webserv_cache_proxy",
+	"/tmp/webserv_cache_tiny"]
+
+def start_upstream():
+	upstream = subprocess.Popen(["/usr/bin/python3",
+		u.get_git_root() + "/tests/scripts/http_upstream.py", str(PORT)])
+	for _ in range(50):
+		try:
+			socket.create_connection(("127.0.0.1", PORT)).close()
+			break
+		except ConnectionRefusedError:
+			time.sleep(.1)
+	return upstream
+
+class TestDiskCache(unittest.TestCase):
+	pid, fd, upstream = 0, 0, None
+
+	@classmethod
+	def setUpClass(cls):
+		for path in DIRS:
+			shutil.rmtree(path, ignore_errors=True)
+		cls.upstream = start_upstream()
+		cls.pid, cls.fd = u.start_server(CONFIG)
+
+	@classmethod
+	def tearDownClass(cls):
+		if cls.fd and cls.pid:
+			u.stop_server(cls.pid, cls.fd)
+		cls.upstream.terminate()
+		cls.upstream.wait()
+
+	def test_disk_hit(self):
+		first = requests.get(STAMP + "?hit")
+		self.assertEqual(first.status_code, 200)
+		self.assertNotIn("Age", first.headers)
+		second = requests.get(STAMP + "?hit")
+		self.assertEqual(second.status_code, 200)
+		self.assertEqual(first.text, second.text)
+		self.assertEqual(second.headers["Content-Type"], "text/plain")
+		self.assertIn("Age", second.headers)
+
+	def test_disk_sharded(self):
+		requests.get(STAMP + "?sharded")
+		files = glob.glob(DIRS[0] + "/*/*/*")
+		self.assertGreater(len(files), 0)
+		found = False
+		for path in files:
+			parts = path[len(DIRS[0]) + 1:].split("/")
+			self.assertEqual(len(parts[2]), 16)
+			self.assertEqual(parts[0], parts[2][15])
+			self.assertEqual(parts[1], parts[2][13:15])
+			with open(path, "rb") as f:
+				found = found or b"/cached/stamp.py?sharded\n" in f.read(4096)
+		self.assertTrue(found)
+
+	def test_disk_control(self):
+		for control in ("no-store", "private", "max-age=0"):
+			query = "?control=" + control
+			first = requests.get(STAMP + query)
+			second = requests.get(STAMP + query)
+			self.assertNotEqual(first.text, second.text, control)
+		first = requests.get(STAMP + "?control=max-age=1")
+		time.sleep(1.1)
+		second = requests.get(STAMP + "?control=max-age=1")
+		self.assertNotEqual(first.text, second.text)
+
+	def test_disk_cookie(self):
+		first = requests.get(STAMP + "?cookie")
+		second = requests.get(STAMP + "?cookie")
+		self.assertNotEqual(first.text, second.text)
+
+	def test_disk_large(self):
+		first = requests.get(STAMP + "?size=300000")
+		second = requests.get(STAMP + "?size=300000")
+		self.assertEqual(len(second.text), len(first.text))
+		self.assertEqual(first.text, second.text)
+		self.assertIn("Age", second.headers)
+
+	def test_disk_restart(self):
+		first = requests.get(STAMP + "?restart")
+		u.stop_server(self.pid, self.fd)
+		TestDiskCache.pid, TestDiskCache.fd = u.start_server(CONFIG)
+		second = requests.get(STAMP + "?restart")
+		self.assertEqual(first.text, second.text)
+		self.assertIn("Age", second.headers)
+
+	def test_disk_proxy(self):
+		first = requests.get(URL + "/api/proxied")
+		self.assertEqual(first.status_code, 200)
+		self.assertNotIn("Age", first.headers)
+		second = requests.get(URL + "/api/proxied")
+		self.assertEqual(second.text, "9104 /api/proxied")
+		self.assertEqual(second.headers["X-Requests"], first.headers["X-Requests"])
+		self.assertIn("Age", second.headers)
+
+	def test_disk_stale(self):
+		first = requests.get(URL + "/api/stale")
+		self.assertEqual(first.status_code, 200)
+		time.sleep(1.1)
+		self.upstream.terminate()
+		self.upstream.wait()
+		try:
+			stale = requests.get(URL + "/api/stale")
+			self.assertEqual(stale.status_code, 200)
+			self.assertEqual(stale.text, "9104 /api/stale")
+			self.assertEqual(stale.headers["X-Requests"], first.headers["X-Requests"])
+			self.assertIn("Age", stale.headers)
+			self.assertEqual(requests.get(URL + "/api/uncached").status_code, 502)
+		finally:
+			TestDiskCache.upstream = start_upstream()
+
+	def test_disk_evict(self):
+		first = requests.get(URL + "/tiny/one?size=3000")
+		requests.get(URL + "/tiny/two?size=3000")
+		self.assertEqual(len(glob.glob(DIRS[2] + "/*/*/*")), 1)
+		again = requests.get(URL + "/tiny/one?size=3000")
+		self.assertEqual(again.text, first.text)
+		self.assertNotIn("Age", again.headers)
+
+if __name__ == '__main__':
+	unittest.main()
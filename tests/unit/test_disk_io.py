@@ -0,0 +1,112 @@
+import os
+import shutil
+import unittest
+import threading
+import requests
+import http.client
+
+import utils as u
+
+CONFIG = "tests/configs/default.conf"
+UPLOADS = "http://localhost:8000/uploads/"
+
+class TestDiskIO(unittest.TestCase):
+	pid, fd = 0, 0
+
+	@classmethod
+	def setUpClass(cls):
+		cls.pid, cls.fd = u.start_server(CONFIG)
+
+	@classmethod
+	def tearDownClass(cls):
+		if cls.fd and cls.pid:
+			u.stop_server(cls.pid, cls.fd)
+
+	def parallel(self, target, count):
+		errors = []
+		def run(i):
+			try:
+				target(i)
+			except Exception as e:
+				errors.append(e)
+		threads = [threading.Thread(target=run, args=(i,)) for i in range(count)]
+		for t in threads:
+			t.start()
+		for t in threads:
+			t.join()
+		self.assertEqual(errors, [])
+
+	def test_io_concurrent_files(self):
+		index = u.get_html_file("index.html")
+		def fetch(_):
+			session = requests.Session()
+			for _ in range(25):
+				r = session.get("http://localhost:8000/index.html")
+				assert r.status_code == 200
+				assert r.text == index
+		self.parallel(fetch, 16)
+
+	def test_io_concurrent_uploads(self):
+		def upload(i):
+			url = UPLOADS + "io_{}.txt".format(i)
+			payload = u.get_random_string(20000)
+			assert requests.post(url, data=payload,
+				headers={"Content-Type": "text/plain"}).status_code == 204
+			r = requests.get(url)
+			assert r.status_code == 200 and r.text == payload
+			assert requests.delete(url).status_code == 204
+		self.parallel(upload, 16)
+
+	def test_io_keepalive_sequence(self):
+		conn = http.client.HTTPConnection("localhost", 8000)
+		url = "/uploads/io_keepalive.txt"
+		steps = [
+			("GET", "/index.html", None, 200),
+			("GET", "/uploads/", None, 200),
+			("GET", url, None, 404),
+			("POST", url, "keepalive", 204),
+			("POST", url, "keepalive", 409),
+			("GET", url, None, 200),
+			("DELETE", url, None, 204),
+			("DELETE", url, None, 404),
+		]
+		for method, path, body, status in steps:
+			conn.request(method, path, body=body,
+				headers={"Content-Type": "text/plain"})
+			r = conn.getresponse()
+			r.read()
+			self.assertEqual(r.status, status, (method, path))
+		conn.close()
+
+	def test_io_delete_directory(self):
+		path = u.get_git_root() + "/tests/www/html/uploads/io_dir"
+		os.makedirs(path, exist_ok=True)
+		with open(path + "/file", "w") as f:
+			f.write("x")
+		try:
+			self.assertEqual(requests.delete(UPLOADS + "io_dir").status_code, 403)
+		finally:
+			shutil.rmtree(path, ignore_errors=True)
+
+	def test_io_large_file_windows(self):
+		# Spans several readahead windows, ranges start past the first one
+		path = u.get_git_root() + "/tests/www/html/uploads/io_large.bin"
+		data = os.urandom(5 * 1024 * 1024 + 123)
+		with open(path, "wb") as f:
+			f.write(data)
+		try:
+			r = requests.get(UPLOADS + "io_large.bin")
+			self.assertEqual(r.status_code, 200)
+			self.assertEqual(r.content, data)
+			r = requests.get(UPLOADS + "io_large.bin",
+				headers={"Range": "bytes=3000000-4500000"})
+			self.assertEqual(r.status_code, 206)
+			self.assertEqual(r.content, data[3000000:4500001])
+			r = requests.get(UPLOADS + "io_large.bin",
+				headers={"Accept-Encoding": "gzip"})
+			self.assertEqual(r.content, data)
+		finally:
+			os.unlink(path)
+
+if __name__ == '__main__':
+	unittest.main()
@@ -0,0 +1,190 @@
+import os
+import time
+import socket
+import unittest
+import requests
+import threading
+import subprocess
+
+import utils as u
+
+CONFIG = "tests/configs/fastcgi.conf"
+SOCKET = "/tmp/webserv_fastcgi.sock"
+CLOSE_SOCKET = "/tmp/webserv_fastcgi_close.sock"
+URL = "http://localhost:8000/fcgi/index.php"
+
+class TestFastCGI(unittest.TestCase):
+	pid, fd, upstream, closing = 0, 0, None, None
+
+	@classmethod
+	def setUpClass(cls):
+		for path in (SOCKET, CLOSE_SOCKET):
+			if os.path.exists(path):
+				os.unlink(path)
+		script = u.get_git_root() + "/tests/scripts/fastcgi_server.py"
+		cls.upstream = subprocess.Popen(["/usr/bin/python3", script, SOCKET])
+		# Does not keep its connections
+		cls.closing = subprocess.Popen(["/usr/bin/python3", script,
+			CLOSE_SOCKET, "--no-mpx", "--close"])
+		cls.pid, cls.fd = u.start_server(CONFIG)
+
+	@classmethod
+	def tearDownClass(cls):
+		if cls.fd and cls.pid:
+			u.stop_server(cls.pid, cls.fd)
+		for upstream in (cls.upstream, cls.closing):
+			if upstream:
+				upstream.terminate()
+				upstream.wait()
+
+	def test_fastcgi_query(self):
+		r = requests.get(URL + "?hello")
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.text, "hello")
+		self.assertTrue(r.headers["X-Script"].endswith("/fcgi/index.php"))
+
+	def test_fastcgi_post_body(self):
+		body = u.get_random_string(256 * 1024)
+		r = requests.post(URL, data=body,
+			headers={"Content-Type": "text/plain"})
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.text, body)
+
+	def test_fastcgi_body_streamed(self):
+		body = u.get_random_string(128 * 1024).encode()
+		s = socket.create_connection(("localhost", 8000), timeout=2)
+		s.sendall("POST /fcgi/index.php HTTP/1.1\r\nHost: localhost\r\n"
+			"Content-Type: text/plain\r\nContent-Length: {}\r\n"
+			"Connection: close\r\n\r\n".format(len(body)).encode() + body[:1000])
+		time.sleep(.3)
+		s.sendall(body[1000:])
+		response = b""
+		while not response.endswith(b"0\r\n\r\n"):
+			data = s.recv(65536)
+			if not data:
+				break
+			response += data
+		s.close()
+		self.assertTrue(response.startswith(b"HTTP/1.1 200"))
+		chunks = response.split(b"\r\n\r\n", 1)[1]
+		self.assertEqual(b"".join(chunks.split(b"\r\n")[1::2]), body)
+
+	def test_fastcgi_status(self):
+		r = requests.get(URL + "?status=404")
+		self.assertEqual(r.status_code, 404)
+
+	def test_fastcgi_keepalive(self):
+		first = requests.get(URL)
+		second = requests.get(URL)
+		self.assertEqual(first.headers["X-Connection"],
+			second.headers["X-Connection"])
+		self.assertGreater(int(second.headers["X-Requests"]),
+			int(first.headers["X-Requests"]))
+
+	def test_fastcgi_concurrent(self):
+		results = []
+		def fetch(i):
+			r = requests.get(URL + "?sleep=0.5&n=" + str(i))
+			results.append((r.status_code, r.headers.get("X-Connection")))
+
+		start = time.time()
+		threads = [threading.Thread(target=fetch, args=(i,)) for i in range(8)]
+		for t in threads:
+			t.start()
+		for t in threads:
+			t.join()
+		self.assertLess(time.time() - start, 1.5)
+		self.assertEqual([r[0] for r in results], [200] * 8)
+		# Multiplexed over a single pooled connection
+		self.assertEqual(len(set(r[1] for r in results)), 1)
+
+	def test_fastcgi_upstream_closing(self):
+		url = "http://localhost:8000/close/index.php"
+		for i in range(12):
+			r = requests.get(url + "?n=" + str(i))
+			self.assertEqual(r.status_code, 200)
+			self.assertEqual(r.text, "n=" + str(i))
+
+		results = []
+		def fetch(i):
+			r = requests.post(url + "?n=" + str(i), data="body",
+				headers={"Content-Type": "text/plain"})
+			results.append((r.status_code, r.text))
+		threads = [threading.Thread(target=fetch, args=(i,)) for i in range(12)]
+		for t in threads:
+			t.start()
+		for t in threads:
+			t.join()
+		self.assertEqual(sorted(results),
+			sorted((200, "n=" + str(i) + "body") for i in range(12)))
+
+	def test_fastcgi_upstream_down(self):
+		r = requests.get("http://localhost:8000/down/index.php")
+		self.assertEqual(r.status_code, 502)
+
+	def test_fastcgi_timeout(self):
+		start = time.time()
+		r = requests.get(URL + "?sleep=3")
+		self.assertEqual(r.status_code, 504)
+		self.assertLess(time.time() - start, 2)
+		r = requests.get(URL + "?alive")
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.text, "alive")
+
+	def test_fastcgi_timeout_headers_only(self):
+		# The deadline stops once the headers arrived
+		r = requests.get(URL + "?drip=1.5")
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.text, "drip=1.5")
+
+	def test_fastcgi_backpressure(self):
+		size = 64 * 1024 * 1024
+		s = socket.create_connection(("localhost", 8000), timeout=5)
+		s.sendall("GET /fcgi/index.php?size={} HTTP/1.1\r\nHost: localhost\r\n"
+			"Connection: close\r\n\r\n".format(size).encode())
+		# The upstream waits on the client instead of filling the server
+		time.sleep(1)
+		with open("/proc/{}/status".format(self.pid.pid)) as f:
+			rss = [l for l in f if l.startswith("VmRSS:")][0]
+		self.assertLess(int(rss.split()[1]), 32 * 1024)
+		received = 0
+		while True:
+			data = s.recv(1024 * 1024)
+			if not data:
+				break
+			received += len(data)
+		s.close()
+		self.assertGreater(received, size)
+
+	def test_fastcgi_shared_stall(self):
+		# Clients not reading hold their own requests, not those sharing
+		# their connection
+		size = 64 * 1024 * 1024
+		stalled = []
+		for _ in range(2):
+			s = socket.create_connection(("localhost", 8000), timeout=5)
+			s.sendall("GET /fcgi/index.php?size={} HTTP/1.1\r\nHost: localhost\r\n"
+				"Connection: close\r\n\r\n".format(size).encode())
+			stalled.append(s)
+		time.sleep(.5)
+		start = time.time()
+		r = requests.get(URL + "?shared")
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.text, "shared")
+		self.assertLess(time.time() - start, 2)
+		# The first past its spill is aborted, the other then waits alone
+		received = []
+		for s in stalled:
+			received.append(0)
+			while True:
+				data = s.recv(1024 * 1024)
+				if not data:
+					break
+				received[-1] += len(data)
+			s.close()
+		received.sort()
+		self.assertLess(received[0], size)
+		self.assertGreater(received[1], size)
+
+if __name__ == '__main__':
+	unittest.main()
@@ -0,0 +1,94 @@
+import time
+import unittest
+import requests
+import threading
+
+import utils as u
+
+CONFIG = "tests/configs/microcache.conf"
+STAMP = "http://localhost:8000/cached/stamp.py"
+
+class TestMicroCache(unittest.TestCase):
+	pid, fd = 0, 0
+
+	@classmethod
+	def setUpClass(cls):
+		cls.pid, cls.fd = u.start_server(CONFIG)
+
+	@classmethod
+	def tearDownClass(cls):
+		if cls.fd and cls.pid:
+			u.stop_server(cls.pid, cls.fd)
+
+	def test_cache_hit(self):
+		first = requests.get(STAMP + "?hit")
+		self.assertEqual(first.status_code, 200)
+		second = requests.get(STAMP + "?hit")
+		self.assertEqual(second.status_code, 200)
+		self.assertEqual(first.text, second.text)
+		self.assertEqual(second.headers["Content-Type"], "text/plain")
+		self.assertIn("Age", second.headers)
+
+	def test_cache_key(self):
+		first = requests.get(STAMP + "?key=1")
+		second = requests.get(STAMP + "?key=2")
+		self.assertNotEqual(first.text, second.text)
+
+	def test_cache_ttl(self):
+		first = requests.get(STAMP + "?ttl")
+		time.sleep(1.1)
+		second = requests.get(STAMP + "?ttl")
+		self.assertNotEqual(first.text, second.text)
+
+	def test_cache_control(self):
+		for control in ("no-store", "private", "max-age=0"):
+			query = "?control=" + control
+			first = requests.get(STAMP + query)
+			second = requests.get(STAMP + query)
+			self.assertNotEqual(first.text, second.text, control)
+		first = requests.get(STAMP + "?control=max-age=5")
+		time.sleep(1.1)
+		second = requests.get(STAMP + "?control=max-age=5")
+		self.assertEqual(first.text, second.text)
+
+	def test_cache_cookie(self):
+		first = requests.get(STAMP + "?cookie")
+		second = requests.get(STAMP + "?cookie")
+		self.assertNotEqual(first.text, second.text)
+
+	def test_cache_budget(self):
+		first = requests.get(STAMP + "?size=100000")
+		second = requests.get(STAMP + "?size=100000")
+		self.assertEqual(len(second.text), len(first.text))
+		self.assertNotEqual(first.text, second.text)
+
+	def test_cache_collapsed(self):
+		bodies = []
+		def fetch():
+			bodies.append(requests.get(STAMP + "?collapsed&sleep=.5").text)
+		start = time.time()
+		threads = [threading.Thread(target=fetch) for _ in range(8)]
+		for t in threads:
+			t.start()
+		for t in threads:
+			t.join()
+		self.assertLess(time.time() - start, 1)
+		self.assertEqual(len(bodies), 8)
+		self.assertEqual(len(set(bodies)), 1)
+
+	def test_cache_not_collapsed_when_uncacheable(self):
+		bodies = []
+		requests.get(STAMP + "?control=no-store&pass")
+		def fetch():
+			bodies.append(requests.get(STAMP + "?control=no-store&pass&sleep=.5").text)
+		start = time.time()
+		threads = [threading.Thread(target=fetch) for _ in range(4)]
+		for t in threads:
+			t.start()
+		for t in threads:
+			t.join()
+		self.assertLess(time.time() - start, 1.5)
+		self.assertEqual(len(set(bodies)), 4)
+
+if __name__ == '__main__':
+	unittest.main()
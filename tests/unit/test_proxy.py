@@ -0,0 +1,149 @@
+import time
+import socket
+import unittest
+import requests
+import threading
+import subprocess
+
+import utils as u
+
+CONFIG = "tests/configs/proxy.conf"
+PORTS = [9101, 9102, 9103]
+URL = "http://localhost:8000"
+
+class TestProxy(unittest.TestCase):
+	pid, fd, upstreams = 0, 0, []
+
+	@classmethod
+	def setUpClass(cls):
+		cls.upstreams = [subprocess.Popen(["/usr/bin/python3",
+			u.get_git_root() + "/tests/scripts/http_upstream.py", str(port)])
+			for port in PORTS]
+		for port in PORTS:
+			for _ in range(50):
+				try:
+					socket.create_connection(("127.0.0.1", port)).close()
+					break
+				except ConnectionRefusedError:
+					time.sleep(.1)
+		cls.pid, cls.fd = u.start_server(CONFIG)
+
+	@classmethod
+	def tearDownClass(cls):
+		if cls.fd and cls.pid:
+			u.stop_server(cls.pid, cls.fd)
+		for upstream in cls.upstreams:
+			upstream.terminate()
+			upstream.wait()
+
+	def test_proxy_get(self):
+		r = requests.get(URL + "/api/hello?x=1")
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.text, "9101 /api/hello")
+		self.assertEqual(r.headers["X-Host"], "localhost:8000")
+		self.assertEqual(r.headers["Content-Type"], "text/plain")
+
+	def test_proxy_status(self):
+		r = requests.get(URL + "/api/missing?status=404")
+		self.assertEqual(r.status_code, 404)
+		self.assertEqual(r.text, "9101 /api/missing")
+
+	def test_proxy_keepalive(self):
+		connections, served = set(), []
+		for _ in range(3):
+			r = requests.get(URL + "/api/keepalive")
+			connections.add(r.headers["X-Connection"])
+			served.append(int(r.headers["X-Requests"]))
+		self.assertEqual(len(connections), 1)
+		self.assertEqual(served, sorted(served))
+		self.assertGreater(served[-1], served[0])
+
+	def test_proxy_post_body(self):
+		body = u.get_random_string(256 * 1024)
+		r = requests.post(URL + "/api/echo", data=body,
+			headers={"Content-Type": "text/plain"})
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.text, body)
+
+	def test_proxy_content_type_kept(self):
+		# The multipart boundary is case-sensitive
+		content_type = "Multipart/Form-Data; boundary=AbCdEf"
+		r = requests.post(URL + "/api/echo", data="--AbCdEf--\r\n",
+			headers={"Content-Type": content_type})
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.headers["X-Content-Type"], content_type)
+
+	def test_proxy_body_streamed(self):
+		body = u.get_random_string(128 * 1024).encode()
+		s = socket.create_connection(("localhost", 8000), timeout=2)
+		s.sendall("POST /api/echo HTTP/1.1\r\nHost: localhost\r\n"
+			"Content-Type: text/plain\r\nContent-Length: {}\r\n"
+			"Connection: close\r\n\r\n"
+			.format(len(body)).encode() + body[:1000])
+		time.sleep(.3)
+		s.sendall(body[1000:])
+		response = b""
+		while True:
+			data = s.recv(65536)
+			if not data:
+				break
+			response += data
+		s.close()
+		head, _, payload = response.partition(b"\r\n\r\n")
+		self.assertTrue(head.startswith(b"HTTP/1.1 200"))
+		self.assertEqual(payload.rstrip(b"\r\n"), body)
+
+	def test_proxy_chunked(self):
+		r = requests.get(URL + "/api/chunked?chunked&size=50000")
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.text, "9101 /api/chunked" + "a" * 50000)
+
+	def test_proxy_close_delimited(self):
+		r = requests.get(URL + "/api/close?close&size=20000")
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.text, "9101 /api/close" + "a" * 20000)
+		self.assertEqual(requests.get(URL + "/api/after").status_code, 200)
+
+	def test_proxy_round_robin(self):
+		upstreams = [requests.get(URL + "/rr/x").headers["X-Upstream"]
+			for _ in range(6)]
+		for port in PORTS:
+			self.assertEqual(upstreams.count(str(port)), 2)
+
+	def test_proxy_least_conn(self):
+		slow = []
+		t = threading.Thread(target=lambda: slow.append(
+			requests.get(URL + "/least/slow?sleep=1").headers["X-Upstream"]))
+		t.start()
+		time.sleep(.3)
+		quick = [requests.get(URL + "/least/quick").headers["X-Upstream"]
+			for _ in range(3)]
+		t.join()
+		self.assertEqual(len(set(quick)), 1)
+		self.assertNotEqual(quick[0], slow[0])
+
+	def test_proxy_hash(self):
+		owners = {}
+		for i in range(20):
+			uri = "/hash/{}".format(i)
+			owners[uri] = requests.get(URL + uri).headers["X-Upstream"]
+		for uri, owner in owners.items():
+			self.assertEqual(requests.get(URL + uri).headers["X-Upstream"], owner)
+		self.assertGreater(len(set(owners.values())), 1)
+
+	def test_proxy_failover(self):
+		for _ in range(4):
+			r = requests.get(URL + "/failover/x")
+			self.assertEqual(r.status_code, 200)
+			self.assertEqual(r.headers["X-Upstream"], "9102")
+
+	def test_proxy_down(self):
+		self.assertEqual(requests.get(URL + "/down/x").status_code, 502)
+
+	def test_proxy_method(self):
+		r = requests.post(URL + "/readonly/x", data="body",
+			headers={"Content-Type": "text/plain"})
+		self.assertEqual(r.status_code, 405)
+
+if __name__ == '__main__':
+	unittest.main()
@@ -0,0 +1,65 @@
+import unittest
+import requests
+
+import utils as u
+
+CONFIG = "tests/configs/regex.conf"
+URL = "http://localhost:8000"
+
+class TestRegex(unittest.TestCase):
+	pid, fd = 0, 0
+
+	@classmethod
+	def setUpClass(cls):
+		cls.pid, cls.fd = u.start_server(CONFIG)
+
+	@classmethod
+	def tearDownClass(cls):
+		if cls.fd and cls.pid:
+			u.stop_server(cls.pid, cls.fd)
+
+	def route(self, uri):
+		r = requests.get(URL + uri, allow_redirects=False)
+		if r.status_code != 301:
+			return None
+		return r.headers["Location"][len("http://localhost"):]
+
+	def test_regex_after_prefix(self):
+		self.assertEqual(self.route("/static/app.js"), "/static")
+		self.assertEqual(self.route("/static/index.php"), "/php")
+		self.assertEqual(self.route("/index.php?a=b.png"), "/php")
+
+	def test_regex_final_prefix(self):
+		self.assertEqual(self.route("/assets/index.php"), "/assets")
+		self.assertEqual(self.route("/exact.php"), "/exact")
+		self.assertEqual(self.route("/exact.php/x.php"), "/php")
+
+	def test_regex_case(self):
+		self.assertEqual(self.route("/img/a.PNG"), "/images")
+		self.assertEqual(self.route("/img/a.Jpeg"), "/images")
+		self.assertIsNone(self.route("/img/a.PHP"))
+
+	def test_regex_order(self):
+		self.assertEqual(self.route("/api/v2/users"), "/api")
+		self.assertEqual(self.route("/v2/users"), "/users")
+		self.assertEqual(self.route("/v2/users/1.php"), "/php")
+		self.assertIsNone(self.route("/api/vx/usersx"))
+
+	def test_regex_bounds(self):
+		self.assertEqual(self.route("/items/12"), "/items")
+		self.assertEqual(self.route("/items/123"), "/items")
+		self.assertIsNone(self.route("/items/1"))
+		self.assertIsNone(self.route("/items/1234"))
+
+	def test_regex_groups(self):
+		self.assertEqual(self.route("/docs/intro.md"), "/docs")
+		self.assertEqual(self.route("/wiki/x.md"), "/docs")
+		self.assertIsNone(self.route("/blog/x.md"))
+		self.assertIsNone(self.route("/docs/a/b.md"))
+
+	def test_regex_none(self):
+		self.assertIsNone(self.route("/"))
+		self.assertIsNone(self.route("/index.html"))
+
+if __name__ == '__main__':
+	unittest.main()
@@ -0,0 +1,138 @@
+import os
+import time
+import signal
+import unittest
+import requests
+import http.client
+
+import utils as u
+import test_cgi_workers as workers
+
+CONFIG = "/tmp/webserv_reload.conf"
+
+BEFORE = """server {
+	server_name	before.test;
+	listen	0.0.0.0:8000;
+	redirect	301 http://localhost/before;
+}
+
+server {
+	server_name	removed.test;
+	listen	0.0.0.0:8001;
+	redirect	301 http://localhost/removed;
+}
+"""
+
+AFTER = """server {
+	server_name	before.test;
+	listen	0.0.0.0:8000;
+	redirect	301 http://localhost/after;
+}
+
+server {
+	server_name	added.test;
+	listen	0.0.0.0:8000;
+	redirect	301 http://localhost/added;
+}
+
+server {
+	server_name	bound.test;
+	listen	0.0.0.0:8002;
+	redirect	301 http://localhost/bound;
+}
+"""
+
+INVALID = """server {
+	server_name	before.test;
+	listen	0.0.0.0:8000;
+	redirect	301 http://localhost/invalid;
+	unknown_directive	on;
+}
+"""
+
+WORKERS = """server {
+	server_name	before.test;
+	listen	0.0.0.0:8000;
+	root	tests/www/html;
+
+	location /workers {
+		root		tests/www/html;
+		cgi			.py tests/scripts/fastcgi_server.py;
+		cgi_workers	.py %d %d 0;
+	}
+}
+"""
+
+class TestReload(unittest.TestCase):
+	pid, fd = 0, 0
+
+	def setUp(self):
+		self.write(BEFORE)
+		self.pid, self.fd = u.start_server(CONFIG)
+
+	def tearDown(self):
+		if self.fd and self.pid:
+			u.stop_server(self.pid, self.fd)
+			self.pid.wait()
+		os.remove(CONFIG)
+
+	def write(self, config):
+		with open(CONFIG, "w") as f:
+			f.write(config)
+
+	def reload(self, config):
+		self.write(config)
+		self.pid.send_signal(signal.SIGHUP)
+		time.sleep(.5)
+
+	def served(self, port, host="before.test"):
+		r = requests.get("http://localhost:{}/".format(port),
+			headers={"Host": host}, allow_redirects=False)
+		self.assertEqual(r.status_code, 301)
+		return r.headers["Location"][len("http://localhost/"):]
+
+	def test_reload_routes(self):
+		self.assertEqual(self.served(8000), "before")
+		self.reload(AFTER)
+		self.assertEqual(self.served(8000), "after")
+		self.assertEqual(self.served(8000, "added.test"), "added")
+
+	def test_reload_listeners(self):
+		self.assertEqual(self.served(8001), "removed")
+		self.reload(AFTER)
+		self.assertEqual(self.served(8002), "bound")
+		with self.assertRaises(requests.exceptions.ConnectionError):
+			self.served(8001)
+
+	def test_reload_keepalive(self):
+		conn = http.client.HTTPConnection("localhost", 8000)
+		conn.request("GET", "/", headers={"Host": "before.test"})
+		r = conn.getresponse()
+		r.read()
+		self.assertEqual(r.headers["Location"], "http://localhost/before")
+		self.reload(AFTER)
+		conn.request("GET", "/", headers={"Host": "before.test"})
+		r = conn.getresponse()
+		r.read()
+		self.assertEqual(r.headers["Location"], "http://localhost/after")
+		conn.close()
+
+	def test_reload_invalid(self):
+		self.reload(INVALID)
+		self.assertEqual(self.served(8000), "before")
+		self.assertEqual(self.served(8001), "removed")
+		self.reload(AFTER)
+		self.assertEqual(self.served(8000), "after")
+
+	def test_reload_cgi_workers(self):
+		self.reload(WORKERS % (3, 3))
+		self.assertEqual(len(workers.workers_of(self.pid.pid)), 3)
+		self.reload(WORKERS % (1, 1))
+		r = requests.get("http://localhost:8000/workers/index.py?hello")
+		self.assertEqual(r.text, "hello")
+		# The pool of the replaced mapping stops once its snapshot is gone
+		time.sleep(1.5)
+		self.assertEqual(len(workers.workers_of(self.pid.pid)), 1)
+
+if __name__ == '__main__':
+	unittest.main()
@@ -0,0 +1,53 @@
+import unittest
+import requests
+
+import utils as u
+
+CONFIG = "tests/configs/routing.conf"
+URL = "http://localhost:8000"
+
+class TestRouting(unittest.TestCase):
+	pid, fd = 0, 0
+
+	@classmethod
+	def setUpClass(cls):
+		cls.pid, cls.fd = u.start_server(CONFIG)
+
+	@classmethod
+	def tearDownClass(cls):
+		if cls.fd and cls.pid:
+			u.stop_server(cls.pid, cls.fd)
+
+	def route(self, uri):
+		r = requests.get(URL + uri, allow_redirects=False)
+		if r.status_code != 301:
+			return None
+		return r.headers["Location"][len("http://localhost"):]
+
+	def test_routing_prefix(self):
+		self.assertEqual(self.route("/api/"), "/api")
+		self.assertEqual(self.route("/api/v1/users"), "/api")
+		self.assertEqual(self.route("/api/v2"), "/api-v2")
+		self.assertEqual(self.route("/api/v2/items/1"), "/api-v2")
+
+	def test_routing_longest(self):
+		self.assertEqual(self.route("/api/v2/users/42"), "/api-v2-users")
+		self.assertEqual(self.route("/api/v2/users"), "/api-v2")
+
+	def test_routing_boundary(self):
+		self.assertIsNone(self.route("/apix"))
+		self.assertEqual(self.route("/api/v20"), "/api")
+		self.assertIsNone(self.route("/static"))
+		self.assertEqual(self.route("/static/app.js"), "/static")
+
+	def test_routing_exact(self):
+		self.assertEqual(self.route("/api"), "/exact-api")
+		self.assertEqual(self.route("/api/v2/status"), "/exact-status")
+		self.assertEqual(self.route("/api/v2/status/1"), "/api-v2")
+
+	def test_routing_server(self):
+		self.assertIsNone(self.route("/"))
+		self.assertIsNone(self.route("/index.html"))
+
+if __name__ == '__main__':
+	unittest.main()
@@ -0,0 +1,103 @@
+import unittest
+import requests
+
+import utils as u
+
+CONFIG = "tests/configs/sendfile.conf"
+ACCEL = "http://localhost:8000/cgi/python/accel.py"
+FILE = "/tests/www/html/private/file.txt"
+
+with open(u.get_git_root() + FILE, "rb") as f:
+	CONTENT = f.read()
+
+class TestSendfile(unittest.TestCase):
+	pid, fd = 0, 0
+
+	@classmethod
+	def setUpClass(cls):
+		cls.pid, cls.fd = u.start_server(CONFIG)
+
+	@classmethod
+	def tearDownClass(cls):
+		if cls.fd and cls.pid:
+			u.stop_server(cls.pid, cls.fd)
+
+	def test_accel_redirect(self):
+		r = requests.get(ACCEL + "?accel=/private/file.txt")
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.content, CONTENT)
+		self.assertEqual(r.headers["Content-Type"], "text/plain")
+		self.assertEqual(r.headers["X-App"], "accel")
+		self.assertNotIn("X-Accel-Redirect", r.headers)
+
+	def test_sendfile(self):
+		r = requests.get(ACCEL + "?sendfile=/private/file.txt")
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.content, CONTENT)
+		self.assertNotIn("X-Sendfile", r.headers)
+
+	def test_accel_range(self):
+		r = requests.get(ACCEL + "?accel=/private/file.txt",
+			headers={"Range": "bytes=29-57"})
+		self.assertEqual(r.status_code, 206)
+		self.assertEqual(r.content, CONTENT[29:58])
+		self.assertEqual(r.headers["Content-Range"],
+			"bytes 29-57/{}".format(len(CONTENT)))
+
+	def test_accel_not_internal(self):
+		r = requests.get(ACCEL + "?accel=/index.html")
+		self.assertEqual(r.status_code, 404)
+		r = requests.get(ACCEL + "?sendfile=/index.html")
+		self.assertEqual(r.status_code, 404)
+
+	def test_accel_missing(self):
+		r = requests.get(ACCEL + "?accel=/private/missing.txt")
+		self.assertEqual(r.status_code, 404)
+		r = requests.get(ACCEL + "?accel=/private/../index.html")
+		self.assertEqual(r.status_code, 404)
+
+	def test_internal_location(self):
+		r = requests.get("http://localhost:8000/private/file.txt")
+		self.assertEqual(r.status_code, 404)
+
+	def test_range(self):
+		r = requests.get("http://localhost:8000/index.html")
+		self.assertEqual(r.headers["Accept-Ranges"], "bytes")
+		index = r.content
+		r = requests.get("http://localhost:8000/index.html",
+			headers={"Range": "bytes=0-9"})
+		self.assertEqual(r.status_code, 206)
+		self.assertEqual(r.content, index[:10])
+		self.assertEqual(r.headers["Content-Type"], "text/html")
+		r = requests.get("http://localhost:8000/index.html",
+			headers={"Range": "bytes=-5"})
+		self.assertEqual(r.content, index[-5:])
+		r = requests.get("http://localhost:8000/index.html",
+			headers={"Range": "bytes=10-"})
+		self.assertEqual(r.content, index[10:])
+
+	def test_range_ignored(self):
+		r = requests.get("http://localhost:8000/index.html",
+			headers={"Range": "bytes=0-1,4-5"})
+		self.assertEqual(r.status_code, 200)
+		r = requests.get("http://localhost:8000/index.html",
+			headers={"Range": "lines=0-1"})
+		self.assertEqual(r.status_code, 200)
+
+	def test_range_not_satisfiable(self):
+		size = len(requests.get("http://localhost:8000/index.html").content)
+		r = requests.get("http://localhost:8000/index.html",
+			headers={"Range": "bytes={}-".format(size)})
+		self.assertEqual(r.status_code, 416)
+		self.assertEqual(r.headers["Content-Range"], "bytes */{}".format(size))
+
+	def test_keepalive(self):
+		with requests.Session() as s:
+			for _ in range(3):
+				r = s.get(ACCEL + "?accel=/private/file.txt")
+				self.assertEqual(r.content, CONTENT)
+				r = s.get("http://localhost:8000/index.html")
+				self.assertEqual(r.status_code, 200)
+
+if __name__ == '__main__':
+	unittest.main()
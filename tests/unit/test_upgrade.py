@@ -0,0 +1,87 @@
+import os
+import time
+import signal
+import unittest
+import threading
+import requests
+import http.client
+
+import utils as u
+
+CONFIG = "tests/configs/upgrade.conf"
+URL = "http://localhost:8000/"
+
+class TestUpgrade(unittest.TestCase):
+	pid, fd, upgraded = 0, 0, 0
+
+	def setUp(self):
+		self.upgraded = 0
+		self.pid, self.fd = u.start_server(CONFIG)
+
+	def tearDown(self):
+		if self.fd and self.pid:
+			u.stop_server(self.pid, self.fd)
+			self.pid.wait()
+		if self.upgraded:
+			os.kill(self.upgraded, signal.SIGTERM)
+			while os.path.exists("/proc/{}".format(self.upgraded)):
+				time.sleep(.05)
+
+	def upgrade(self):
+		self.pid.send_signal(signal.SIGUSR2)
+		time.sleep(.5)
+		# The new process outlives the one it was started from
+		for pid in os.listdir("/proc"):
+			if not pid.isdigit() or int(pid) == self.pid.pid:
+				continue
+			try:
+				with open("/proc/{}/cmdline".format(pid), "rb") as f:
+					cmdline = f.read().split(b"\0")
+			except OSError:
+				continue
+			if cmdline[:2] == [b"./webserv", CONFIG.encode()]:
+				self.upgraded = int(pid)
+		self.assertNotEqual(self.upgraded, 0)
+
+	def served(self):
+		r = requests.get(URL, allow_redirects=False)
+		self.assertEqual(r.status_code, 301)
+		return r.headers["Location"]
+
+	def test_upgrade_drain(self):
+		conn = http.client.HTTPConnection("localhost", 8000)
+		conn.request("GET", "/")
+		conn.getresponse().read()
+		self.upgrade()
+		self.assertEqual(self.served(), "http://localhost/upgraded")
+		self.assertIsNone(self.pid.poll())
+		conn.request("GET", "/")
+		self.assertEqual(conn.getresponse().status, 301)
+		conn.close()
+		self.assertEqual(self.pid.wait(3), 0)
+		self.assertEqual(self.served(), "http://localhost/upgraded")
+
+	def test_upgrade_no_refused(self):
+		failures, stop = [], threading.Event()
+
+		def hammer():
+			while not stop.is_set():
+				try:
+					requests.get(URL, allow_redirects=False, timeout=2)
+				except requests.exceptions.RequestException as e:
+					failures.append(e)
+
+		threads = [threading.Thread(target=hammer) for _ in range(4)]
+		for t in threads:
+			t.start()
+		time.sleep(.2)
+		self.upgrade()
+		self.pid.wait(5)
+		time.sleep(.2)
+		stop.set()
+		for t in threads:
+			t.join()
+		self.assertEqual(failures, [])
+
+if __name__ == '__main__':
+	unittest.main()
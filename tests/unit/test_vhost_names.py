@@ -0,0 +1,57 @@
+import unittest
+import requests
+
+import utils as u
+
+CONFIG = "tests/configs/vhost_names.conf"
+URL = "http://localhost:8000/"
+
+class TestVhostNames(unittest.TestCase):
+	pid, fd = 0, 0
+
+	@classmethod
+	def setUpClass(cls):
+		cls.pid, cls.fd = u.start_server(CONFIG)
+
+	@classmethod
+	def tearDownClass(cls):
+		if cls.fd and cls.pid:
+			u.stop_server(cls.pid, cls.fd)
+
+	def server(self, host):
+		r = requests.get(URL, headers={"Host": host}, allow_redirects=False)
+		self.assertEqual(r.status_code, 301)
+		return r.headers["Location"][len("http://localhost/"):]
+
+	def test_vhost_exact(self):
+		self.assertEqual(self.server("www.example.com"), "exact")
+		self.assertEqual(self.server("example.com"), "exact")
+		self.assertEqual(self.server("WWW.Example.COM"), "exact")
+		self.assertEqual(self.server("www.example.com:8000"), "exact")
+		self.assertEqual(self.server("www.example.com."), "exact")
+
+	def test_vhost_leading(self):
+		self.assertEqual(self.server("a.example.com"), "leading")
+		self.assertEqual(self.server("a.b.example.com"), "leading")
+		self.assertEqual(self.server("api.example.com"), "leading")
+		self.assertEqual(self.server("v1.api.example.com"), "leading-api")
+		self.assertEqual(self.server("a.v1.api.example.com"), "leading-api")
+
+	def test_vhost_trailing(self):
+		self.assertEqual(self.server("www.example.net"), "trailing")
+		self.assertEqual(self.server("www.example.co.uk"), "trailing")
+		self.assertEqual(self.server("www.shop.io"), "trailing")
+		self.assertEqual(self.server("www.example"), "default")
+
+	def test_vhost_dotted(self):
+		self.assertEqual(self.server("example.org"), "dotted")
+		self.assertEqual(self.server("a.b.example.org"), "dotted")
+		self.assertEqual(self.server("anexample.org"), "default")
+
+	def test_vhost_default(self):
+		self.assertEqual(self.server("localhost:8000"), "default")
+		self.assertEqual(self.server("example.net"), "default")
+		self.assertEqual(self.server("mixedcase.test"), "mixed")
+
+if __name__ == '__main__':
+	unittest.main()
@@ -0,0 +1,151 @@
+import os
+import time
+import base64
+import socket
+import struct
+import hashlib
+import unittest
+import requests
+import subprocess
+
+import utils as u
+
+CONFIG = "tests/configs/websocket.conf"
+PORT = 9105
+URL = "http://localhost:8000"
+GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+class WebSocket:
+	def __init__(self, path="/ws/echo"):
+		self.key = base64.b64encode(os.urandom(16)).decode()
+		self.sock = socket.create_connection(("localhost", 8000), timeout=5)
+		self.sock.sendall("GET {} HTTP/1.1\r\nHost: localhost\r\n"
+			"Upgrade: websocket\r\nConnection: Upgrade\r\n"
+			"Sec-WebSocket-Key: {}\r\nSec-WebSocket-Version: 13\r\n\r\n"
+			.format(path, self.key).encode())
+		self.buffer = b""
+		while b"\r\n\r\n" not in self.buffer:
+			data = self.sock.recv(65536)
+			if not data:
+				raise EOFError
+			self.buffer += data
+		head, self.buffer = self.buffer.split(b"\r\n\r\n", 1)
+		lines = head.decode().split("\r\n")
+		self.status = int(lines[0].split(" ")[1])
+		self.headers = {}
+		for line in lines[1:]:
+			name, value = line.split(":", 1)
+			self.headers[name.strip().lower()] = value.strip()
+
+	def _read(self, n):
+		while len(self.buffer) < n:
+			data = self.sock.recv(65536)
+			if not data:
+				raise EOFError
+			self.buffer += data
+		data, self.buffer = self.buffer[:n], self.buffer[n:]
+		return data
+
+	def send(self, payload, opcode=1):
+		mask = os.urandom(4)
+		head = bytes([0x80 | opcode])
+		if len(payload) < 126:
+			head += bytes([0x80 | len(payload)])
+		elif len(payload) < 65536:
+			head += bytes([0x80 | 126]) + struct.pack("!H", len(payload))
+		else:
+			head += bytes([0x80 | 127]) + struct.pack("!Q", len(payload))
+		masked = bytes(b ^ mask[i % 4] for i, b in enumerate(payload))
+		self.sock.sendall(head + mask + masked)
+
+	def recv(self):
+		first, second = self._read(2)
+		length = second & 0x7f
+		if length == 126:
+			length = struct.unpack("!H", self._read(2))[0]
+		elif length == 127:
+			length = struct.unpack("!Q", self._read(8))[0]
+		return first & 0x0f, self._read(length)
+
+	def close(self):
+		self.sock.close()
+
+class TestWebSocket(unittest.TestCase):
+	pid, fd, upstream = 0, 0, None
+
+	@classmethod
+	def setUpClass(cls):
+		cls.upstream = subprocess.Popen(["/usr/bin/python3",
+			u.get_git_root() + "/tests/scripts/ws_upstream.py", str(PORT)])
+		for _ in range(50):
+			try:
+				socket.create_connection(("127.0.0.1", PORT)).close()
+				break
+			except ConnectionRefusedError:
+				time.sleep(.1)
+		cls.pid, cls.fd = u.start_server(CONFIG)
+
+	@classmethod
+	def tearDownClass(cls):
+		if cls.fd and cls.pid:
+			u.stop_server(cls.pid, cls.fd)
+		cls.upstream.terminate()
+		cls.upstream.wait()
+
+	def test_ws_handshake(self):
+		ws = WebSocket()
+		self.assertEqual(ws.status, 101)
+		self.assertEqual(ws.headers["upgrade"], "websocket")
+		self.assertEqual(ws.headers["connection"], "Upgrade")
+		self.assertNotIn("content-length", ws.headers)
+		accept = base64.b64encode(hashlib.sha1(
+			(ws.key + GUID).encode()).digest()).decode()
+		self.assertEqual(ws.headers["sec-websocket-accept"], accept)
+		# Sent by the upstream along with its 101
+		self.assertEqual(ws.recv(), (1, b"hello 9105"))
+		ws.close()
+
+	def test_ws_echo(self):
+		ws = WebSocket()
+		ws.recv()
+		for i in range(20):
+			message = "message {}".format(i).encode()
+			ws.send(message)
+			self.assertEqual(ws.recv(), (1, message))
+		ws.close()
+
+	def test_ws_large(self):
+		ws = WebSocket()
+		ws.recv()
+		message = u.get_random_string(4 * 1024 * 1024).encode()
+		ws.send(message, 2)
+		self.assertEqual(ws.recv(), (2, message))
+		ws.close()
+
+	def test_ws_close(self):
+		ws = WebSocket()
+		ws.recv()
+		ws.send(b"\x03\xe8", 8)
+		self.assertEqual(ws.recv(), (8, b"\x03\xe8"))
+		# The upstream closed, so does the tunnel
+		self.assertEqual(ws.sock.recv(1), b"")
+		ws.close()
+
+	def test_ws_concurrent(self):
+		sockets = [WebSocket() for _ in range(100)]
+		for i, ws in enumerate(sockets):
+			self.assertEqual(ws.status, 101)
+			ws.recv()
+			ws.send(str(i).encode())
+		for i, ws in enumerate(sockets):
+			self.assertEqual(ws.recv(), (1, str(i).encode()))
+			ws.close()
+		self.assertEqual(requests.get(URL + "/ws/plain").status_code, 200)
+
+	def test_ws_plain(self):
+		r = requests.get(URL + "/ws/plain")
+		self.assertEqual(r.status_code, 200)
+		self.assertEqual(r.text, "9105 /ws/plain")
+
+if __name__ == '__main__':
+	unittest.main()
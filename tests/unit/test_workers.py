@@ -0,0 +1,145 @@
+import os
+import time
+import shutil
+import signal
+import unittest
+import requests
+
+import utils as u
+
+CONFIG = "/tmp/webserv_workers.conf"
+CACHE = "/tmp/webserv_cache_workers"
+
+SERVER = """worker_processes	2;
+{}
+
+server {{
+	server_name	workers.test;
+	listen	0.0.0.0:8000;
+	redirect	301 http://localhost/{};
+}}
+"""
+
+CACHED = """
+server {{
+	server_name	cached.test;
+	listen	0.0.0.0:8001;
+	disk_cache	{} 60 1048576;
+}}
+"""
+
+class TestWorkers(unittest.TestCase):
+	pid, fd = 0, 0
+
+	def setUp(self):
+		self.write("before")
+		self.pid, self.fd = u.start_server(CONFIG)
+
+	def tearDown(self):
+		if self.fd and self.pid:
+			u.stop_server(self.pid, self.fd)
+			self.pid.wait()
+		os.remove(CONFIG)
+
+	def write(self, location, main=""):
+		with open(CONFIG, "w") as f:
+			f.write(SERVER.format(main, location))
+
+	def workers(self):
+		with open("/proc/{0}/task/{0}/children".format(self.pid.pid)) as f:
+			return [int(pid) for pid in f.read().split()]
+
+	def cpus(self, pid):
+		with open("/proc/{}/status".format(pid)) as f:
+			for line in f:
+				if line.startswith("Cpus_allowed_list:"):
+					return line.split()[1]
+		return ""
+
+	def served(self):
+		r = requests.get("http://localhost:8000/", allow_redirects=False)
+		self.assertEqual(r.status_code, 301)
+		return r.headers["Location"][len("http://localhost/"):]
+
+	def test_workers_spawned(self):
+		self.assertEqual(len(self.workers()), 2)
+		for _ in range(8):
+			self.assertEqual(self.served(), "before")
+
+	def test_workers_respawn(self):
+		time.sleep(1)
+		killed = self.workers()[0]
+		os.kill(killed, signal.SIGKILL)
+		time.sleep(.5)
+		workers = self.workers()
+		self.assertEqual(len(workers), 2)
+		self.assertNotIn(killed, workers)
+		for _ in range(8):
+			self.assertEqual(self.served(), "before")
+
+	def test_workers_respawn_delayed(self):
+		# Just started, it is started again a second later
+		killed = self.workers()[0]
+		os.kill(killed, signal.SIGKILL)
+		time.sleep(.3)
+		self.assertEqual(len(self.workers()), 1)
+		time.sleep(1.2)
+		workers = self.workers()
+		self.assertEqual(len(workers), 2)
+		self.assertNotIn(killed, workers)
+
+	def test_workers_stop_while_delayed(self):
+		# The master still serves its signals meanwhile
+		os.kill(self.workers()[0], signal.SIGKILL)
+		time.sleep(.2)
+		start = time.time()
+		u.stop_server(self.pid, self.fd)
+		self.pid.wait()
+		self.fd = 0
+		self.assertLess(time.time() - start, .5)
+
+	def test_workers_reload(self):
+		before = self.workers()
+		self.write("after")
+		self.pid.send_signal(signal.SIGHUP)
+		time.sleep(.5)
+		for _ in range(8):
+			self.assertEqual(self.served(), "after")
+		for pid in before:
+			self.assertNotIn(pid, self.workers())
+
+	def test_workers_stop(self):
+		workers = self.workers()
+		u.stop_server(self.pid, self.fd)
+		self.pid.wait()
+		self.fd = 0
+		time.sleep(.2)
+		for pid in workers:
+			self.assertFalse(os.path.exists("/proc/{}".format(pid)))
+
+	def test_workers_affinity(self):
+		u.stop_server(self.pid, self.fd)
+		self.pid.wait()
+		self.write("pinned", "worker_cpu_affinity\tauto;\nworker_incoming_cpu\ton;")
+		self.pid, self.fd = u.start_server(CONFIG)
+		ncpu = os.cpu_count()
+		workers = self.workers()
+		self.assertEqual(len(workers), 2)
+		self.assertEqual(sorted(self.cpus(pid) for pid in workers),
+			sorted(str(slot % ncpu) for slot in range(2)))
+		for _ in range(8):
+			self.assertEqual(self.served(), "pinned")
+
+	def test_workers_disk_cache(self):
+		# One directory, and index, per worker
+		u.stop_server(self.pid, self.fd)
+		self.pid.wait()
+		shutil.rmtree(CACHE, ignore_errors=True)
+		with open(CONFIG, "w") as f:
+			f.write(SERVER.format("", "cached") + CACHED.format(CACHE))
+		self.pid, self.fd = u.start_server(CONFIG)
+		self.assertEqual(self.served(), "cached")
+		self.assertEqual(sorted(os.listdir(CACHE)), ["worker-0", "worker-1"])
+
+if __name__ == '__main__':
+	unittest.main()
@@ -0,0 +1,20 @@
+#!/usr/bin/python3
+
+import os
+import time
+import urllib.parse
+
+# Body unique to the run of the script, the query may hold sleep=<seconds>,
+# control=<Cache-Control>, cookie, or size=<padding bytes>
+query = urllib.parse.parse_qs(os.environ.get("QUERY_STRING", ""),
+	keep_blank_values=True)
+time.sleep(float(query.get("sleep", ["0"])[0]))
+
+print("Content-Type: text/plain\r")
+if "control" in query:
+	print("Cache-Control: {}\r".format(query["control"][0]))
+if "cookie" in query:
+	print("Set-Cookie: app=1\r")
+print("\r")
+print("{} {}".format(os.getpid(), time.time_ns()), end="")
+print("a" * int(query.get("size", ["0"])[0]), end="")
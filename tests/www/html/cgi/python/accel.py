@@ -0,0 +1,17 @@
+#!/usr/bin/python3
+
+import os
+import urllib.parse
+
+# accel=<uri> answers with X-Accel-Redirect, sendfile=<uri> with the
+# X-Sendfile path of uri under the document root
+query = urllib.parse.parse_qs(os.environ.get("QUERY_STRING", ""))
+
+print("X-App: accel\r")
+if "accel" in query:
+	print("X-Accel-Redirect: {}\r".format(query["accel"][0]))
+if "sendfile" in query:
+	path = os.environ["DOCUMENT_ROOT"] + query["sendfile"][0]
+	print("X-Sendfile: {}\r".format(os.path.abspath(path)))
+print("\r")
+print("body of the script")
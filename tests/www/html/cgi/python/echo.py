@@ -0,0 +1,15 @@
+#!/usr/bin/python3
+
+import os
+import sys
+
+length = int(os.environ.get("CONTENT_LENGTH") or 0)
+
+sys.stdout.write("Content-Type: text/plain\r\n\r\n")
+sys.stdout.flush()
+while length > 0:
+	data = os.read(0, min(length, 65536))
+	if not data:
+		break
+	os.write(1, data)
+	length -= len(data)
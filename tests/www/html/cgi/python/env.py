@@ -0,0 +1,10 @@
+#!/usr/bin/python3
+
+import os
+
+# Environment of the script, then the file descriptors it inherited
+fds = sorted(int(fd) for fd in os.listdir("/proc/self/fd"))
+print("Content-Type: text/plain\r\n\r\n", end="")
+for key in sorted(os.environ):
+	print("{}={}".format(key, os.environ[key]))
+print("FDS=" + ",".join(str(fd) for fd in fds[:-1]))
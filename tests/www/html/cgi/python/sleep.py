@@ -0,0 +1,11 @@
+#!/usr/bin/python
+
+import os
+import sys
+import time
+
+time.sleep(0.5)
+body = sys.stdin.read()
+
+print("Content-Type: text/plain\r\n\r\n", end="")
+print(os.environ.get("QUERY_STRING", "") + body, end="")
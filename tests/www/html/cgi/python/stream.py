@@ -0,0 +1,23 @@
+#!/usr/bin/python3
+
+import os
+import sys
+import time
+
+# <size>[&length]: size bytes of body after the first line, with a
+# Content-Length when length is given
+query = os.environ.get("QUERY_STRING", "").split("&")
+size = int(query[0] or 0)
+
+sys.stdout.write("Content-Type: text/plain\r\n")
+if "length" in query[1:]:
+	sys.stdout.write("Content-Length: {}\r\n".format(size + len("first\n")))
+sys.stdout.write("\r\n")
+sys.stdout.write("first\n")
+sys.stdout.flush()
+if size:
+	for i in range(0, size, 65536):
+		sys.stdout.write("a" * min(65536, size - i))
+else:
+	time.sleep(.5)
+	sys.stdout.write("second\n")
@@ -0,0 +1,13 @@
+#!/usr/bin/python3
+
+import os
+import time
+import urllib.parse
+
+# Sleeps for the sleep=<seconds> of the query before answering its pid
+query = urllib.parse.parse_qs(os.environ.get("QUERY_STRING", ""))
+time.sleep(float(query.get("sleep", ["0"])[0]))
+
+print("Content-Type: text/plain\r")
+print("\r")
+print(os.getpid(), end="")